@@ -0,0 +1,178 @@
+/*!
+ * \file ClockSyncEstimator.hpp
+ *
+ * Host side of CONFIG_SOF_SYNC.  The device reports (USB frame number,
+ * device time) pairs in COMMAND_DEVICE_TO_HOST_SOF_SYNC.  The host turns the
+ * frame number into its own time, e.g. from WinUsb_GetCurrentFrameNumber()
+ * pairs, and feeds (host time, device time) samples here.  A least squares
+ * line over a sliding window gives offset and drift; samples latched late
+ * by interrupt latency are rejected against the fit.
+ *
+ *     ClockSyncEstimator est;
+ *     est.addSample(hostUs, deviceUs);
+ *     int64_t t = est.toHostUs(frame.timestamp);
+ *
+ * Header only, C++17, no dependencies.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef HOST_CLOCKSYNC_CLOCKSYNCESTIMATOR_HPP_
+#define HOST_CLOCKSYNC_CLOCKSYNCESTIMATOR_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+
+namespace webusb_canfd {
+
+/* Unwraps the 11-bit USB frame number, reports must be less than 2.048 s apart */
+class FrameUnwrapper {
+public:
+    int64_t unwrap(uint16_t frameNumber)
+    {
+        const int64_t frame = frameNumber & 0x7FF;
+        if(!valid_) {
+            valid_ = true;
+            count_ = frame;
+        } else {
+            count_ += (frame - (count_ & 0x7FF)) & 0x7FF;
+        }
+        return count_;
+    }
+
+private:
+    bool valid_ = false;
+    int64_t count_ = 0;
+};
+
+
+class ClockSyncEstimator {
+public:
+    /*
+     * window     : samples kept for the fit
+     * rejectUs   : a sample whose device time reads this much later than
+     *              the fit is treated as a late latch and left out, once
+     *              the fit has settled
+     */
+    explicit ClockSyncEstimator(std::size_t window = 64, double rejectUs = 20.0)
+        : window_(window), rejectUs_(rejectUs) {}
+
+    /* Returns false when the sample was rejected */
+    bool addSample(int64_t hostUs, uint32_t deviceUs)
+    {
+        const int64_t device = unwrapDevice(deviceUs);
+
+        if(samples_.size() >= kSettled) {
+            /* A late latch reads the device counter too high */
+            if((toHost(device) - static_cast<double>(hostUs)) > rejectUs_) {
+                return false;
+            }
+        }
+        samples_.push_back({device, hostUs});
+        if(samples_.size() > window_) {
+            samples_.pop_front();
+        }
+        fit();
+        return true;
+    }
+
+    bool valid() const { return samples_.size() >= 2; }
+
+    /* Host time of a device timestamp, e.g. can_frame_t::timestamp */
+    int64_t toHostUs(uint32_t deviceUs) const
+    {
+        return static_cast<int64_t>(toHost(peekDevice(deviceUs)));
+    }
+
+    /* host = offsetUs + (1 + drift) * (device - originUs) */
+    double offsetUs() const { return offset_; }
+    double driftPpm() const { return (slope_ - 1.0) * 1e6; }
+    int64_t originUs() const { return origin_; }
+
+    void reset()
+    {
+        samples_.clear();
+        deviceValid_ = false;
+        slope_ = 1.0;
+        offset_ = 0.0;
+        origin_ = 0;
+    }
+
+private:
+    static constexpr std::size_t kSettled = 8;
+
+    struct Sample {
+        int64_t device;
+        int64_t host;
+    };
+
+    /* The device counter is 32-bit and wraps every ~71 minutes */
+    int64_t unwrapDevice(uint32_t deviceUs)
+    {
+        const int64_t device = peekDevice(deviceUs);
+        deviceValid_ = true;
+        lastDevice_ = device;
+        return device;
+    }
+
+    int64_t peekDevice(uint32_t deviceUs) const
+    {
+        if(!deviceValid_) {
+            return deviceUs;
+        }
+        const int32_t delta = static_cast<int32_t>(deviceUs - static_cast<uint32_t>(lastDevice_));
+        return lastDevice_ + delta;
+    }
+
+    double toHost(int64_t device) const
+    {
+        return offset_ + slope_ * static_cast<double>(device - origin_);
+    }
+
+    /* Centered sums keep the doubles well inside their precision */
+    void fit()
+    {
+        const std::size_t n = samples_.size();
+        origin_ = samples_.front().device;
+        const int64_t hostOrigin = samples_.front().host;
+
+        if(n == 1) {
+            slope_ = 1.0;
+            offset_ = static_cast<double>(hostOrigin);
+            return;
+        }
+
+        double meanX = 0.0;
+        double meanY = 0.0;
+        for(const Sample & s : samples_) {
+            meanX += static_cast<double>(s.device - origin_);
+            meanY += static_cast<double>(s.host - hostOrigin);
+        }
+        meanX /= static_cast<double>(n);
+        meanY /= static_cast<double>(n);
+
+        double sxx = 0.0;
+        double sxy = 0.0;
+        for(const Sample & s : samples_) {
+            const double dx = static_cast<double>(s.device - origin_) - meanX;
+            const double dy = static_cast<double>(s.host - hostOrigin) - meanY;
+            sxx += dx * dx;
+            sxy += dx * dy;
+        }
+        slope_ = (sxx > 0.0) ? (sxy / sxx) : 1.0;
+        offset_ = static_cast<double>(hostOrigin) + meanY - (slope_ * meanX);
+    }
+
+    std::size_t window_;
+    double rejectUs_;
+    std::deque<Sample> samples_;
+    bool deviceValid_ = false;
+    int64_t lastDevice_ = 0;
+    double slope_ = 1.0;
+    double offset_ = 0.0;
+    int64_t origin_ = 0;
+};
+
+} // namespace webusb_canfd
+
+#endif /* HOST_CLOCKSYNC_CLOCKSYNCESTIMATOR_HPP_ */
@@ -0,0 +1,174 @@
+/*!
+ * \file FrameCrc.hpp
+ *
+ * Host side of the frame trailers negotiated with CONNECT_OPT_INTEGRITY.
+ * Same CRCs as the device's CRC unit (bsp/crc.h), table driven, slice by
+ * 8.  Both are MSB first without a final XOR: the trailer is written most
+ * significant byte first and the check over a whole frame is 0.
+ *
+ *     FrameCheck check(FrameIntegrity::Crc32);
+ *     check.update(frame.data(), frame.size());
+ *     bool intact = (check.value() == 0);
+ *
+ * Header only, C++17, no dependencies.  Defining FRAME_CRC_DEVICE_API in
+ * one translation unit also provides the device's CRC_update16/32, for
+ * host builds of main/usb_device/frameParser/frameParser.c.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef HOST_FRAMECRC_FRAMECRC_HPP_
+#define HOST_FRAMECRC_FRAMECRC_HPP_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace webusb_canfd {
+
+/* Bits 14..15 of the frame length, FRAME_INTEGRITY_T on the device */
+enum class FrameIntegrity : uint8_t {
+    Sum8 = 0,
+    Crc16 = 1,      // CRC-16/CCITT-FALSE
+    Crc32 = 2       // CRC-32/MPEG-2
+};
+
+constexpr std::size_t trailerSize(FrameIntegrity integrity)
+{
+    return (integrity == FrameIntegrity::Crc32) ? 4 : ((integrity == FrameIntegrity::Crc16) ? 2 : 1);
+}
+
+
+namespace detail {
+
+/* table[k][b]: CRC of byte b followed by k zero bytes, from a zero register */
+template<typename T, T Poly>
+constexpr std::array<std::array<T, 256>, 8> makeTables()
+{
+    constexpr unsigned kWidth = sizeof(T) * 8;
+    constexpr T kTop = static_cast<T>(T(1) << (kWidth - 1));
+    std::array<std::array<T, 256>, 8> table{};
+
+    for(unsigned b = 0; b < 256; b++) {
+        T crc = static_cast<T>(T(b) << (kWidth - 8));
+        for(int bit = 0; bit < 8; bit++) {
+            crc = static_cast<T>((crc & kTop) ? ((crc << 1) ^ Poly) : (crc << 1));
+        }
+        table[0][b] = crc;
+    }
+    for(unsigned k = 1; k < 8; k++) {
+        for(unsigned b = 0; b < 256; b++) {
+            const T prev = table[k - 1][b];
+            table[k][b] = static_cast<T>((prev << 8) ^ table[0][prev >> (kWidth - 8)]);
+        }
+    }
+    return table;
+}
+
+inline constexpr auto kCrc16Table = makeTables<uint16_t, 0x1021>();
+inline constexpr auto kCrc32Table = makeTables<uint32_t, 0x04C11DB7>();
+
+} // namespace detail
+
+
+/* Continues crc over data, start from 0xFFFF */
+inline uint16_t crc16(uint16_t crc, const uint8_t * data, std::size_t length)
+{
+    const auto & t = detail::kCrc16Table;
+
+    while(length >= 8) {
+        const unsigned a = crc ^ ((unsigned(data[0]) << 8) | data[1]);
+        crc = static_cast<uint16_t>(t[7][a >> 8] ^ t[6][a & 0xFF] ^ t[5][data[2]] ^ t[4][data[3]] ^
+                                    t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]]);
+        data += 8;
+        length -= 8;
+    }
+    while(length-- > 0) {
+        crc = static_cast<uint16_t>((crc << 8) ^ t[0][(crc >> 8) ^ *data++]);
+    }
+    return crc;
+}
+
+
+/* Continues crc over data, start from 0xFFFFFFFF */
+inline uint32_t crc32(uint32_t crc, const uint8_t * data, std::size_t length)
+{
+    const auto & t = detail::kCrc32Table;
+
+    while(length >= 8) {
+        const uint32_t a = crc ^ ((uint32_t(data[0]) << 24) | (uint32_t(data[1]) << 16) |
+                                  (uint32_t(data[2]) << 8) | data[3]);
+        crc = t[7][a >> 24] ^ t[6][(a >> 16) & 0xFF] ^ t[5][(a >> 8) & 0xFF] ^ t[4][a & 0xFF] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        length -= 8;
+    }
+    while(length-- > 0) {
+        crc = (crc << 8) ^ t[0][(crc >> 24) ^ *data++];
+    }
+    return crc;
+}
+
+
+/* Running check over a frame, mirrors frame_check_*() on the device */
+class FrameCheck {
+public:
+    explicit FrameCheck(FrameIntegrity integrity)
+        : integrity_(integrity),
+          value_((integrity == FrameIntegrity::Crc32) ? 0xFFFFFFFFu :
+                 ((integrity == FrameIntegrity::Crc16) ? 0xFFFFu : 0u)) {}
+
+    void update(const uint8_t * data, std::size_t length)
+    {
+        switch(integrity_) {
+        case FrameIntegrity::Crc16:
+            value_ = crc16(static_cast<uint16_t>(value_), data, length);
+            break;
+        case FrameIntegrity::Crc32:
+            value_ = crc32(value_, data, length);
+            break;
+        default:
+            for(std::size_t i = 0; i < length; i++) {
+                value_ = (value_ + data[i]) & 0xFF;
+            }
+            break;
+        }
+    }
+
+    uint32_t value() const { return value_; }
+
+    /* Writes the trailer that brings the check to 0, returns its size */
+    std::size_t trailer(uint8_t * out) const
+    {
+        const std::size_t size = trailerSize(integrity_);
+        if(integrity_ == FrameIntegrity::Sum8) {
+            out[0] = static_cast<uint8_t>(-value_);
+        } else {
+            for(std::size_t i = 0; i < size; i++) {
+                out[i] = static_cast<uint8_t>(value_ >> (8 * (size - 1 - i)));
+            }
+        }
+        return size;
+    }
+
+private:
+    FrameIntegrity integrity_;
+    uint32_t value_;
+};
+
+} // namespace webusb_canfd
+
+
+#ifdef FRAME_CRC_DEVICE_API
+/* Stand in for the CRC unit, see bsp/crc.h */
+extern "C" uint16_t CRC_update16(uint16_t crc, const uint8_t * pBuf, uint32_t length)
+{
+    return webusb_canfd::crc16(crc, pBuf, length);
+}
+
+extern "C" uint32_t CRC_update32(uint32_t crc, const uint8_t * pBuf, uint32_t length)
+{
+    return webusb_canfd::crc32(crc, pBuf, length);
+}
+#endif /* FRAME_CRC_DEVICE_API */
+
+#endif /* HOST_FRAMECRC_FRAMECRC_HPP_ */
@@ -0,0 +1,128 @@
+/*!
+ * \file SendWindow.hpp
+ *
+ * Host side of CONNECT_OPT_HOST_ACK.  Keeps the frames sent to the device
+ * until a COMMAND_DEVICE_TO_HOST_HOST_ACK report covers them, resends only
+ * the ones the report marks missing, and keeps the bytes in flight within
+ * the room the device reported in its receive ring.
+ *
+ *     SendWindow win;
+ *     if(win.canSend(frame.size())) {
+ *         win.sent(sequence, frame);         // frame as written to the device
+ *     }
+ *     for(auto & f : win.onReport(expected, missing, freeBytes)) {
+ *         write(f);                          // missing frames, as they were
+ *     }
+ *     // no report within a few ms while win.inFlight(): write win.onTimeout()
+ *
+ * Frames carry their own sequence, so a resent frame is written unchanged.
+ * At most kMaxFrames are in flight, so a resent frame lands within the
+ * device's 32 frame missing mask.  A frame is resent again only once frames
+ * sent after the last resend have arrived.  A frame the device has not
+ * seen within 32 sequences is given up on and counted in lost().
+ *
+ * Header only, C++17, no dependencies.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef HOST_SENDWINDOW_SENDWINDOW_HPP_
+#define HOST_SENDWINDOW_SENDWINDOW_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace webusb_canfd {
+
+class SendWindow {
+public:
+    static constexpr std::size_t kMaxFrames = 8;
+
+    /* initialCredit : bytes that may be sent before the first report */
+    explicit SendWindow(std::size_t initialCredit = 256) : credit_(initialCredit) {}
+
+    bool canSend(std::size_t frameSize) const
+    {
+        return (frameSize <= credit_) && (pending_.size() < kMaxFrames);
+    }
+
+    void sent(uint16_t sequence, std::vector<uint8_t> frame)
+    {
+        credit_ -= (frame.size() <= credit_) ? frame.size() : credit_;
+        nextSequence_ = static_cast<uint16_t>(sequence + 1);
+        pending_[sequence] = Entry{std::move(frame), false, 0};
+    }
+
+    /* Returns the frames to send again, oldest first */
+    std::vector<std::vector<uint8_t>> onReport(uint16_t expected, uint32_t missing, uint16_t freeBytes)
+    {
+        std::vector<std::vector<uint8_t>> resend;
+        std::size_t inFlight = 0;
+
+        for(auto it = pending_.begin(); it != pending_.end(); ) {
+            /* age 0 is expected - 1, negative is not seen by the device yet */
+            const int32_t age = static_cast<int16_t>(static_cast<uint16_t>(expected - 1 - it->first));
+            Entry & entry = it->second;
+            if(age < 0) {
+                inFlight += entry.frame.size();
+                ++it;
+            } else if((age < 32) && ((missing & (1UL << age)) != 0)) {
+                /* A later frame got through after the last resend, so that one was lost too */
+                if(!entry.resent || (static_cast<int16_t>(static_cast<uint16_t>(expected - entry.resendMark)) > 0)) {
+                    entry.resent = true;
+                    entry.resendMark = nextSequence_;
+                    resend.push_back(entry.frame);
+                }
+                inFlight += entry.frame.size();
+                ++it;
+            } else {
+                if(age >= 32) {
+                    lost_++;
+                }
+                it = pending_.erase(it);
+            }
+        }
+
+        /* Unreported frames may already be in the ring, counting them again errs safe */
+        credit_ = (freeBytes > inFlight) ? (freeBytes - inFlight) : 0;
+        return resend;
+    }
+
+    /*
+     * No report for a while: the last frames, or their resends, were lost
+     * with nothing after them to show the gap.  Returns every frame not yet
+     * acknowledged, the device drops the ones it has and reports.
+     */
+    std::vector<std::vector<uint8_t>> onTimeout()
+    {
+        std::vector<std::vector<uint8_t>> resend;
+
+        for(auto & item : pending_) {
+            item.second.resent = true;
+            item.second.resendMark = nextSequence_;
+            resend.push_back(item.second.frame);
+        }
+        return resend;
+    }
+
+    std::size_t inFlight() const { return pending_.size(); }
+    std::size_t lost() const { return lost_; }
+
+private:
+    struct Entry {
+        std::vector<uint8_t> frame;
+        bool resent;
+        uint16_t resendMark;    // next new sequence when last resent
+    };
+
+    /* Keyed by sequence, ordered oldest first until the 16-bit wrap */
+    std::map<uint16_t, Entry> pending_;
+    uint16_t nextSequence_ = 0;
+    std::size_t credit_;
+    std::size_t lost_ = 0;
+};
+
+} // namespace webusb_canfd
+
+#endif /* HOST_SENDWINDOW_SENDWINDOW_HPP_ */
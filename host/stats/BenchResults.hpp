@@ -0,0 +1,90 @@
+/*!
+ * \file BenchResults.hpp
+ *
+ * Host side of VENDOR_REQUEST_GET_BENCH (bmRequestType 0xC0, bRequest 11),
+ * see main/stats/bench.h for the benchmarks and the layout.  The reply has
+ * no results until the device finished its run, shortly after start up.
+ * Firmware built without CONFIG_BENCH stalls the request.
+ *
+ *     auto bench = BenchResults::parse(reply.data(), reply.size());
+ *     if(bench) {
+ *         for(std::size_t i = 0; i < bench->results.size(); i++) {
+ *             printf("%-14s %8.2f cycles/unit\n", BenchResults::name(i), bench->cyclesPerUnit(i));
+ *         }
+ *     }
+ *
+ * Header only, C++17, no dependencies.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef HOST_STATS_BENCHRESULTS_HPP_
+#define HOST_STATS_BENCHRESULTS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace webusb_canfd {
+
+struct BenchResults {
+    static constexpr std::size_t kHeaderSize = 8;
+    static constexpr std::size_t kResultSize = 8;
+
+    struct Result {
+        uint32_t cycles = 0;    // fewest over the runs
+        uint32_t units = 0;     // bytes or calls in one run
+    };
+
+    uint8_t version = 0;
+    uint32_t cpuHz = 0;
+    std::vector<Result> results;
+
+    /* BENCH_T order */
+    static const char * name(std::size_t bench)
+    {
+        static const char * const kNames[] = {
+            "parse-clean", "parse-noise", "parse-resync", "command-locks",
+            "check-sum8", "check-crc16", "check-crc32", "check-crc32-sw",
+            "code-flash", "code-flash-cold", "code-ccm", "code-ccm-cold"
+        };
+        return (bench < (sizeof(kNames) / sizeof(kNames[0]))) ? kNames[bench] : "?";
+    }
+
+    static std::optional<BenchResults> parse(const uint8_t * data, std::size_t length)
+    {
+        BenchResults bench;
+        std::size_t count;
+
+        if(length < kHeaderSize) {
+            return std::nullopt;
+        }
+        bench.version = data[0];
+        count = data[1];
+        bench.cpuHz = readU32(&data[4]);
+        if(length < kHeaderSize + (count * kResultSize)) {
+            return std::nullopt;
+        }
+        for(std::size_t i = 0; i < count; i++) {
+            const uint8_t * p = &data[kHeaderSize + (kResultSize * i)];
+            bench.results.push_back({readU32(&p[0]), readU32(&p[4])});
+        }
+        return bench;
+    }
+
+    double cyclesPerUnit(std::size_t bench) const
+    {
+        const Result & r = results.at(bench);
+        return (r.units == 0) ? 0.0 : (double(r.cycles) / double(r.units));
+    }
+
+private:
+    static uint32_t readU32(const uint8_t * p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+};
+
+} // namespace webusb_canfd
+
+#endif /* HOST_STATS_BENCHRESULTS_HPP_ */
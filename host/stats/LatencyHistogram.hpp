@@ -0,0 +1,118 @@
+/*!
+ * \file LatencyHistogram.hpp
+ *
+ * Host side of VENDOR_REQUEST_GET_LATENCY (bmRequestType 0xC0, bRequest 10),
+ * see main/stats/latency.h for the stages and the layout.  wValue 1 clears
+ * the histograms after the read, so polling with it gives one interval per
+ * reply.  Firmware built without CONFIG_LATENCY_PROBES stalls the request.
+ *
+ *     auto latency = LatencyHistogram::parse(reply.data(), reply.size());
+ *     if(latency) {
+ *         for(std::size_t i = 0; i < latency->stages.size(); i++) {
+ *             printf("%-12s p99 < %.1f us, max %.1f us\n", LatencyHistogram::stageName(i),
+ *                    latency->percentileUs(i, 0.99), latency->toUs(latency->stages[i].maxCycles));
+ *         }
+ *     }
+ *
+ * Header only, C++17, no dependencies.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef HOST_STATS_LATENCYHISTOGRAM_HPP_
+#define HOST_STATS_LATENCYHISTOGRAM_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace webusb_canfd {
+
+struct LatencyHistogram {
+    static constexpr std::size_t kHeaderSize = 8;
+
+    struct Stage {
+        uint32_t maxCycles = 0;
+        std::vector<uint32_t> counts;   // counts[n]: [2^n, 2^(n+1)) cycles, the last one open ended
+    };
+
+    uint8_t version = 0;
+    uint32_t cpuHz = 0;
+    std::vector<Stage> stages;
+
+    /* LATENCY_STAGE_T order */
+    static const char * stageName(std::size_t stage)
+    {
+        static const char * const kNames[] = {
+            "rx-queue", "rx-encoder", "rx-submit", "rx-complete", "tx-ring", "tx-fifo"
+        };
+        return (stage < (sizeof(kNames) / sizeof(kNames[0]))) ? kNames[stage] : "?";
+    }
+
+    static std::optional<LatencyHistogram> parse(const uint8_t * data, std::size_t length)
+    {
+        LatencyHistogram latency;
+        std::size_t stageCount;
+        std::size_t bucketCount;
+        std::size_t offset = kHeaderSize;
+
+        if(length < kHeaderSize) {
+            return std::nullopt;
+        }
+        latency.version = data[0];
+        stageCount = data[1];
+        bucketCount = data[2];
+        latency.cpuHz = readU32(&data[4]);
+        if(length < kHeaderSize + (stageCount * 4 * (1 + bucketCount))) {
+            return std::nullopt;
+        }
+        for(std::size_t i = 0; i < stageCount; i++) {
+            Stage stage;
+            stage.maxCycles = readU32(&data[offset]);
+            offset += 4;
+            for(std::size_t n = 0; n < bucketCount; n++) {
+                stage.counts.push_back(readU32(&data[offset]));
+                offset += 4;
+            }
+            latency.stages.push_back(stage);
+        }
+        return latency;
+    }
+
+    double toUs(uint32_t cycles) const
+    {
+        return (cpuHz == 0) ? 0.0 : ((double(cycles) * 1e6) / double(cpuHz));
+    }
+
+    /* Upper edge of the bucket holding the fraction, the stage maximum for the last bucket */
+    double percentileUs(std::size_t stage, double fraction) const
+    {
+        const Stage & s = stages.at(stage);
+        uint64_t total = 0;
+        uint64_t seen = 0;
+
+        for(uint32_t count : s.counts) {
+            total += count;
+        }
+        for(std::size_t n = 0; n < s.counts.size(); n++) {
+            seen += s.counts[n];
+            if((total != 0) && (double(seen) >= (fraction * double(total)))) {
+                if((n + 1) == s.counts.size()) {
+                    return toUs(s.maxCycles);
+                }
+                return toUs(uint32_t((uint64_t(2) << n) - 1));
+            }
+        }
+        return 0.0;
+    }
+
+private:
+    static uint32_t readU32(const uint8_t * p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+};
+
+} // namespace webusb_canfd
+
+#endif /* HOST_STATS_LATENCYHISTOGRAM_HPP_ */
@@ -0,0 +1,82 @@
+/*!
+ * \file StatsBlock.hpp
+ *
+ * Host side of VENDOR_REQUEST_GET_STATS (bmRequestType 0xC0, bRequest 6).
+ * The layout comes from the same STATS_FIELDS list the firmware uses, so a
+ * field added there shows up here on the next build.
+ *
+ *     auto stats = StatsBlock::parse(reply.data(), reply.size());
+ *     if(stats) {
+ *         stats->forEach([](const char * name, const char * description, uint32_t value) { ... });
+ *     }
+ *
+ * Fields a device does not send (older firmware) read as 0, fields this
+ * build does not know (newer firmware) are skipped.  Bus load over a poll
+ * interval is the canRxBusUs + canTxBusUs delta over the uptimeUs delta.
+ *
+ * Header only, C++17, no dependencies.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef HOST_STATS_STATSBLOCK_HPP_
+#define HOST_STATS_STATSBLOCK_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include "../../main/stats/statsFields.h"
+
+namespace webusb_canfd {
+
+struct StatsBlock {
+    static constexpr std::size_t kHeaderSize = 4;
+
+    uint8_t version = 0;
+    uint8_t fieldCount = 0;
+#define STATS_BLOCK_MEMBER(name, description) uint32_t name = 0;
+    STATS_FIELDS(STATS_BLOCK_MEMBER)
+#undef STATS_BLOCK_MEMBER
+
+    static std::optional<StatsBlock> parse(const uint8_t * data, std::size_t length)
+    {
+        StatsBlock block;
+        std::size_t index = 0;
+
+        if(length < kHeaderSize) {
+            return std::nullopt;
+        }
+        block.version = data[0];
+        block.fieldCount = data[1];
+        if(length < kHeaderSize + (4 * std::size_t(block.fieldCount))) {
+            return std::nullopt;
+        }
+#define STATS_BLOCK_PARSE(name, description) \
+        if(index < block.fieldCount) { \
+            block.name = readU32(&data[kHeaderSize + (4 * index)]); \
+        } \
+        index++;
+        STATS_FIELDS(STATS_BLOCK_PARSE)
+#undef STATS_BLOCK_PARSE
+        return block;
+    }
+
+    /* fn(const char * name, const char * description, uint32_t value), in block order */
+    template<typename Fn>
+    void forEach(Fn && fn) const
+    {
+#define STATS_BLOCK_VISIT(name, description) fn(#name, description, name);
+        STATS_FIELDS(STATS_BLOCK_VISIT)
+#undef STATS_BLOCK_VISIT
+    }
+
+private:
+    static uint32_t readU32(const uint8_t * p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+};
+
+} // namespace webusb_canfd
+
+#endif /* HOST_STATS_STATSBLOCK_HPP_ */
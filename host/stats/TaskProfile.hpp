@@ -0,0 +1,96 @@
+/*!
+ * \file TaskProfile.hpp
+ *
+ * Host side of VENDOR_REQUEST_GET_PROFILE (bmRequestType 0xC0, bRequest 9),
+ * see main/stats/taskProfile.h for the layout.  The device refreshes the
+ * profile once per window, so polling faster returns the same window.
+ *
+ *     auto profile = TaskProfile::parse(reply.data(), reply.size());
+ *     if(profile) {
+ *         for(const auto & task : profile->tasks) {
+ *             printf("%-16s %5.1f%% %u words free\n", task.name.c_str(),
+ *                    task.cpuPermille / 10.0, task.stackFreeMin);
+ *         }
+ *     }
+ *
+ * Header only, C++17, no dependencies.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef HOST_STATS_TASKPROFILE_HPP_
+#define HOST_STATS_TASKPROFILE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace webusb_canfd {
+
+struct TaskProfile {
+    static constexpr std::size_t kHeaderSize = 16;
+    static constexpr std::size_t kEntrySize = 24;
+    static constexpr std::size_t kNameLength = 16;
+
+    struct Task {
+        std::string name;
+        uint32_t cycles = 0;
+        uint16_t cpuPermille = 0;
+        uint16_t stackFreeMin = 0;  // words
+    };
+
+    uint8_t version = 0;
+    uint32_t windowCycles = 0;      // 0 until the first window closes
+    uint32_t isrCycles = 0;
+    uint16_t isrPermille = 0;
+    std::vector<Task> tasks;
+
+    static std::optional<TaskProfile> parse(const uint8_t * data, std::size_t length)
+    {
+        TaskProfile profile;
+        std::size_t taskCount;
+
+        if(length < kHeaderSize) {
+            return std::nullopt;
+        }
+        profile.version = data[0];
+        taskCount = data[1];
+        if(length < kHeaderSize + (kEntrySize * taskCount)) {
+            return std::nullopt;
+        }
+        profile.windowCycles = readU32(&data[4]);
+        profile.isrCycles = readU32(&data[8]);
+        profile.isrPermille = readU16(&data[12]);
+        for(std::size_t i = 0; i < taskCount; i++) {
+            const uint8_t * p = &data[kHeaderSize + (kEntrySize * i)];
+            Task task;
+            std::size_t nameLength = 0;
+
+            while((nameLength < kNameLength) && (p[nameLength] != 0)) {
+                nameLength++;
+            }
+            task.name.assign(reinterpret_cast<const char *>(p), nameLength);
+            task.cycles = readU32(&p[16]);
+            task.cpuPermille = readU16(&p[20]);
+            task.stackFreeMin = readU16(&p[22]);
+            profile.tasks.push_back(task);
+        }
+        return profile;
+    }
+
+private:
+    static uint16_t readU16(const uint8_t * p)
+    {
+        return uint16_t(p[0] | (p[1] << 8));
+    }
+
+    static uint32_t readU32(const uint8_t * p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+};
+
+} // namespace webusb_canfd
+
+#endif /* HOST_STATS_TASKPROFILE_HPP_ */
@@ -84,7 +84,9 @@ extern uint32_t SystemCoreClock;
 #define configCHECK_FOR_STACK_OVERFLOW         2
 
 /* Run time and task stats gathering related definitions. */
-#define configGENERATE_RUN_TIME_STATS          0
+#define configGENERATE_RUN_TIME_STATS          1
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()    // DWT cycle counter, started in board_init()
+#define portGET_RUN_TIME_COUNTER_VALUE()       (DWT->CYCCNT)
 #define configUSE_TRACE_FACILITY               1 // legacy trace
 #define configUSE_STATS_FORMATTING_FUNCTIONS   0
 
@@ -108,7 +110,7 @@ extern uint32_t SystemCoreClock;
 #define INCLUDE_vTaskDelay                     1
 #define INCLUDE_xTaskGetSchedulerState         0
 #define INCLUDE_xTaskGetCurrentTaskHandle      0
-#define INCLUDE_uxTaskGetStackHighWaterMark    0
+#define INCLUDE_uxTaskGetStackHighWaterMark    1
 #define INCLUDE_xTaskGetIdleTaskHandle         0
 #define INCLUDE_xTimerGetTimerDaemonTaskHandle 0
 #define INCLUDE_pcTaskGetTaskName              0
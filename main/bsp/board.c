@@ -3,9 +3,19 @@
 #include "stm32g4xx_hal.h"
 #include "bsp/board_api.h"
 #include "bsp/can.h"
+#include "bsp/crc.h"
+#include "bsp/ccm.h"
+#include "usb_device/webusb.h"
 
 static PCD_HandleTypeDef hpcd_USB_FS;
 
+#if CONFIG_SOF_SYNC
+/* Latest SOF latch, written by the USB interrupt */
+static volatile uint32_t sofLatchCount = 0;
+static volatile uint32_t sofLatchTimeUs = 0;
+static volatile uint16_t sofLatchFrame = 0;
+#endif
+
 void HAL_MspInit(void)
 {
     __HAL_RCC_SYSCFG_CLK_ENABLE();
@@ -93,7 +103,7 @@ static void MX_USB_PCD_Init(void)
     hpcd_USB_FS.Init.dev_endpoints = 8;
     hpcd_USB_FS.Init.speed = PCD_SPEED_FULL;
     hpcd_USB_FS.Init.phy_itface = PCD_PHY_EMBEDDED;
-    hpcd_USB_FS.Init.Sof_enable = DISABLE;
+    hpcd_USB_FS.Init.Sof_enable = CONFIG_SOF_SYNC ? ENABLE : DISABLE;
     hpcd_USB_FS.Init.low_power_enable = DISABLE;
     hpcd_USB_FS.Init.lpm_enable = DISABLE;
     hpcd_USB_FS.Init.battery_charging_enable = DISABLE;
@@ -123,14 +133,45 @@ void HAL_PCD_MspInit(PCD_HandleTypeDef* hpcd)
 }
 
 
+/*
+ * TIM2 free-running at 1MHz, used to timestamp CAN frames.
+ * APB1 prescaler is 1 so the timer clock equals HCLK.
+ */
+static void BoardTimestamp_Config(void)
+{
+    __HAL_RCC_TIM2_CLK_ENABLE();
+    TIM2->CR1 = 0;
+    TIM2->PSC = (SystemCoreClock / 1000000U) - 1U;
+    TIM2->ARR = 0xFFFFFFFFU;
+    TIM2->EGR = TIM_EGR_UG;     // load prescaler
+    TIM2->CR1 = TIM_CR1_CEN;
+}
+
+
+/*
+ * DWT cycle counter, the FreeRTOS run-time stats clock (taskProfile.h).
+ * Wraps every 25.6 s at 168 MHz.
+ */
+static void BoardCycleCounter_Config(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+
 void board_init()
 {
+    CCM_init();
     HAL_Init();
     SystemClock_Config();
     SysTick->CTRL &= ~1U;   // Explicitly disable systick to prevent its ISR runs before scheduler start
     BoardGpio_Config();
+    BoardTimestamp_Config();
+    BoardCycleCounter_Config();
     MX_USB_PCD_Init();
     CAN_init();
+    CRC_init();
 
     NVIC_SetPriority(FDCAN1_IT0_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY);
     NVIC_SetPriority(USB_HP_IRQn, configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY);
@@ -139,6 +180,52 @@ void board_init()
 }
 
 
+uint32_t board_timestamp_us(void)
+{
+    return TIM2->CNT;
+}
+
+
+#if CONFIG_SOF_SYNC
+/*
+ * NOTE: TinyUSB writes CNTR itself in tud_init() and HAL_PCD_Start() is
+ *       never called, so Sof_enable alone does not unmask the SOF interrupt.
+ */
+void board_init_after_tusb(void)
+{
+    USB->CNTR |= USB_CNTR_SOFM;
+}
+
+
+/*
+ * NOTE: This called from the interrupt, before TinyUSB clears the flag
+ */
+void board_sof_latch(void)
+{
+    const uint32_t now = TIM2->CNT;
+
+    sofLatchTimeUs = now;
+    sofLatchFrame = (uint16_t)(USB->FNR & USB_FNR_FN);
+    sofLatchCount++;
+}
+
+
+bool board_sof_sample(uint16_t * pFrame, uint32_t * pTimeUs)
+{
+    uint32_t count;
+
+    /* Retry if a SOF landed in between */
+    do {
+        count = sofLatchCount;
+        *pFrame = sofLatchFrame;
+        *pTimeUs = sofLatchTimeUs;
+    } while(count != sofLatchCount);
+
+    return (count != 0);
+}
+#endif /* CONFIG_SOF_SYNC */
+
+
 void board_led_write(bool isOn)
 {
     if(isOn) {
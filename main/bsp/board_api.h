@@ -68,6 +68,16 @@ void board_led_write(bool state);
 // a '1' means active (pressed), a '0' means inactive.
 uint32_t board_button_read(void);
 
+// Free-running 32-bit microsecond counter, wraps every ~71 minutes
+uint32_t board_timestamp_us(void);
+
+// Latches board_timestamp_us() and the USB frame number, called from the
+// USB interrupt on SOF (CONFIG_SOF_SYNC)
+void board_sof_latch(void);
+
+// Latest SOF latch. Returns false until the first SOF
+bool board_sof_sample(uint16_t * pFrame, uint32_t * pTimeUs);
+
 // Get board unique ID for USB serial number. Return number of bytes. Note max_len is typically 16
 TU_ATTR_WEAK size_t board_get_unique_id(uint8_t id[], size_t max_len);
 
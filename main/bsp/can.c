@@ -3,51 +3,75 @@
  *
  * \author Sicris Rey Embay
  */
+#include "string.h"
 #include "stm32g4xx_hal.h"
 #include "board_api.h"
+#include "ccm.h"
 #include "can.h"
 #include "main.h"
-#include "usb_device/frameParser/frameParser.h"
 #include "usb_device/webusb.h"
-#include "commandParser/commandParser.h"
+#include "stats/stats.h"
+#include "stats/latency.h"
+#include "bufferArena/bufferArena.h"
 
 #define CAN_TX_BIT          (0x01)
 #define CAN_RX_BIT          (0x02)
+#define CAN_STATUS_BIT      (0x04)
+#define CAN_DEFER_BIT       (0x08)
 
-#define CAN_STACK_SIZE          (256)
+#define CAN_STATUS_ITS      (FDCAN_IT_BUS_OFF | FDCAN_IT_ERROR_PASSIVE | FDCAN_IT_ERROR_WARNING)
+#define CAN_RX_ITS          (FDCAN_IT_RX_FIFO0_NEW_MESSAGE | FDCAN_IT_RX_FIFO0_MESSAGE_LOST)
+/* FDCAN1 is the first instance, RX and TX elements go through fdcanRam.h */
+#define CAN_MESSAGE_RAM     ((uint32_t volatile *)SRAMCAN_BASE)
 
 FDCAN_HandleTypeDef hfdcan1;
+#if CONFIG_USB_CAN_REACTOR
+/* CAN work is run by the USB reactor task; ISRs only accumulate event bits */
+static volatile uint32_t reactorEvents = 0;
+#else
+#define CAN_STACK_SIZE          (384)   // also runs parser configuration, see CAN_defer()
 static TaskHandle_t canTask = NULL;
 static StackType_t can_stack[CAN_STACK_SIZE];
 static StaticTask_t can_taskdef;
+#endif
 static ARBIT_BITRATE_T arbit_bps = ARBIT_1MHZ;
 static DATA_BITRATE_T data_bps = DATA_1MHZ;
 static bool txInProgress = false;
+static can_rx_handler_t rxHandler = NULL;
+static can_tx_handler_t txHandler = NULL;
+static can_status_handler_t statusHandler = NULL;
+static can_defer_handler_t deferHandler = NULL;
 
-typedef struct {
-    FDCAN_RxHeaderTypeDef header;
-    uint8_t data[64];
-} rx_queue_element_t;
 
-typedef struct {
-    uint32_t prescaler;
-    uint32_t sjw;
-    uint32_t tseg1;
-    uint32_t tseg2;
-} timing_config_t;
-
-
-#define CAN_TX_QUEUE_LENGTH     (3)
-#define CAN_TX_ELEMENT_SZ       sizeof(tx_queue_element_t)
-static StaticQueue_t canTxStaticQueue;
-uint8_t canTxQueueStorageArea[CAN_TX_QUEUE_LENGTH * CAN_TX_ELEMENT_SZ];
-static QueueHandle_t canTxQHandle;
-
-#define CAN_RX_QUEUE_LENGTH     (3)
-#define CAN_RX_ELEMENT_SZ       sizeof(rx_queue_element_t)
+/*
+ * TX ring, elements are built in place by the producer (CAN_tx_claim) and
+ * copied to the TX FIFO from the same slot.  Indices are free running.  The
+ * ring and the RX queue storage come from the buffer arena.
+ *
+ * Single producer, single consumer without a lock: only the producer
+ * writes canTxHead and only the consumer canTxTail.  There is one producer
+ * context, the USB class (or reactor) task, gs_usb under its own mutex.
+ */
+static tx_queue_element_t * canTxRing = NULL;
+static uint32_t canTxLength = 0;   // power of two
+static volatile uint32_t canTxHead = 0;
+static volatile uint32_t canTxTail = 0;
+/* Set from CAN_tx_claim() to CAN_tx_commit(), see CAN_buffers_idle() */
+static volatile bool bTxClaimed = false;
+
+#define CAN_RX_ELEMENT_SZ       sizeof(can_frame_t)
 static StaticQueue_t canRxStaticQueue;
-uint8_t canRxQueueStorageArea[CAN_RX_QUEUE_LENGTH * CAN_RX_ELEMENT_SZ];
-static QueueHandle_t canRxQHandle;
+static QueueHandle_t canRxQHandle = NULL;
+static uint32_t rxSequence = 0;
+static volatile uint32_t rxFifoLost = 0;
+
+/* Bus time accounting, bit times in kernel clocks (see NOTE below) */
+#define CAN_KERNEL_CLOCK_MHZ    (84)
+static uint32_t nominalBitClocks = 84;
+static uint32_t dataBitClocks = 84;
+static uint32_t rxBusRemainder = 0;
+static uint32_t txBusRemainder = 0;
+static CAN_BUS_STATE_T lastBusState = CAN_BUS_ERROR_ACTIVE;
 
 /*
  * NOTE:
@@ -58,7 +82,7 @@ static QueueHandle_t canRxQHandle;
  *   Sampling Point is 85.71%
  *
  */
-static timing_config_t const DEFAULT_ARBITRATION_TIMING[N_SUPPORTED_ARBIT_BITRATE] = {
+static can_timing_t const DEFAULT_ARBITRATION_TIMING[N_SUPPORTED_ARBIT_BITRATE] = {
     {
         /* ARBIT_500KHZ */
         .prescaler = 1,
@@ -75,7 +99,7 @@ static timing_config_t const DEFAULT_ARBITRATION_TIMING[N_SUPPORTED_ARBIT_BITRAT
     },
 };
 
-static timing_config_t const DEFAULT_DATA_TIMING[N_SUPPORTED_DATA_BITRATE] = {
+static can_timing_t const DEFAULT_DATA_TIMING[N_SUPPORTED_DATA_BITRATE] = {
     {
         /* DATA_500KHZ */
         .prescaler = 6,
@@ -92,9 +116,12 @@ static timing_config_t const DEFAULT_DATA_TIMING[N_SUPPORTED_DATA_BITRATE] = {
     },
 };
 
-static const uint8_t DLCtoBytes[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
-
+static void can_process(uint32_t events);
+#if CONFIG_USB_CAN_REACTOR
+static void can_reactor_cb(void * pxParam);
+#else
 static void can_task(void * pxParam);
+#endif
 
 void HAL_FDCAN_MspInit(FDCAN_HandleTypeDef* hfdcan)
 {
@@ -129,19 +156,6 @@ void HAL_FDCAN_MspInit(FDCAN_HandleTypeDef* hfdcan)
 
 void CAN_init(void)
 {
-    canTxQHandle = xQueueCreateStatic(
-                                CAN_TX_QUEUE_LENGTH,
-                                CAN_TX_ELEMENT_SZ,
-                                canTxQueueStorageArea,
-                                &canTxStaticQueue);
-    ASSERT_ME(canTxQHandle != NULL);
-
-    canRxQHandle = xQueueCreateStatic(
-                                CAN_RX_QUEUE_LENGTH,
-                                CAN_RX_ELEMENT_SZ,
-                                canRxQueueStorageArea,
-                                &canRxStaticQueue);
-    ASSERT_ME(canRxQHandle != NULL);
 
     hfdcan1.Instance = FDCAN1;
     hfdcan1.Init.ClockDivider = FDCAN_CLOCK_DIV2;
@@ -163,6 +177,7 @@ void CAN_init(void)
     hfdcan1.Init.TxFifoQueueMode = FDCAN_TX_FIFO_OPERATION;
     ASSERT_ME(HAL_FDCAN_Init(&hfdcan1) == HAL_OK);
 
+#if !CONFIG_USB_CAN_REACTOR
     canTask = xTaskCreateStatic(
                         can_task,
                         "can-task",
@@ -172,16 +187,158 @@ void CAN_init(void)
                         can_stack,
                         &can_taskdef
                         );
+#endif
+}
+
+
+/*
+ * Bus time of a frame in kernel clocks, stuff bits excluded.  The data
+ * phase of an FD frame runs at the data bit rate when BRS is set.
+ */
+static CCM_CODE uint32_t can_frame_clocks(uint8_t flags, uint8_t len)
+{
+    const uint32_t dataBytes = ((flags & CAN_FRAME_FLAG_RTR) != 0) ? 0 : len;
+    uint32_t nominalBits;
+    uint32_t dataBits;
+
+    if((flags & CAN_FRAME_FLAG_FD) == 0) {
+        /* SOF to intermission, 11-bit ID */
+        nominalBits = 47 + (8 * dataBytes);
+        dataBits = 0;
+    } else {
+        /* ESI, DLC, data, stuff count and CRC-17/21 in the data phase */
+        nominalBits = 30;
+        dataBits = 26 + (8 * dataBytes) + ((dataBytes > 16) ? 4 : 0);
+    }
+    if((flags & CAN_FRAME_FLAG_EXTENDED) != 0) {
+        nominalBits += 20;
+    }
+    if((flags & CAN_FRAME_FLAG_BRS) == 0) {
+        nominalBits += dataBits;
+        dataBits = 0;
+    }
+
+    return (nominalBits * nominalBitClocks) + (dataBits * dataBitClocks);
+}
+
+
+static CCM_CODE uint32_t can_bus_time_us(uint32_t * pRemainder, uint32_t clocks)
+{
+    clocks += *pRemainder;
+    *pRemainder = clocks % CAN_KERNEL_CLOCK_MHZ;
+
+    return clocks / CAN_KERNEL_CLOCK_MHZ;
+}
+
+
+static void can_service_tx(void)
+{
+    tx_queue_element_t * pElem;
+    uint8_t flags;
+    uint8_t len;
+
+    if(canTxTail != canTxHead) {
+        pElem = &canTxRing[canTxTail & (canTxLength - 1)];
+        /* Dropped while stopped, as HAL_FDCAN_AddMessageToTxFifoQ() did */
+        if((hfdcan1.State == HAL_FDCAN_STATE_BUSY) &&
+           fdcan_ram_write_tx(hfdcan1.Instance, CAN_MESSAGE_RAM, pElem->word0, pElem->word1, pElem->data)) {
+            txInProgress = true;
+            LATENCY_PROBE_TX_FIFO(canTxTail);
+            len = fdcan_elem_len(pElem->word1);
+            flags = fdcan_elem_flags(pElem->word0, pElem->word1);
+            STATS_INC(canTxFrames);
+            STATS_ADD(canTxBytes, len);
+            STATS_ADD(canTxBusUs, can_bus_time_us(&txBusRemainder, can_frame_clocks(flags, len)));
+            if(txHandler != NULL) {
+                txHandler(pElem);
+            }
+        }
+        /* The slot is only reused after the handler returns */
+        canTxTail++;
+    } else {
+        txInProgress = false;
+    }
+}
+
+
+static void can_service_rx(void)
+{
+    can_frame_t frame;
+
+    /* Drain everything queued since the last event, as event bits coalesce */
+    while(pdTRUE == xQueueReceive(canRxQHandle, &frame, 0)) {
+        if(rxHandler != NULL) {
+            rxHandler(&frame, uxQueueMessagesWaiting(canRxQHandle) > 0);
+        }
+    }
+}
+
+
+static void can_process(uint32_t events)
+{
+    if((events & CAN_TX_BIT) != 0) {
+        can_service_tx();
+    }
+    if((events & CAN_RX_BIT) != 0) {
+        can_service_rx();
+    }
+    if((events & CAN_STATUS_BIT) != 0) {
+        can_status_t status;
+        CAN_get_status(&status);
+        if(status.busState != lastBusState) {
+            if(status.busState == CAN_BUS_ERROR_WARNING) {
+                STATS_INC(errWarning);
+            } else if(status.busState == CAN_BUS_ERROR_PASSIVE) {
+                STATS_INC(errPassive);
+            } else if(status.busState == CAN_BUS_OFF) {
+                STATS_INC(errBusOff);
+            }
+            lastBusState = status.busState;
+        }
+        if(statusHandler != NULL) {
+            statusHandler(&status);
+        }
+    }
+    if(((events & CAN_DEFER_BIT) != 0) && (deferHandler != NULL)) {
+        deferHandler();
+    }
 }
 
 
+#if CONFIG_USB_CAN_REACTOR
+/*
+ * NOTE: Runs inside tud_task() on the USB reactor task
+ */
+static void can_reactor_cb(void * pxParam)
+{
+    uint32_t events;
+    (void)pxParam;
+
+    taskENTER_CRITICAL();
+    events = reactorEvents;
+    reactorEvents = 0;
+    taskEXIT_CRITICAL();
+
+    can_process(events);
+}
+
+
+/*
+ * usbd_defer_func() cannot report a full TinyUSB event queue, so a deferred
+ * call may be lost with reactorEvents already set.  A full queue makes
+ * tud_task() return once it is drained, and the reactor loop then calls
+ * this to service whatever is still pending.
+ */
+void CAN_reactor_poll(void)
+{
+    if(reactorEvents != 0) {
+        can_reactor_cb(NULL);
+    }
+}
+#else
 static void can_task(void * pxParam)
 {
-    rx_queue_element_t rxElement;
-    tx_queue_element_t txElement;
     uint32_t notifyValue = 0;
-    uint8_t canDeviceToHost[CFG_TUD_VENDOR_EPSIZE];
-    uint16_t packetSequence = 0;
     txInProgress = false;
 
     while(1) {
@@ -190,125 +347,83 @@ static void can_task(void * pxParam)
                         UINT32_MAX,
                         &notifyValue,
                         portMAX_DELAY)) {
-            if((notifyValue & CAN_TX_BIT) != 0) {
-                if(pdTRUE == xQueueReceive(canTxQHandle, &txElement, 0)) {
-                    if(HAL_OK == HAL_FDCAN_AddMessageToTxFifoQ(
-                            &hfdcan1,
-                            &(txElement.header),
-                            &(txElement.data[0]))) {
-                        txInProgress = true;
-                    }
-                } else {
-                    txInProgress = false;
-                }
-            }
-            if((notifyValue & CAN_RX_BIT) != 0) {
-                if(pdTRUE == xQueueReceive(canRxQHandle, &rxElement, 0)) {
-                    uint8_t checksum = 0;
-                    uint32_t idx = 0;
-                    bool multiplePacket = false;
-                    const uint8_t dlc = DLCtoBytes[(uint8_t)((rxElement.header.DataLength >> 16) & 0x0F)];
-                    const uint8_t maxpayload = CFG_TUD_VENDOR_EPSIZE - SZ_USB_BYTES_IN_PACKET - SZ_FRAME_OVERHEAD - SZ_COMMAND_OVERHEAD;
-                    //const uint8_t frameSize = SZ_FRAME_OVERHEAD + SZ_COMMAND_OVERHEAD + dlc;
-                    uint8_t frameSize = 0;
-
-                    uint8_t command = 0;
-                    if(rxElement.header.FDFormat == FDCAN_CLASSIC_CAN) {
-                        /* Classic CAN */
-                        if(rxElement.header.IdType == FDCAN_STANDARD_ID) {
-                            /* Base Frame */
-                            command = COMMAND_DEVICE_TO_HOST_CAN_STANDARD;
-                        } else {
-                            /* Extended Frame */
-                            command = COMMAND_DEVICE_TO_HOST_CAN_EXTENDED;
-                        }
-                    } else {
-                        /* CAN FD */
-                        if(rxElement.header.IdType == FDCAN_STANDARD_ID) {
-                            /* Base Frame */
-                            command = COMMAND_DEVICE_TO_HOST_FD_STANDARD;
-                        } else {
-                            /* Extended Frame */
-                            command = COMMAND_DEVICE_TO_HOST_FD_EXTENDED;
-                        }
-                    }
-
-                    if(dlc > maxpayload) {
-                        /* Exceeds the Endpoint Size */
-                        multiplePacket = true;
-                        frameSize = CFG_TUD_VENDOR_EPSIZE - 1;
-                    } else {
-                        multiplePacket = false;
-                        frameSize = SZ_FRAME_OVERHEAD + SZ_COMMAND_OVERHEAD + dlc;
-                    }
-
-                    /*
-                     * First Packet
-                     */
-                    memset(canDeviceToHost, 0, sizeof(canDeviceToHost));
-                    // Frame Prefix -->
-                    canDeviceToHost[OFFSET_USB_BYTES_IN_PACKET] = frameSize;
-                    canDeviceToHost[OFFSET_TAG_SOF] = TAG_SOF;
-                    canDeviceToHost[OFFSET_LENGTH] = (uint8_t)(frameSize & 0xFF);
-                    canDeviceToHost[OFFSET_LENGTH + 1] = (uint8_t)(((frameSize) >> 8) & 0xFF);
-                    canDeviceToHost[OFFSET_PKT_SEQ] = (uint8_t)(packetSequence & 0xFF);
-                    canDeviceToHost[OFFSET_PKT_SEQ + 1] = (uint8_t)((packetSequence >> 8) & 0xFF);
-                    packetSequence++;
-                    // <-- Frame Prefix
-                    // Payload -->
-                    canDeviceToHost[OFFSET_PAYLOAD + OFFSET_COMMAND_ID] = command;
-                    canDeviceToHost[OFFSET_PAYLOAD + OFFSET_MSGID] =
-                            (uint8_t)(rxElement.header.Identifier & 0xFF);
-                    canDeviceToHost[OFFSET_PAYLOAD + OFFSET_MSGID + 1] =
-                            (uint8_t)((rxElement.header.Identifier >> 8) & 0xFF);
-                    canDeviceToHost[OFFSET_PAYLOAD + OFFSET_MSGID + 2] =
-                            (uint8_t)((rxElement.header.Identifier >> 16) & 0xFF);
-                    canDeviceToHost[OFFSET_PAYLOAD + OFFSET_MSGID + 3] =
-                            (uint8_t)((rxElement.header.Identifier >> 24) & 0xFF);
-                    canDeviceToHost[OFFSET_PAYLOAD + OFFSET_DLC] = dlc;
-                    for(idx = 0; idx < (multiplePacket ? maxpayload : dlc); idx++) {
-                        canDeviceToHost[OFFSET_PAYLOAD + OFFSET_DATA + idx] =
-                                rxElement.data[idx];
-                    }
-                    // <-- Payload
-                    checksum = 0;
-                    for(idx = 0; idx < (frameSize - 1); idx++) {
-                        checksum += canDeviceToHost[idx + OFFSET_TAG_SOF];
-                    }
-                    canDeviceToHost[frameSize] = (uint8_t)((~checksum) + 1);
-
-                    // Send to WebUSB queue
-                    if(webusb_sendEp(&canDeviceToHost[0])) {
-                        if(multiplePacket) {
-                            /*
-                             * Second Packet
-                             */
-                            /// TODO
-                        }
-                    } else {
-                        /// TODO: handle error
-                    }
-                }
-            }
+            can_process(notifyValue);
         }
     }
 }
+#endif
+
 
 /*
  * NOTE: This called from the interrupt
  */
-void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs)
+static CCM_CODE void can_notify_from_isr(uint32_t events, BaseType_t * pxHigherPriorityTaskWoken)
+{
+#if CONFIG_USB_CAN_REACTOR
+    bool idle;
+    UBaseType_t savedMask = taskENTER_CRITICAL_FROM_ISR();
+    idle = (reactorEvents == 0);
+    reactorEvents |= events;
+    taskEXIT_CRITICAL_FROM_ISR(savedMask);
+    /* Only one deferred call is outstanding; later events ride along with it */
+    if(idle) {
+        webusb_reactor_defer(can_reactor_cb, NULL, true);
+    }
+    (void)pxHigherPriorityTaskWoken;
+#else
+    xTaskNotifyFromISR(canTask, events, eSetBits, pxHigherPriorityTaskWoken);
+#endif
+}
+
+/*
+ * Runs the defer handler in CAN processing context, from any task
+ */
+void CAN_defer(void)
 {
-    rx_queue_element_t rxElement = {0};
+#if CONFIG_USB_CAN_REACTOR
+    bool idle;
+    taskENTER_CRITICAL();
+    idle = (reactorEvents == 0);
+    reactorEvents |= CAN_DEFER_BIT;
+    taskEXIT_CRITICAL();
+    if(idle) {
+        webusb_reactor_defer(can_reactor_cb, NULL, false);
+    }
+#else
+    xTaskNotify(canTask, CAN_DEFER_BIT, eSetBits);
+#endif
+}
+
+/*
+ * NOTE: This called from the interrupt
+ */
+CCM_CODE void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs)
+{
+    can_frame_t frame;
+    bool received = false;
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
 
     if((RxFifo0ITs & FDCAN_IT_RX_FIFO0_NEW_MESSAGE) != RESET) {
-        /* Retrieve Rx messages from RX FIFO0 */
-        if(HAL_OK == HAL_FDCAN_GetRxMessage(hfdcan, FDCAN_RX_FIFO0, &(rxElement.header), &(rxElement.data[0]))) {
-            xQueueSendFromISR(canRxQHandle, &rxElement, &xHigherPriorityTaskWoken);
-            xTaskNotifyFromISR(canTask, CAN_RX_BIT, eSetBits, &xHigherPriorityTaskWoken);
+        /* Drain RX FIFO0, frames that arrived together share the timestamp */
+        frame.timestamp = board_timestamp_us();
+        while(fdcan_ram_read_rx0(hfdcan->Instance, CAN_MESSAGE_RAM, &frame)) {
+            /* A full queue drops the frame, the handler sees the sequence gap */
+            frame.sequence = rxSequence++;
+            (void)xQueueSendFromISR(canRxQHandle, &frame, &xHigherPriorityTaskWoken);
+            LATENCY_PROBE_RX_QUEUED(frame.sequence);
+            STATS_INC(canRxFrames);
+            STATS_ADD(canRxBytes, frame.len);
+            STATS_ADD(canRxBusUs, can_bus_time_us(&rxBusRemainder, can_frame_clocks(frame.flags, frame.len)));
+            STATS_MAX(hwmCanRxQueue, uxQueueMessagesWaitingFromISR(canRxQHandle));
+            received = true;
+        }
+        if(received) {
+            can_notify_from_isr(CAN_RX_BIT, &xHigherPriorityTaskWoken);
         }
     }
+    if((RxFifo0ITs & FDCAN_IT_RX_FIFO0_MESSAGE_LOST) != RESET) {
+        rxFifoLost++;
+    }
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
@@ -318,26 +433,53 @@ void HAL_FDCAN_RxFifo0Callback(FDCAN_HandleTypeDef *hfdcan, uint32_t RxFifo0ITs)
 void HAL_FDCAN_TxFifoEmptyCallback(FDCAN_HandleTypeDef *hfdcan)
 {
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    xTaskNotifyFromISR(canTask, CAN_TX_BIT, eSetBits, &xHigherPriorityTaskWoken);
+    can_notify_from_isr(CAN_TX_BIT, &xHigherPriorityTaskWoken);
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
 }
 
+/*
+ * NOTE: This called from the interrupt, on entering or leaving error
+ *       warning, error passive or bus off
+ */
+void HAL_FDCAN_ErrorStatusCallback(FDCAN_HandleTypeDef *hfdcan, uint32_t ErrorStatusITs)
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    can_notify_from_isr(CAN_STATUS_BIT, &xHigherPriorityTaskWoken);
+    portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+}
 
-bool CAN_configure(ARBIT_BITRATE_T arb_bps, DATA_BITRATE_T dat_bps)
+
+static bool can_apply_timing(can_timing_t const * pNominal, can_timing_t const * pData)
 {
     if(HAL_FDCAN_GetState(&hfdcan1) != HAL_FDCAN_STATE_READY) {
         return false;
     }
 
-    hfdcan1.Init.NominalPrescaler = DEFAULT_ARBITRATION_TIMING[arb_bps].prescaler;
-    hfdcan1.Init.NominalSyncJumpWidth = DEFAULT_ARBITRATION_TIMING[arb_bps].sjw;
-    hfdcan1.Init.NominalTimeSeg1 = DEFAULT_ARBITRATION_TIMING[arb_bps].tseg1;
-    hfdcan1.Init.NominalTimeSeg2 = DEFAULT_ARBITRATION_TIMING[arb_bps].tseg2;
-    hfdcan1.Init.DataPrescaler = DEFAULT_DATA_TIMING[dat_bps].prescaler;
-    hfdcan1.Init.DataSyncJumpWidth = DEFAULT_DATA_TIMING[dat_bps].sjw;
-    hfdcan1.Init.DataTimeSeg1 = DEFAULT_DATA_TIMING[dat_bps].tseg1;
-    hfdcan1.Init.DataTimeSeg2 = DEFAULT_DATA_TIMING[dat_bps].tseg2;
-    if(HAL_FDCAN_Init(&hfdcan1) != HAL_OK) {
+    hfdcan1.Init.NominalPrescaler = pNominal->prescaler;
+    hfdcan1.Init.NominalSyncJumpWidth = pNominal->sjw;
+    hfdcan1.Init.NominalTimeSeg1 = pNominal->tseg1;
+    hfdcan1.Init.NominalTimeSeg2 = pNominal->tseg2;
+    hfdcan1.Init.DataPrescaler = pData->prescaler;
+    hfdcan1.Init.DataSyncJumpWidth = pData->sjw;
+    hfdcan1.Init.DataTimeSeg1 = pData->tseg1;
+    hfdcan1.Init.DataTimeSeg2 = pData->tseg2;
+    nominalBitClocks = pNominal->prescaler * (1 + pNominal->tseg1 + pNominal->tseg2);
+    dataBitClocks = pData->prescaler * (1 + pData->tseg1 + pData->tseg2);
+
+    return (HAL_FDCAN_Init(&hfdcan1) == HAL_OK);
+}
+
+
+bool CAN_configure(ARBIT_BITRATE_T arb_bps, DATA_BITRATE_T dat_bps)
+{
+    if((arb_bps >= N_SUPPORTED_ARBIT_BITRATE) || (dat_bps >= N_SUPPORTED_DATA_BITRATE)) {
+        return false;
+    }
+
+    hfdcan1.Init.FrameFormat = FDCAN_FRAME_FD_NO_BRS;
+    hfdcan1.Init.Mode = FDCAN_MODE_NORMAL;
+    hfdcan1.Init.AutoRetransmission = DISABLE;
+    if(!can_apply_timing(&DEFAULT_ARBITRATION_TIMING[arb_bps], &DEFAULT_DATA_TIMING[dat_bps])) {
         return false;
     }
     arbit_bps = arb_bps;
@@ -346,13 +488,63 @@ bool CAN_configure(ARBIT_BITRATE_T arb_bps, DATA_BITRATE_T dat_bps)
     return true;
 }
 
+
+bool CAN_configure_timing(can_timing_t const * pNominal, can_timing_t const * pData, uint32_t mode)
+{
+    if((mode & CAN_MODE_LOOPBACK) != 0) {
+        hfdcan1.Init.Mode = FDCAN_MODE_INTERNAL_LOOPBACK;
+    } else if((mode & CAN_MODE_LISTEN_ONLY) != 0) {
+        hfdcan1.Init.Mode = FDCAN_MODE_BUS_MONITORING;
+    } else {
+        hfdcan1.Init.Mode = FDCAN_MODE_NORMAL;
+    }
+    hfdcan1.Init.AutoRetransmission = ((mode & CAN_MODE_ONE_SHOT) != 0) ? DISABLE : ENABLE;
+    hfdcan1.Init.FrameFormat = ((mode & CAN_MODE_FD) != 0) ? FDCAN_FRAME_FD_BRS : FDCAN_FRAME_CLASSIC;
+
+    return can_apply_timing(pNominal, pData);
+}
+
+/*
+ * CAN is stopped, so only a producer between CAN_tx_claim() and
+ * CAN_tx_commit() still holds a buffer.  Checked with the scheduler
+ * suspended, see buffer_arena_apply().
+ */
+bool CAN_buffers_idle(void)
+{
+    return !bTxClaimed;
+}
+
+
+void CAN_set_buffers(tx_queue_element_t * pTxRing, uint32_t txLength, uint8_t * pRxStorage, uint32_t rxLength)
+{
+    if(canRxQHandle != NULL) {
+        vQueueDelete(canRxQHandle);
+    }
+    canRxQHandle = xQueueCreateStatic(
+                                rxLength,
+                                CAN_RX_ELEMENT_SZ,
+                                pRxStorage,
+                                &canRxStaticQueue);
+    ASSERT_ME(canRxQHandle != NULL);
+
+    canTxRing = pTxRing;
+    canTxLength = txLength;
+    canTxHead = 0;
+    canTxTail = 0;
+    txInProgress = false;
+}
+
+
 bool CAN_start(void)
 {
+    /* A newly selected buffer split takes effect here */
+    buffer_arena_apply();
+
     if(HAL_FDCAN_Start(&hfdcan1) != HAL_OK) {
         return false;
     }
 
-    if(HAL_FDCAN_ActivateNotification(&hfdcan1, FDCAN_IT_RX_FIFO0_NEW_MESSAGE | FDCAN_IT_TX_FIFO_EMPTY, FDCAN_TX_BUFFER0) != HAL_OK) {
+    if(HAL_FDCAN_ActivateNotification(&hfdcan1, CAN_RX_ITS | FDCAN_IT_TX_FIFO_EMPTY | CAN_STATUS_ITS, FDCAN_TX_BUFFER0) != HAL_OK) {
         return false;
     }
 
@@ -365,7 +557,7 @@ bool CAN_stop(void)
 {
     NVIC_DisableIRQ(FDCAN1_IT0_IRQn);
 
-    if(HAL_FDCAN_DeactivateNotification(&hfdcan1, FDCAN_IT_RX_FIFO0_NEW_MESSAGE) != HAL_OK) {
+    if(HAL_FDCAN_DeactivateNotification(&hfdcan1, CAN_RX_ITS | CAN_STATUS_ITS) != HAL_OK) {
         return false;
     }
 
@@ -373,18 +565,114 @@ bool CAN_stop(void)
         return false;
     }
 
+    /* A buffer split selected while running can be saved now */
+    buffer_arena_save();
+
     return true;
 }
 
-bool CAN_send(tx_queue_element_t * pElem)
+tx_queue_element_t * CAN_tx_claim(void)
 {
-    if(pdTRUE != xQueueSend(canTxQHandle, pElem, 0)) {
-        return false;
+    /* Before the ring is looked at, so a re-carve waits for the commit */
+    bTxClaimed = true;
+    if((canTxHead - canTxTail) >= canTxLength) {
+        bTxClaimed = false;
+        return NULL;
     }
+
+    return &canTxRing[canTxHead & (canTxLength - 1)];
+}
+
+void CAN_tx_commit(void)
+{
+    /* Element contents before the index */
+    __DMB();
+    LATENCY_PROBE_TX_QUEUED(canTxHead);
+    canTxHead++;
+    STATS_MAX(hwmCanTxRing, canTxHead - canTxTail);
+    bTxClaimed = false;
+
     if(!txInProgress){
+#if CONFIG_USB_CAN_REACTOR
+        /* Already on the reactor task, so start the transfer in place */
+        can_process(CAN_TX_BIT);
+#else
         xTaskNotify(canTask, CAN_TX_BIT, eSetBits);
+#endif
     }
+}
+
+void CAN_get_status(can_status_t * pStatus)
+{
+    FDCAN_ErrorCountersTypeDef errorCounters = {0};
+    FDCAN_ProtocolStatusTypeDef protocolStatus = {0};
+
+    HAL_FDCAN_GetErrorCounters(&hfdcan1, &errorCounters);
+    HAL_FDCAN_GetProtocolStatus(&hfdcan1, &protocolStatus);
+
+    pStatus->started = (HAL_FDCAN_GetState(&hfdcan1) == HAL_FDCAN_STATE_BUSY);
+    pStatus->txErrorCount = (uint8_t)errorCounters.TxErrorCnt;
+    pStatus->rxErrorCount = (uint8_t)errorCounters.RxErrorCnt;
+    if(protocolStatus.BusOff != 0) {
+        pStatus->busState = CAN_BUS_OFF;
+    } else if(protocolStatus.ErrorPassive != 0) {
+        pStatus->busState = CAN_BUS_ERROR_PASSIVE;
+    } else if(protocolStatus.Warning != 0) {
+        pStatus->busState = CAN_BUS_ERROR_WARNING;
+    } else {
+        pStatus->busState = CAN_BUS_ERROR_ACTIVE;
+    }
+}
+
+
+uint32_t CAN_get_rx_lost(void)
+{
+    return rxFifoLost;
+}
+
+
+bool CAN_send_frame(can_frame_t const * pFrame, uint32_t tag)
+{
+    tx_queue_element_t * pElem;
+
+    if(pFrame->len > CAN_MAX_DATA_LENGTH) {
+        return false;
+    }
+    pElem = CAN_tx_claim();
+    if(pElem == NULL) {
+        return false;
+    }
+
+    pElem->word0 = fdcan_elem_word0(pFrame->id, pFrame->flags);
+    pElem->word1 = fdcan_elem_word1(pFrame->len, pFrame->flags);
+    pElem->tag = tag;
+    memcpy(pElem->data, pFrame->data, pFrame->len);
+
+    CAN_tx_commit();
 
     return true;
 }
 
+
+void CAN_set_defer_handler(can_defer_handler_t handler)
+{
+    deferHandler = handler;
+}
+
+
+void CAN_set_rx_handler(can_rx_handler_t handler)
+{
+    rxHandler = handler;
+}
+
+
+void CAN_set_tx_handler(can_tx_handler_t handler)
+{
+    txHandler = handler;
+}
+
+
+void CAN_set_status_handler(can_status_handler_t handler)
+{
+    statusHandler = handler;
+}
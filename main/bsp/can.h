@@ -7,6 +7,15 @@
 #define CAN_H
 
 #include "stm32g4xx_hal.h"
+#include "can_types.h"
+#include "fdcanRam.h"
+
+/* CAN_configure_timing() mode flags */
+#define CAN_MODE_NORMAL                 (0x00)
+#define CAN_MODE_LISTEN_ONLY            (0x01)
+#define CAN_MODE_LOOPBACK               (0x02)
+#define CAN_MODE_ONE_SHOT               (0x04)  //!< no automatic retransmission
+#define CAN_MODE_FD                     (0x08)  //!< CAN FD with bit rate switching
 
 typedef enum {
     ARBIT_500KHZ = 0,
@@ -21,16 +30,76 @@ typedef enum {
 } DATA_BITRATE_T;
 
 typedef struct {
-    FDCAN_TxHeaderTypeDef header;
+    uint32_t word0;     // TX element T0, see fdcan_elem_word0()
+    uint32_t word1;     // TX element T1, see fdcan_elem_word1()
+    uint32_t tag;       // opaque to the driver, handed back to the TX handler
     uint8_t data[64];   // max CAN-FD payload size
 } tx_queue_element_t;
 
+/*
+ * Called from CAN processing context for every received frame, more is
+ * set while further frames are already queued (lets encoders batch)
+ */
+typedef void (* can_rx_handler_t)(can_frame_t const * pFrame, bool more);
+/* Called from CAN processing context once a frame is queued to the TX FIFO */
+typedef void (* can_tx_handler_t)(tx_queue_element_t const * pElem);
+
+typedef enum {
+    CAN_BUS_ERROR_ACTIVE = 0,
+    CAN_BUS_ERROR_WARNING,
+    CAN_BUS_ERROR_PASSIVE,
+    CAN_BUS_OFF
+} CAN_BUS_STATE_T;
+
+typedef struct {
+    bool started;
+    CAN_BUS_STATE_T busState;
+    uint8_t txErrorCount;
+    uint8_t rxErrorCount;
+} can_status_t;
+
+/* Called from CAN processing context when the bus error state changes */
+typedef void (* can_status_handler_t)(can_status_t const * pStatus);
+/* Called from CAN processing context after CAN_defer() */
+typedef void (* can_defer_handler_t)(void);
+
 
 void CAN_init(void);
 bool CAN_configure(ARBIT_BITRATE_T arb_bps, DATA_BITRATE_T dat_bps);
+bool CAN_configure_timing(can_timing_t const * pNominal, can_timing_t const * pData, uint32_t mode);
 bool CAN_start(void);
 bool CAN_stop(void);
-bool CAN_send(tx_queue_element_t * pElem);
+/*
+ * Builds a TX element in place: CAN_tx_claim() returns a free slot, or NULL
+ * when the ring is full, and must be followed by CAN_tx_commit() on the
+ * same task.  Lock free, for a single producer context: callers on more
+ * than one task serialize themselves.
+ */
+tx_queue_element_t * CAN_tx_claim(void);
+void CAN_tx_commit(void);
+bool CAN_send_frame(can_frame_t const * pFrame, uint32_t tag);
+void CAN_set_rx_handler(can_rx_handler_t handler);
+void CAN_set_tx_handler(can_tx_handler_t handler);
+void CAN_set_status_handler(can_status_handler_t handler);
+void CAN_set_defer_handler(can_defer_handler_t handler);
+void CAN_defer(void);
+/* CONFIG_USB_CAN_REACTOR: reactor loop, after every tud_task() return */
+void CAN_reactor_poll(void);
+void CAN_get_status(can_status_t * pStatus);
+/*
+ * Every frame read from the RX FIFO takes the next can_frame_t sequence, so
+ * frames dropped between the FIFO and the RX handler show as a gap.  Frames
+ * the FIFO itself lost never get a sequence; this counts the overruns, each
+ * one or more frames.
+ */
+uint32_t CAN_get_rx_lost(void);
+/*
+ * Buffers from the buffer arena.  txLength is a power of two, rxLength is
+ * in can_frame_t.  Queued frames are dropped.  CAN must be stopped.
+ */
+void CAN_set_buffers(tx_queue_element_t * pTxRing, uint32_t txLength, uint8_t * pRxStorage, uint32_t rxLength);
+/* No TX element is being built, see CAN_tx_claim() */
+bool CAN_buffers_idle(void);
 
 
 #endif /* CAN_H */
@@ -0,0 +1,61 @@
+/*!
+ * \file can_types.h
+ *
+ * Hardware independent CAN types shared by the CAN driver and the USB
+ * protocol encoders.  Keep this header free of HAL/RTOS includes so the
+ * encoders can be built on a host.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef CAN_TYPES_H
+#define CAN_TYPES_H
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#define CAN_MAX_DATA_LENGTH             (64)
+
+/* can_frame_t flags */
+#define CAN_FRAME_FLAG_EXTENDED         (0x01)  //!< 29-bit identifier
+#define CAN_FRAME_FLAG_FD               (0x02)  //!< CAN FD frame
+#define CAN_FRAME_FLAG_BRS              (0x04)  //!< CAN FD bit rate switch
+#define CAN_FRAME_FLAG_ESI              (0x08)  //!< CAN FD error state indicator
+#define CAN_FRAME_FLAG_RTR              (0x10)  //!< Classic CAN remote frame
+
+typedef struct {
+    uint32_t id;            //!< 11-bit or 29-bit identifier, no flag bits
+    uint32_t timestamp;     //!< microseconds, board_timestamp_us() time base
+    uint32_t sequence;      //!< received frames: RX FIFO read order, see CAN_get_rx_lost()
+    uint8_t flags;          //!< CAN_FRAME_FLAG_*
+    uint8_t len;            //!< payload length in bytes
+    uint8_t data[CAN_MAX_DATA_LENGTH];
+} can_frame_t;
+
+typedef struct {
+    uint32_t prescaler;
+    uint32_t sjw;
+    uint32_t tseg1;
+    uint32_t tseg2;
+} can_timing_t;
+
+static inline uint8_t can_dlc_to_len(uint8_t dlc)
+{
+    static const uint8_t DLCtoBytes[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+    return DLCtoBytes[dlc & 0x0F];
+}
+
+static inline uint8_t can_len_to_dlc(uint8_t len)
+{
+    if(len <= 8) {
+        return len;
+    } else if(len <= 24) {
+        return (uint8_t)(8 + ((len - 8 + 3) / 4));
+    } else if(len <= 32) {
+        return 13;
+    } else if(len <= 48) {
+        return 14;
+    }
+    return 15;
+}
+
+#endif /* CAN_TYPES_H */
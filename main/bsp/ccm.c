@@ -0,0 +1,26 @@
+/*!
+ * \file ccm.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "stdint.h"
+#include "string.h"
+#include "stm32g4xx_hal.h"
+#include "ccm.h"
+
+/* STM32G431C8TX_FLASH.ld, the startup code leaves both sections alone */
+extern uint32_t _siccmsram;
+extern uint32_t _sccmsram;
+extern uint32_t _eccmsram;
+extern uint32_t _sccmbss;
+extern uint32_t _eccmbss;
+
+
+void CCM_init(void)
+{
+    memcpy(&_sccmsram, &_siccmsram, (size_t)((uint8_t *)&_eccmsram - (uint8_t *)&_sccmsram));
+    memset(&_sccmbss, 0, (size_t)((uint8_t *)&_eccmbss - (uint8_t *)&_sccmbss));
+    /* Code was written through the data bus, fetch it fresh */
+    __DSB();
+    __ISB();
+}
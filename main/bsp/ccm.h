@@ -0,0 +1,31 @@
+/*!
+ * \file ccm.h
+ *
+ * CCM SRAM placement.  Flash runs with 4 wait states at 168 MHz, the ART
+ * cache hides most of them but not on a miss, while CCM SRAM is zero wait
+ * on both the instruction and data bus.
+ *
+ *    CCM_CODE : function copied to CCM SRAM by CCM_init()
+ *    CCM_BSS  : zero initialized data in CCM SRAM, not DMA capable
+ *
+ * Calls between CCM SRAM and flash go through linker veneers, so keep
+ * CCM_CODE to whole hot paths rather than single helpers.  On a host build
+ * both expand to nothing.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef CCM_H
+#define CCM_H
+
+#if defined(__arm__)
+#define CCM_CODE                        __attribute__ ((section(".ccmsram.text")))
+#define CCM_BSS                         __attribute__ ((section(".ccmbss")))
+#else
+#define CCM_CODE
+#define CCM_BSS
+#endif
+
+/* Loads .ccmsram from flash and clears .ccmbss, first thing in board_init() */
+void CCM_init(void);
+
+#endif /* CCM_H */
@@ -0,0 +1,75 @@
+/*!
+ * \file crc.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "stm32g4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "crc.h"
+#include "ccm.h"
+
+#define CRC16_POLYNOMIAL                (0x1021UL)
+#define CRC32_POLYNOMIAL                (0x04C11DB7UL)
+
+
+void CRC_init(void)
+{
+    __HAL_RCC_CRC_CLK_ENABLE();
+}
+
+
+/*
+ * Without input reversal the unit takes a word write from bit 31 down, so
+ * bytes go in most significant first and little endian words are swapped.
+ */
+static CCM_CODE void CRC_feed(uint8_t const * pBuf, uint32_t length)
+{
+    uint32_t word;
+
+    while(length >= 4) {
+        memcpy(&word, pBuf, sizeof(word));
+        CRC->DR = __REV(word);
+        pBuf += 4;
+        length -= 4;
+    }
+    while(length > 0) {
+        *((__IO uint8_t *)&CRC->DR) = *pBuf++;
+        length--;
+    }
+}
+
+
+/*
+ * Frames are short, a whole command frame takes a few hundred cycles, so
+ * the unit is held in a critical section rather than behind a mutex.
+ * DMA set up and completion would cost more than feeding it directly.
+ */
+static CCM_CODE uint32_t CRC_run(uint32_t polySize, uint32_t polynomial, uint32_t crc,
+                                 uint8_t const * pBuf, uint32_t length)
+{
+    uint32_t result;
+
+    taskENTER_CRITICAL();
+    CRC->POL = polynomial;
+    CRC->INIT = crc;
+    CRC->CR = polySize | CRC_CR_RESET;  // loads INIT
+    CRC_feed(pBuf, length);
+    result = CRC->DR;
+    taskEXIT_CRITICAL();
+
+    return result;
+}
+
+
+CCM_CODE uint16_t CRC_update16(uint16_t crc, uint8_t const * pBuf, uint32_t length)
+{
+    return (uint16_t)CRC_run(CRC_CR_POLYSIZE_0, CRC16_POLYNOMIAL, crc, pBuf, length);
+}
+
+
+CCM_CODE uint32_t CRC_update32(uint32_t crc, uint8_t const * pBuf, uint32_t length)
+{
+    return CRC_run(0, CRC32_POLYNOMIAL, crc, pBuf, length);
+}
@@ -0,0 +1,25 @@
+/*!
+ * \file crc.h
+ *
+ * CRC calculation unit.  Both CRCs are MSB first with no final XOR, so
+ * appending the CRC most significant byte first makes the CRC over the
+ * whole message 0.
+ *    CRC-16 : CRC-16/CCITT-FALSE, polynomial 0x1021, init 0xFFFF
+ *    CRC-32 : CRC-32/MPEG-2, polynomial 0x04C11DB7, init 0xFFFFFFFF
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef CRC_H
+#define CRC_H
+
+#include "stdint.h"
+
+#define CRC16_INIT_VALUE                (0xFFFFU)
+#define CRC32_INIT_VALUE                (0xFFFFFFFFUL)
+
+void CRC_init(void);
+/* Continues crc over pBuf, task context only */
+uint16_t CRC_update16(uint16_t crc, uint8_t const * pBuf, uint32_t length);
+uint32_t CRC_update32(uint32_t crc, uint8_t const * pBuf, uint32_t length);
+
+#endif /* CRC_H */
@@ -0,0 +1,74 @@
+/*!
+ * \file fdcanRam.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "fdcanRam.h"
+#include "ccm.h"
+
+
+/*
+ * Message RAM takes word accesses only for the data too, the frame side
+ * is unaligned (can_frame_t data) and goes through memcpy, which the
+ * compiler turns into single unaligned loads and stores.
+ */
+CCM_CODE bool fdcan_ram_read_rx0(FDCAN_GlobalTypeDef * pRegs, uint32_t const volatile * pRam, can_frame_t * pFrame)
+{
+    const uint32_t status = pRegs->RXF0S;
+    uint32_t const volatile * pElem;
+    uint32_t index;
+    uint32_t word0;
+    uint32_t word1;
+    uint32_t word;
+
+    if((status & FDCAN_RXF0S_F0FL) == 0) {
+        return false;
+    }
+    index = (status & FDCAN_RXF0S_F0GI) >> FDCAN_RXF0S_F0GI_Pos;
+    pElem = pRam + FDCAN_RAM_RX_FIFO0_OFFSET + (index * FDCAN_RAM_ELEMENT_WORDS);
+
+    word0 = pElem[0];
+    word1 = pElem[1];
+    pFrame->id = fdcan_elem_id(word0);
+    pFrame->flags = fdcan_elem_flags(word0, word1);
+    pFrame->len = fdcan_elem_len(word1);
+    for(uint32_t i = 0; (4 * i) < pFrame->len; i++) {
+        word = pElem[2 + i];
+        memcpy(&pFrame->data[4 * i], &word, sizeof(word));
+    }
+
+    /* Frees the element */
+    pRegs->RXF0A = index;
+
+    return true;
+}
+
+
+bool fdcan_ram_write_tx(FDCAN_GlobalTypeDef * pRegs, uint32_t volatile * pRam,
+                        uint32_t word0, uint32_t word1, uint8_t const * pData)
+{
+    const uint32_t status = pRegs->TXFQS;
+    const uint8_t len = fdcan_elem_len(word1);
+    uint32_t volatile * pElem;
+    uint32_t index;
+    uint32_t word;
+
+    if((status & FDCAN_TXFQS_TFQF) != 0) {
+        return false;
+    }
+    index = (status & FDCAN_TXFQS_TFQPI) >> FDCAN_TXFQS_TFQPI_Pos;
+    pElem = pRam + FDCAN_RAM_TX_FIFO_OFFSET + (index * FDCAN_RAM_ELEMENT_WORDS);
+
+    pElem[0] = word0;
+    pElem[1] = word1;
+    for(uint32_t i = 0; (4 * i) < len; i++) {
+        word = 0;
+        memcpy(&word, &pData[4 * i], ((len - (4 * i)) < 4) ? (len - (4 * i)) : 4);
+        pElem[2 + i] = word;
+    }
+
+    pRegs->TXBAR = (1UL << index);
+
+    return true;
+}
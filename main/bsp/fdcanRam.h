@@ -0,0 +1,112 @@
+/*!
+ * \file fdcanRam.h
+ *
+ * Register level access to the FDCAN message RAM for the RX FIFO 0 and
+ * TX FIFO hot path.  HAL still does initialization, filters and
+ * interrupts; elements are read and written here a word at a time, with
+ * the header kept in the element's own T0/T1 layout end to end.
+ *
+ * Registers and message RAM are parameters, so the driver also runs on a
+ * host against a simulated message RAM.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef FDCAN_RAM_H
+#define FDCAN_RAM_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "stm32g4xx_hal.h"
+#include "can_types.h"
+
+/* Fixed layout of one FDCAN instance (RM0440, message RAM), in words */
+#define FDCAN_RAM_RX_FIFO0_OFFSET       (0x0B0U / 4U)
+#define FDCAN_RAM_TX_FIFO_OFFSET        (0x278U / 4U)
+#define FDCAN_RAM_ELEMENT_WORDS         (18U)
+#define FDCAN_RAM_SIZE_WORDS            (0x350U / 4U)
+
+/* Element header, the same bits in RX R0/R1 and TX T0/T1 */
+#define FDCAN_ELEM_ESI                  (0x80000000UL)  // word 0
+#define FDCAN_ELEM_XTD                  (0x40000000UL)
+#define FDCAN_ELEM_RTR                  (0x20000000UL)
+#define FDCAN_ELEM_EXT_ID_MASK          (0x1FFFFFFFUL)
+#define FDCAN_ELEM_STD_ID_SHIFT         (18U)
+#define FDCAN_ELEM_STD_ID_MASK          (0x7FFUL)
+#define FDCAN_ELEM_FDF                  (0x00200000UL)  // word 1
+#define FDCAN_ELEM_BRS                  (0x00100000UL)
+#define FDCAN_ELEM_DLC_SHIFT            (16U)
+#define FDCAN_ELEM_DLC_MASK             (0xFUL)
+
+static inline uint32_t fdcan_elem_word0(uint32_t id, uint8_t flags)
+{
+    uint32_t word = ((flags & CAN_FRAME_FLAG_EXTENDED) != 0) ?
+                    (FDCAN_ELEM_XTD | (id & FDCAN_ELEM_EXT_ID_MASK)) :
+                    ((id & FDCAN_ELEM_STD_ID_MASK) << FDCAN_ELEM_STD_ID_SHIFT);
+
+    if((flags & CAN_FRAME_FLAG_ESI) != 0) {
+        word |= FDCAN_ELEM_ESI;
+    }
+    if(((flags & CAN_FRAME_FLAG_RTR) != 0) && ((flags & CAN_FRAME_FLAG_FD) == 0)) {
+        word |= FDCAN_ELEM_RTR;
+    }
+    return word;
+}
+
+/* TX word 1: no TX event, message marker 0 */
+static inline uint32_t fdcan_elem_word1(uint8_t len, uint8_t flags)
+{
+    uint32_t word = (uint32_t)can_len_to_dlc(len) << FDCAN_ELEM_DLC_SHIFT;
+
+    if((flags & CAN_FRAME_FLAG_FD) != 0) {
+        word |= FDCAN_ELEM_FDF;
+        if((flags & CAN_FRAME_FLAG_BRS) != 0) {
+            word |= FDCAN_ELEM_BRS;
+        }
+    }
+    return word;
+}
+
+static inline uint32_t fdcan_elem_id(uint32_t word0)
+{
+    return ((word0 & FDCAN_ELEM_XTD) != 0) ?
+           (word0 & FDCAN_ELEM_EXT_ID_MASK) :
+           ((word0 >> FDCAN_ELEM_STD_ID_SHIFT) & FDCAN_ELEM_STD_ID_MASK);
+}
+
+static inline uint8_t fdcan_elem_len(uint32_t word1)
+{
+    return can_dlc_to_len((uint8_t)((word1 >> FDCAN_ELEM_DLC_SHIFT) & FDCAN_ELEM_DLC_MASK));
+}
+
+/* CAN_FRAME_FLAG_* of an element header */
+static inline uint8_t fdcan_elem_flags(uint32_t word0, uint32_t word1)
+{
+    uint8_t flags = ((word0 & FDCAN_ELEM_XTD) != 0) ? CAN_FRAME_FLAG_EXTENDED : 0;
+
+    if((word1 & FDCAN_ELEM_FDF) != 0) {
+        flags |= CAN_FRAME_FLAG_FD;
+        if((word1 & FDCAN_ELEM_BRS) != 0) {
+            flags |= CAN_FRAME_FLAG_BRS;
+        }
+        if((word0 & FDCAN_ELEM_ESI) != 0) {
+            flags |= CAN_FRAME_FLAG_ESI;
+        }
+    } else if((word0 & FDCAN_ELEM_RTR) != 0) {
+        flags |= CAN_FRAME_FLAG_RTR;
+    }
+    return flags;
+}
+
+/*
+ * Takes the oldest element of RX FIFO 0 into pFrame, id, flags, len and
+ * data only.  False when the FIFO is empty.
+ */
+bool fdcan_ram_read_rx0(FDCAN_GlobalTypeDef * pRegs, uint32_t const volatile * pRam, can_frame_t * pFrame);
+/*
+ * Puts an element in the TX FIFO and requests its transmission, pData
+ * holds the bytes of the DLC in word1.  False when the FIFO is full.
+ */
+bool fdcan_ram_write_tx(FDCAN_GlobalTypeDef * pRegs, uint32_t volatile * pRam,
+                        uint32_t word0, uint32_t word1, uint8_t const * pData);
+
+#endif /* FDCAN_RAM_H */
@@ -0,0 +1,84 @@
+/*!
+ * \file settings.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "stddef.h"
+#include "string.h"
+#include "stm32g4xx_hal.h"
+#include "crc.h"
+#include "settings.h"
+
+/* Last 2 KB page, kept out of FLASH by STM32G431C8TX_FLASH.ld */
+#define SETTINGS_PAGE                   (31)
+#define SETTINGS_ADDRESS                (FLASH_BASE + (SETTINGS_PAGE * FLASH_PAGE_SIZE))
+#define SETTINGS_MAGIC                  (0x53455454UL)  // "SETT"
+
+/* Programmed a double word at a time */
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+    uint8_t data[SETTINGS_MAX_SIZE];
+    uint32_t crc;           // CRC-32 over the fields above
+    uint32_t reserved;
+} settings_record_t;
+
+_Static_assert((sizeof(settings_record_t) % 8) == 0, "settings_record_t is programmed in double words");
+
+
+static uint32_t SETTINGS_crc(settings_record_t const * pRecord)
+{
+    return CRC_update32(CRC32_INIT_VALUE, (uint8_t const *)pRecord, offsetof(settings_record_t, crc));
+}
+
+
+bool SETTINGS_load(void * pData, uint32_t size)
+{
+    settings_record_t const * pRecord = (settings_record_t const *)SETTINGS_ADDRESS;
+
+    if((pRecord->magic != SETTINGS_MAGIC) || (pRecord->size != size) ||
+       (size > SETTINGS_MAX_SIZE) || (pRecord->crc != SETTINGS_crc(pRecord))) {
+        return false;
+    }
+    memcpy(pData, pRecord->data, size);
+
+    return true;
+}
+
+
+bool SETTINGS_save(void const * pData, uint32_t size)
+{
+    settings_record_t record;
+    FLASH_EraseInitTypeDef erase;
+    uint32_t pageError = 0;
+    uint64_t doubleWord;
+    bool ret = true;
+
+    if(size > SETTINGS_MAX_SIZE) {
+        return false;
+    }
+    memset(&record, 0xFF, sizeof(record));
+    record.magic = SETTINGS_MAGIC;
+    record.size = size;
+    memcpy(record.data, pData, size);
+    record.crc = SETTINGS_crc(&record);
+    if(memcmp(&record, (void const *)SETTINGS_ADDRESS, sizeof(record)) == 0) {
+        return true;
+    }
+
+    erase.TypeErase = FLASH_TYPEERASE_PAGES;
+    erase.Banks = FLASH_BANK_1;
+    erase.Page = SETTINGS_PAGE;
+    erase.NbPages = 1;
+    HAL_FLASH_Unlock();
+    if(HAL_FLASHEx_Erase(&erase, &pageError) != HAL_OK) {
+        ret = false;
+    }
+    for(uint32_t offset = 0; ret && (offset < sizeof(record)); offset += sizeof(doubleWord)) {
+        memcpy(&doubleWord, (uint8_t const *)&record + offset, sizeof(doubleWord));
+        ret = (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, SETTINGS_ADDRESS + offset, doubleWord) == HAL_OK);
+    }
+    HAL_FLASH_Lock();
+
+    return ret;
+}
@@ -0,0 +1,24 @@
+/*!
+ * \file settings.h
+ *
+ * Settings kept across resets in the last flash page.  One record of up
+ * to SETTINGS_MAX_SIZE bytes, checked with a CRC-32 on load.  Saving
+ * erases the page, which stalls the CPU for about 20 ms, so save only
+ * while CAN is stopped, from a low priority task.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#define SETTINGS_MAX_SIZE               (16)
+
+/* False when nothing valid of that size was saved, pData is then untouched */
+bool SETTINGS_load(void * pData, uint32_t size);
+/* Task context, skips the write when the record is unchanged */
+bool SETTINGS_save(void const * pData, uint32_t size);
+
+#endif /* SETTINGS_H */
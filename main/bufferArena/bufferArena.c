@@ -0,0 +1,222 @@
+/*!
+ * \file bufferArena.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "tusb.h"
+#include "task.h"
+#include "bufferArena.h"
+#include "usb_device/webusb.h"
+#include "usb_device/frameParser/frameParser.h"
+#include "commandParser/commandParser.h"
+#include "bsp/can.h"
+#include "bsp/settings.h"
+#include "bsp/ccm.h"
+
+#define ARENA_ALIGN(n)                  (((n) + 7UL) & ~7UL)
+#define SAVE_STACK_SIZE                 (configMINIMAL_STACK_SIZE)
+
+/* Bytes taken by a split, the gs_usb build has no command parser */
+#if CONFIG_GS_USB
+#define PARSER_RINGS_SIZE(bytes)        (0UL)
+#else
+#define PARSER_RINGS_SIZE(bytes)        (2UL * (bytes))
+#endif
+#define SPLIT_SIZE(tx, rx, usb, parser) \
+    (ARENA_ALIGN((tx) * sizeof(tx_queue_element_t)) + \
+     ARENA_ALIGN((rx) * sizeof(can_frame_t)) + \
+     ARENA_ALIGN((usb) * WEBUSB_TX_ELEMENT_SZ) + \
+     PARSER_RINGS_SIZE(parser))
+
+static const buffer_split_t PROFILES[N_BUFFER_PROFILE] = {
+    [BUFFER_PROFILE_BALANCED]   = { .canTxFrames = 4, .canRxFrames = 3, .usbTxPackets = 10, .parserRxBytes = CONFIG_PARSER_RX_BUF_SIZE },
+    [BUFFER_PROFILE_RX_LOGGING] = { .canTxFrames = 2, .canRxFrames = 8, .usbTxPackets = 24, .parserRxBytes = 512 },
+    [BUFFER_PROFILE_TX_REPLAY]  = { .canTxFrames = 8, .canRxFrames = 3, .usbTxPackets = 6,  .parserRxBytes = 1024 },
+};
+
+/* The fallback when nothing valid was saved */
+TU_VERIFY_STATIC(SPLIT_SIZE(4, 3, 10, CONFIG_PARSER_RX_BUF_SIZE) <= CONFIG_BUFFER_ARENA_SIZE,
+                 "balanced profile exceeds the buffer arena");
+TU_VERIFY_STATIC(CONFIG_BUFFER_ARENA_SIZE <= UINT16_MAX, "buffer_status_t reports the arena in 16 bits");
+
+/* CCM SRAM: the ISR writes the RX queue, the encoders read it, no DMA touches it */
+static CCM_BSS uint8_t bufferArena[CONFIG_BUFFER_ARENA_SIZE] __attribute__ ((aligned(8)));
+
+/* selectedSplit is written by the USB task, read under a critical section */
+static buffer_split_t selectedSplit;
+static buffer_split_t appliedSplit;
+/* selectedSplit is not in flash yet */
+static bool bSavePending = false;
+static TaskHandle_t saveTask = NULL;
+static StaticTask_t saveTaskDef;
+static StackType_t saveStack[SAVE_STACK_SIZE];
+
+
+static uint32_t buffer_split_size(buffer_split_t const * pSplit)
+{
+    return SPLIT_SIZE((uint32_t)pSplit->canTxFrames, (uint32_t)pSplit->canRxFrames,
+                      (uint32_t)pSplit->usbTxPackets, (uint32_t)pSplit->parserRxBytes);
+}
+
+
+static bool buffer_split_valid(buffer_split_t const * pSplit)
+{
+    if((pSplit->canTxFrames == 0) ||
+       ((pSplit->canTxFrames & (pSplit->canTxFrames - 1)) != 0) ||
+       (pSplit->canRxFrames == 0) ||
+       (pSplit->usbTxPackets == 0)) {
+        return false;
+    }
+#if !CONFIG_GS_USB
+    if(!FRAME_PARSER_RING_VALID((uint32_t)pSplit->parserRxBytes)) {
+        return false;
+    }
+#endif
+    return (buffer_split_size(pSplit) <= CONFIG_BUFFER_ARENA_SIZE);
+}
+
+
+/* Every user of the buffers is idle or not running yet */
+static void buffer_arena_carve(buffer_split_t const * pSplit)
+{
+    uint8_t * pNext = bufferArena;
+
+#if !CONFIG_GS_USB
+    command_parser_set_rings(pNext, pNext + pSplit->parserRxBytes, pSplit->parserRxBytes);
+    pNext += PARSER_RINGS_SIZE(pSplit->parserRxBytes);
+#endif
+    CAN_set_buffers((tx_queue_element_t *)pNext, pSplit->canTxFrames,
+                    pNext + ARENA_ALIGN(pSplit->canTxFrames * sizeof(tx_queue_element_t)),
+                    pSplit->canRxFrames);
+    pNext += ARENA_ALIGN(pSplit->canTxFrames * sizeof(tx_queue_element_t));
+    pNext += ARENA_ALIGN(pSplit->canRxFrames * sizeof(can_frame_t));
+    webusb_set_tx_queue(pNext, pSplit->usbTxPackets);
+
+    appliedSplit = *pSplit;
+}
+
+
+/*
+ * The page erase stalls the CPU, so it waits for CAN to stop rather than
+ * lose frames.  CAN_start() runs in a task, it can not slip in while the
+ * scheduler is suspended.  A failed save is tried again the next time.
+ */
+static void buffer_save_task(void * pxParam)
+{
+    can_status_t canStatus;
+    buffer_split_t split;
+    bool save;
+
+    (void) pxParam;
+
+    for(;;) {
+        (void)xTaskNotifyWait(0, 0xFFFFFFFF, NULL, portMAX_DELAY);
+
+        vTaskSuspendAll();
+        CAN_get_status(&canStatus);
+        taskENTER_CRITICAL();
+        split = selectedSplit;
+        save = bSavePending && !canStatus.started;
+        taskEXIT_CRITICAL();
+        if(save) {
+            save = !SETTINGS_save(&split, sizeof(split));
+            taskENTER_CRITICAL();
+            /* Still pending when it failed or another split came in meanwhile */
+            bSavePending = save || (memcmp(&split, &selectedSplit, sizeof(split)) != 0);
+            taskEXIT_CRITICAL();
+        }
+        (void)xTaskResumeAll();
+    }
+}
+
+
+void buffer_arena_init(void)
+{
+    buffer_split_t split;
+
+    if(!SETTINGS_load(&split, sizeof(split)) || !buffer_split_valid(&split)) {
+        split = PROFILES[BUFFER_PROFILE_BALANCED];
+    }
+    selectedSplit = split;
+    buffer_arena_carve(&split);
+
+    saveTask = xTaskCreateStatic(
+                        buffer_save_task,
+                        "buffer-save",
+                        SAVE_STACK_SIZE,
+                        NULL,
+                        tskIDLE_PRIORITY + 1,
+                        saveStack,
+                        &saveTaskDef
+                        );
+    configASSERT(saveTask);
+}
+
+
+bool buffer_arena_select(buffer_split_t const * pSplit)
+{
+    if(!buffer_split_valid(pSplit)) {
+        return false;
+    }
+    taskENTER_CRITICAL();
+    selectedSplit = *pSplit;
+    bSavePending = true;
+    taskEXIT_CRITICAL();
+    buffer_arena_save();
+
+    return true;
+}
+
+
+bool buffer_arena_select_profile(BUFFER_PROFILE_T profile)
+{
+    if(profile >= N_BUFFER_PROFILE) {
+        return false;
+    }
+    return buffer_arena_select(&PROFILES[profile]);
+}
+
+
+void buffer_arena_get_status(buffer_status_t * pStatus)
+{
+    taskENTER_CRITICAL();
+    pStatus->selected = selectedSplit;
+    pStatus->applied = appliedSplit;
+    taskEXIT_CRITICAL();
+    pStatus->arenaSize = CONFIG_BUFFER_ARENA_SIZE;
+    pStatus->arenaUsed = (uint16_t)buffer_split_size(&pStatus->applied);
+}
+
+
+/*
+ * The scheduler is suspended so no task can start using a buffer between
+ * the idle checks and the re-carve.  A parser mid receive, a TX element
+ * being built, or IN packets still queued for the host keep the current
+ * layout until the next CAN_start().
+ */
+void buffer_arena_apply(void)
+{
+    buffer_split_t split;
+
+    taskENTER_CRITICAL();
+    split = selectedSplit;
+    taskEXIT_CRITICAL();
+    if(memcmp(&split, &appliedSplit, sizeof(split)) == 0) {
+        return;
+    }
+
+    vTaskSuspendAll();
+    if(command_parser_rings_idle() && CAN_buffers_idle() && webusb_tx_idle()) {
+        buffer_arena_carve(&split);
+    }
+    (void)xTaskResumeAll();
+}
+
+
+void buffer_arena_save(void)
+{
+    if(saveTask != NULL) {
+        xTaskNotify(saveTask, 0, eNoAction);
+    }
+}
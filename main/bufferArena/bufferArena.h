@@ -0,0 +1,65 @@
+/*!
+ * \file bufferArena.h
+ *
+ * The pipeline buffers (CAN TX ring, CAN RX queue, vendor IN packet queue
+ * and the command parser receive rings) are carved from one static arena.
+ * The host picks the split, from a profile or element by element.  A low
+ * priority task saves it to flash while CAN is stopped, it takes effect at
+ * the next CAN_start().
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef BUFFERARENA_BUFFERARENA_H_
+#define BUFFERARENA_BUFFERARENA_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+
+#ifndef CONFIG_BUFFER_ARENA_SIZE
+#define CONFIG_BUFFER_ARENA_SIZE        (3584)
+#endif /* CONFIG_BUFFER_ARENA_SIZE */
+
+typedef enum {
+    BUFFER_PROFILE_BALANCED = 0,
+    BUFFER_PROFILE_RX_LOGGING,          // deep RX queue and IN packet queue
+    BUFFER_PROFILE_TX_REPLAY,           // deep TX ring
+    N_BUFFER_PROFILE
+} BUFFER_PROFILE_T;
+
+/* VENDOR_REQUEST_SET_BUFFERS data stage, counts in elements */
+typedef struct __attribute__ ((packed)) {
+    uint16_t canTxFrames;               // power of two
+    uint16_t canRxFrames;
+    uint16_t usbTxPackets;
+    uint16_t parserRxBytes;             // per interface, FRAME_PARSER_RING_VALID
+} buffer_split_t;
+
+/* VENDOR_REQUEST_GET_BUFFERS reply */
+typedef struct __attribute__ ((packed)) {
+    uint16_t arenaSize;                 // bytes
+    uint16_t arenaUsed;                 // bytes, applied split
+    buffer_split_t selected;            // takes effect at the next CAN_start()
+    buffer_split_t applied;
+} buffer_status_t;
+
+/* Loads the saved split, or the balanced profile, and carves it */
+void buffer_arena_init(void);
+/*
+ * False, and nothing changes, when the split does not fit the arena.
+ * Returns without waiting for the save, so it may answer a control request.
+ */
+bool buffer_arena_select(buffer_split_t const * pSplit);
+bool buffer_arena_select_profile(BUFFER_PROFILE_T profile);
+void buffer_arena_get_status(buffer_status_t * pStatus);
+/*
+ * Called by CAN_start(), CAN stopped.  Re-carves when a new split was
+ * selected and no buffer is in use, otherwise keeps the current layout.
+ */
+void buffer_arena_apply(void);
+/*
+ * Called by CAN_stop().  Lets the save task write a split selected while
+ * CAN was running, the page erase stalls the CPU for about 20 ms.
+ */
+void buffer_arena_save(void);
+
+#endif /* BUFFERARENA_BUFFERARENA_H_ */
@@ -0,0 +1,224 @@
+/*
+ * canCodec.c
+ *
+ *      Author: Sicris
+ */
+
+#include "string.h"
+#include "canCodec.h"
+#include "bsp/ccm.h"
+#include "commandParser/commandParser.h"
+#include "usb_device/frameParser/frameParser.h"
+
+static const char hexDigits[] = "0123456789ABCDEF";
+
+
+CCM_CODE uint32_t can_codec_seal_binary(uint8_t * pBuf, uint32_t payloadLength, uint16_t sequence,
+                                        FRAME_INTEGRITY_T integrity)
+{
+    const uint32_t bodySize = CAN_CODEC_BINARY_PAYLOAD_OFFSET + payloadLength;
+    const uint32_t frameSize = bodySize + SZ_TRAILER(integrity);
+    const uint32_t length = frameSize | ((uint32_t)integrity << FRAME_LENGTH_INTEGRITY_SHIFT);
+    uint32_t check;
+
+    // Frame Prefix -->
+    pBuf[OFFSET_TAG_SOF - SZ_USB_BYTES_IN_PACKET] = TAG_SOF;
+    pBuf[OFFSET_LENGTH - SZ_USB_BYTES_IN_PACKET] = (uint8_t)(length & 0xFF);
+    pBuf[OFFSET_LENGTH - SZ_USB_BYTES_IN_PACKET + 1] = (uint8_t)((length >> 8) & 0xFF);
+    pBuf[OFFSET_PKT_SEQ - SZ_USB_BYTES_IN_PACKET] = (uint8_t)(sequence & 0xFF);
+    pBuf[OFFSET_PKT_SEQ - SZ_USB_BYTES_IN_PACKET + 1] = (uint8_t)((sequence >> 8) & 0xFF);
+    // <-- Frame Prefix
+    check = frame_check_update(integrity, frame_check_start(integrity), pBuf, bodySize);
+    frame_check_trailer(integrity, check, &pBuf[bodySize]);
+
+    return frameSize;
+}
+
+
+CCM_CODE void can_codec_set_sequence(uint8_t * pBuf, uint32_t frameSize, uint16_t sequence,
+                                     FRAME_INTEGRITY_T integrity)
+{
+    uint8_t * pSequence = &pBuf[OFFSET_PKT_SEQ - SZ_USB_BYTES_IN_PACKET];
+    const uint8_t low = (uint8_t)(sequence & 0xFF);
+    const uint8_t high = (uint8_t)((sequence >> 8) & 0xFF);
+
+    if(integrity != FRAME_INTEGRITY_SUM8) {
+        can_codec_seal_binary(pBuf, frameSize - CAN_CODEC_BINARY_PAYLOAD_OFFSET - SZ_TRAILER(integrity),
+                              sequence, integrity);
+        return;
+    }
+    /* The checksum cancels the byte sum, so move it by the difference */
+    pBuf[frameSize - 1] = (uint8_t)(pBuf[frameSize - 1] + pSequence[0] + pSequence[1] - low - high);
+    pSequence[0] = low;
+    pSequence[1] = high;
+}
+
+
+CCM_CODE uint32_t can_codec_encode_binary(uint8_t * pBuf, can_frame_t const * pFrame,
+                                          uint16_t sequence, uint32_t maxLength,
+                                          FRAME_INTEGRITY_T integrity)
+{
+    const uint32_t overhead = CAN_CODEC_BINARY_PAYLOAD_OFFSET + SZ_TRAILER(integrity) + SZ_COMMAND_OVERHEAD;
+    uint8_t * pPayload = &pBuf[CAN_CODEC_BINARY_PAYLOAD_OFFSET];
+    uint32_t dataLength = pFrame->len;
+    uint8_t command;
+
+    if((pFrame->flags & CAN_FRAME_FLAG_FD) == 0) {
+        command = ((pFrame->flags & CAN_FRAME_FLAG_EXTENDED) == 0) ?
+                    COMMAND_DEVICE_TO_HOST_CAN_STANDARD : COMMAND_DEVICE_TO_HOST_CAN_EXTENDED;
+    } else {
+        command = ((pFrame->flags & CAN_FRAME_FLAG_EXTENDED) == 0) ?
+                    COMMAND_DEVICE_TO_HOST_FD_STANDARD : COMMAND_DEVICE_TO_HOST_FD_EXTENDED;
+    }
+
+    if((overhead + dataLength) > maxLength) {
+        dataLength = maxLength - overhead;
+    }
+
+    // Payload -->
+    pPayload[OFFSET_COMMAND_ID] = command;
+    pPayload[OFFSET_MSGID] = (uint8_t)(pFrame->id & 0xFF);
+    pPayload[OFFSET_MSGID + 1] = (uint8_t)((pFrame->id >> 8) & 0xFF);
+    pPayload[OFFSET_MSGID + 2] = (uint8_t)((pFrame->id >> 16) & 0xFF);
+    pPayload[OFFSET_MSGID + 3] = (uint8_t)((pFrame->id >> 24) & 0xFF);
+    pPayload[OFFSET_DLC] = pFrame->len;
+    memcpy(&pPayload[OFFSET_DATA], pFrame->data, dataLength);
+    // <-- Payload
+
+    return can_codec_seal_binary(pBuf, SZ_COMMAND_OVERHEAD + dataLength, sequence, integrity);
+}
+
+
+static char * put_hex(char * pBuf, uint32_t value, uint32_t digits)
+{
+    while(digits > 0) {
+        digits--;
+        *pBuf++ = hexDigits[(value >> (4 * digits)) & 0x0F];
+    }
+    return pBuf;
+}
+
+
+uint32_t can_codec_encode_slcan(char * pBuf, can_frame_t const * pFrame, bool withTimestamp)
+{
+    const bool isExtended = ((pFrame->flags & CAN_FRAME_FLAG_EXTENDED) != 0);
+    char * p = pBuf;
+    uint32_t idx;
+    char type;
+
+    if((pFrame->flags & CAN_FRAME_FLAG_FD) != 0) {
+        if((pFrame->flags & CAN_FRAME_FLAG_BRS) != 0) {
+            type = 'b';
+        } else {
+            type = 'd';
+        }
+    } else if((pFrame->flags & CAN_FRAME_FLAG_RTR) != 0) {
+        type = 'r';
+    } else {
+        type = 't';
+    }
+    *p++ = isExtended ? (char)(type - ('a' - 'A')) : type;
+    p = put_hex(p, pFrame->id, isExtended ? 8 : 3);
+    *p++ = hexDigits[can_len_to_dlc(pFrame->len)];
+    if(type != 'r') {
+        for(idx = 0; idx < pFrame->len; idx++) {
+            p = put_hex(p, pFrame->data[idx], 2);
+        }
+    }
+    if(withTimestamp) {
+        /* Lawicel timestamp is in milliseconds, wrapping at 60s */
+        p = put_hex(p, (pFrame->timestamp / 1000U) % 60000U, 4);
+    }
+    *p++ = '\r';
+
+    return (uint32_t)(p - pBuf);
+}
+
+
+static bool get_hex(char const * pBuf, uint32_t digits, uint32_t * pValue)
+{
+    uint32_t value = 0;
+    char c;
+
+    while(digits > 0) {
+        c = *pBuf++;
+        value <<= 4;
+        if((c >= '0') && (c <= '9')) {
+            value |= (uint32_t)(c - '0');
+        } else if((c >= 'A') && (c <= 'F')) {
+            value |= (uint32_t)(c - 'A' + 10);
+        } else if((c >= 'a') && (c <= 'f')) {
+            value |= (uint32_t)(c - 'a' + 10);
+        } else {
+            return false;
+        }
+        digits--;
+    }
+    *pValue = value;
+
+    return true;
+}
+
+
+bool can_codec_decode_slcan(char const * pLine, uint32_t length, can_frame_t * pFrame)
+{
+    uint32_t idDigits;
+    uint32_t value;
+    uint32_t idx;
+    uint32_t dataStart;
+    bool isRemote = false;
+
+    if(length < 1) {
+        return false;
+    }
+
+    pFrame->flags = 0;
+    pFrame->timestamp = 0;
+    switch(pLine[0]) {
+        case 'T': pFrame->flags |= CAN_FRAME_FLAG_EXTENDED; /* fall through */
+        case 't': break;
+        case 'R': pFrame->flags |= CAN_FRAME_FLAG_EXTENDED; /* fall through */
+        case 'r': isRemote = true; pFrame->flags |= CAN_FRAME_FLAG_RTR; break;
+        case 'D': pFrame->flags |= CAN_FRAME_FLAG_EXTENDED; /* fall through */
+        case 'd': pFrame->flags |= CAN_FRAME_FLAG_FD; break;
+        case 'B': pFrame->flags |= CAN_FRAME_FLAG_EXTENDED; /* fall through */
+        case 'b': pFrame->flags |= (CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_BRS); break;
+        default: return false;
+    }
+
+    idDigits = ((pFrame->flags & CAN_FRAME_FLAG_EXTENDED) != 0) ? 8 : 3;
+    if((length < (1 + idDigits + 1)) || !get_hex(&pLine[1], idDigits, &value)) {
+        return false;
+    }
+    if(value > (((pFrame->flags & CAN_FRAME_FLAG_EXTENDED) != 0) ? 0x1FFFFFFFUL : 0x7FFUL)) {
+        return false;
+    }
+    pFrame->id = value;
+
+    if(!get_hex(&pLine[1 + idDigits], 1, &value)) {
+        return false;
+    }
+    if((pFrame->flags & CAN_FRAME_FLAG_FD) != 0) {
+        pFrame->len = can_dlc_to_len((uint8_t)value);
+    } else if(value <= 8) {
+        pFrame->len = (uint8_t)value;
+    } else {
+        return false;
+    }
+
+    dataStart = 1 + idDigits + 1;
+    if(isRemote) {
+        return (length == dataStart);
+    }
+    if(length != (dataStart + (2 * (uint32_t)pFrame->len))) {
+        return false;
+    }
+    for(idx = 0; idx < pFrame->len; idx++) {
+        if(!get_hex(&pLine[dataStart + (2 * idx)], 2, &value)) {
+            return false;
+        }
+        pFrame->data[idx] = (uint8_t)value;
+    }
+
+    return true;
+}
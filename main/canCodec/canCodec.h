@@ -0,0 +1,54 @@
+/*
+ * canCodec.h
+ *
+ *  Shared CAN frame encoders for the vendor and CDC interfaces.
+ *
+ *    Binary : TAG_SOF framed command packet, see frameParser.h
+ *    SLCAN  : Lawicel text format, extended with d/D/b/B for CAN FD
+ *
+ *      Author: Sicris
+ */
+
+#ifndef CANCODEC_CANCODEC_H_
+#define CANCODEC_CANCODEC_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "bsp/can_types.h"
+#include "usb_device/frameParser/frameParser.h"
+
+/* TAG + length + sequence + (command + msgID + DLC) + data + largest trailer */
+#define CAN_CODEC_BINARY_MAX_SZ         (5 + 6 + CAN_MAX_DATA_LENGTH + SZ_TRAILER_MAX)
+#define CAN_CODEC_BINARY_PAYLOAD_OFFSET (5)
+#define CAN_CODEC_BINARY_OVERHEAD       (5 + SZ_TRAILER_MAX)
+/* type + 8 id + dlc + 2 per data byte + 4 timestamp + CR */
+#define CAN_CODEC_SLCAN_MAX_SZ          (1 + 8 + 1 + (2 * CAN_MAX_DATA_LENGTH) + 4 + 1)
+
+/*
+ * Writes the TAG_SOF, length, sequence and trailer around payloadLength
+ * bytes already placed at CAN_CODEC_BINARY_PAYLOAD_OFFSET.  Returns the
+ * frame size, overhead included.
+ */
+uint32_t can_codec_seal_binary(uint8_t * pBuf, uint32_t payloadLength, uint16_t sequence,
+                               FRAME_INTEGRITY_T integrity);
+
+/* Replaces the sequence of a sealed packet and patches or redoes its trailer */
+void can_codec_set_sequence(uint8_t * pBuf, uint32_t frameSize, uint16_t sequence,
+                            FRAME_INTEGRITY_T integrity);
+
+/*
+ * Encodes a received frame as a binary command packet.  Payload that does
+ * not fit in maxLength is truncated, the DLC field still carries the full
+ * length.  Returns the packet length.
+ */
+uint32_t can_codec_encode_binary(uint8_t * pBuf, can_frame_t const * pFrame,
+                                 uint16_t sequence, uint32_t maxLength,
+                                 FRAME_INTEGRITY_T integrity);
+
+/* Returns the line length including the trailing CR */
+uint32_t can_codec_encode_slcan(char * pBuf, can_frame_t const * pFrame, bool withTimestamp);
+
+/* Parses a t/T/r/R/d/D/b/B line (without CR) into a frame to transmit */
+bool can_codec_decode_slcan(char const * pLine, uint32_t length, can_frame_t * pFrame);
+
+#endif /* CANCODEC_CANCODEC_H_ */
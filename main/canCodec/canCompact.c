@@ -0,0 +1,173 @@
+/*
+ * canCompact.c
+ *
+ *      Author: Sicris
+ */
+
+#include "string.h"
+#include "canCompact.h"
+#include "bsp/ccm.h"
+
+#define FRAME_KEY_FLAGS                 (CAN_FRAME_FLAG_EXTENDED | CAN_FRAME_FLAG_FD | \
+                                         CAN_FRAME_FLAG_BRS | CAN_FRAME_FLAG_ESI | \
+                                         CAN_FRAME_FLAG_RTR)
+
+
+static CCM_CODE uint32_t put_varint(uint8_t * pBuf, uint32_t value)
+{
+    uint32_t n = 0;
+
+    while(value >= 0x80) {
+        pBuf[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    pBuf[n++] = (uint8_t)value;
+
+    return n;
+}
+
+
+static uint32_t get_varint(uint8_t const * pBuf, uint32_t length, uint32_t * pValue)
+{
+    uint32_t value = 0;
+    uint32_t n = 0;
+
+    while(n < length && n < 5) {
+        value |= ((uint32_t)(pBuf[n] & 0x7F)) << (7 * n);
+        if((pBuf[n++] & 0x80) == 0) {
+            *pValue = value;
+            return n;
+        }
+    }
+
+    return 0;
+}
+
+
+void can_compact_reset(can_compact_t * pCtx, uint8_t options)
+{
+    memset(pCtx, 0, sizeof(can_compact_t));
+    pCtx->options = options;
+}
+
+
+static CCM_CODE int32_t find_slot(can_compact_t const * pCtx, uint32_t id, uint8_t flags)
+{
+    for(uint32_t slot = 0; slot < CAN_COMPACT_TABLE_SIZE; slot++) {
+        if(pCtx->table[slot].valid &&
+           (pCtx->table[slot].id == id) &&
+           (pCtx->table[slot].flags == flags)) {
+            return (int32_t)slot;
+        }
+    }
+
+    return -1;
+}
+
+
+CCM_CODE uint32_t can_compact_encode(can_compact_t * pCtx, uint8_t * pBuf, uint32_t size,
+                                     can_frame_t const * pFrame)
+{
+    uint8_t record[CAN_COMPACT_RECORD_MAX_SZ];
+    const uint8_t flags = pFrame->flags & FRAME_KEY_FLAGS;
+    can_compact_entry_t * pEntry;
+    int32_t slot = find_slot(pCtx, pFrame->id, flags);
+    uint32_t n = 1;
+    uint8_t header;
+
+    if(slot < 0) {
+        slot = pCtx->nextSlot;
+        header = CAN_COMPACT_HDR_LITERAL | (uint8_t)slot;
+        n += put_varint(&record[n], pFrame->id);
+        record[n++] = flags;
+    } else {
+        header = (uint8_t)slot;
+        if(((pCtx->options & CAN_COMPACT_OPT_REPEAT) != 0) &&
+           (pCtx->table[slot].len == pFrame->len) &&
+           (memcmp(pCtx->table[slot].data, pFrame->data, pFrame->len) == 0)) {
+            header |= CAN_COMPACT_HDR_REPEAT;
+        }
+    }
+    record[0] = header;
+    n += put_varint(&record[n], pFrame->timestamp - pCtx->lastTimestamp);
+    if((header & CAN_COMPACT_HDR_REPEAT) == 0) {
+        n += put_varint(&record[n], pFrame->len);
+        memcpy(&record[n], pFrame->data, pFrame->len);
+        n += pFrame->len;
+    }
+
+    if(n > size) {
+        return 0;
+    }
+    memcpy(pBuf, record, n);
+
+    /* Commit */
+    pEntry = &(pCtx->table[slot]);
+    if((header & CAN_COMPACT_HDR_LITERAL) != 0) {
+        pEntry->valid = true;
+        pEntry->id = pFrame->id;
+        pEntry->flags = flags;
+        pCtx->nextSlot = (uint8_t)((pCtx->nextSlot + 1) % CAN_COMPACT_TABLE_SIZE);
+    }
+    pEntry->len = pFrame->len;
+    memcpy(pEntry->data, pFrame->data, pFrame->len);
+    pCtx->lastTimestamp = pFrame->timestamp;
+
+    return n;
+}
+
+
+uint32_t can_compact_decode(can_compact_t * pCtx, uint8_t const * pBuf, uint32_t length,
+                            can_frame_t * pFrame)
+{
+    can_compact_entry_t * pEntry;
+    uint32_t value;
+    uint32_t used;
+    uint32_t n = 1;
+    uint8_t header;
+
+    if(length < 1) {
+        return 0;
+    }
+    header = pBuf[0];
+    pEntry = &(pCtx->table[header & CAN_COMPACT_HDR_SLOT_MASK]);
+
+    if((header & CAN_COMPACT_HDR_LITERAL) != 0) {
+        used = get_varint(&pBuf[n], length - n, &value);
+        if((used == 0) || ((n + used) >= length)) {
+            return 0;
+        }
+        n += used;
+        pEntry->valid = true;
+        pEntry->id = value;
+        pEntry->flags = pBuf[n++];
+    } else if(!pEntry->valid) {
+        return 0;
+    }
+
+    used = get_varint(&pBuf[n], length - n, &value);
+    if(used == 0) {
+        return 0;
+    }
+    n += used;
+    pCtx->lastTimestamp += value;
+
+    if((header & CAN_COMPACT_HDR_REPEAT) == 0) {
+        used = get_varint(&pBuf[n], length - n, &value);
+        if((used == 0) || (value > CAN_MAX_DATA_LENGTH) || ((n + used + value) > length)) {
+            return 0;
+        }
+        n += used;
+        pEntry->len = (uint8_t)value;
+        memcpy(pEntry->data, &pBuf[n], value);
+        n += value;
+    }
+
+    pFrame->id = pEntry->id;
+    pFrame->flags = pEntry->flags;
+    pFrame->timestamp = pCtx->lastTimestamp;
+    pFrame->len = pEntry->len;
+    memcpy(pFrame->data, pEntry->data, pEntry->len);
+
+    return n;
+}
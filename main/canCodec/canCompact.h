@@ -0,0 +1,72 @@
+/*
+ * canCompact.h
+ *
+ *  Compact device to host CAN frame records, negotiated on connect.
+ *
+ *  Record
+ *    Header     : 1 byte
+ *                   [3:0] ID table slot
+ *                   [4]   literal, ID and flags follow and replace the slot
+ *                   [5]   repeat, payload equals the last one of this slot
+ *    ID         : varint, literal only
+ *    Flags      : 1 byte CAN_FRAME_FLAG_*, literal only
+ *    Timestamp  : varint, microseconds since the previous record
+ *    Length     : varint, not present on repeat
+ *    Data       : Length bytes, not present on repeat
+ *
+ *  The encoder picks the slot a literal replaces, so the decoder only has
+ *  to mirror the table, not the replacement policy.
+ *
+ *      Author: Sicris
+ */
+
+#ifndef CANCODEC_CANCOMPACT_H_
+#define CANCODEC_CANCOMPACT_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "bsp/can_types.h"
+
+#define CAN_COMPACT_TABLE_SIZE          (16)
+
+/* Encoding options, negotiated on connect */
+#define CAN_COMPACT_OPT_ENABLE          (0x01)
+#define CAN_COMPACT_OPT_REPEAT          (0x02)  //!< code repeated payloads
+
+#define CAN_COMPACT_HDR_SLOT_MASK       (0x0F)
+#define CAN_COMPACT_HDR_LITERAL         (0x10)
+#define CAN_COMPACT_HDR_REPEAT          (0x20)
+
+/* header + 5 byte ID + flags + 5 byte timestamp + length + data */
+#define CAN_COMPACT_RECORD_MAX_SZ       (1 + 5 + 1 + 5 + 1 + CAN_MAX_DATA_LENGTH)
+
+typedef struct {
+    bool valid;
+    uint32_t id;
+    uint8_t flags;
+    uint8_t len;
+    uint8_t data[CAN_MAX_DATA_LENGTH];
+} can_compact_entry_t;
+
+/* Encoder and decoder share the same state layout */
+typedef struct {
+    can_compact_entry_t table[CAN_COMPACT_TABLE_SIZE];
+    uint32_t lastTimestamp;
+    uint8_t nextSlot;
+    uint8_t options;
+} can_compact_t;
+
+void can_compact_reset(can_compact_t * pCtx, uint8_t options);
+
+/*
+ * Returns the record length, or 0 if it does not fit in size.  The state
+ * is only updated when the record is written.
+ */
+uint32_t can_compact_encode(can_compact_t * pCtx, uint8_t * pBuf, uint32_t size,
+                            can_frame_t const * pFrame);
+
+/* Returns the number of bytes consumed, or 0 on a malformed record */
+uint32_t can_compact_decode(can_compact_t * pCtx, uint8_t const * pBuf, uint32_t length,
+                            can_frame_t * pFrame);
+
+#endif /* CANCODEC_CANCOMPACT_H_ */
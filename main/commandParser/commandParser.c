@@ -6,10 +6,22 @@
  */
 
 #include "stdbool.h"
+#include "string.h"
+#include "tusb.h"
+#include "queue.h"
+#include "timers.h"
 #include "commandParser.h"
 #include "frameParser/frameParser.h"
 #include "usb_device/webusb.h"
+#include "usb_device/cdcCan/cdcCan.h"
+#include "usb_device/isoStream/isoStream.h"
+#include "canCodec/canCodec.h"
+#include "canCodec/canCompact.h"
 #include "bsp/can.h"
+#include "bsp/board_api.h"
+#include "flushPolicy/flushPolicy.h"
+#include "stats/stats.h"
+#include "stats/latency.h"
 
 /*
  * Command Format
@@ -19,11 +31,21 @@
 
 
 /* COMMAND: CONNECT (0x01) ****************************************************/
+/* Legacy in-band form of VENDOR_REQUEST_CONNECT; new hosts should use EP0 */
 #define COMMAND_CONNECT                 (0x01)
 #define SZ_CMD_CONNECT                  (1 + 1)  // 1byte command + 1byte parameter
-/* Param0
+#define SZ_CMD_CONNECT_OPTIONS          (1 + 2)  // optional encoding options
+#define SZ_CMD_RESUME                   (1 + 2)  // 1byte command + 2byte sequence
+#define SZ_CMD_RESUME_OPTIONS           (1 + 3)  // optional encoding options
+#define SZ_CMD_ACK                      (1 + 2)  // 1byte command + 2byte sequence
+/* Applies to the interface it arrives on, vendor and CDC subscribe independently
+ * Param0
  *  0x01: Connect
- *  0x02: Disconnect
+ *  0x02: Disconnect, in a RESUME session CAN keeps running for the host
+ *  0x03: Disconnect and end a RESUME session
+ * Param1 (optional)
+ *  CAN_COMPACT_OPT_* device to host encoding, 0 for one command per frame,
+ *  and the CONNECT_OPT_INTEGRITY_MASK trailer
  */
 
 typedef struct __attribute__ ((packed)) {
@@ -34,11 +56,137 @@ typedef struct __attribute__ ((packed)) {
 } command_t;
 
 
+/* One interface's view of the CAN stream */
+typedef struct {
+    COMMAND_CHANNEL_T channel;
+    bool bConnected;
+    uint16_t packetSequence;
+    uint8_t encodingOptions;
+    FRAME_INTEGRITY_T integrity;
+    uint32_t filterIds[FILTER_MAX_ENTRIES];
+    uint32_t filterMasks[FILTER_MAX_ENTRIES];
+    uint32_t filterCount;
+    can_compact_t compactEncoder;
+    /* Compact batch, a binary frame holding COMMAND_DEVICE_TO_HOST_COMPACT */
+    uint8_t compactPacket[CAN_CODEC_BINARY_MAX_SZ];
+    uint32_t compactLength;
+    uint32_t compactFrames;
+    flush_policy_t flushPolicy;
+    TimerHandle_t flushTimer;
+    StaticTimer_t flushTimerDef;
+    bool bFlushTimerArmed;
+    /* Frames not sent to this interface, see COMMAND_DEVICE_TO_HOST_DROP_REPORT */
+    uint32_t filteredFrames;
+    uint32_t encoderDrops;
+    uint32_t usbDrops;
+    uint32_t reportedSequence;
+    uint32_t reportedDrops;
+#if CONFIG_LATENCY_PROBES
+    uint32_t latencyCycles;     // encoder stamp of the oldest frame in the packet
+#endif
+} subscriber_t;
+
+
 static bool bInit = false;
+static bool bConnected = false;
+static COMMAND_CHANNEL_T commandSource = COMMAND_CHANNEL_VENDOR;
+static frame_parser_t vendorParser;
+static frame_parser_t cdcParser;
+/* Set while a parser is in use, its ring can not be replaced then */
+static volatile bool parserBusy[N_COMMAND_CHANNEL];
+static subscriber_t subscribers[N_COMMAND_CHANNEL];
+#if CONFIG_STREAM_RESUME
+typedef struct {
+    uint16_t sequence;
+    uint8_t frames;         // CAN frames in the packet
+    uint8_t packet[CFG_TUD_VENDOR_EPSIZE];
+} resume_entry_t;
+
+TU_VERIFY_STATIC((CONFIG_STREAM_RESUME_PACKETS & (CONFIG_STREAM_RESUME_PACKETS - 1)) == 0,
+                 "CONFIG_STREAM_RESUME_PACKETS must be a power of two");
+#define RESUME_RING_MASK                (CONFIG_STREAM_RESUME_PACKETS - 1)
+
+/* Free running indices, resumeAcked <= resumeSent <= resumeHead */
+static resume_entry_t resumeRing[CONFIG_STREAM_RESUME_PACKETS];
+static uint32_t resumeAcked = 0;
+static uint32_t resumeSent = 0;
+static uint32_t resumeHead = 0;
+static bool bResumeSession = false;
+static bool bHostAway = false;
+#endif
+#if CONFIG_SOF_SYNC
+static TimerHandle_t sofSyncTimer = NULL;
+static StaticTimer_t sofSyncTimerDef;
+#endif
+static TimerHandle_t dropReportTimer = NULL;
+static StaticTimer_t dropReportTimerDef;
+/* Sequence of the next CAN frame and the gaps left by the RX queue */
+static uint32_t rxNextSequence = 0;
+static uint32_t rxQueueDrops = 0;
+static uint8_t arbitBps = ARBIT_1MHZ;
+static uint8_t dataBps = DATA_1MHZ;
+static uint16_t expressSequence = 0;
+static uint8_t expressEvents = 0;
+static uint32_t urgentIds[EXPRESS_MAX_URGENT_IDS];
+static uint32_t urgentIdCount = 0;
+/* Payloads that wrap in a parser's ring are copied here */
 static command_t __attribute__ ((aligned (4))) commandBuffer;
-static SemaphoreHandle_t xParserMutex = NULL;
-static StaticSemaphore_t xMutexBuffer;
-static int32_t commandHandler(uint32_t length);
+
+/*
+ * The stream state above belongs to the CAN processing context.  Other
+ * tasks post configuration through parserQHandle (run inline on the
+ * reactor, which is that context), timers and USB completions set pending
+ * bits.  Neither the CAN RX nor the command path takes a lock.
+ */
+typedef enum {
+    PARSER_MSG_COMMAND = 0,
+    PARSER_MSG_CONNECT,
+    PARSER_MSG_BITRATE
+} PARSER_MSG_T;
+
+/* Bits 0..N_COMMAND_CHANNEL-1 are the flush deadline of that subscriber */
+#define PARSER_PENDING_SOF_SYNC         (0x100UL)
+#define PARSER_PENDING_TX_READY         (0x200UL)
+/* Shifted by the channel, the report is in hostAckReports[] */
+#define PARSER_PENDING_HOST_ACK         (0x400UL)
+#define PARSER_PENDING_DROP_REPORT      (0x1000UL)
+
+static frame_seq_report_t hostAckReports[N_COMMAND_CHANNEL];
+
+static volatile uint32_t pendingEvents = 0;
+#if !CONFIG_USB_CAN_REACTOR
+typedef struct {
+    uint8_t type;           // PARSER_MSG_T
+    uint8_t channel;        // COMMAND_CHANNEL_T
+    uint8_t arg[2];
+    uint16_t length;
+    uint8_t payload[CONFIG_CMD_FRAME_SIZE];
+} parser_msg_t;
+
+#define PARSER_QUEUE_LENGTH             (4)
+static StaticQueue_t parserStaticQueue;
+static uint8_t parserQueueStorageArea[PARSER_QUEUE_LENGTH * sizeof(parser_msg_t)];
+static QueueHandle_t parserQHandle;
+static parser_msg_t deferredMsg;
+#endif
+static int32_t commandHandler(command_t const * pCommand, uint32_t length);
+static int32_t vendorCommandHandler(uint8_t const * pPayload, uint32_t length);
+static int32_t cdcCommandHandler(uint8_t const * pPayload, uint32_t length);
+static void canRxHandler(can_frame_t const * pFrame, bool more);
+static void canTxHandler(tx_queue_element_t const * pElem);
+static void canStatusHandler(can_status_t const * pStatus);
+static void flushTimerCb(TimerHandle_t xTimer);
+static void compactFlush(subscriber_t * pSub);
+static void flushDeadline(subscriber_t * pSub);
+static void parserSetPending(uint32_t events);
+static void parserDeferred(void);
+static void hostAckSend(subscriber_t * pSub);
+static void dropReportSend(subscriber_t * pSub, bool force);
+static void dropReportTimerCb(TimerHandle_t xTimer);
+#if CONFIG_SOF_SYNC
+static void sofSyncSend(void);
+static void sofSyncTimerCb(TimerHandle_t xTimer);
+#endif
 
 
 void command_parser_init(void)
@@ -46,63 +194,539 @@ void command_parser_init(void)
     frame_valid_cb_t validCb;
 
     if(!bInit) {
-        xParserMutex = xSemaphoreCreateRecursiveMutexStatic( &xMutexBuffer );
-        configASSERT(xParserMutex);
-
-        validCb.callback = commandHandler;
+#if !CONFIG_USB_CAN_REACTOR
+        parserQHandle = xQueueCreateStatic(
+                                PARSER_QUEUE_LENGTH,
+                                sizeof(parser_msg_t),
+                                parserQueueStorageArea,
+                                &parserStaticQueue);
+        configASSERT(parserQHandle);
+#endif
         validCb.pCommandBuffer = (uint8_t *)(&commandBuffer);
-        validCb.mutex = xParserMutex;
 
-        frame_parser_init(&validCb);
+        validCb.callback = vendorCommandHandler;
+        frame_parser_init(&vendorParser, &validCb);
+        validCb.callback = cdcCommandHandler;
+        frame_parser_init(&cdcParser, &validCb);
+        for(uint32_t i = 0; i < N_COMMAND_CHANNEL; i++) {
+            subscriber_t * pSub = &subscribers[i];
+            pSub->channel = (COMMAND_CHANNEL_T)i;
+            flush_policy_init(&pSub->flushPolicy);
+            pSub->flushTimer = xTimerCreateStatic(
+                                "flush",
+                                1,
+                                pdFALSE,
+                                pSub,
+                                flushTimerCb,
+                                &pSub->flushTimerDef
+                                );
+        }
+#if CONFIG_SOF_SYNC
+        sofSyncTimer = xTimerCreateStatic(
+                            "sof-sync",
+                            pdMS_TO_TICKS(CONFIG_SOF_SYNC_PERIOD_MS),
+                            pdTRUE,
+                            NULL,
+                            sofSyncTimerCb,
+                            &sofSyncTimerDef
+                            );
+        xTimerStart(sofSyncTimer, 0);
+#endif
+        dropReportTimer = xTimerCreateStatic(
+                            "drop-report",
+                            pdMS_TO_TICKS(CONFIG_DROP_REPORT_MS),
+                            pdTRUE,
+                            NULL,
+                            dropReportTimerCb,
+                            &dropReportTimerDef
+                            );
+        xTimerStart(dropReportTimer, 0);
+        CAN_set_rx_handler(canRxHandler);
+        CAN_set_tx_handler(canTxHandler);
+        CAN_set_status_handler(canStatusHandler);
+        CAN_set_defer_handler(parserDeferred);
 
         bInit = true;
     }
 }
 
 
-static int32_t commandHandler(uint32_t length)
+void command_parser_receive(COMMAND_CHANNEL_T channel, uint8_t * pBuf, uint32_t len)
+{
+    frame_parser_t * pParser = (channel == COMMAND_CHANNEL_CDC) ? &cdcParser : &vendorParser;
+    frame_seq_report_t report;
+    bool bTaken;
+
+    parserBusy[channel] = true;
+    bTaken = frame_parser_receive(pParser, pBuf, len);
+    if(channel == COMMAND_CHANNEL_VENDOR) {
+        STATS_ADD(usbOutBytes, len);
+        STATS_MAX(hwmParserRing, (pParser->wrPtr - pParser->rdPtr) & pParser->rxBufMask);
+        if(!bTaken) {
+            STATS_INC(usbOutOverflow);
+        }
+    }
+    frame_parser_process(pParser);
+    parserBusy[channel] = false;
+    if(frame_parser_sequence_report(pParser, &report)) {
+        /* Sent from CAN processing context, which owns the stream sequence */
+        taskENTER_CRITICAL();
+        hostAckReports[channel] = report;
+        taskEXIT_CRITICAL();
+        parserSetPending(PARSER_PENDING_HOST_ACK << channel);
+    }
+}
+
+
+void command_parser_connect(bool isConnect, uint8_t options)
+{
+    command_parser_connect_on(COMMAND_CHANNEL_VENDOR, isConnect, options);
+}
+
+
+#if CONFIG_STREAM_RESUME
+static void resumeDrain(void)
+{
+    uint8_t packet[CFG_TUD_VENDOR_EPSIZE];
+
+    while(!bHostAway && (resumeSent != resumeHead)) {
+        /* webusb_sendEp() may swap the buffer with the head of its queue */
+        memcpy(packet, resumeRing[resumeSent & RESUME_RING_MASK].packet, sizeof(packet));
+        if(!webusb_sendEp(packet)) {
+            break;
+        }
+        resumeSent++;
+    }
+}
+
+
+static void resumeAppend(uint8_t const * pPacket, uint16_t sequence, uint8_t frames)
 {
-    switch(commandBuffer.commandId) {
+    resume_entry_t * pEntry;
+
+    if((resumeHead - resumeAcked) >= CONFIG_STREAM_RESUME_PACKETS) {
+        /* Overwrite the oldest unacknowledged packet, the host sees a gap */
+        if(resumeSent == resumeAcked) {
+            subscribers[COMMAND_CHANNEL_VENDOR].usbDrops += resumeRing[resumeAcked & RESUME_RING_MASK].frames;
+        }
+        resumeAcked++;
+        if((int32_t)(resumeSent - resumeAcked) < 0) {
+            resumeSent = resumeAcked;
+        }
+    }
+    pEntry = &resumeRing[resumeHead & RESUME_RING_MASK];
+    pEntry->sequence = sequence;
+    pEntry->frames = frames;
+    memcpy(pEntry->packet, pPacket, CFG_TUD_VENDOR_EPSIZE);
+    resumeHead++;
+
+    resumeDrain();
+}
+
+
+static void resumeAcknowledge(uint16_t sequence)
+{
+    while((resumeAcked != resumeSent) &&
+          ((int16_t)(sequence - resumeRing[resumeAcked & RESUME_RING_MASK].sequence) >= 0)) {
+        resumeAcked++;
+    }
+}
+
+
+#endif /* CONFIG_STREAM_RESUME */
+
+
+static void parserSetPending(uint32_t events)
+{
+    taskENTER_CRITICAL();
+    pendingEvents |= events;
+    taskEXIT_CRITICAL();
+    CAN_defer();
+}
+
+
+/* Called from the vendor TX complete callback */
+void command_parser_tx_ready(void)
+{
+#if CONFIG_STREAM_RESUME
+    parserSetPending(PARSER_PENDING_TX_READY);
+#endif
+}
+
+
+static bool anySubscriber(void)
+{
+    for(uint32_t i = 0; i < N_COMMAND_CHANNEL; i++) {
+        if(subscribers[i].bConnected) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/*
+ * resume, on connect    : keep the ring and the sequence (RESUME)
+ *         on disconnect : keep CAN running, the host is only away
+ *
+ * CAN runs while any interface is connected.
+ */
+static void connectOn(COMMAND_CHANNEL_T channel, bool isConnect, uint8_t options, bool resume)
+{
+    subscriber_t * pSub = &subscribers[channel];
+    frame_parser_t * pParser = (channel == COMMAND_CHANNEL_CDC) ? &cdcParser : &vendorParser;
+    uint32_t integrity = (options & CONNECT_OPT_INTEGRITY_MASK) >> CONNECT_OPT_INTEGRITY_SHIFT;
+
+    if(isConnect) {
+#if CONFIG_STREAM_RESUME
+        if(channel == COMMAND_CHANNEL_VENDOR) {
+            if(resume && pSub->bConnected) {
+                /* Keep the pending batch in the ring */
+                compactFlush(pSub);
+            }
+            bHostAway = false;
+            bResumeSession = resume;
+            if(!bResumeSession) {
+                resumeAcked = resumeHead;
+                resumeSent = resumeHead;
+            }
+        }
+#endif
+        if(integrity >= N_FRAME_INTEGRITY) {
+            integrity = FRAME_INTEGRITY_SUM8;
+        }
+        pSub->encodingOptions = options;
+        pSub->integrity = (FRAME_INTEGRITY_T)integrity;
+        frame_parser_require(pParser, pSub->integrity);
+        frame_parser_track_sequence(pParser, (options & CONNECT_OPT_HOST_ACK) != 0);
+        can_compact_reset(&pSub->compactEncoder, options);
+        pSub->compactLength = 0;
+        pSub->compactFrames = 0;
+        flush_policy_flushed(&pSub->flushPolicy);
+        pSub->bConnected = true;
+        webusb_set_connect_state(true, channel == COMMAND_CHANNEL_VENDOR);
+        if(!bConnected && CAN_configure(arbitBps, dataBps)) {
+            bConnected = CAN_start();
+        }
+        /* After CAN_start(), which may replace the vendor IN queue */
+        dropReportSend(pSub, true);
+    } else if(pSub->bConnected) {
+#if CONFIG_STREAM_RESUME
+        if((channel == COMMAND_CHANNEL_VENDOR) && bResumeSession) {
+            if(resume) {
+                bHostAway = true;
+                return;
+            }
+            bResumeSession = false;
+            resumeAcked = resumeHead;
+            resumeSent = resumeHead;
+        }
+#endif
+        pSub->bConnected = false;
+        pSub->compactLength = 0;
+        pSub->compactFrames = 0;
+        frame_parser_require(pParser, FRAME_INTEGRITY_SUM8);
+        frame_parser_track_sequence(pParser, false);
+        if(!anySubscriber()) {
+            webusb_set_connect_state(false, false);
+            CAN_stop();
+            bConnected = false;
+        }
+    }
+}
+
+
+static void setBitrate(uint8_t arbitBitrate, uint8_t dataBitrate)
+{
+    arbitBps = arbitBitrate;
+    dataBps = dataBitrate;
+    if(bConnected) {
+        /* Bit timing can only be changed while stopped */
+        CAN_stop();
+        bConnected = CAN_configure(arbitBps, dataBps) && CAN_start();
+    }
+}
+
+
+/* Runs in CAN processing context */
+static void parserExecute(PARSER_MSG_T type, COMMAND_CHANNEL_T channel, uint8_t const * pArg,
+                          uint8_t const * pPayload, uint32_t length)
+{
+    switch(type) {
+        case PARSER_MSG_COMMAND: {
+            commandSource = channel;
+            commandHandler((command_t const *)pPayload, length);
+            break;
+        }
+        case PARSER_MSG_CONNECT: {
+#if CONFIG_STREAM_RESUME
+            connectOn(channel, pArg[0] != 0, pArg[1], pArg[0] == 0);
+#else
+            connectOn(channel, pArg[0] != 0, pArg[1], false);
+#endif
+            break;
+        }
+        case PARSER_MSG_BITRATE: {
+            setBitrate(pArg[0], pArg[1]);
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+}
+
+
+static void parserPost(PARSER_MSG_T type, COMMAND_CHANNEL_T channel, uint8_t arg0, uint8_t arg1,
+                       uint8_t const * pPayload, uint32_t length)
+{
+#if CONFIG_USB_CAN_REACTOR
+    /* Every caller already runs on the reactor task */
+    const uint8_t arg[2] = {arg0, arg1};
+    parserExecute(type, channel, arg, pPayload, length);
+#else
+    parser_msg_t msg;
+
+    msg.type = (uint8_t)type;
+    msg.channel = (uint8_t)channel;
+    msg.arg[0] = arg0;
+    msg.arg[1] = arg1;
+    msg.length = (uint16_t)length;
+    if(length > 0) {
+        memcpy(msg.payload, pPayload, length);
+    }
+    /* Configuration is rare, waiting for a slot keeps it in order */
+    xQueueSend(parserQHandle, &msg, portMAX_DELAY);
+    CAN_defer();
+#endif
+}
+
+
+static void parserDeferred(void)
+{
+    uint32_t events;
+
+#if !CONFIG_USB_CAN_REACTOR
+    while(pdTRUE == xQueueReceive(parserQHandle, &deferredMsg, 0)) {
+        parserExecute((PARSER_MSG_T)deferredMsg.type, (COMMAND_CHANNEL_T)deferredMsg.channel,
+                      deferredMsg.arg, deferredMsg.payload, deferredMsg.length);
+    }
+#endif
+
+    taskENTER_CRITICAL();
+    events = pendingEvents;
+    pendingEvents = 0;
+    taskEXIT_CRITICAL();
+
+    for(uint32_t i = 0; i < N_COMMAND_CHANNEL; i++) {
+        if((events & (1UL << i)) != 0) {
+            flushDeadline(&subscribers[i]);
+        }
+        if((events & (PARSER_PENDING_HOST_ACK << i)) != 0) {
+            hostAckSend(&subscribers[i]);
+        }
+        if((events & PARSER_PENDING_DROP_REPORT) != 0) {
+            dropReportSend(&subscribers[i], false);
+        }
+    }
+#if CONFIG_SOF_SYNC
+    if((events & PARSER_PENDING_SOF_SYNC) != 0) {
+        sofSyncSend();
+    }
+#endif
+#if CONFIG_STREAM_RESUME
+    if(((events & PARSER_PENDING_TX_READY) != 0) && bResumeSession) {
+        resumeDrain();
+    }
+#endif
+}
+
+
+void command_parser_connect_on(COMMAND_CHANNEL_T channel, bool isConnect, uint8_t options)
+{
+    parserPost(PARSER_MSG_CONNECT, channel, isConnect ? 1 : 0, options, NULL, 0);
+}
+
+
+void command_parser_channel_closed(COMMAND_CHANNEL_T channel)
+{
+    command_parser_connect_on(channel, false, 0);
+}
+
+
+bool command_parser_is_connected(void)
+{
+    return bConnected;
+}
+
+
+/* Applied asynchronously, the outcome shows in command_parser_get_status() */
+bool command_parser_set_bitrate(uint8_t arbitBitrate, uint8_t dataBitrate)
+{
+    if((arbitBitrate >= N_SUPPORTED_ARBIT_BITRATE) ||
+       (dataBitrate >= N_SUPPORTED_DATA_BITRATE)) {
+        return false;
+    }
+    parserPost(PARSER_MSG_BITRATE, COMMAND_CHANNEL_VENDOR, arbitBitrate, dataBitrate, NULL, 0);
+
+    return true;
+}
+
+
+void command_parser_get_status(device_status_t * pStatus)
+{
+    can_status_t canStatus;
+
+    CAN_get_status(&canStatus);
+
+    pStatus->version = DEVICE_STATUS_VERSION;
+    pStatus->connected = bConnected ? 1 : 0;
+    pStatus->arbitBitrate = arbitBps;
+    pStatus->dataBitrate = dataBps;
+    pStatus->busState = (uint8_t)canStatus.busState;
+    pStatus->txErrorCount = canStatus.txErrorCount;
+    pStatus->rxErrorCount = canStatus.rxErrorCount;
+    pStatus->features = DEVICE_FEATURE_CRC16 | DEVICE_FEATURE_CRC32;
+}
+
+
+/* Any task, the counters belong to CAN processing context and are only read */
+void command_parser_get_drops(uint32_t * pRxQueue, uint32_t * pEncoder, uint32_t * pUsb)
+{
+    *pRxQueue = rxQueueDrops;
+    *pEncoder = 0;
+    *pUsb = 0;
+    for(uint32_t i = 0; i < N_COMMAND_CHANNEL; i++) {
+        *pEncoder += subscribers[i].encoderDrops;
+        *pUsb += subscribers[i].usbDrops;
+    }
+}
+
+
+bool command_parser_rings_idle(void)
+{
+    return !parserBusy[COMMAND_CHANNEL_VENDOR] && frame_parser_idle(&vendorParser) &&
+           !parserBusy[COMMAND_CHANNEL_CDC] && frame_parser_idle(&cdcParser);
+}
+
+
+void command_parser_set_rings(uint8_t * pVendorRing, uint8_t * pCdcRing, uint32_t size)
+{
+    frame_parser_set_ring(&vendorParser, pVendorRing, size);
+    frame_parser_set_ring(&cdcParser, pCdcRing, size);
+}
+
+
+static uint32_t getU32(uint8_t const * pBuf)
+{
+    return (uint32_t)pBuf[0] | ((uint32_t)pBuf[1] << 8) |
+           ((uint32_t)pBuf[2] << 16) | ((uint32_t)pBuf[3] << 24);
+}
+
+
+static int32_t commandHandler(command_t const * pCommand, uint32_t length)
+{
+    switch(pCommand->commandId) {
         case COMMAND_CONNECT: {
-            if(SZ_CMD_CONNECT == length) {
-                if(commandBuffer.param.raw[0] == 0x01) {
-                    /* Connect */
-                    webusb_set_connect_state(true);
-                    if(CAN_configure(ARBIT_1MHZ, DATA_1MHZ)) {
-                        CAN_start();
-                    }
-                } else {
-                    /* Disconnect */
-                    webusb_set_connect_state(false);
-                    CAN_stop();
+            /* Already in CAN processing context, parserPost() would queue to this task */
+            if((SZ_CMD_CONNECT == length) && (pCommand->param.raw[0] == 0x03)) {
+                connectOn(commandSource, false, 0, false);
+            } else if((SZ_CMD_CONNECT == length) || (SZ_CMD_CONNECT_OPTIONS == length)) {
+                const bool isConnect = (pCommand->param.raw[0] == 0x01);
+                /* As PARSER_MSG_CONNECT: a plain disconnect leaves a resume session open */
+                connectOn(commandSource, isConnect,
+                          (SZ_CMD_CONNECT_OPTIONS == length) ? pCommand->param.raw[1] : 0,
+                          (CONFIG_STREAM_RESUME != 0) && !isConnect);
+            }
+            break;
+        }
+        case COMMAND_SET_EXPRESS: {
+            if((length >= 2) && (((length - 2) % 4) == 0) &&
+               (((length - 2) / 4) <= EXPRESS_MAX_URGENT_IDS)) {
+                expressEvents = pCommand->param.raw[0];
+                urgentIdCount = (length - 2) / 4;
+                for(uint32_t i = 0; i < urgentIdCount; i++) {
+                    urgentIds[i] = getU32(&pCommand->param.raw[1 + (4 * i)]);
+                }
+            }
+            break;
+        }
+        case COMMAND_SET_FLUSH_POLICY: {
+            if((length >= 6) && (((length - 6) % 4) == 0)) {
+                subscriber_t * pSub = &subscribers[commandSource];
+                uint32_t flaggedIds[FLUSH_POLICY_MAX_FLAGGED_IDS];
+                uint32_t flaggedCount = (length - 6) / 4;
+                if(flaggedCount > FLUSH_POLICY_MAX_FLAGGED_IDS) {
+                    break;
+                }
+                for(uint32_t i = 0; i < flaggedCount; i++) {
+                    flaggedIds[i] = getU32(&pCommand->param.raw[5 + (4 * i)]);
                 }
+                /* Send what is batched under the old policy first */
+                compactFlush(pSub);
+                flush_policy_configure(&pSub->flushPolicy, (FLUSH_MODE_T)pCommand->param.raw[0],
+                                       getU32(&pCommand->param.raw[1]), flaggedIds, flaggedCount);
             }
             break;
         }
+        case COMMAND_SET_FILTER: {
+            if((((length - 1) % 8) == 0) && (((length - 1) / 8) <= FILTER_MAX_ENTRIES)) {
+                subscriber_t * pSub = &subscribers[commandSource];
+                pSub->filterCount = (length - 1) / 8;
+                for(uint32_t i = 0; i < pSub->filterCount; i++) {
+                    pSub->filterIds[i] = getU32(&pCommand->param.raw[8 * i]);
+                    pSub->filterMasks[i] = getU32(&pCommand->param.raw[(8 * i) + 4]);
+                }
+            }
+            break;
+        }
+#if CONFIG_STREAM_RESUME
+        case COMMAND_RESUME: {
+            if((commandSource == COMMAND_CHANNEL_VENDOR) && ((SZ_CMD_RESUME == length) || (SZ_CMD_RESUME_OPTIONS == length))) {
+                const uint16_t sequence = (uint16_t)pCommand->param.raw[0] |
+                                          ((uint16_t)pCommand->param.raw[1] << 8);
+                resumeAcknowledge(sequence);
+                /*
+                 * Everything not acknowledged is sent again.  Rewound before
+                 * connectOn(), so the batch and the drop report it appends
+                 * follow the replay once.
+                 */
+                resumeSent = resumeAcked;
+                connectOn(COMMAND_CHANNEL_VENDOR, true, (SZ_CMD_RESUME_OPTIONS == length) ? pCommand->param.raw[2] : 0, true);
+                resumeDrain();
+            }
+            break;
+        }
+        case COMMAND_ACK: {
+            if((SZ_CMD_ACK == length) && bResumeSession) {
+                resumeAcknowledge((uint16_t)pCommand->param.raw[0] |
+                                  ((uint16_t)pCommand->param.raw[1] << 8));
+            }
+            break;
+        }
+#endif /* CONFIG_STREAM_RESUME */
         case COMMAND_CAN_SEND: {
             if((length >= SZ_COMMAND_OVERHEAD) && (length <= SZMAX_CMD_CAN_SEND)) {
-                tx_queue_element_t txElement;
-                uint8_t dlc = commandBuffer.param.raw[2];
-                if(dlc > 8) {
-                    /* classic CAN max payload is 8 bytes */
+                tx_queue_element_t * pElem;
+                uint8_t dlc = pCommand->param.raw[2];
+                if((dlc > 8) || (length < (SZ_COMMAND_OVERHEAD + (uint32_t)dlc))) {
+                    /* classic CAN max payload is 8 bytes, and it must be in the frame */
+                    break;
+                }
+                /* Built in the TX ring, the payload is copied once */
+                pElem = CAN_tx_claim();
+                if(pElem == NULL) {
                     break;
                 }
                 /* header */
-                txElement.header.Identifier = 0x07FF & ((uint16_t)commandBuffer.param.raw[0] +
-                                        (((uint16_t)commandBuffer.param.raw[1]) << 8));
-                txElement.header.IdType = FDCAN_STANDARD_ID;
-                txElement.header.TxFrameType = FDCAN_DATA_FRAME;
-                txElement.header.DataLength = ((uint32_t)dlc) << 16U;
-                txElement.header.ErrorStateIndicator = FDCAN_ESI_ACTIVE;
-                txElement.header.BitRateSwitch = FDCAN_BRS_OFF;
-                txElement.header.FDFormat = FDCAN_CLASSIC_CAN;
-                txElement.header.TxEventFifoControl = FDCAN_NO_TX_EVENTS;
-                txElement.header.MessageMarker = 0;
+                pElem->word0 = fdcan_elem_word0(0x07FF & ((uint16_t)pCommand->param.raw[0] +
+                                                (((uint16_t)pCommand->param.raw[1]) << 8)), 0);
+                pElem->word1 = fdcan_elem_word1(dlc, 0);
+                pElem->tag = 0;
                 /* payload */
-                for(uint32_t i = 0; i < dlc; i++) {
-                    txElement.data[i] = commandBuffer.param.raw[3 + i];
-                }
-                CAN_send(&txElement);
+                memcpy(pElem->data, &pCommand->param.raw[3], dlc);
+                CAN_tx_commit();
             }
             break;
         }
@@ -113,3 +737,479 @@ static int32_t commandHandler(uint32_t length)
 
     return 0;
 }
+
+
+/* Frame parser callback, on the task that reads the interface */
+static int32_t dispatchCommand(COMMAND_CHANNEL_T channel, uint8_t const * pPayload, uint32_t length)
+{
+#if !CONFIG_USB_CAN_REACTOR
+    /* CAN_SEND only touches the TX ring, run it here unless configuration is queued ahead */
+    if((pPayload[OFFSET_COMMAND_ID] == COMMAND_CAN_SEND) && (uxQueueMessagesWaiting(parserQHandle) == 0)) {
+        return commandHandler((command_t const *)pPayload, length);
+    }
+#endif
+    parserPost(PARSER_MSG_COMMAND, channel, 0, 0, pPayload, length);
+
+    return 0;
+}
+
+
+static int32_t vendorCommandHandler(uint8_t const * pPayload, uint32_t length)
+{
+    STATS_INC(usbOutFrames);
+    return dispatchCommand(COMMAND_CHANNEL_VENDOR, pPayload, length);
+}
+
+
+static int32_t cdcCommandHandler(uint8_t const * pPayload, uint32_t length)
+{
+    return dispatchCommand(COMMAND_CHANNEL_CDC, pPayload, length);
+}
+
+
+/*
+ * Neither interface blocks, a host that does not read only loses its own
+ * packets.  frames is the number of CAN frames in the packet.
+ */
+static void sendBinaryPacket(subscriber_t * pSub, uint8_t const * pFrame, uint32_t frameSize, uint32_t frames)
+{
+    uint8_t canDeviceToHost[CFG_TUD_VENDOR_EPSIZE];
+
+    if(pSub->channel == COMMAND_CHANNEL_CDC) {
+        if(!cdc_can_send_packet(pFrame, frameSize)) {
+            pSub->usbDrops += frames;
+        }
+        return;
+    }
+
+    /* byte 0 is the number of valid bytes in the packet */
+    memset(canDeviceToHost, 0, sizeof(canDeviceToHost));
+    canDeviceToHost[OFFSET_USB_BYTES_IN_PACKET] = (uint8_t)frameSize;
+    memcpy(&canDeviceToHost[OFFSET_TAG_SOF], pFrame, frameSize);
+
+#if CONFIG_STREAM_RESUME
+    if(bResumeSession) {
+        resumeAppend(canDeviceToHost, (uint16_t)canDeviceToHost[OFFSET_PKT_SEQ] |
+                                      ((uint16_t)canDeviceToHost[OFFSET_PKT_SEQ + 1] << 8), (uint8_t)frames);
+        return;
+    }
+#endif
+
+    // Send to WebUSB queue
+    LATENCY_PROBE_IN_PACKET((frames != 0) ? pSub->latencyCycles : 0);
+    if(!webusb_sendEp(&canDeviceToHost[0])) {
+        pSub->usbDrops += frames;
+    }
+}
+
+
+static bool sendExpressPacket(uint8_t const * pFrame, uint32_t frameSize)
+{
+    uint8_t canDeviceToHost[CFG_TUD_VENDOR_EPSIZE];
+
+    memset(canDeviceToHost, 0, sizeof(canDeviceToHost));
+    canDeviceToHost[OFFSET_USB_BYTES_IN_PACKET] = (uint8_t)frameSize;
+    memcpy(&canDeviceToHost[OFFSET_TAG_SOF], pFrame, frameSize);
+
+    return webusb_sendExpress(&canDeviceToHost[0]);
+}
+
+
+/* Express traffic is only defined for the vendor interface */
+static bool expressEnabled(void)
+{
+    return bConnected && subscribers[COMMAND_CHANNEL_VENDOR].bConnected;
+}
+
+
+/* ID with EXPRESS_ID_EXTENDED set for 29-bit IDs */
+static uint32_t frameKey(can_frame_t const * pFrame)
+{
+    return pFrame->id | (((pFrame->flags & CAN_FRAME_FLAG_EXTENDED) != 0) ? EXPRESS_ID_EXTENDED : 0);
+}
+
+
+static bool isUrgent(uint32_t key)
+{
+    for(uint32_t i = 0; i < urgentIdCount; i++) {
+        if(urgentIds[i] == key) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static bool subscriberAccepts(subscriber_t const * pSub, uint32_t key)
+{
+    if(pSub->filterCount == 0) {
+        return true;
+    }
+    for(uint32_t i = 0; i < pSub->filterCount; i++) {
+        if(((key ^ pSub->filterIds[i]) & pSub->filterMasks[i]) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static void compactFlush(subscriber_t * pSub)
+{
+    if(pSub->compactLength > (CAN_CODEC_BINARY_PAYLOAD_OFFSET + 1)) {
+        const uint32_t frameSize = can_codec_seal_binary(pSub->compactPacket,
+                                            pSub->compactLength - CAN_CODEC_BINARY_PAYLOAD_OFFSET,
+                                            pSub->packetSequence++, pSub->integrity);
+        sendBinaryPacket(pSub, pSub->compactPacket, frameSize, pSub->compactFrames);
+    }
+    pSub->compactLength = 0;
+    pSub->compactFrames = 0;
+    flush_policy_flushed(&pSub->flushPolicy);
+}
+
+
+/* Runs the one-shot timer up to the flush deadline, rounded up to a tick */
+static void flushTimerArm(subscriber_t * pSub, uint32_t remainingUs)
+{
+    TickType_t ticks = (TickType_t)((((uint64_t)remainingUs * configTICK_RATE_HZ) + 999999U) / 1000000U);
+
+    if(ticks == 0) {
+        ticks = 1;
+    }
+    pSub->bFlushTimerArmed = (pdPASS == xTimerChangePeriod(pSub->flushTimer, ticks, 0));
+}
+
+
+static void flushTimerCb(TimerHandle_t xTimer)
+{
+    subscriber_t const * pSub = (subscriber_t const *)pvTimerGetTimerID(xTimer);
+
+    parserSetPending(1UL << pSub->channel);
+}
+
+
+static void flushDeadline(subscriber_t * pSub)
+{
+    uint32_t remainingUs;
+
+    pSub->bFlushTimerArmed = false;
+    if(flush_policy_deadline(&pSub->flushPolicy, board_timestamp_us(), &remainingUs)) {
+        if(remainingUs == 0) {
+            compactFlush(pSub);
+        } else {
+            flushTimerArm(pSub, remainingUs);
+        }
+    }
+}
+
+
+/*
+ * Appends a frame to the compact batch.  The batch goes out when the next
+ * record does not fit, or when the flush policy says so.
+ */
+static bool compactAppend(subscriber_t * pSub, can_frame_t const * pFrame, bool more)
+{
+    const uint32_t maxLength = (pSub->channel == COMMAND_CHANNEL_CDC) ?
+                            CAN_CODEC_BINARY_MAX_SZ : (CFG_TUD_VENDOR_EPSIZE - SZ_USB_BYTES_IN_PACKET);
+    uint32_t used = 0;
+
+    for(uint32_t attempt = 0; (attempt < 2) && (used == 0); attempt++) {
+        if(pSub->compactLength == 0) {
+#if CONFIG_STREAM_RESUME
+            /* Every packet decodes on its own, as the host may resume at any of them */
+            if(bResumeSession && (pSub->channel == COMMAND_CHANNEL_VENDOR)) {
+                can_compact_reset(&pSub->compactEncoder, pSub->encodingOptions);
+            }
+#endif
+            pSub->compactPacket[CAN_CODEC_BINARY_PAYLOAD_OFFSET] = COMMAND_DEVICE_TO_HOST_COMPACT;
+            pSub->compactLength = CAN_CODEC_BINARY_PAYLOAD_OFFSET + 1;
+        }
+        used = can_compact_encode(&pSub->compactEncoder, &pSub->compactPacket[pSub->compactLength],
+                                  maxLength - SZ_TRAILER(pSub->integrity) - pSub->compactLength, pFrame);
+        if(used == 0) {
+            compactFlush(pSub);
+        }
+    }
+    pSub->compactLength += used;
+
+    if(used != 0) {
+        if(pSub->compactFrames == 0) {
+            LATENCY_PROBE_RX_KEEP(pSub->latencyCycles);
+        }
+        pSub->compactFrames++;
+        const uint32_t now = board_timestamp_us();
+        uint32_t remainingUs;
+        if(flush_policy_on_frame(&pSub->flushPolicy, now, pFrame, more)) {
+            compactFlush(pSub);
+        } else if(!pSub->bFlushTimerArmed && flush_policy_deadline(&pSub->flushPolicy, now, &remainingUs)) {
+            flushTimerArm(pSub, remainingUs);
+        }
+    }
+
+    return (used != 0);
+}
+
+
+/*
+ * Vendor-only paths: urgent IDs go to the express endpoint and the iso
+ * alternate setting replaces the bulk stream.  True when the frame is taken.
+ */
+static bool vendorDivert(can_frame_t const * pFrame, uint32_t key)
+{
+    if(expressEnabled() && (urgentIdCount > 0) && isUrgent(key)) {
+        uint8_t binaryFrame[CFG_TUD_VENDOR_EPSIZE - SZ_USB_BYTES_IN_PACKET];
+        const uint32_t frameSize = can_codec_encode_binary(binaryFrame, pFrame, expressSequence++,
+                                                           sizeof(binaryFrame),
+                                                           subscribers[COMMAND_CHANNEL_VENDOR].integrity);
+        if(!sendExpressPacket(binaryFrame, frameSize)) {
+            subscribers[COMMAND_CHANNEL_VENDOR].usbDrops++;
+        }
+        return true;
+    }
+
+#if CONFIG_ISO_STREAM
+    if(iso_stream_active()) {
+        /* Overrun is also reported in the iso packet flags */
+        if(!iso_stream_push(pFrame)) {
+            subscribers[COMMAND_CHANNEL_VENDOR].encoderDrops++;
+        }
+        return true;
+    }
+#endif /* CONFIG_ISO_STREAM */
+
+    return false;
+}
+
+
+/*
+ * Fans a received CAN frame out to every connected interface.  The full
+ * frame command is encoded once, each interface only patches in its own
+ * sequence.  Compact batches depend on the interface's ID table and stay
+ * per interface.
+ */
+static void canRxHandler(can_frame_t const * pFrame, bool more)
+{
+    uint8_t binaryFrame[CAN_CODEC_BINARY_MAX_SZ];
+    uint32_t frameSize = 0;
+    FRAME_INTEGRITY_T sealedIntegrity = FRAME_INTEGRITY_SUM8;
+    const uint32_t key = frameKey(pFrame);
+
+    rxQueueDrops += pFrame->sequence - rxNextSequence;
+    rxNextSequence = pFrame->sequence + 1;
+    LATENCY_PROBE_RX_ENCODER(pFrame->sequence);
+
+    for(uint32_t i = 0; i < N_COMMAND_CHANNEL; i++) {
+        subscriber_t * pSub = &subscribers[i];
+        const bool isVendor = (pSub->channel == COMMAND_CHANNEL_VENDOR);
+        const bool isBinary = isVendor || cdc_can_is_binary();
+        const uint32_t maxLength = isVendor ?
+                            (CFG_TUD_VENDOR_EPSIZE - SZ_USB_BYTES_IN_PACKET) : CAN_CODEC_BINARY_MAX_SZ;
+
+        if(!pSub->bConnected) {
+            continue;
+        }
+        if(!subscriberAccepts(pSub, key)) {
+            pSub->filteredFrames++;
+            continue;
+        }
+        if(isVendor && vendorDivert(pFrame, key)) {
+            continue;
+        }
+
+        if(isBinary && ((pSub->encodingOptions & CAN_COMPACT_OPT_ENABLE) != 0)) {
+            if(compactAppend(pSub, pFrame, more)) {
+                continue;
+            }
+            /* Record larger than a packet, fall back to a full frame command */
+        }
+
+        if(!isBinary) {
+            if(!cdc_can_send_frame(pFrame, pSub->packetSequence++, pSub->integrity)) {
+                pSub->usbDrops++;
+            }
+            continue;
+        }
+
+        /* Interfaces on another trailer get the frame sealed again */
+        if((frameSize == 0) || (sealedIntegrity != pSub->integrity)) {
+            frameSize = can_codec_encode_binary(binaryFrame, pFrame, 0, sizeof(binaryFrame), pSub->integrity);
+            sealedIntegrity = pSub->integrity;
+        }
+        LATENCY_PROBE_RX_KEEP(pSub->latencyCycles);
+        if(frameSize <= maxLength) {
+            can_codec_set_sequence(binaryFrame, frameSize, pSub->packetSequence++, pSub->integrity);
+            sendBinaryPacket(pSub, binaryFrame, frameSize, 1);
+        } else {
+            /* CAN-FD payload beyond one packet is truncated */
+            uint8_t truncated[CFG_TUD_VENDOR_EPSIZE - SZ_USB_BYTES_IN_PACKET];
+            const uint32_t truncatedSize = can_codec_encode_binary(truncated, pFrame,
+                                                                   pSub->packetSequence++, maxLength,
+                                                                   pSub->integrity);
+            sendBinaryPacket(pSub, truncated, truncatedSize, 1);
+            STATS_INC(canRxTruncated);
+        }
+    }
+}
+
+
+static void canTxHandler(tx_queue_element_t const * pElem)
+{
+    uint8_t binaryFrame[CAN_CODEC_BINARY_OVERHEAD + 1 + 4 + 1];
+    uint8_t * pPayload = &binaryFrame[CAN_CODEC_BINARY_PAYLOAD_OFFSET];
+    uint32_t msgId = fdcan_elem_id(pElem->word0);
+    uint32_t frameSize;
+
+    if(!expressEnabled() || ((expressEvents & EXPRESS_EVENT_TX_CONFIRM) == 0)) {
+        return;
+    }
+    if((pElem->word0 & FDCAN_ELEM_XTD) != 0) {
+        msgId |= EXPRESS_ID_EXTENDED;
+    }
+    pPayload[OFFSET_COMMAND_ID] = COMMAND_DEVICE_TO_HOST_TX_CONFIRM;
+    pPayload[OFFSET_MSGID] = (uint8_t)(msgId & 0xFF);
+    pPayload[OFFSET_MSGID + 1] = (uint8_t)((msgId >> 8) & 0xFF);
+    pPayload[OFFSET_MSGID + 2] = (uint8_t)((msgId >> 16) & 0xFF);
+    pPayload[OFFSET_MSGID + 3] = (uint8_t)((msgId >> 24) & 0xFF);
+    pPayload[OFFSET_DLC] = fdcan_elem_len(pElem->word1);
+    frameSize = can_codec_seal_binary(binaryFrame, 1 + 4 + 1, expressSequence++,
+                                      subscribers[COMMAND_CHANNEL_VENDOR].integrity);
+    (void)sendExpressPacket(binaryFrame, frameSize);
+}
+
+
+static void canStatusHandler(can_status_t const * pStatus)
+{
+    uint8_t binaryFrame[CAN_CODEC_BINARY_OVERHEAD + 1 + 3];
+    uint8_t * pPayload = &binaryFrame[CAN_CODEC_BINARY_PAYLOAD_OFFSET];
+    uint32_t frameSize;
+
+    if(!expressEnabled() || ((expressEvents & EXPRESS_EVENT_BUS_STATE) == 0)) {
+        return;
+    }
+    pPayload[0] = COMMAND_DEVICE_TO_HOST_BUS_STATE;
+    pPayload[1] = (uint8_t)pStatus->busState;
+    pPayload[2] = pStatus->txErrorCount;
+    pPayload[3] = pStatus->rxErrorCount;
+    frameSize = can_codec_seal_binary(binaryFrame, 1 + 3, expressSequence++,
+                                      subscribers[COMMAND_CHANNEL_VENDOR].integrity);
+    (void)sendExpressPacket(binaryFrame, frameSize);
+}
+
+
+static void hostAckSend(subscriber_t * pSub)
+{
+    uint8_t binaryFrame[CAN_CODEC_BINARY_OVERHEAD + 1 + 2 + 4 + 2];
+    uint8_t * pPayload = &binaryFrame[CAN_CODEC_BINARY_PAYLOAD_OFFSET];
+    frame_seq_report_t report;
+    uint32_t frameSize;
+
+    if(!pSub->bConnected || ((pSub->channel == COMMAND_CHANNEL_CDC) && !cdc_can_is_binary())) {
+        return;
+    }
+    taskENTER_CRITICAL();
+    report = hostAckReports[pSub->channel];
+    taskEXIT_CRITICAL();
+
+    pPayload[0] = COMMAND_DEVICE_TO_HOST_HOST_ACK;
+    pPayload[1] = (uint8_t)(report.expected & 0xFF);
+    pPayload[2] = (uint8_t)((report.expected >> 8) & 0xFF);
+    pPayload[3] = (uint8_t)(report.missing & 0xFF);
+    pPayload[4] = (uint8_t)((report.missing >> 8) & 0xFF);
+    pPayload[5] = (uint8_t)((report.missing >> 16) & 0xFF);
+    pPayload[6] = (uint8_t)((report.missing >> 24) & 0xFF);
+    pPayload[7] = (uint8_t)(report.freeBytes & 0xFF);
+    pPayload[8] = (uint8_t)((report.freeBytes >> 8) & 0xFF);
+    frameSize = can_codec_seal_binary(binaryFrame, 1 + 2 + 4 + 2, pSub->packetSequence++, pSub->integrity);
+    sendBinaryPacket(pSub, binaryFrame, frameSize, 0);
+}
+
+
+static void dropReportTimerCb(TimerHandle_t xTimer)
+{
+    (void)xTimer;
+
+    parserSetPending(PARSER_PENDING_DROP_REPORT);
+}
+
+
+/* Sent when the counters moved since the last report, or when forced */
+static void dropReportSend(subscriber_t * pSub, bool force)
+{
+    uint8_t binaryFrame[CAN_CODEC_BINARY_OVERHEAD + 1 + (6 * 4)];
+    uint8_t * pPayload = &binaryFrame[CAN_CODEC_BINARY_PAYLOAD_OFFSET];
+    uint32_t counters[6];
+    uint32_t drops;
+    uint32_t frameSize;
+
+    if(!pSub->bConnected || ((pSub->encodingOptions & CONNECT_OPT_DROP_REPORT) == 0) ||
+       ((pSub->channel == COMMAND_CHANNEL_CDC) && !cdc_can_is_binary())) {
+        return;
+    }
+    drops = CAN_get_rx_lost() + rxQueueDrops + pSub->encoderDrops + pSub->usbDrops;
+    if(!force && (rxNextSequence == pSub->reportedSequence) && (drops == pSub->reportedDrops)) {
+        return;
+    }
+    /* Frames still in the batch are counted as sent, so they go first */
+    compactFlush(pSub);
+
+    counters[0] = rxNextSequence;
+    counters[1] = CAN_get_rx_lost();
+    counters[2] = rxQueueDrops;
+    counters[3] = pSub->filteredFrames;
+    counters[4] = pSub->encoderDrops;
+    counters[5] = pSub->usbDrops;
+    pPayload[0] = COMMAND_DEVICE_TO_HOST_DROP_REPORT;
+    for(uint32_t i = 0; i < 6; i++) {
+        pPayload[1 + (4 * i)] = (uint8_t)(counters[i] & 0xFF);
+        pPayload[2 + (4 * i)] = (uint8_t)((counters[i] >> 8) & 0xFF);
+        pPayload[3 + (4 * i)] = (uint8_t)((counters[i] >> 16) & 0xFF);
+        pPayload[4 + (4 * i)] = (uint8_t)((counters[i] >> 24) & 0xFF);
+    }
+    frameSize = can_codec_seal_binary(binaryFrame, 1 + (6 * 4), pSub->packetSequence++, pSub->integrity);
+    sendBinaryPacket(pSub, binaryFrame, frameSize, 0);
+    /* Counters are cumulative, a lost report is covered by the next one */
+    pSub->reportedSequence = rxNextSequence;
+    pSub->reportedDrops = counters[1] + counters[2] + counters[4] + counters[5];
+}
+
+
+#if CONFIG_SOF_SYNC
+/*
+ * Reports the latest SOF latch in the bulk stream.  The host maps the
+ * frame number to its own time and fits offset and drift from the pairs.
+ */
+static void sofSyncTimerCb(TimerHandle_t xTimer)
+{
+    (void)xTimer;
+
+    parserSetPending(PARSER_PENDING_SOF_SYNC);
+}
+
+
+static void sofSyncSend(void)
+{
+    subscriber_t * pSub = &subscribers[COMMAND_CHANNEL_VENDOR];
+    uint8_t binaryFrame[CAN_CODEC_BINARY_OVERHEAD + 1 + 2 + 4];
+    uint8_t * pPayload = &binaryFrame[CAN_CODEC_BINARY_PAYLOAD_OFFSET];
+    uint16_t frameNumber;
+    uint32_t timeUs;
+    uint32_t frameSize;
+
+    if(!bConnected || !pSub->bConnected ||
+       !board_sof_sample(&frameNumber, &timeUs)) {
+        return;
+    }
+
+    pPayload[0] = COMMAND_DEVICE_TO_HOST_SOF_SYNC;
+    pPayload[1] = (uint8_t)(frameNumber & 0xFF);
+    pPayload[2] = (uint8_t)((frameNumber >> 8) & 0xFF);
+    pPayload[3] = (uint8_t)(timeUs & 0xFF);
+    pPayload[4] = (uint8_t)((timeUs >> 8) & 0xFF);
+    pPayload[5] = (uint8_t)((timeUs >> 16) & 0xFF);
+    pPayload[6] = (uint8_t)((timeUs >> 24) & 0xFF);
+    frameSize = can_codec_seal_binary(binaryFrame, 1 + 2 + 4, pSub->packetSequence++, pSub->integrity);
+    sendBinaryPacket(pSub, binaryFrame, frameSize, 0);
+}
+#endif /* CONFIG_SOF_SYNC */
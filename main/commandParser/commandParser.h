@@ -8,6 +8,14 @@
 #ifndef COMMANDPARSER_COMMANDPARSER_H_
 #define COMMANDPARSER_COMMANDPARSER_H_
 
+#include "stdint.h"
+#include "stdbool.h"
+
+/* Period of COMMAND_DEVICE_TO_HOST_DROP_REPORT while the counters move */
+#ifndef CONFIG_DROP_REPORT_MS
+#define CONFIG_DROP_REPORT_MS           (100)
+#endif /* CONFIG_DROP_REPORT_MS */
+
 #define OFFSET_COMMAND_ID               (0x00)
 #define OFFSET_MSGID                    (0x01)
 #define OFFSET_DLC                      (0x05)
@@ -18,12 +26,136 @@
 #define COMMAND_CAN_SEND                (0x10)
 #define SZMAX_CMD_CAN_SEND              (SZ_COMMAND_OVERHEAD + 8) // +8bytes payload
 
+/* COMMAND: SET_EXPRESS (0x02) ************************************************/
+/*
+ * Selects the traffic sent on the vendor interrupt IN (express) endpoint
+ *  Param0      : EXPRESS_EVENT_* mask
+ *  Param1..    : up to EXPRESS_MAX_URGENT_IDS urgent IDs, 4 bytes each,
+ *                with EXPRESS_ID_EXTENDED set for 29-bit IDs
+ * Express packets carry their own sequence, separate from the bulk stream.
+ */
+#define COMMAND_SET_EXPRESS             (0x02)
+#define EXPRESS_EVENT_TX_CONFIRM        (0x01)
+#define EXPRESS_EVENT_BUS_STATE         (0x02)
+#define EXPRESS_MAX_URGENT_IDS          (8)
+#define EXPRESS_ID_EXTENDED             (0x80000000UL)
+
+/* COMMAND: SET_FLUSH_POLICY (0x03) *******************************************/
+/*
+ * Selects when batched (compact) device to host packets go out
+ *  Param0      : FLUSH_MODE_T
+ *  Param1..4   : deadline in microseconds, resolution is one RTOS tick
+ *  Param5..    : up to FLUSH_POLICY_MAX_FLAGGED_IDS flagged IDs, 4 bytes
+ *                each, with EXPRESS_ID_EXTENDED set for 29-bit IDs
+ * Applies to the interface the command arrives on.
+ */
+#define COMMAND_SET_FLUSH_POLICY        (0x03)
+
+/* COMMAND: RESUME (0x04) / ACK (0x05) ****************************************/
+/*
+ * CONFIG_STREAM_RESUME only.  RESUME connects like CONNECT but keeps the
+ * stream: CAN is not stopped while the host is away and packets after the
+ * given sequence are sent again.  CONNECT or CONNECT 0x03 ends the session,
+ * a plain disconnect (0x02) leaves CAN running for the next RESUME.
+ *  RESUME      : Param0..1 last sequence received, Param2 (optional) options
+ *  ACK         : Param0..1 last sequence received, frees the ring up to it
+ * Compact batches restart the ID table in every packet, so any packet can
+ * be decoded on its own.
+ */
+#define COMMAND_RESUME                  (0x04)
+#define COMMAND_ACK                     (0x05)
+
+/* COMMAND: SET_FILTER (0x06) ************************************************/
+/*
+ * Selects the received frames sent to the interface the command arrives on
+ *  Param0..    : up to FILTER_MAX_ENTRIES (ID, mask) pairs, 4 bytes each,
+ *                IDs with EXPRESS_ID_EXTENDED set for 29-bit IDs
+ * A frame passes when (ID ^ filter ID) & mask is 0 for any pair.  No pairs
+ * passes everything, which is the state after reset.
+ */
+#define COMMAND_SET_FILTER              (0x06)
+#define FILTER_MAX_ENTRIES              (4)
+
 /* COMMAND: CAN_DEVICE_TO_HOST (0x20) ****************************************/
 #define COMMAND_DEVICE_TO_HOST_CAN_STANDARD     (0x20)
 #define COMMAND_DEVICE_TO_HOST_CAN_EXTENDED     (0x21)
 #define COMMAND_DEVICE_TO_HOST_FD_STANDARD      (0x22)
 #define COMMAND_DEVICE_TO_HOST_FD_EXTENDED      (0x23)
+/* Batch of canCompact records, negotiated with the CONNECT options */
+#define COMMAND_DEVICE_TO_HOST_COMPACT          (0x24)
+/* Frame queued to the CAN controller: msgID (with EXPRESS_ID_EXTENDED) + DLC */
+#define COMMAND_DEVICE_TO_HOST_TX_CONFIRM       (0x25)
+/* Bus error state changed: CAN_BUS_STATE_T + TX error count + RX error count */
+#define COMMAND_DEVICE_TO_HOST_BUS_STATE        (0x26)
+/* Latest SOF latch (CONFIG_SOF_SYNC): frame number (2) + device time in us (4) */
+#define COMMAND_DEVICE_TO_HOST_SOF_SYNC         (0x27)
+/*
+ * Host frame sequence state (CONNECT_OPT_HOST_ACK): next expected sequence
+ * (2) + missing mask (4), bit i is sequence expected - 1 - i + free bytes in
+ * the receive ring (2).  The host resends only the missing frames and keeps
+ * no more than the free bytes in flight.
+ */
+#define COMMAND_DEVICE_TO_HOST_HOST_ACK         (0x28)
+/*
+ * Receive path accounting (CONNECT_OPT_DROP_REPORT), 4 bytes each: next
+ * CAN frame sequence + RX FIFO overruns + frames lost on the RX queue +
+ * frames filtered + frames lost by the encoder + frames lost on the USB
+ * queue.  Counters are cumulative, and the report follows every frame it
+ * counts.  Between two reports, the frames received plus the filtered and
+ * lost ones equal the advance of the sequence.  An overrun loses one or
+ * more frames before they are numbered.
+ */
+#define COMMAND_DEVICE_TO_HOST_DROP_REPORT      (0x29)
+
+/* CONNECT OPTIONS ***********************************************************/
+/*
+ * Besides CAN_COMPACT_OPT_*, bits 4..5 select the FRAME_INTEGRITY_T trailer
+ * of the interface's frames in both directions, see DEVICE_FEATURE_*.
+ * Host frames with a weaker trailer are dropped until the next disconnect.
+ */
+#define CONNECT_OPT_INTEGRITY_SHIFT     (4)
+#define CONNECT_OPT_INTEGRITY_MASK      (0x30)
+/* Check the host frame sequence and send COMMAND_DEVICE_TO_HOST_HOST_ACK */
+#define CONNECT_OPT_HOST_ACK            (0x40)
+/* Send COMMAND_DEVICE_TO_HOST_DROP_REPORT on connect and when it changes */
+#define CONNECT_OPT_DROP_REPORT         (0x80)
+
+/* DEVICE STATUS (EP0 VENDOR_REQUEST_GET_STATUS) *****************************/
+#define DEVICE_STATUS_VERSION           (0x02)
+#define DEVICE_FEATURE_CRC16            (0x01)  //!< FRAME_INTEGRITY_CRC16 trailer
+#define DEVICE_FEATURE_CRC32            (0x02)  //!< FRAME_INTEGRITY_CRC32 trailer
+
+typedef struct __attribute__ ((packed)) {
+    uint8_t version;        // DEVICE_STATUS_VERSION
+    uint8_t connected;      // 1: CAN started on behalf of the host
+    uint8_t arbitBitrate;   // ARBIT_BITRATE_T
+    uint8_t dataBitrate;    // DATA_BITRATE_T
+    uint8_t busState;       // CAN_BUS_STATE_T
+    uint8_t txErrorCount;
+    uint8_t rxErrorCount;
+    uint8_t features;       // DEVICE_FEATURE_* (version 2, reserved before)
+} device_status_t;
+
+/* Interface a command arrived on, each connected one gets the CAN stream */
+typedef enum {
+    COMMAND_CHANNEL_VENDOR = 0,
+    COMMAND_CHANNEL_CDC,
+    N_COMMAND_CHANNEL
+} COMMAND_CHANNEL_T;
 
 void command_parser_init(void);
+void command_parser_receive(COMMAND_CHANNEL_T channel, uint8_t * pBuf, uint32_t len);
+void command_parser_connect(bool isConnect, uint8_t options);
+void command_parser_connect_on(COMMAND_CHANNEL_T channel, bool isConnect, uint8_t options);
+void command_parser_channel_closed(COMMAND_CHANNEL_T channel);
+bool command_parser_is_connected(void);
+bool command_parser_set_bitrate(uint8_t arbitBitrate, uint8_t dataBitrate);
+void command_parser_get_status(device_status_t * pStatus);
+/* Drop counters of COMMAND_DEVICE_TO_HOST_DROP_REPORT, summed over the interfaces */
+void command_parser_get_drops(uint32_t * pRxQueue, uint32_t * pEncoder, uint32_t * pUsb);
+void command_parser_tx_ready(void);
+/* Receive rings from the buffer arena, see frame_parser_set_ring() */
+bool command_parser_rings_idle(void);
+void command_parser_set_rings(uint8_t * pVendorRing, uint8_t * pCdcRing, uint32_t size);
 
 #endif /* COMMANDPARSER_COMMANDPARSER_H_ */
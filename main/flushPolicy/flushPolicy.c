@@ -0,0 +1,128 @@
+/*
+ * flushPolicy.c
+ *
+ *      Author: Sicris
+ */
+
+#include "string.h"
+#include "flushPolicy.h"
+
+/* Weight of a new inter-arrival gap in the running average, 1/2^n */
+#define AVG_GAP_SHIFT                   (3)
+
+
+void flush_policy_init(flush_policy_t * pCtx)
+{
+    memset(pCtx, 0, sizeof(flush_policy_t));
+    pCtx->mode = FLUSH_MODE_IDLE;
+}
+
+
+bool flush_policy_configure(flush_policy_t * pCtx, FLUSH_MODE_T mode, uint32_t deadlineUs,
+                            uint32_t const * pFlaggedIds, uint32_t flaggedCount)
+{
+    if((mode >= N_FLUSH_MODE) || (flaggedCount > FLUSH_POLICY_MAX_FLAGGED_IDS)) {
+        return false;
+    }
+    if((deadlineUs == 0) &&
+       ((mode == FLUSH_MODE_DEADLINE) || (mode == FLUSH_MODE_FLAGGED) || (mode == FLUSH_MODE_ADAPTIVE))) {
+        return false;
+    }
+
+    flush_policy_init(pCtx);
+    pCtx->mode = mode;
+    pCtx->deadlineUs = deadlineUs;
+    pCtx->flaggedCount = flaggedCount;
+    if(flaggedCount > 0) {
+        memcpy(pCtx->flaggedIds, pFlaggedIds, flaggedCount * sizeof(uint32_t));
+    }
+
+    return true;
+}
+
+
+static bool is_flagged(flush_policy_t const * pCtx, can_frame_t const * pFrame)
+{
+    const uint32_t key = pFrame->id |
+                    (((pFrame->flags & CAN_FRAME_FLAG_EXTENDED) != 0) ? FLUSH_POLICY_ID_EXTENDED : 0);
+
+    for(uint32_t i = 0; i < pCtx->flaggedCount; i++) {
+        if(pCtx->flaggedIds[i] == key) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static void track_arrival(flush_policy_t * pCtx, uint32_t nowUs)
+{
+    uint32_t gap;
+
+    if(pCtx->bArrival) {
+        gap = nowUs - pCtx->lastArrivalUs;
+        if(gap >= pCtx->avgGapUs) {
+            pCtx->avgGapUs += (gap - pCtx->avgGapUs) >> AVG_GAP_SHIFT;
+        } else {
+            pCtx->avgGapUs -= (pCtx->avgGapUs - gap) >> AVG_GAP_SHIFT;
+        }
+    } else {
+        /* Start from the slow side so the first frames go out at once */
+        pCtx->avgGapUs = pCtx->deadlineUs;
+        pCtx->bArrival = true;
+    }
+    pCtx->lastArrivalUs = nowUs;
+}
+
+
+bool flush_policy_on_frame(flush_policy_t * pCtx, uint32_t nowUs, can_frame_t const * pFrame, bool more)
+{
+    if(!pCtx->bPending) {
+        pCtx->bPending = true;
+        pCtx->oldestUs = nowUs;
+    }
+    track_arrival(pCtx, nowUs);
+
+    switch(pCtx->mode) {
+        case FLUSH_MODE_FULL:
+            return false;
+        case FLUSH_MODE_FLAGGED:
+            if(is_flagged(pCtx, pFrame)) {
+                return true;
+            }
+            break;
+        case FLUSH_MODE_ADAPTIVE:
+            if(!more && (pCtx->avgGapUs >= pCtx->deadlineUs)) {
+                return true;
+            }
+            break;
+        case FLUSH_MODE_DEADLINE:
+            break;
+        case FLUSH_MODE_IDLE:
+        default:
+            return !more;
+    }
+
+    return ((nowUs - pCtx->oldestUs) >= pCtx->deadlineUs);
+}
+
+
+bool flush_policy_deadline(flush_policy_t const * pCtx, uint32_t nowUs, uint32_t * pRemainingUs)
+{
+    uint32_t age;
+
+    if(!pCtx->bPending || (pCtx->mode == FLUSH_MODE_IDLE) || (pCtx->mode == FLUSH_MODE_FULL)) {
+        return false;
+    }
+    age = nowUs - pCtx->oldestUs;
+    *pRemainingUs = (age >= pCtx->deadlineUs) ? 0 : (pCtx->deadlineUs - age);
+
+    return true;
+}
+
+
+void flush_policy_flushed(flush_policy_t * pCtx)
+{
+    pCtx->bPending = false;
+}
@@ -0,0 +1,63 @@
+/*
+ * flushPolicy.h
+ *
+ *  Decides when a batch of device to host CAN records goes out, trading
+ *  latency against packets per second.  Time is passed in, in microseconds,
+ *  so the deadline logic runs the same against a virtual clock.
+ *
+ *    IDLE     : flush once no further frame is queued (default)
+ *    FULL     : flush full packets only
+ *    DEADLINE : flush a full packet, or once the oldest record is deadlineUs old
+ *    FLAGGED  : as DEADLINE, and at once after a flagged ID
+ *    ADAPTIVE : at once while frames arrive further apart than deadlineUs on
+ *               average, otherwise as DEADLINE
+ *
+ *      Author: Sicris
+ */
+
+#ifndef FLUSHPOLICY_FLUSHPOLICY_H_
+#define FLUSHPOLICY_FLUSHPOLICY_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "bsp/can_types.h"
+
+typedef enum {
+    FLUSH_MODE_IDLE = 0,
+    FLUSH_MODE_FULL,
+    FLUSH_MODE_DEADLINE,
+    FLUSH_MODE_FLAGGED,
+    FLUSH_MODE_ADAPTIVE,
+    N_FLUSH_MODE
+} FLUSH_MODE_T;
+
+#define FLUSH_POLICY_MAX_FLAGGED_IDS    (4)
+/* Set on flagged IDs that are 29-bit */
+#define FLUSH_POLICY_ID_EXTENDED        (0x80000000UL)
+
+typedef struct {
+    FLUSH_MODE_T mode;
+    uint32_t deadlineUs;
+    uint32_t flaggedIds[FLUSH_POLICY_MAX_FLAGGED_IDS];
+    uint32_t flaggedCount;
+    bool bPending;
+    uint32_t oldestUs;
+    bool bArrival;
+    uint32_t lastArrivalUs;
+    uint32_t avgGapUs;
+} flush_policy_t;
+
+void flush_policy_init(flush_policy_t * pCtx);
+bool flush_policy_configure(flush_policy_t * pCtx, FLUSH_MODE_T mode, uint32_t deadlineUs,
+                            uint32_t const * pFlaggedIds, uint32_t flaggedCount);
+
+/* Call after a record is added to the batch; true when the batch should go now */
+bool flush_policy_on_frame(flush_policy_t * pCtx, uint32_t nowUs, can_frame_t const * pFrame, bool more);
+
+/* True when a pending batch has a deadline; *pRemainingUs is the time left */
+bool flush_policy_deadline(flush_policy_t const * pCtx, uint32_t nowUs, uint32_t * pRemainingUs);
+
+/* Call whenever the batch went out, for any reason */
+void flush_policy_flushed(flush_policy_t * pCtx);
+
+#endif /* FLUSHPOLICY_FLUSHPOLICY_H_ */
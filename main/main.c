@@ -5,13 +5,28 @@
 #include "bsp/board_api.h"
 #include "webusb.h"
 #include "commandParser/commandParser.h"
+#include "gsUsb/gsUsb.h"
+#include "cdcCan/cdcCan.h"
+#include "bufferArena/bufferArena.h"
+#include "stats/taskProfile.h"
+#include "stats/bench.h"
 
 /*------------- MAIN -------------*/
 int main(void)
 {
     board_init();
     webusb_init();
+#if CONFIG_GS_USB
+    gs_usb_init();
+#else
     command_parser_init();
+    cdc_can_init();
+#endif
+    buffer_arena_init();
+    task_profile_init();
+#if CONFIG_BENCH
+    bench_init();
+#endif
 
     vTaskStartScheduler();
 }
@@ -0,0 +1,381 @@
+/*!
+ * \file bench.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "stm32g4xx_hal.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+#include "tusb.h"
+#include "bench.h"
+#include "bsp/ccm.h"
+#include "bsp/crc.h"
+#include "canCodec/canCodec.h"
+#include "usb_device/frameParser/frameParser.h"
+
+#if CONFIG_BENCH
+
+#define BENCH_STACK_SIZE                (configMINIMAL_STACK_SIZE * 2)
+#define BENCH_PAYLOAD_SIZE              (20)
+/* Fed as the USB class task does, one full speed packet at a time */
+#define BENCH_CHUNK_SIZE                (64)
+/* Longest frame there is, it has a CRC-32 trailer */
+#define RESYNC_LENGTH                   (FRAME_MAX_LENGTH | (FRAME_INTEGRITY_CRC32 << FRAME_LENGTH_INTEGRITY_SHIFT))
+
+TU_VERIFY_STATIC(sizeof(bench_block_t) == (8 + (N_BENCH * 8)), "bench_block_t is not packed");
+TU_VERIFY_STATIC((BENCH_STREAM_SIZE % BENCH_CHECK_BLOCK) == 0, "BENCH_STREAM_SIZE is not whole check blocks");
+TU_VERIFY_STATIC(FRAME_PARSER_RING_VALID(BENCH_STREAM_SIZE), "BENCH_STREAM_SIZE is not a valid parser ring");
+
+static bool bInit = false;
+static TaskHandle_t benchTask = NULL;
+static StaticTask_t benchTaskDef;
+static StackType_t benchStack[BENCH_STACK_SIZE];
+
+static bench_block_t results;
+static uint8_t stream[BENCH_STREAM_SIZE];
+static uint8_t parserRing[BENCH_STREAM_SIZE];
+static uint8_t commandBuffer[CONFIG_CMD_FRAME_SIZE];
+static frame_parser_t parser;
+static uint32_t rngState = 0x12345678UL;
+static SemaphoreHandle_t parserMutex = NULL;
+static StaticSemaphore_t parserMutexDef;
+static SemaphoreHandle_t callbackMutex = NULL;
+static StaticSemaphore_t callbackMutexDef;
+static SemaphoreHandle_t txMutex = NULL;
+static StaticSemaphore_t txMutexDef;
+static uint32_t crc32Table[256];
+static volatile uint32_t checkResult;
+
+
+static uint32_t rng(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+/* Fewest cycles of BENCH_REPEAT runs, interrupts held off for each */
+static void measure(BENCH_T bench, void (* run)(void), uint32_t units)
+{
+    uint32_t best = UINT32_MAX;
+
+    for(uint32_t i = 0; i < BENCH_REPEAT; i++) {
+        uint32_t start;
+        uint32_t cycles;
+
+        taskENTER_CRITICAL();
+        start = DWT->CYCCNT;
+        run();
+        cycles = DWT->CYCCNT - start;
+        taskEXIT_CRITICAL();
+        if(cycles < best) {
+            best = cycles;
+        }
+    }
+    results.results[bench].cycles = best;
+    results.results[bench].units = units;
+}
+
+
+static int32_t parserFrameCb(uint8_t const * pPayload, uint32_t length)
+{
+    (void) pPayload;
+    (void) length;
+    return 0;
+}
+
+
+static void parseStream(void)
+{
+    for(uint32_t offset = 0; offset < BENCH_STREAM_SIZE; offset += BENCH_CHUNK_SIZE) {
+        frame_parser_receive(&parser, &stream[offset], BENCH_CHUNK_SIZE);
+        frame_parser_process(&parser);
+    }
+}
+
+
+/* Whole frames, the tail padded with bytes that never start one */
+static void streamClean(void)
+{
+    uint8_t frame[CAN_CODEC_BINARY_PAYLOAD_OFFSET + BENCH_PAYLOAD_SIZE + SZ_TRAILER_MAX];
+    uint32_t length = 0;
+    uint16_t sequence = 0;
+
+    for(uint32_t i = 0; i < BENCH_PAYLOAD_SIZE; i++) {
+        frame[CAN_CODEC_BINARY_PAYLOAD_OFFSET + i] = (uint8_t)rng();
+    }
+    for(;;) {
+        const uint32_t size = can_codec_seal_binary(frame, BENCH_PAYLOAD_SIZE, sequence++, FRAME_INTEGRITY_SUM8);
+        if((length + size) > BENCH_STREAM_SIZE) {
+            break;
+        }
+        memcpy(&stream[length], frame, size);
+        length += size;
+    }
+    memset(&stream[length], 0, BENCH_STREAM_SIZE - length);
+}
+
+
+static void benchParser(void)
+{
+    frame_valid_cb_t validCb = {
+        .callback = parserFrameCb,
+        .pCommandBuffer = commandBuffer
+    };
+
+    frame_parser_init(&parser, &validCb);
+    frame_parser_set_ring(&parser, parserRing, sizeof(parserRing));
+
+    streamClean();
+    measure(BENCH_PARSE_CLEAN, parseStream, BENCH_STREAM_SIZE);
+
+    for(uint32_t i = 0; i < BENCH_STREAM_SIZE; i++) {
+        stream[i] = (uint8_t)rng();
+    }
+    measure(BENCH_PARSE_NOISE, parseStream, BENCH_STREAM_SIZE);
+
+    /* Every SOF announces a frame that never checks out */
+    memset(stream, 0, sizeof(stream));
+    for(uint32_t i = 0; (i + 3) <= BENCH_STREAM_SIZE; i += 3) {
+        stream[i] = TAG_SOF;
+        stream[i + 1] = (uint8_t)(RESYNC_LENGTH & 0xFF);
+        stream[i + 2] = (uint8_t)(RESYNC_LENGTH >> 8);
+    }
+    measure(BENCH_PARSE_RESYNC, parseStream, BENCH_STREAM_SIZE);
+}
+
+
+/* What a CAN_SEND frame paid before the parsers ran lock free on the CAN
+ * task and the TX ring went lock free: the frame parser mutex around
+ * processing, the command parser one around the callback and the TX ring
+ * mutex around claim/commit.  A received CAN frame paid the callback one
+ * alone. */
+static void commandLocks(void)
+{
+    for(uint32_t i = 0; i < BENCH_CALLS; i++) {
+        xSemaphoreTakeRecursive(parserMutex, portMAX_DELAY);
+        xSemaphoreTakeRecursive(callbackMutex, portMAX_DELAY);
+        xSemaphoreTake(txMutex, portMAX_DELAY);
+        xSemaphoreGive(txMutex);
+        xSemaphoreGiveRecursive(callbackMutex);
+        xSemaphoreGiveRecursive(parserMutex);
+    }
+}
+
+
+static void benchLocks(void)
+{
+    parserMutex = xSemaphoreCreateRecursiveMutexStatic(&parserMutexDef);
+    configASSERT(parserMutex);
+    callbackMutex = xSemaphoreCreateRecursiveMutexStatic(&callbackMutexDef);
+    configASSERT(callbackMutex);
+    txMutex = xSemaphoreCreateMutexStatic(&txMutexDef);
+    configASSERT(txMutex);
+
+    measure(BENCH_COMMAND_LOCKS, commandLocks, BENCH_CALLS);
+}
+
+
+static void checkStream(FRAME_INTEGRITY_T integrity)
+{
+    uint32_t check = frame_check_start(integrity);
+
+    for(uint32_t offset = 0; offset < BENCH_STREAM_SIZE; offset += BENCH_CHECK_BLOCK) {
+        check = frame_check_update(integrity, check, &stream[offset], BENCH_CHECK_BLOCK);
+    }
+    checkResult = check;
+}
+
+
+static void checkSum8(void)
+{
+    checkStream(FRAME_INTEGRITY_SUM8);
+}
+
+
+static void checkCrc16(void)
+{
+    checkStream(FRAME_INTEGRITY_CRC16);
+}
+
+
+static void checkCrc32(void)
+{
+    checkStream(FRAME_INTEGRITY_CRC32);
+}
+
+
+/* The software alternative to the CRC unit, one 1 KB table lookup per byte */
+static void checkCrc32Table(void)
+{
+    uint32_t crc = CRC32_INIT_VALUE;
+
+    for(uint32_t offset = 0; offset < BENCH_STREAM_SIZE; offset += BENCH_CHECK_BLOCK) {
+        for(uint32_t i = 0; i < BENCH_CHECK_BLOCK; i++) {
+            crc = (crc << 8) ^ crc32Table[(crc >> 24) ^ stream[offset + i]];
+        }
+    }
+    checkResult = crc;
+}
+
+
+static void benchChecks(void)
+{
+    uint32_t hardware;
+
+    for(uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b << 24;
+        for(uint32_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000UL) ? ((crc << 1) ^ 0x04C11DB7UL) : (crc << 1);
+        }
+        crc32Table[b] = crc;
+    }
+    for(uint32_t i = 0; i < BENCH_STREAM_SIZE; i++) {
+        stream[i] = (uint8_t)rng();
+    }
+
+    measure(BENCH_CHECK_SUM8, checkSum8, BENCH_STREAM_SIZE);
+    measure(BENCH_CHECK_CRC16, checkCrc16, BENCH_STREAM_SIZE);
+    measure(BENCH_CHECK_CRC32, checkCrc32, BENCH_STREAM_SIZE);
+    hardware = checkResult;
+    measure(BENCH_CHECK_CRC32_TABLE, checkCrc32Table, BENCH_STREAM_SIZE);
+    configASSERT(checkResult == hardware);
+}
+
+
+/*
+ * One body, placed in flash and in CCM SRAM by the wrappers below.  noipa
+ * keeps the compiler from folding the two into one.
+ */
+static inline __attribute__ ((always_inline)) uint32_t sumBlock(uint8_t const * pBuf, uint32_t length)
+{
+    uint32_t sum = 0;
+
+    while(length > 0) {
+        sum += *pBuf++;
+        length--;
+    }
+    return sum;
+}
+
+
+static __attribute__ ((noipa)) uint32_t sumFlash(uint8_t const * pBuf, uint32_t length)
+{
+    return sumBlock(pBuf, length);
+}
+
+
+static CCM_CODE __attribute__ ((noipa)) uint32_t sumCcm(uint8_t const * pBuf, uint32_t length)
+{
+    return sumBlock(pBuf, length);
+}
+
+
+static void codeFlash(void)
+{
+    for(uint32_t offset = 0; offset < BENCH_STREAM_SIZE; offset += BENCH_CHECK_BLOCK) {
+        checkResult = sumFlash(&stream[offset], BENCH_CHECK_BLOCK);
+    }
+}
+
+
+static void codeCcm(void)
+{
+    for(uint32_t offset = 0; offset < BENCH_STREAM_SIZE; offset += BENCH_CHECK_BLOCK) {
+        checkResult = sumCcm(&stream[offset], BENCH_CHECK_BLOCK);
+    }
+}
+
+
+/*
+ * One call straight after the ART instruction and data caches are reset,
+ * as after other code ran, the fewest cycles of BENCH_REPEAT
+ */
+static void measureCold(BENCH_T bench, uint32_t (* sum)(uint8_t const *, uint32_t))
+{
+    uint32_t best = UINT32_MAX;
+
+    for(uint32_t i = 0; i < BENCH_REPEAT; i++) {
+        uint32_t start;
+        uint32_t cycles;
+
+        taskENTER_CRITICAL();
+        __HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+        __HAL_FLASH_DATA_CACHE_DISABLE();
+        __HAL_FLASH_INSTRUCTION_CACHE_RESET();
+        __HAL_FLASH_DATA_CACHE_RESET();
+        __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+        __HAL_FLASH_DATA_CACHE_ENABLE();
+        __DSB();
+        __ISB();
+        start = DWT->CYCCNT;
+        checkResult = sum(stream, BENCH_CHECK_BLOCK);
+        cycles = DWT->CYCCNT - start;
+        taskEXIT_CRITICAL();
+        if(cycles < best) {
+            best = cycles;
+        }
+    }
+    results.results[bench].cycles = best;
+    results.results[bench].units = BENCH_CHECK_BLOCK;
+}
+
+
+static void benchCode(void)
+{
+    measure(BENCH_CODE_FLASH, codeFlash, BENCH_STREAM_SIZE);
+    measureCold(BENCH_CODE_FLASH_COLD, sumFlash);
+    measure(BENCH_CODE_CCM, codeCcm, BENCH_STREAM_SIZE);
+    measureCold(BENCH_CODE_CCM_COLD, sumCcm);
+}
+
+
+static void bench_task(void * pxParam)
+{
+    (void) pxParam;
+
+    benchParser();
+    benchLocks();
+    benchChecks();
+    benchCode();
+
+    taskENTER_CRITICAL();
+    results.count = N_BENCH;
+    taskEXIT_CRITICAL();
+    vTaskSuspend(NULL);
+}
+
+
+void bench_init(void)
+{
+    if(!bInit) {
+        results.version = BENCH_BLOCK_VERSION;
+        results.cpuHz = SystemCoreClock;
+        benchTask = xTaskCreateStatic(
+                            bench_task,
+                            "bench",
+                            BENCH_STACK_SIZE,
+                            NULL,
+                            tskIDLE_PRIORITY + 1,
+                            benchStack,
+                            &benchTaskDef
+                            );
+        configASSERT(benchTask);
+
+        bInit = true;
+    }
+}
+
+
+void bench_get(bench_block_t * pBlock)
+{
+    taskENTER_CRITICAL();
+    memcpy(pBlock, &results, sizeof(results));
+    taskEXIT_CRITICAL();
+}
+
+#endif /* CONFIG_BENCH */
@@ -0,0 +1,66 @@
+/*!
+ * \file bench.h
+ *
+ * On-target micro benchmarks timed with the DWT cycle counter.  With
+ * CONFIG_BENCH 1 a low priority task runs them once after start up and
+ * VENDOR_REQUEST_GET_BENCH returns the results, empty until it is done.
+ *
+ * Each result is the fewest cycles over BENCH_REPEAT runs, each run in a
+ * critical section, and the units (bytes or calls) one run covers.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "stdint.h"
+
+#ifndef CONFIG_BENCH
+#define CONFIG_BENCH                    (0)
+#endif /* CONFIG_BENCH */
+
+#define BENCH_BLOCK_VERSION             (1)
+#define BENCH_REPEAT                    (8)
+/* Bytes of parser input per run, several USB packets */
+#define BENCH_STREAM_SIZE               (1024)
+/* Bytes per frame check call, a full speed packet */
+#define BENCH_CHECK_BLOCK               (64)
+/* Calls per run for the per call benchmarks */
+#define BENCH_CALLS                     (64)
+
+typedef enum {
+    BENCH_PARSE_CLEAN = 0,              // frame parser, 20 byte payload frames, per byte
+    BENCH_PARSE_NOISE,                  // frame parser, random bytes, per byte
+    BENCH_PARSE_RESYNC,                 // frame parser, SOF and a long length over and over, per byte
+    BENCH_COMMAND_LOCKS,                // the three mutex take/give pairs a CAN_SEND frame no longer pays, per frame
+    BENCH_CHECK_SUM8,                   // frame check, 8-bit sum, per byte
+    BENCH_CHECK_CRC16,                  // frame check, CRC unit CRC-16, per byte
+    BENCH_CHECK_CRC32,                  // frame check, CRC unit CRC-32, per byte
+    BENCH_CHECK_CRC32_TABLE,            // byte wise table CRC-32 in software, per byte
+    BENCH_CODE_FLASH,                   // byte sum run from flash, ART cache warm, per byte
+    BENCH_CODE_FLASH_COLD,              // the same, ART caches reset before each call, per byte
+    BENCH_CODE_CCM,                     // the same code run from CCM SRAM, per byte
+    BENCH_CODE_CCM_COLD,                // from CCM SRAM, ART caches reset before each call, per byte
+    N_BENCH
+} BENCH_T;
+
+typedef struct __attribute__ ((packed)) {
+    uint32_t cycles;
+    uint32_t units;
+} bench_result_t;
+
+/* VENDOR_REQUEST_GET_BENCH reply */
+typedef struct __attribute__ ((packed)) {
+    uint8_t version;                    // BENCH_BLOCK_VERSION
+    uint8_t count;                      // N_BENCH once the run is done, 0 before
+    uint16_t reserved;
+    uint32_t cpuHz;
+    bench_result_t results[N_BENCH];
+} bench_block_t;
+
+#if CONFIG_BENCH
+void bench_init(void);
+void bench_get(bench_block_t * pBlock);
+#endif /* CONFIG_BENCH */
+
+#endif /* BENCH_H */
@@ -0,0 +1,170 @@
+/*!
+ * \file latency.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "tusb.h"
+#include "latency.h"
+#include "bsp/can.h"
+#include "usb_device/webusb.h"
+#include "bufferArena/bufferArena.h"
+
+#if CONFIG_LATENCY_PROBES
+
+#define RING_MASK                       (LATENCY_RING_SIZE - 1)
+
+TU_VERIFY_STATIC(sizeof(latency_block_t) == (8 + (N_LATENCY_STAGE * 4 * (1 + LATENCY_BUCKETS))), "latency_block_t is not packed");
+TU_VERIFY_STATIC((LATENCY_RING_SIZE & RING_MASK) == 0, "LATENCY_RING_SIZE is not a power of two");
+/* The arena bounds every queue, so a ring slot is never reused while in flight */
+TU_VERIFY_STATIC((CONFIG_BUFFER_ARENA_SIZE / sizeof(can_frame_t)) < LATENCY_RING_SIZE, "RX queue outgrows the latency ring");
+TU_VERIFY_STATIC((CONFIG_BUFFER_ARENA_SIZE / sizeof(tx_queue_element_t)) < LATENCY_RING_SIZE, "TX ring outgrows the latency ring");
+TU_VERIFY_STATIC(((CONFIG_BUFFER_ARENA_SIZE / WEBUSB_TX_ELEMENT_SZ) + (CFG_TUD_VENDOR_TX_BUFSIZE / WEBUSB_TX_ELEMENT_SZ) + 1) <= LATENCY_RING_SIZE,
+                 "vendor IN queue outgrows the latency ring");
+
+volatile uint32_t latencyIsrCycles = 0;
+uint32_t latencyFrameCycles = 0;
+uint32_t latencyPacketCycles = 0;
+volatile uint32_t latencyOutCycles = 0;
+
+static latency_histogram_t histograms[N_LATENCY_STAGE];
+static uint32_t rxCycles[LATENCY_RING_SIZE];
+static uint32_t txCycles[LATENCY_RING_SIZE];
+/* Vendor IN packets, taken <= written <= completed in order, 0: no frame */
+static uint32_t inCycles[LATENCY_RING_SIZE];
+static uint32_t inTaken = 0;
+static uint32_t inWritten = 0;
+static uint32_t inCompleted = 0;
+
+
+/* Any context, the FDCAN and USB interrupts share one priority */
+static void record(LATENCY_STAGE_T stage, uint32_t cycles)
+{
+    latency_histogram_t * pHistogram = &histograms[stage];
+    uint32_t bucket = (cycles == 0) ? 0 : (31U - __CLZ(cycles));
+    UBaseType_t savedMask;
+
+    if(bucket >= LATENCY_BUCKETS) {
+        bucket = LATENCY_BUCKETS - 1;
+    }
+    savedMask = taskENTER_CRITICAL_FROM_ISR();
+    pHistogram->counts[bucket]++;
+    if(cycles > pHistogram->maxCycles) {
+        pHistogram->maxCycles = cycles;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(savedMask);
+}
+
+
+void latency_rx_queued(uint32_t sequence)
+{
+    const uint32_t now = DWT->CYCCNT;
+
+    record(LATENCY_STAGE_RX_QUEUE, now - latencyIsrCycles);
+    rxCycles[sequence & RING_MASK] = now;
+}
+
+
+void latency_rx_encoder(uint32_t sequence)
+{
+    const uint32_t now = DWT->CYCCNT;
+
+    record(LATENCY_STAGE_RX_ENCODER, now - rxCycles[sequence & RING_MASK]);
+    latencyFrameCycles = now;
+}
+
+
+void latency_in_sent(bool taken, bool written)
+{
+    const uint32_t now = DWT->CYCCNT;
+    UBaseType_t savedMask = taskENTER_CRITICAL_FROM_ISR();
+
+    if(taken) {
+        inCycles[inTaken & RING_MASK] = latencyPacketCycles;
+        inTaken++;
+    }
+    latencyPacketCycles = 0;
+    /* The FIFO gets the oldest packet taken */
+    if(written && (inWritten != inTaken)) {
+        uint32_t * pCycles = &inCycles[inWritten & RING_MASK];
+        if(*pCycles != 0) {
+            record(LATENCY_STAGE_RX_SUBMIT, now - *pCycles);
+            *pCycles = now;
+        }
+        inWritten++;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(savedMask);
+}
+
+
+void latency_in_completed(void)
+{
+    const uint32_t now = DWT->CYCCNT;
+    UBaseType_t savedMask = taskENTER_CRITICAL_FROM_ISR();
+
+    if(inCompleted != inWritten) {
+        const uint32_t cycles = inCycles[inCompleted & RING_MASK];
+        if(cycles != 0) {
+            record(LATENCY_STAGE_RX_COMPLETE, now - cycles);
+        }
+        inCompleted++;
+    }
+    taskEXIT_CRITICAL_FROM_ISR(savedMask);
+}
+
+
+void latency_in_untracked(void)
+{
+    UBaseType_t savedMask = taskENTER_CRITICAL_FROM_ISR();
+
+    /* Only written while nothing waits in the queue */
+    inCycles[inTaken & RING_MASK] = 0;
+    inTaken++;
+    inWritten = inTaken;
+    taskEXIT_CRITICAL_FROM_ISR(savedMask);
+}
+
+
+void latency_in_flushed(void)
+{
+    UBaseType_t savedMask = taskENTER_CRITICAL_FROM_ISR();
+
+    inTaken = inWritten;
+    taskEXIT_CRITICAL_FROM_ISR(savedMask);
+}
+
+
+void latency_tx_queued(uint32_t index)
+{
+    const uint32_t now = DWT->CYCCNT;
+
+    record(LATENCY_STAGE_TX_RING, now - latencyOutCycles);
+    txCycles[index & RING_MASK] = now;
+}
+
+
+void latency_tx_fifo(uint32_t index)
+{
+    record(LATENCY_STAGE_TX_FIFO, DWT->CYCCNT - txCycles[index & RING_MASK]);
+}
+
+
+void latency_get(latency_block_t * pBlock, bool reset)
+{
+    pBlock->version = LATENCY_BLOCK_VERSION;
+    pBlock->stageCount = N_LATENCY_STAGE;
+    pBlock->bucketCount = LATENCY_BUCKETS;
+    pBlock->reserved = 0;
+    pBlock->cpuHz = SystemCoreClock;
+
+    taskENTER_CRITICAL();
+    memcpy(pBlock->stages, histograms, sizeof(histograms));
+    if(reset) {
+        memset(histograms, 0, sizeof(histograms));
+    }
+    taskEXIT_CRITICAL();
+}
+
+#endif /* CONFIG_LATENCY_PROBES */
@@ -0,0 +1,118 @@
+/*!
+ * \file latency.h
+ *
+ * Pipeline latency probes.  Each stage takes a DWT cycle stamp; the time
+ * since the previous stage goes into a log2 histogram per stage, read and
+ * reset by the host with VENDOR_REQUEST_GET_LATENCY.
+ *
+ *    RX: FDCAN interrupt entry > RX queue > encoder > IN endpoint FIFO > IN complete
+ *    TX: OUT packet read > TX ring > FDCAN TX FIFO
+ *
+ * Frames are matched across the RX queue and the TX ring by their position,
+ * packets through the vendor IN queue by order.  A packet is timed from its
+ * oldest frame.  Express, iso and CDC packets are not followed past the
+ * encoder.
+ *
+ * With CONFIG_LATENCY_PROBES 0 the probes expand to nothing.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "stm32g4xx_hal.h"
+
+#ifndef CONFIG_LATENCY_PROBES
+#define CONFIG_LATENCY_PROBES           (0)
+#endif /* CONFIG_LATENCY_PROBES */
+
+#define LATENCY_BLOCK_VERSION           (1)
+/* Bucket n counts [2^n, 2^(n+1)) cycles, the last one everything above */
+#define LATENCY_BUCKETS                 (24)
+/* Frames or packets in flight, power of two */
+#define LATENCY_RING_SIZE               (64)
+
+typedef enum {
+    LATENCY_STAGE_RX_QUEUE = 0,         // FDCAN interrupt entry to RX queue
+    LATENCY_STAGE_RX_ENCODER,           // RX queue to the encoder
+    LATENCY_STAGE_RX_SUBMIT,            // encoder to IN endpoint FIFO
+    LATENCY_STAGE_RX_COMPLETE,          // IN endpoint FIFO to transfer complete
+    LATENCY_STAGE_TX_RING,              // OUT packet read to TX ring
+    LATENCY_STAGE_TX_FIFO,              // TX ring to FDCAN TX FIFO
+    N_LATENCY_STAGE
+} LATENCY_STAGE_T;
+
+typedef struct __attribute__ ((packed)) {
+    uint32_t maxCycles;
+    uint32_t counts[LATENCY_BUCKETS];
+} latency_histogram_t;
+
+/* VENDOR_REQUEST_GET_LATENCY reply */
+typedef struct __attribute__ ((packed)) {
+    uint8_t version;                    // LATENCY_BLOCK_VERSION
+    uint8_t stageCount;                 // N_LATENCY_STAGE
+    uint8_t bucketCount;                // LATENCY_BUCKETS
+    uint8_t reserved;
+    uint32_t cpuHz;                     // cycles per second
+    latency_histogram_t stages[N_LATENCY_STAGE];
+} latency_block_t;
+
+#if CONFIG_LATENCY_PROBES
+extern volatile uint32_t latencyIsrCycles;
+extern uint32_t latencyFrameCycles;
+extern uint32_t latencyPacketCycles;
+extern volatile uint32_t latencyOutCycles;
+
+/* FDCAN1 interrupt entry */
+#define LATENCY_PROBE_ISR_ENTER()               (latencyIsrCycles = DWT->CYCCNT)
+/* Frame sequence put on the RX queue, from the interrupt */
+#define LATENCY_PROBE_RX_QUEUED(sequence)       latency_rx_queued(sequence)
+/* Frame sequence taken by the encoder, remembered in latencyFrameCycles */
+#define LATENCY_PROBE_RX_ENCODER(sequence)      latency_rx_encoder(sequence)
+/* Saves the encoder stamp of the current frame */
+#define LATENCY_PROBE_RX_KEEP(lvalue)           ((lvalue) = latencyFrameCycles)
+/* Encoder stamp of the next packet for webusb_sendEp(), 0 when it holds no frame */
+#define LATENCY_PROBE_IN_PACKET(cycles)         (latencyPacketCycles = (cycles))
+/* Vendor IN queue: packet taken and possibly written, written, completed */
+#define LATENCY_PROBE_IN_SENT(taken, written)   latency_in_sent(taken, written)
+#define LATENCY_PROBE_IN_WRITTEN()              latency_in_sent(false, true)
+#define LATENCY_PROBE_IN_COMPLETED()            latency_in_completed()
+/* Packet written to the endpoint FIFO without going through the queue */
+#define LATENCY_PROBE_IN_UNTRACKED()            latency_in_untracked()
+/* Vendor IN queue reset */
+#define LATENCY_PROBE_IN_FLUSHED()              latency_in_flushed()
+/* Host OUT packet read, any interface */
+#define LATENCY_PROBE_OUT_READ()                (latencyOutCycles = DWT->CYCCNT)
+/* TX ring slot committed, written to the TX FIFO */
+#define LATENCY_PROBE_TX_QUEUED(index)          latency_tx_queued(index)
+#define LATENCY_PROBE_TX_FIFO(index)            latency_tx_fifo(index)
+
+void latency_rx_queued(uint32_t sequence);
+void latency_rx_encoder(uint32_t sequence);
+void latency_in_sent(bool taken, bool written);
+void latency_in_completed(void);
+void latency_in_untracked(void);
+void latency_in_flushed(void);
+void latency_tx_queued(uint32_t index);
+void latency_tx_fifo(uint32_t index);
+/* Copy of the histograms, cleared afterwards when reset is set */
+void latency_get(latency_block_t * pBlock, bool reset);
+#else
+#define LATENCY_PROBE_ISR_ENTER()
+#define LATENCY_PROBE_RX_QUEUED(sequence)
+#define LATENCY_PROBE_RX_ENCODER(sequence)
+#define LATENCY_PROBE_RX_KEEP(lvalue)
+#define LATENCY_PROBE_IN_PACKET(cycles)
+#define LATENCY_PROBE_IN_SENT(taken, written)
+#define LATENCY_PROBE_IN_WRITTEN()
+#define LATENCY_PROBE_IN_COMPLETED()
+#define LATENCY_PROBE_IN_UNTRACKED()
+#define LATENCY_PROBE_IN_FLUSHED()
+#define LATENCY_PROBE_OUT_READ()
+#define LATENCY_PROBE_TX_QUEUED(index)
+#define LATENCY_PROBE_TX_FIFO(index)
+#endif /* CONFIG_LATENCY_PROBES */
+
+#endif /* LATENCY_H */
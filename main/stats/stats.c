@@ -0,0 +1,43 @@
+/*!
+ * \file stats.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "tusb.h"
+#include "stats.h"
+#include "bsp/board_api.h"
+#include "bsp/can.h"
+#include "commandParser/commandParser.h"
+
+#define STATS_COUNT_FIELD(name, description)    + 1
+#define STATS_FIELD_COUNT               (0 STATS_FIELDS(STATS_COUNT_FIELD))
+
+TU_VERIFY_STATIC(sizeof(stats_block_t) == (4 + (4 * STATS_FIELD_COUNT)), "stats_block_t is not packed");
+
+stats_counters_t deviceStats;
+
+
+void stats_snapshot(stats_block_t * pBlock)
+{
+    can_status_t status;
+    uint32_t rxQueueDrops;
+    uint32_t encoderDrops;
+    uint32_t usbDrops;
+
+    CAN_get_status(&status);
+    command_parser_get_drops(&rxQueueDrops, &encoderDrops, &usbDrops);
+    deviceStats.uptimeUs = board_timestamp_us();
+    deviceStats.errTxCount = status.txErrorCount;
+    deviceStats.errRxCount = status.rxErrorCount;
+    deviceStats.dropRxFifo = CAN_get_rx_lost();
+    deviceStats.dropRxQueue = rxQueueDrops;
+    deviceStats.dropEncoder = encoderDrops;
+    deviceStats.dropUsb = usbDrops;
+
+    pBlock->version = STATS_BLOCK_VERSION;
+    pBlock->fieldCount = STATS_FIELD_COUNT;
+    pBlock->size = sizeof(stats_block_t);
+#define STATS_COPY_FIELD(name, description)     pBlock->name = deviceStats.name;
+    STATS_FIELDS(STATS_COPY_FIELD)
+#undef STATS_COPY_FIELD
+}
@@ -0,0 +1,45 @@
+/*!
+ * \file stats.h
+ *
+ * Device statistics.  Counters are bumped where the event happens, each by
+ * a single context, and read without locks; values derived from other
+ * modules are filled in by stats_snapshot().
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef STATS_H
+#define STATS_H
+
+#include "stdint.h"
+#include "statsFields.h"
+
+typedef struct {
+#define STATS_COUNTER(name, description)    volatile uint32_t name;
+    STATS_FIELDS(STATS_COUNTER)
+#undef STATS_COUNTER
+} stats_counters_t;
+
+/* VENDOR_REQUEST_GET_STATS reply */
+typedef struct __attribute__ ((packed)) {
+    uint8_t version;        // STATS_BLOCK_VERSION
+    uint8_t fieldCount;     // uint32_t fields that follow
+    uint16_t size;          // bytes, this header included
+#define STATS_BLOCK_FIELD(name, description)    uint32_t name;
+    STATS_FIELDS(STATS_BLOCK_FIELD)
+#undef STATS_BLOCK_FIELD
+} stats_block_t;
+
+extern stats_counters_t deviceStats;
+
+#define STATS_ADD(name, n)              (deviceStats.name += (uint32_t)(n))
+#define STATS_INC(name)                 STATS_ADD(name, 1)
+#define STATS_MAX(name, value) \
+    do { \
+        if((uint32_t)(value) > deviceStats.name) { \
+            deviceStats.name = (uint32_t)(value); \
+        } \
+    } while(0)
+
+void stats_snapshot(stats_block_t * pBlock);
+
+#endif /* STATS_H */
@@ -0,0 +1,50 @@
+/*!
+ * \file statsFields.h
+ *
+ * Layout of the statistics block (VENDOR_REQUEST_GET_STATS), shared by the
+ * firmware (stats.h) and the host tools (host/stats/StatsBlock.hpp).  Each
+ * entry is a little endian uint32_t, in this order.  Append only, and bump
+ * STATS_BLOCK_VERSION when an existing field changes meaning.
+ *
+ * Plain preprocessor, no includes, so host code can include it as is.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef STATS_FIELDS_H
+#define STATS_FIELDS_H
+
+#define STATS_BLOCK_VERSION             (1)
+
+/* X(name, description) */
+#define STATS_FIELDS(X) \
+    X(uptimeUs,         "device time in us, wraps") \
+    X(canRxFrames,      "CAN frames read from the RX FIFO") \
+    X(canRxBytes,       "CAN payload bytes read from the RX FIFO") \
+    X(canTxFrames,      "CAN frames queued to the TX FIFO") \
+    X(canTxBytes,       "CAN payload bytes queued to the TX FIFO") \
+    X(canRxBusUs,       "bus time of received frames in us, stuff bits excluded") \
+    X(canTxBusUs,       "bus time of transmitted frames in us, stuff bits excluded") \
+    X(usbInPackets,     "vendor IN packets queued, bulk and express") \
+    X(usbInBytes,       "vendor IN frame bytes queued") \
+    X(usbOutBytes,      "vendor OUT bytes received") \
+    X(usbOutFrames,     "vendor OUT command frames accepted") \
+    X(hwmCanRxQueue,    "CAN RX queue high-water mark, frames") \
+    X(hwmCanTxRing,     "CAN TX ring high-water mark, frames") \
+    X(hwmUsbTxQueue,    "vendor bulk TX queue high-water mark, packets") \
+    X(hwmParserRing,    "vendor parser ring high-water mark, bytes") \
+    X(dropRxFifo,       "RX FIFO overruns, one or more frames each") \
+    X(dropRxQueue,      "CAN frames lost on the RX queue") \
+    X(dropEncoder,      "CAN frames lost by the encoders, all interfaces") \
+    X(dropUsb,          "CAN frames lost on the USB queues, all interfaces") \
+    X(isrFdcan,         "FDCAN interrupts") \
+    X(isrUsb,           "USB interrupts") \
+    X(errTxCount,       "transmit error counter") \
+    X(errRxCount,       "receive error counter") \
+    X(errWarning,       "entries into error warning") \
+    X(errPassive,       "entries into error passive") \
+    X(errBusOff,        "entries into bus off") \
+    X(usbInBusy,        "vendor IN packets that found the endpoint full") \
+    X(usbOutOverflow,   "vendor OUT packets cut short by a full parser ring") \
+    X(canRxTruncated,   "CAN FD frames sent with their payload cut to fit one vendor packet")
+
+#endif /* STATS_FIELDS_H */
@@ -0,0 +1,127 @@
+/*!
+ * \file taskProfile.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "stddef.h"
+#include "string.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "timers.h"
+#include "tusb.h"
+#include "taskProfile.h"
+
+TU_VERIFY_STATIC(sizeof(task_profile_entry_t) == 24, "task_profile_entry_t is not packed");
+TU_VERIFY_STATIC(sizeof(task_profile_block_t) == (16 + (24 * CONFIG_TASK_PROFILE_MAX_TASKS)), "task_profile_block_t is not packed");
+TU_VERIFY_STATIC(TASK_PROFILE_NAME_LEN == configMAX_TASK_NAME_LEN, "task name length mismatch");
+
+volatile uint32_t taskProfileIsrCycles = 0;
+
+static bool bInit = false;
+static TimerHandle_t windowTimer = NULL;
+static StaticTimer_t windowTimerDef;
+
+/* Timer task stack is small, keep the sample out of it */
+static TaskStatus_t taskStatus[CONFIG_TASK_PROFILE_MAX_TASKS];
+static struct {
+    UBaseType_t taskNumber;
+    uint32_t runTime;
+} lastRunTime[CONFIG_TASK_PROFILE_MAX_TASKS];
+static uint32_t lastTotal = 0;
+static uint32_t lastIsr = 0;
+static task_profile_block_t profile = {
+    .version = TASK_PROFILE_VERSION,
+    .size = offsetof(task_profile_block_t, tasks)
+};
+
+
+static uint16_t permille(uint32_t cycles, uint32_t window)
+{
+    if(window == 0) {
+        return 0;
+    }
+    return (uint16_t)(((uint64_t)cycles * 1000U) / window);
+}
+
+
+/* Counter at the start of the window, 0 for a task not seen before */
+static uint32_t lastRunTimeOf(UBaseType_t taskNumber)
+{
+    for(uint32_t i = 0; i < CONFIG_TASK_PROFILE_MAX_TASKS; i++) {
+        if(lastRunTime[i].taskNumber == taskNumber) {
+            return lastRunTime[i].runTime;
+        }
+    }
+    return 0;
+}
+
+
+static void windowTimerCb(TimerHandle_t xTimer)
+{
+    uint32_t total = 0;
+    const UBaseType_t count = uxTaskGetSystemState(taskStatus, CONFIG_TASK_PROFILE_MAX_TASKS, &total);
+    const uint32_t isr = taskProfileIsrCycles;
+    const uint32_t window = total - lastTotal;
+    uint32_t cycles[CONFIG_TASK_PROFILE_MAX_TASKS];
+
+    /* count is 0 when there are more tasks than CONFIG_TASK_PROFILE_MAX_TASKS */
+    configASSERT(count != 0);
+
+    for(UBaseType_t i = 0; i < count; i++) {
+        cycles[i] = (uint32_t)taskStatus[i].ulRunTimeCounter - lastRunTimeOf(taskStatus[i].xTaskNumber);
+    }
+    for(UBaseType_t i = 0; i < count; i++) {
+        lastRunTime[i].taskNumber = taskStatus[i].xTaskNumber;
+        lastRunTime[i].runTime = (uint32_t)taskStatus[i].ulRunTimeCounter;
+    }
+
+    taskENTER_CRITICAL();
+    profile.taskCount = (uint8_t)count;
+    profile.size = (uint16_t)(offsetof(task_profile_block_t, tasks) + (count * sizeof(task_profile_entry_t)));
+    profile.windowCycles = window;
+    profile.isrCycles = isr - lastIsr;
+    profile.isrPermille = permille(profile.isrCycles, window);
+    for(UBaseType_t i = 0; i < count; i++) {
+        task_profile_entry_t * pEntry = &profile.tasks[i];
+        strncpy(pEntry->name, taskStatus[i].pcTaskName, TASK_PROFILE_NAME_LEN);
+        pEntry->cycles = cycles[i];
+        pEntry->cpuPermille = permille(cycles[i], window);
+        pEntry->stackFreeMin = (uint16_t)taskStatus[i].usStackHighWaterMark;
+    }
+    taskEXIT_CRITICAL();
+
+    lastTotal = total;
+    lastIsr = isr;
+}
+
+
+void task_profile_init(void)
+{
+    if(!bInit) {
+        windowTimer = xTimerCreateStatic(
+                            "task-profile",
+                            pdMS_TO_TICKS(CONFIG_TASK_PROFILE_WINDOW_MS),
+                            pdTRUE,
+                            NULL,
+                            windowTimerCb,
+                            &windowTimerDef
+                            );
+        configASSERT(windowTimer);
+        xTimerStart(windowTimer, 0);
+
+        bInit = true;
+    }
+}
+
+
+uint32_t task_profile_get(task_profile_block_t * pBlock)
+{
+    uint32_t size;
+
+    taskENTER_CRITICAL();
+    size = profile.size;
+    memcpy(pBlock, &profile, size);
+    taskEXIT_CRITICAL();
+
+    return size;
+}
@@ -0,0 +1,63 @@
+/*!
+ * \file taskProfile.h
+ *
+ * Per-task CPU load and stack use.  FreeRTOS run-time stats count DWT
+ * cycles (see FreeRTOSConfig.h); every CONFIG_TASK_PROFILE_WINDOW_MS the
+ * timer task turns the counters into a load per task over that window.
+ * The window keeps the deltas well inside the 25 s wrap of the cycle
+ * counter at 168 MHz.
+ *
+ * Task time includes the interrupts that ran on top of it.  The measured
+ * interrupts (FDCAN, USB) are also summed separately as ISR time.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef TASK_PROFILE_H
+#define TASK_PROFILE_H
+
+#include "stdint.h"
+#include "stm32g4xx_hal.h"
+
+#ifndef CONFIG_TASK_PROFILE_WINDOW_MS
+#define CONFIG_TASK_PROFILE_WINDOW_MS   (1000)
+#endif /* CONFIG_TASK_PROFILE_WINDOW_MS */
+
+#ifndef CONFIG_TASK_PROFILE_MAX_TASKS
+#define CONFIG_TASK_PROFILE_MAX_TASKS   (8)
+#endif /* CONFIG_TASK_PROFILE_MAX_TASKS */
+
+#define TASK_PROFILE_VERSION            (1)
+#define TASK_PROFILE_NAME_LEN           (16)    // configMAX_TASK_NAME_LEN
+
+typedef struct __attribute__ ((packed)) {
+    char name[TASK_PROFILE_NAME_LEN];   // NUL padded
+    uint32_t cycles;                    // run in the last window
+    uint16_t cpuPermille;
+    uint16_t stackFreeMin;              // words never used since start
+} task_profile_entry_t;
+
+/* VENDOR_REQUEST_GET_PROFILE reply, taskCount entries are sent */
+typedef struct __attribute__ ((packed)) {
+    uint8_t version;                    // TASK_PROFILE_VERSION
+    uint8_t taskCount;
+    uint16_t size;                      // bytes, header and entries
+    uint32_t windowCycles;              // 0 until the first window closes
+    uint32_t isrCycles;
+    uint16_t isrPermille;
+    uint16_t reserved;
+    task_profile_entry_t tasks[CONFIG_TASK_PROFILE_MAX_TASKS];
+} task_profile_block_t;
+
+/* Cycles spent in the measured interrupts, wraps */
+extern volatile uint32_t taskProfileIsrCycles;
+
+/* At the very top and bottom of an interrupt handler */
+#define TASK_PROFILE_ISR_ENTER()        const uint32_t isrEnterCycles = DWT->CYCCNT
+#define TASK_PROFILE_ISR_EXIT()         (taskProfileIsrCycles += DWT->CYCCNT - isrEnterCycles)
+
+/* Starts the window timer, before the scheduler */
+void task_profile_init(void);
+/* Copy of the last window, returns the bytes to send */
+uint32_t task_profile_get(task_profile_block_t * pBlock);
+
+#endif /* TASK_PROFILE_H */
@@ -21,6 +21,12 @@
 #include "stm32g4xx_hal.h"
 #include "stm32g4xx_it.h"
 #include "tusb.h"
+#include "bsp/board_api.h"
+#include "bsp/ccm.h"
+#include "usb_device/webusb.h"
+#include "stats/stats.h"
+#include "stats/taskProfile.h"
+#include "stats/latency.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 /* USER CODE END Includes */
@@ -164,11 +170,22 @@ void DebugMon_Handler(void)
 /* USER CODE END 1 */
 
 void USB_HP_IRQHandler(void) {
+    TASK_PROFILE_ISR_ENTER();
+    STATS_INC(isrUsb);
     tud_int_handler(0);
+    TASK_PROFILE_ISR_EXIT();
 }
 
 void USB_LP_IRQHandler(void) {
+    TASK_PROFILE_ISR_ENTER();
+    STATS_INC(isrUsb);
+#if CONFIG_SOF_SYNC
+    if((USB->ISTR & USB_ISTR_SOF) != 0) {
+        board_sof_latch();
+    }
+#endif
     tud_int_handler(0);
+    TASK_PROFILE_ISR_EXIT();
 }
 
 void USBWakeUp_IRQHandler(void) {
@@ -182,7 +199,11 @@ void UCPD1_IRQHandler(void) {
 
 // CAN-FD
 extern FDCAN_HandleTypeDef hfdcan1;
-void FDCAN1_IT0_IRQHandler(void)
+CCM_CODE void FDCAN1_IT0_IRQHandler(void)
 {
+    TASK_PROFILE_ISR_ENTER();
+    LATENCY_PROBE_ISR_ENTER();
+    STATS_INC(isrFdcan);
     HAL_FDCAN_IRQHandler(&hfdcan1);
+    TASK_PROFILE_ISR_EXIT();
 }
@@ -0,0 +1,248 @@
+/*
+ * cdcCan.c
+ *
+ *      Author: Sicris
+ */
+
+#include "stdbool.h"
+#include "string.h"
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "tusb.h"
+#include "cdcCan.h"
+#include "canCodec/canCodec.h"
+#include "commandParser/commandParser.h"
+#include "frameParser/frameParser.h"
+#include "bsp/can.h"
+
+#define SLCAN_OK                        '\r'
+
+/* Longest SLCAN command is a D frame without CR */
+#define SLCAN_LINE_SIZE                 (CAN_CODEC_SLCAN_MAX_SZ - 4 - 1)
+
+/* Lawicel status flags */
+#define SLCAN_STATUS_ERROR_WARNING      (0x04)
+#define SLCAN_STATUS_ERROR_PASSIVE      (0x20)
+#define SLCAN_STATUS_BUS_ERROR          (0x80)
+
+static bool bBinary = false;
+static bool bTimestamp = false;
+static char line[SLCAN_LINE_SIZE];
+static uint32_t lineLength = 0;
+
+static bool bInit = false;
+/* Serializes writes from the CAN task and the USB class task */
+static SemaphoreHandle_t xCdcWriteMutex = NULL;
+static StaticSemaphore_t xCdcWriteMutexBuffer;
+
+
+void cdc_can_init(void)
+{
+    if(!bInit) {
+        xCdcWriteMutex = xSemaphoreCreateMutexStatic( &xCdcWriteMutexBuffer );
+        configASSERT(xCdcWriteMutex);
+
+        bInit = true;
+    }
+}
+
+
+static bool cdc_write(void const * pBuf, uint32_t length)
+{
+    bool ret = false;
+
+    xSemaphoreTake(xCdcWriteMutex, portMAX_DELAY);
+    /* Drop rather than block the caller when the host is not reading */
+    if(tud_cdc_write_available() >= length) {
+        tud_cdc_write(pBuf, length);
+        tud_cdc_write_flush();
+        ret = true;
+    }
+    xSemaphoreGive(xCdcWriteMutex);
+
+    return ret;
+}
+
+
+static void slcan_reply(char const * pReply)
+{
+    cdc_write(pReply, strlen(pReply));
+}
+
+
+static void slcan_status(void)
+{
+    device_status_t status;
+    char reply[4] = {'F', '0', '0', SLCAN_OK};
+    uint8_t flags = 0;
+
+    command_parser_get_status(&status);
+    if(status.busState == CAN_BUS_OFF) {
+        flags = SLCAN_STATUS_BUS_ERROR;
+    } else if(status.busState == CAN_BUS_ERROR_PASSIVE) {
+        flags = SLCAN_STATUS_ERROR_PASSIVE;
+    } else if(status.busState == CAN_BUS_ERROR_WARNING) {
+        flags = SLCAN_STATUS_ERROR_WARNING;
+    }
+    reply[1] = "0123456789ABCDEF"[flags >> 4];
+    reply[2] = "0123456789ABCDEF"[flags & 0x0F];
+    cdc_write(reply, sizeof(reply));
+}
+
+
+static bool slcan_set_bitrate(char code, bool isData)
+{
+    device_status_t status;
+
+    command_parser_get_status(&status);
+    if(isData) {
+        /* Y1: 1Mbps data phase */
+        if(code == '1') {
+            return command_parser_set_bitrate(status.arbitBitrate, DATA_1MHZ);
+        }
+    } else {
+        /* S6: 500kbps, S8: 1Mbps */
+        if(code == '6') {
+            return command_parser_set_bitrate(ARBIT_500KHZ, status.dataBitrate);
+        } else if(code == '8') {
+            return command_parser_set_bitrate(ARBIT_1MHZ, status.dataBitrate);
+        }
+    }
+
+    return false;
+}
+
+
+static void slcan_execute(void)
+{
+    can_frame_t frame;
+    bool ok = false;
+
+    if(lineLength == 0) {
+        return;
+    }
+
+    switch(line[0]) {
+        case 'O':
+            /* Applied in CAN processing context, F reports the outcome */
+            command_parser_connect_on(COMMAND_CHANNEL_CDC, true, 0);
+            ok = true;
+            break;
+
+        case 'C':
+            command_parser_connect_on(COMMAND_CHANNEL_CDC, false, 0);
+            ok = true;
+            break;
+
+        case 'S':
+        case 'Y':
+            ok = (lineLength == 2) && slcan_set_bitrate(line[1], line[0] == 'Y');
+            break;
+
+        case 'Z':
+            if((lineLength == 2) && ((line[1] == '0') || (line[1] == '1'))) {
+                bTimestamp = (line[1] == '1');
+                ok = true;
+            }
+            break;
+
+        case 'V':
+            slcan_reply("V0100\r");
+            return;
+
+        case 'N':
+            slcan_reply("N0001\r");
+            return;
+
+        case 'F':
+            slcan_status();
+            return;
+
+        case 't': case 'T':
+        case 'r': case 'R':
+        case 'd': case 'D':
+        case 'b': case 'B':
+            if(command_parser_is_connected() &&
+               can_codec_decode_slcan(line, lineLength, &frame) &&
+               CAN_send_frame(&frame, 0)) {
+                slcan_reply(((frame.flags & CAN_FRAME_FLAG_EXTENDED) != 0) ? "Z\r" : "z\r");
+                return;
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    slcan_reply(ok ? "\r" : "\a");
+}
+
+
+void cdc_can_receive(uint8_t * pBuf, uint32_t length)
+{
+    uint32_t idx;
+
+    for(idx = 0; (idx < length) && !bBinary; idx++) {
+        if(pBuf[idx] == TAG_SOF) {
+            bBinary = true;
+            lineLength = 0;
+            break;
+        } else if(pBuf[idx] == '\r') {
+            if(lineLength <= SLCAN_LINE_SIZE) {
+                slcan_execute();
+            } else {
+                slcan_reply("\a");
+            }
+            lineLength = 0;
+        } else if(pBuf[idx] == '\n') {
+            /* ignore */
+        } else if(lineLength < SLCAN_LINE_SIZE) {
+            line[lineLength++] = (char)pBuf[idx];
+        } else {
+            /* overlong line, discard it up to the next CR */
+            lineLength = SLCAN_LINE_SIZE + 1;
+        }
+    }
+
+    if(bBinary && (idx < length)) {
+        command_parser_receive(COMMAND_CHANNEL_CDC, &pBuf[idx], length - idx);
+    }
+}
+
+
+void cdc_can_line_state(bool dtr)
+{
+    if(!dtr) {
+        command_parser_channel_closed(COMMAND_CHANNEL_CDC);
+        bBinary = false;
+        bTimestamp = false;
+        lineLength = 0;
+    }
+}
+
+
+bool cdc_can_send_frame(can_frame_t const * pFrame, uint16_t sequence, FRAME_INTEGRITY_T integrity)
+{
+    uint8_t buf[CAN_CODEC_SLCAN_MAX_SZ];
+    uint32_t length;
+
+    if(bBinary) {
+        length = can_codec_encode_binary(buf, pFrame, sequence, CAN_CODEC_BINARY_MAX_SZ, integrity);
+    } else {
+        length = can_codec_encode_slcan((char *)buf, pFrame, bTimestamp);
+    }
+
+    return cdc_write(buf, length);
+}
+
+
+bool cdc_can_send_packet(uint8_t const * pBuf, uint32_t length)
+{
+    return cdc_write(pBuf, length);
+}
+
+
+bool cdc_can_is_binary(void)
+{
+    return bBinary;
+}
@@ -0,0 +1,28 @@
+/*
+ * cdcCan.h
+ *
+ *  CAN stream over the CDC ACM interface.
+ *
+ *  The port starts in SLCAN text mode.  A TAG_SOF (0xFF) byte, which never
+ *  appears in SLCAN text, switches it to the binary command protocol used
+ *  on the vendor interface.  Dropping DTR returns it to text mode.
+ *
+ *      Author: Sicris
+ */
+
+#ifndef USB_DEVICE_CDCCAN_CDCCAN_H_
+#define USB_DEVICE_CDCCAN_CDCCAN_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "bsp/can_types.h"
+#include "frameParser/frameParser.h"
+
+void cdc_can_init(void);
+void cdc_can_receive(uint8_t * pBuf, uint32_t length);
+void cdc_can_line_state(bool dtr);
+bool cdc_can_send_frame(can_frame_t const * pFrame, uint16_t sequence, FRAME_INTEGRITY_T integrity);
+bool cdc_can_send_packet(uint8_t const * pBuf, uint32_t length);
+bool cdc_can_is_binary(void);
+
+#endif /* USB_DEVICE_CDCCAN_CDCCAN_H_ */
@@ -0,0 +1,167 @@
+/*!
+ * \file expressEp.c
+ *
+ * TinyUSB application class driver for the express interrupt IN endpoint.
+ * A send queues the packet and has the USB device task start it, each
+ * completed IN transfer starts the next queued packet.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "webusb.h"
+#include "expressEp.h"
+
+#define EXPRESS_EP_QUEUE_LENGTH         (4)
+
+static StaticQueue_t expressStaticQueue;
+static uint8_t expressQueueStorageArea[EXPRESS_EP_QUEUE_LENGTH * WEBUSB_TX_ELEMENT_SZ];
+static QueueHandle_t expressQHandle = NULL;
+CFG_TUSB_MEM_SECTION CFG_TUSB_MEM_ALIGN static uint8_t expressPacket[WEBUSB_TX_ELEMENT_SZ];
+
+static uint8_t expressRhport = 0;
+static uint8_t expressEpAddr = 0;
+static volatile bool bOpen = false;
+/* Only touched on the USB device task */
+static bool bBusy = false;
+
+
+/* USB device task only */
+static void expressFlush(void * param)
+{
+    (void)param;
+
+    if(!bOpen || bBusy) {
+        return;
+    }
+    if(pdTRUE == xQueueReceive(expressQHandle, expressPacket, 0)) {
+        bBusy = usbd_edpt_xfer(expressRhport, expressEpAddr, expressPacket, WEBUSB_TX_ELEMENT_SZ);
+    }
+}
+
+
+static void expressInit(void)
+{
+    if(expressQHandle == NULL) {
+        expressQHandle = xQueueCreateStatic(
+                            EXPRESS_EP_QUEUE_LENGTH,
+                            WEBUSB_TX_ELEMENT_SZ,
+                            expressQueueStorageArea,
+                            &expressStaticQueue
+                            );
+        configASSERT(expressQHandle);
+    }
+}
+
+
+static void expressReset(uint8_t rhport)
+{
+    (void)rhport;
+    bOpen = false;
+    bBusy = false;
+}
+
+
+static uint16_t expressOpen(uint8_t rhport, tusb_desc_interface_t const * desc_intf, uint16_t max_len)
+{
+    uint8_t const * p_desc = tu_desc_next(desc_intf);
+    uint16_t const drv_len = sizeof(tusb_desc_interface_t) + sizeof(tusb_desc_endpoint_t);
+    tusb_desc_endpoint_t const * desc_ep = (tusb_desc_endpoint_t const *)p_desc;
+
+    if((desc_intf->bInterfaceClass != TUSB_CLASS_VENDOR_SPECIFIC) ||
+       (desc_intf->bInterfaceSubClass != EXPRESS_EP_SUBCLASS) ||
+       (desc_intf->bInterfaceProtocol != EXPRESS_EP_PROTOCOL) ||
+       (desc_intf->bNumEndpoints != 1) ||
+       (max_len < drv_len)) {
+        return 0;
+    }
+    if((tu_desc_type(p_desc) != TUSB_DESC_ENDPOINT) ||
+       (desc_ep->bmAttributes.xfer != TUSB_XFER_INTERRUPT) ||
+       (tu_edpt_dir(desc_ep->bEndpointAddress) != TUSB_DIR_IN) ||
+       !usbd_edpt_open(rhport, desc_ep)) {
+        return 0;
+    }
+
+    expressRhport = rhport;
+    expressEpAddr = desc_ep->bEndpointAddress;
+    bBusy = false;
+    xQueueReset(expressQHandle);
+    bOpen = true;
+
+    return drv_len;
+}
+
+
+static bool expressControlXferCb(uint8_t rhport, uint8_t stage, tusb_control_request_t const * request)
+{
+    (void)rhport;
+    (void)stage;
+    (void)request;
+
+    /* No class requests, the stack answers SET/GET_INTERFACE itself */
+    return false;
+}
+
+
+static bool expressXferCb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
+{
+    (void)rhport;
+    (void)result;
+    (void)xferred_bytes;
+
+    if(ep_addr != expressEpAddr) {
+        return false;
+    }
+    bBusy = false;
+    expressFlush(NULL);
+
+    return true;
+}
+
+
+static usbd_class_driver_t const expressDriver = {
+#if CFG_TUSB_DEBUG >= 2
+    .name            = "EXPRESS",
+#endif
+    .init            = expressInit,
+    .reset           = expressReset,
+    .open            = expressOpen,
+    .control_xfer_cb = expressControlXferCb,
+    .xfer_cb         = expressXferCb,
+    .sof             = NULL
+};
+
+
+usbd_class_driver_t const * express_ep_driver(void)
+{
+    return &expressDriver;
+}
+
+
+/*
+ * Returns false while the interface is not configured or the queue is
+ * full, the caller then falls back to bulk.
+ */
+bool express_ep_send(uint8_t const * pBuffer)
+{
+    if(!bOpen || (pdTRUE != xQueueSend(expressQHandle, pBuffer, 0))) {
+        return false;
+    }
+#if CONFIG_USB_CAN_REACTOR
+    /* Already on the USB device task, and its event queue may be full */
+    expressFlush(NULL);
+#else
+    usbd_defer_func(expressFlush, NULL, false);
+#endif
+
+    return true;
+}
+
+
+/* Drops the packets not yet started, e.g. from before a reconnect */
+void express_ep_discard(void)
+{
+    if(expressQHandle != NULL) {
+        xQueueReset(expressQHandle);
+    }
+}
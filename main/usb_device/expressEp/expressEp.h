@@ -0,0 +1,28 @@
+/*!
+ * \file expressEp.h
+ *
+ * Express interrupt IN endpoint, in an interface of its own next to the
+ * vendor (WebUSB) interface.  Urgent packets queued here go out ahead of
+ * the bulk backlog, bounded by the endpoint polling interval.  Transfers
+ * are only started on the USB device task, from the completion callback or
+ * a deferred call, so the endpoint needs no claim.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef USB_DEVICE_EXPRESSEP_EXPRESSEP_H_
+#define USB_DEVICE_EXPRESSEP_EXPRESSEP_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+
+/* Vendor specific interface subclass/protocol claimed by the express driver */
+#define EXPRESS_EP_SUBCLASS             (0x02)
+#define EXPRESS_EP_PROTOCOL             (0x01)
+
+usbd_class_driver_t const * express_ep_driver(void);
+bool express_ep_send(uint8_t const * pBuffer);
+void express_ep_discard(void);
+
+#endif /* USB_DEVICE_EXPRESSEP_EXPRESSEP_H_ */
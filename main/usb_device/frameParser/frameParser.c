@@ -6,179 +6,383 @@
  */
 
 #include "stdbool.h"
+#include "string.h"
+#include "bsp/crc.h"
+#include "bsp/ccm.h"
 #include "frameParser.h"
 
-#ifndef CONFIG_PARSER_RX_BUF_SIZE
-#define CONFIG_PARSER_RX_BUF_SIZE       (1024)
-#endif /* CONFIG_PARSER_RX_BUF_SIZE */
+/*
+ * Defining FRAME_PARSER_ASSERT builds the parser on a host without
+ * FreeRTOS, e.g. for fuzzing: -DFRAME_PARSER_ASSERT=assert, linked with
+ * FRAME_CRC_DEVICE_API from host/frameCrc/FrameCrc.hpp for the CRCs.
+ */
+#ifndef FRAME_PARSER_ASSERT
+#include "FreeRTOS.h"
+#define FRAME_PARSER_ASSERT(x)          configASSERT(x)
+#else
+#include "assert.h"
+#endif
+
+#if FRAME_MAX_LENGTH > (CONFIG_PARSER_RX_BUF_SIZE - 1)
+#error "CONFIG_PARSER_RX_BUF_SIZE must hold a whole command frame"
+#endif
+
+CCM_CODE uint32_t frame_check_start(FRAME_INTEGRITY_T integrity)
+{
+    switch(integrity) {
+        case FRAME_INTEGRITY_CRC16: return CRC16_INIT_VALUE;
+        case FRAME_INTEGRITY_CRC32: return CRC32_INIT_VALUE;
+        default:                    return 0;
+    }
+}
+
+
+CCM_CODE uint32_t frame_check_update(FRAME_INTEGRITY_T integrity, uint32_t check,
+                                     uint8_t const * pBuf, uint32_t length)
+{
+    uint8_t sum;
+
+    switch(integrity) {
+        case FRAME_INTEGRITY_CRC16: {
+            return CRC_update16((uint16_t)check, pBuf, length);
+        }
+        case FRAME_INTEGRITY_CRC32: {
+            return CRC_update32(check, pBuf, length);
+        }
+        default: {
+            sum = (uint8_t)check;
+            while(length > 0) {
+                sum += *pBuf++;
+                length--;
+            }
+            return sum;
+        }
+    }
+}
+
+
+CCM_CODE uint32_t frame_check_trailer(FRAME_INTEGRITY_T integrity, uint32_t check, uint8_t * pTrailer)
+{
+    const uint32_t size = SZ_TRAILER(integrity);
+
+    if(integrity == FRAME_INTEGRITY_SUM8) {
+        pTrailer[0] = (uint8_t)((~check) + 1);
+    } else {
+        for(uint32_t idx = 0; idx < size; idx++) {
+            pTrailer[idx] = (uint8_t)(check >> (8 * (size - 1 - idx)));
+        }
+    }
 
-static bool bInit = false;
-static uint32_t rdPtr = 0;
-static uint32_t wrPtr = 0;
-static uint8_t rxFrameBuffer[CONFIG_PARSER_RX_BUF_SIZE];
-static uint32_t packetSeq = 0;
-static SemaphoreHandle_t xParserMutex = NULL;
-static StaticSemaphore_t xMutexBuffer;
-static frame_valid_cb_t validFrameCb = {0};
+    return size;
+}
 
 
-static void ProcessValidFrame(uint32_t index, uint32_t len)
+/* Continues the running check over length ring bytes from index, in at most two runs as they may wrap */
+static CCM_CODE void CheckRun(frame_parser_t * pParser, uint32_t index, uint32_t length)
 {
-    uint32_t i = 0;
+    const uint32_t first = (pParser->rxBufMask + 1) - index;
+
+    if(length <= first) {
+        pParser->frameCheck = frame_check_update(pParser->frameIntegrity, pParser->frameCheck,
+                                                 &pParser->rxFrameBuffer[index], length);
+    } else {
+        pParser->frameCheck = frame_check_update(pParser->frameIntegrity, pParser->frameCheck,
+                                                 &pParser->rxFrameBuffer[index], first);
+        pParser->frameCheck = frame_check_update(pParser->frameIntegrity, pParser->frameCheck,
+                                                 &pParser->rxFrameBuffer[0], length - first);
+    }
+}
 
-    if(len <= SZ_FRAME_OVERHEAD) {
+
+/*
+ * False for a duplicate.  A frame past the expected one leaves the ones in
+ * between in the missing mask, a retransmission of those is taken once.
+ */
+static bool SequenceAccept(frame_parser_t * pParser, uint16_t sequence)
+{
+    const int32_t diff = (int16_t)(sequence - pParser->expectedSequence);
+    uint32_t age;
+
+    if(!pParser->bTrackSequence) {
+        return true;
+    }
+    if(!pParser->bSequenceValid) {
+        pParser->bSequenceValid = true;
+        pParser->missingMask = 0;
+    } else if(diff > 0) {
+        /* expectedSequence .. sequence - 1 did not arrive */
+        if(diff >= 32) {
+            pParser->missingMask = 0xFFFFFFFEUL;
+        } else {
+            pParser->missingMask = (uint32_t)(((uint64_t)pParser->missingMask << (diff + 1)) |
+                                              ((((uint64_t)1 << diff) - 1) << 1));
+        }
+        pParser->bReportDue = true;
+    } else if(diff == 0) {
+        pParser->missingMask <<= 1;
+    } else {
+        age = (uint32_t)(-diff) - 1;
+        if((age < 32) && ((pParser->missingMask & (1UL << age)) != 0)) {
+            pParser->missingMask &= ~(1UL << age);
+            pParser->acceptedSinceReport++;
+            return true;
+        }
+        pParser->bReportDue = true;
+        return false;
+    }
+    pParser->expectedSequence = (uint16_t)(sequence + 1);
+    pParser->acceptedSinceReport++;
+
+    return true;
+}
+
+
+static void ProcessValidFrame(frame_parser_t * pParser, uint32_t index, uint32_t len)
+{
+    const uint32_t overhead = SZ_FRAME_HEADER + SZ_TRAILER(pParser->frameIntegrity);
+    uint8_t const * pPayload;
+    uint32_t first;
+
+    if(len <= overhead) {
         return;
     }
 
     /* Remove overhead from frame */
-    index = (index + SZ_TAG_SOF + SZ_LENGTH + SZ_PKT_SEQ) % CONFIG_PARSER_RX_BUF_SIZE;
-    len = len - SZ_FRAME_OVERHEAD;
+    index = (index + SZ_FRAME_HEADER) & pParser->rxBufMask;
+    len = len - overhead;
 
     if(len > CONFIG_CMD_FRAME_SIZE) {
         return;
     }
 
-    /* Prepare Data and execute handler callback */
-    xSemaphoreTakeRecursive(validFrameCb.mutex, portMAX_DELAY);
-    for(i = 0; i < len; i++) {
-        validFrameCb.pCommandBuffer[i] = rxFrameBuffer[index];
-        index = (index + 1) % CONFIG_PARSER_RX_BUF_SIZE;
+    if(!SequenceAccept(pParser, (uint16_t)pParser->rxFrameBuffer[(index - SZ_PKT_SEQ) & pParser->rxBufMask] |
+                                ((uint16_t)pParser->rxFrameBuffer[(index - SZ_PKT_SEQ + 1) & pParser->rxBufMask] << 8))) {
+        return;
+    }
+
+    /* Hand out the payload in place, only a wrapped one is copied */
+    first = (pParser->rxBufMask + 1) - index;
+    if(len <= first) {
+        pPayload = &pParser->rxFrameBuffer[index];
+    } else {
+        FRAME_PARSER_ASSERT(first < len);
+        memcpy(pParser->validFrameCb.pCommandBuffer, &pParser->rxFrameBuffer[index], first);
+        memcpy(&pParser->validFrameCb.pCommandBuffer[first], &pParser->rxFrameBuffer[0], len - first);
+        pPayload = pParser->validFrameCb.pCommandBuffer;
+    }
+    pParser->validFrameCb.callback(pPayload, len);
+}
+
+
+/*
+ * The candidate at rdPtr is not a frame.  Skip its start of frame tag and
+ * scan again from the next byte, a frame may start inside the candidate.
+ */
+static void Resync(frame_parser_t * pParser)
+{
+    pParser->rdPtr = (pParser->rdPtr + 1) & pParser->rxBufMask;
+    pParser->scanPtr = pParser->rdPtr;
+    pParser->state = FRAME_STATE_SOF;
+}
+
+
+void frame_parser_init(frame_parser_t * pParser, frame_valid_cb_t * pCallbackDef)
+{
+    FRAME_PARSER_ASSERT(pParser);
+    FRAME_PARSER_ASSERT(pCallbackDef);
+
+    if(!pParser->bInit) {
+        pParser->rdPtr = 0U;
+        pParser->wrPtr = 0U;
+        pParser->scanPtr = 0U;
+        pParser->state = FRAME_STATE_SOF;
+        pParser->requiredIntegrity = FRAME_INTEGRITY_SUM8;
+
+        pParser->validFrameCb.callback = pCallbackDef->callback;
+        FRAME_PARSER_ASSERT(pParser->validFrameCb.callback);
+        pParser->validFrameCb.pCommandBuffer = pCallbackDef->pCommandBuffer;
+        FRAME_PARSER_ASSERT(pParser->validFrameCb.pCommandBuffer);
+
+        pParser->bInit = true;
     }
-    validFrameCb.callback(len);
-    xSemaphoreGiveRecursive(validFrameCb.mutex);
 }
 
 
-void frame_parser_init(frame_valid_cb_t * pCallbackDef)
+void frame_parser_require(frame_parser_t * pParser, FRAME_INTEGRITY_T integrity)
 {
-    configASSERT(pCallbackDef);
+    pParser->requiredIntegrity = (uint8_t)integrity;
+}
+
 
-    if(!bInit) {
-        xParserMutex = xSemaphoreCreateRecursiveMutexStatic( &xMutexBuffer );
-        configASSERT(xParserMutex);
+void frame_parser_track_sequence(frame_parser_t * pParser, bool enable)
+{
+    pParser->bTrackSequence = enable;
+    pParser->trackGeneration++;
+}
 
-        rdPtr = 0U;
-        wrPtr = 0U;
-        packetSeq = 0U;
 
-        validFrameCb.callback = pCallbackDef->callback;
-        configASSERT(validFrameCb.callback);
-        validFrameCb.pCommandBuffer = pCallbackDef->pCommandBuffer;
-        configASSERT(validFrameCb.pCommandBuffer);
-        validFrameCb.mutex = pCallbackDef->mutex;
-        configASSERT(validFrameCb.mutex);
+bool frame_parser_sequence_report(frame_parser_t * pParser, frame_seq_report_t * pReport)
+{
+    const bool bIdle = (pParser->state == FRAME_STATE_SOF) && (pParser->scanPtr == pParser->wrPtr);
 
-        bInit = true;
+    if(!pParser->bTrackSequence || !pParser->bSequenceValid) {
+        pParser->bReportDue = false;
+        return false;
     }
+    if(!pParser->bReportDue && (pParser->acceptedSinceReport < CONFIG_PARSER_ACK_INTERVAL) &&
+       (!bIdle || (pParser->acceptedSinceReport == 0))) {
+        return false;
+    }
+    pReport->expected = pParser->expectedSequence;
+    pReport->missing = pParser->missingMask;
+    pReport->freeBytes = (uint16_t)((pParser->rdPtr - pParser->wrPtr - 1) & pParser->rxBufMask);
+    pParser->bReportDue = false;
+    pParser->acceptedSinceReport = 0;
+
+    return true;
 }
 
 
-bool frame_parser_receive(uint8_t *pBuf, uint32_t len)
+void frame_parser_set_ring(frame_parser_t * pParser, uint8_t * pRing, uint32_t size)
+{
+    FRAME_PARSER_ASSERT(pRing);
+    FRAME_PARSER_ASSERT(FRAME_PARSER_RING_VALID(size));
+
+    pParser->rxFrameBuffer = pRing;
+    pParser->rxBufMask = size - 1;
+    pParser->rdPtr = 0U;
+    pParser->wrPtr = 0U;
+    pParser->scanPtr = 0U;
+    pParser->state = FRAME_STATE_SOF;
+}
+
+
+bool frame_parser_idle(frame_parser_t const * pParser)
+{
+    return (pParser->state == FRAME_STATE_SOF) && (pParser->rdPtr == pParser->wrPtr);
+}
+
+
+bool frame_parser_receive(frame_parser_t * pParser, uint8_t *pBuf, uint32_t len)
 {
     uint32_t i = 0;
     bool ret = true;
 
-    if(!bInit) {
+    if(!pParser->bInit || (pParser->rxFrameBuffer == NULL)) {
         return false;
     }
 
-    xSemaphoreTakeRecursive(xParserMutex, portMAX_DELAY);
-
     for(i = 0; i < len; i++) {
-        uint32_t next = (wrPtr + 1) % CONFIG_PARSER_RX_BUF_SIZE;
-        if(next == rdPtr) {
-            /* buffer full */
+        uint32_t next = (pParser->wrPtr + 1) & pParser->rxBufMask;
+        if(next == pParser->rdPtr) {
+            /* buffer full, the host sees the gap in the next report */
+            pParser->bReportDue = true;
             ret = false;
             break;
         } else {
-            rxFrameBuffer[wrPtr] = pBuf[i];
-            wrPtr = next;
+            pParser->rxFrameBuffer[pParser->wrPtr] = pBuf[i];
+            pParser->wrPtr = next;
         }
     }
 
-    xSemaphoreGiveRecursive(xParserMutex);
     return (ret);
 }
 
 
-void frame_parser_process(void)
+/*
+ * SOF -> LENGTH -> BODY state machine.  An incomplete frame resumes where
+ * the last call stopped, the check runs over each run of body bytes as it
+ * is consumed, so a frame is only ever scanned once.
+ */
+void frame_parser_process(frame_parser_t * pParser)
 {
-    uint32_t availableBytes = 0;
-    uint32_t length = 0;
-    uint32_t idx = 0;
-    uint8_t sum = 0;
+    uint8_t byte;
 
-    if(!bInit) {
+    if(!pParser->bInit) {
         return;
     }
 
-    xSemaphoreTakeRecursive(xParserMutex, portMAX_DELAY);
-
-    while(wrPtr != rdPtr) {
-        /* Check start of command TAG */
-        if(TAG_SOF != rxFrameBuffer[rdPtr])
-        {
-            // Skip character
-            rdPtr = (rdPtr + 1) % CONFIG_PARSER_RX_BUF_SIZE;
-            continue;
-        }
-
-        /* Get available bytes in the buffer */
-        if(wrPtr >= rdPtr) {
-            availableBytes = wrPtr - rdPtr;
-        } else {
-            availableBytes = (wrPtr + CONFIG_PARSER_RX_BUF_SIZE) - rdPtr;
-        }
-        if(availableBytes < SZ_FRAME_OVERHEAD) {
-            /* Can't be less than frame overhead */
-            break;
-        }
-        // See if the packet size byte is valid.  A command packet must be at
-        // least four bytes and can not be larger than the receive buffer size.
-        length = (uint32_t)(rxFrameBuffer[(rdPtr+1)%CONFIG_PARSER_RX_BUF_SIZE]) +
-                ((uint32_t)(rxFrameBuffer[(rdPtr+2)%CONFIG_PARSER_RX_BUF_SIZE]) << 8);
-
-        if((length < SZ_FRAME_OVERHEAD) || (length > (CONFIG_PARSER_RX_BUF_SIZE-1)))
-        {
-            // The packet size is too large, so either this is not the start of
-            // a packet or an invalid packet was received.  Skip this start of
-            // command packet tag.
-            rdPtr = (rdPtr + 1) % CONFIG_PARSER_RX_BUF_SIZE;
-
-            // Keep scanning for a start of command packet tag.
-            continue;
-        }
-
-        // If the entire command packet is not in the receive buffer then stop
-        if(availableBytes < length)
-        {
-            break;
-        }
-
-        // The entire command packet is in the receive buffer, so compute its
-        // checksum.
-        for(idx = 0, sum = 0; idx < length; idx++)
-        {
-            sum += rxFrameBuffer[(rdPtr + idx)%CONFIG_PARSER_RX_BUF_SIZE];
-        }
-
-        // Skip this packet if the checksum is not correct (that is, it is
-        // probably not really the start of a packet).
-        if(sum != 0)
-        {
-            // Skip this character
-            rdPtr = (rdPtr + 1) % CONFIG_PARSER_RX_BUF_SIZE;
+    if(pParser->trackGenerationSeen != pParser->trackGeneration) {
+        pParser->trackGenerationSeen = pParser->trackGeneration;
+        pParser->bSequenceValid = false;
+        pParser->bReportDue = false;
+        pParser->acceptedSinceReport = 0;
+    }
 
-            // Keep scanning for a start of command packet tag.
-            continue;
+    while(pParser->scanPtr != pParser->wrPtr) {
+        byte = pParser->rxFrameBuffer[pParser->scanPtr];
+        pParser->scanPtr = (pParser->scanPtr + 1) & pParser->rxBufMask;
+
+        switch(pParser->state) {
+            case FRAME_STATE_SOF: {
+                if(TAG_SOF != byte) {
+                    // Skip character
+                    pParser->rdPtr = pParser->scanPtr;
+                } else {
+                    pParser->frameCount = SZ_TAG_SOF;
+                    pParser->frameLength = 0;
+                    pParser->state = FRAME_STATE_LENGTH;
+                }
+                break;
+            }
+            case FRAME_STATE_LENGTH: {
+                uint32_t integrity;
+                pParser->frameLength |= ((uint32_t)byte) << (8 * (pParser->frameCount - SZ_TAG_SOF));
+                pParser->frameCount++;
+                if(pParser->frameCount < (SZ_TAG_SOF + SZ_LENGTH)) {
+                    break;
+                }
+                integrity = pParser->frameLength >> FRAME_LENGTH_INTEGRITY_SHIFT;
+                pParser->frameLength &= FRAME_LENGTH_MASK;
+                if((integrity >= N_FRAME_INTEGRITY) || (integrity < pParser->requiredIntegrity)) {
+                    // Unknown trailer, or weaker than negotiated
+                    Resync(pParser);
+                    break;
+                }
+                pParser->frameIntegrity = (FRAME_INTEGRITY_T)integrity;
+                if((pParser->frameLength < (SZ_FRAME_HEADER + SZ_TRAILER(integrity))) ||
+                   (pParser->frameLength > (SZ_FRAME_HEADER + CONFIG_CMD_FRAME_SIZE + SZ_TRAILER(integrity)))) {
+                    // Not the start of a frame, or a frame too large to deliver.  An intact
+                    // one that is too large would swallow the frames inside it.
+                    Resync(pParser);
+                } else {
+                    /* Tag and length, the body follows as it arrives */
+                    pParser->frameCheck = frame_check_start(pParser->frameIntegrity);
+                    CheckRun(pParser, pParser->rdPtr, SZ_TAG_SOF + SZ_LENGTH);
+                    pParser->state = FRAME_STATE_BODY;
+                }
+                break;
+            }
+            case FRAME_STATE_BODY: {
+                /* Checks this byte and the rest of the body that is already here in one run */
+                uint32_t run = pParser->frameLength - pParser->frameCount - 1;
+                const uint32_t available = (pParser->wrPtr - pParser->scanPtr) & pParser->rxBufMask;
+                if(run > available) {
+                    run = available;
+                }
+                CheckRun(pParser, (pParser->scanPtr - 1) & pParser->rxBufMask, run + 1);
+                pParser->frameCount += run + 1;
+                pParser->scanPtr = (pParser->scanPtr + run) & pParser->rxBufMask;
+                /* The bytes scanned are exactly the frame so far */
+                FRAME_PARSER_ASSERT(((pParser->scanPtr - pParser->rdPtr) & pParser->rxBufMask) == pParser->frameCount);
+                FRAME_PARSER_ASSERT(pParser->frameCount <= pParser->frameLength);
+                if(pParser->frameCount < pParser->frameLength) {
+                    break;
+                }
+                if(pParser->frameCheck != 0) {
+                    // Probably not really the start of a frame
+                    Resync(pParser);
+                } else {
+                    ProcessValidFrame(pParser, pParser->rdPtr, pParser->frameLength);
+                    pParser->rdPtr = pParser->scanPtr;
+                    pParser->state = FRAME_STATE_SOF;
+                }
+                break;
+            }
+            default: {
+                Resync(pParser);
+                break;
+            }
         }
-
-        // A valid command packet was received, so process it now.
-        ProcessValidFrame(rdPtr, length);
-
-        // Done with processing this command packet.
-        rdPtr = (rdPtr + length) % CONFIG_PARSER_RX_BUF_SIZE;
     }
-
-    xSemaphoreGiveRecursive(xParserMutex);
 }
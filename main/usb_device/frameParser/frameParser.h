@@ -9,30 +9,66 @@
 #define USB_DEVICE_FRAMEPARSER_FRAMEPARSER_H_
 
 #include "stdint.h"
-#include "FreeRTOS.h"
-#include "semphr.h"
+#include "stdbool.h"
 
 #ifndef CONFIG_CMD_FRAME_SIZE
 #define CONFIG_CMD_FRAME_SIZE           (128)
 #endif /* CONFIG_CMD_FRAME_SIZE */
 
+/* Receive ring of the default buffer profile, see bufferArena.h */
+#ifndef CONFIG_PARSER_RX_BUF_SIZE
+#define CONFIG_PARSER_RX_BUF_SIZE       (1024)
+#endif /* CONFIG_PARSER_RX_BUF_SIZE */
+
+/* Accepted frames between sequence reports while the host keeps sending */
+#ifndef CONFIG_PARSER_ACK_INTERVAL
+#define CONFIG_PARSER_ACK_INTERVAL      (8)
+#endif /* CONFIG_PARSER_ACK_INTERVAL */
+
+#if (CONFIG_PARSER_RX_BUF_SIZE & (CONFIG_PARSER_RX_BUF_SIZE - 1)) != 0
+#error "CONFIG_PARSER_RX_BUF_SIZE must be a power of two"
+#endif
+
 /* Since WebUSB TransferIN must be the same size as endpoint */
 #define SZ_USB_BYTES_IN_PACKET          (1) // ALWAYS offest 0 in EP buffer
 
 /*
  * Frame Format
  *   TAG        : 1 byte
- *   Length     : 4 bytes
- *   Packet Seq : 4 bytes
+ *   Length     : 2 bytes, bits 0..13 frame size, bits 14..15 FRAME_INTEGRITY_T
+ *   Packet Seq : 2 bytes
  *   Payload    : N Bytes
- *   Checksum   : 1 byte
+ *   Trailer    : 1 byte checksum, or 2/4 byte CRC most significant byte first
+ * The check over the whole frame, trailer included, is 0.
  */
+typedef enum {
+    FRAME_INTEGRITY_SUM8 = 0,   //!< two's complement of the byte sum
+    FRAME_INTEGRITY_CRC16,      //!< CRC-16/CCITT-FALSE, see bsp/crc.h
+    FRAME_INTEGRITY_CRC32,      //!< CRC-32/MPEG-2
+    N_FRAME_INTEGRITY
+} FRAME_INTEGRITY_T;
+
 // Size in bytes
 #define SZ_TAG_SOF                      (1)
 #define SZ_LENGTH                       (2)
 #define SZ_PKT_SEQ                      (2)
 #define SZ_CHECKSUM                     (1)
-#define SZ_FRAME_OVERHEAD               (SZ_TAG_SOF + SZ_LENGTH + SZ_PKT_SEQ + SZ_CHECKSUM)
+#define SZ_CRC16                        (2)
+#define SZ_CRC32                        (4)
+#define SZ_TRAILER_MAX                  (SZ_CRC32)
+#define SZ_TRAILER(integrity)           (((integrity) == FRAME_INTEGRITY_CRC32) ? SZ_CRC32 : \
+                                         (((integrity) == FRAME_INTEGRITY_CRC16) ? SZ_CRC16 : SZ_CHECKSUM))
+#define SZ_FRAME_HEADER                 (SZ_TAG_SOF + SZ_LENGTH + SZ_PKT_SEQ)
+#define SZ_FRAME_OVERHEAD               (SZ_FRAME_HEADER + SZ_CHECKSUM)
+#define SZ_FRAME_OVERHEAD_MAX           (SZ_FRAME_HEADER + SZ_TRAILER_MAX)
+
+/* Longer frames can not be delivered, so the parser does not wait for them */
+#define FRAME_MAX_LENGTH                (CONFIG_CMD_FRAME_SIZE + SZ_FRAME_OVERHEAD_MAX)
+/* A receive ring is a power of two that holds a whole command frame */
+#define FRAME_PARSER_RING_VALID(size)   ((((size) & ((size) - 1)) == 0) && ((size) > FRAME_MAX_LENGTH))
+
+#define FRAME_LENGTH_MASK               (0x3FFF)
+#define FRAME_LENGTH_INTEGRITY_SHIFT    (14)
 
 // Offset
 #define OFFSET_USB_BYTES_IN_PACKET      (0)
@@ -43,16 +79,100 @@
 
 #define TAG_SOF                         (0xFF)  //!< Value used as Start of frame
 
-typedef int32_t (* cbValidFrame)(uint32_t);
+/*
+ * Called with the frame payload (command + parameters).  pPayload points
+ * into the receive ring, or into pCommandBuffer when the payload wraps, and
+ * is only valid during the call.
+ */
+typedef int32_t (* cbValidFrame)(uint8_t const * pPayload, uint32_t length);
 
 typedef struct {
     cbValidFrame callback;
-    uint8_t * pCommandBuffer;
-    SemaphoreHandle_t mutex;
+    uint8_t * pCommandBuffer;   //!< CONFIG_CMD_FRAME_SIZE bytes, used for wrapped payloads
 } frame_valid_cb_t;
 
-void frame_parser_init(frame_valid_cb_t * pCallbackDef);
-bool frame_parser_receive(uint8_t *pBuf, uint32_t len);
-void frame_parser_process(void);
+/*
+ * Host sequence state, see frame_parser_track_sequence()
+ *  expected   : next new sequence
+ *  missing    : bit i set when expected - 1 - i has not arrived
+ *  freeBytes  : room left in the receive ring
+ */
+typedef struct {
+    uint16_t expected;
+    uint16_t freeBytes;
+    uint32_t missing;
+} frame_seq_report_t;
+
+typedef enum {
+    FRAME_STATE_SOF = 0,
+    FRAME_STATE_LENGTH,
+    FRAME_STATE_BODY
+} FRAME_STATE_T;
+
+/*
+ * One instance per byte stream (vendor, CDC).  Not locked: receive and
+ * process, and so the callback, must all run on one task.
+ *  rdPtr   : start of the frame being parsed, bytes before it are free
+ *  scanPtr : next byte to parse, the state below covers rdPtr..scanPtr
+ */
+typedef struct {
+    bool bInit;
+    uint32_t rdPtr;
+    uint32_t wrPtr;
+    uint32_t scanPtr;
+    FRAME_STATE_T state;
+    uint32_t frameLength;
+    uint32_t frameCount;
+    FRAME_INTEGRITY_T frameIntegrity;
+    uint32_t frameCheck;                //!< running check over rdPtr..scanPtr, BODY state
+    volatile uint8_t requiredIntegrity; //!< FRAME_INTEGRITY_T, weaker frames are dropped
+    volatile bool bTrackSequence;
+    volatile uint8_t trackGeneration;   //!< bumped by frame_parser_track_sequence()
+    uint8_t trackGenerationSeen;
+    bool bSequenceValid;
+    bool bReportDue;
+    uint16_t expectedSequence;
+    uint32_t missingMask;
+    uint32_t acceptedSinceReport;
+    uint8_t * rxFrameBuffer;            //!< frame_parser_set_ring()
+    uint32_t rxBufMask;
+    frame_valid_cb_t validFrameCb;
+} frame_parser_t;
+
+void frame_parser_init(frame_parser_t * pParser, frame_valid_cb_t * pCallbackDef);
+/*
+ * Gives the parser a receive ring of size bytes, FRAME_PARSER_RING_VALID,
+ * dropping anything held in the old one.  Nothing is received until then.
+ * Same task as receive, or while that task can not run.
+ */
+void frame_parser_set_ring(frame_parser_t * pParser, uint8_t * pRing, uint32_t size);
+/* No bytes held and no frame in progress */
+bool frame_parser_idle(frame_parser_t const * pParser);
+bool frame_parser_receive(frame_parser_t * pParser, uint8_t *pBuf, uint32_t len);
+void frame_parser_process(frame_parser_t * pParser);
+/* Takes effect from the next frame, may be called from any task */
+void frame_parser_require(frame_parser_t * pParser, FRAME_INTEGRITY_T integrity);
+/*
+ * Checks the host sequence from the next frame on, the first frame sets
+ * it.  Duplicates are dropped, a frame that fills a reported gap is taken.
+ * May be called from any task.
+ */
+void frame_parser_track_sequence(frame_parser_t * pParser, bool enable);
+/*
+ * True when the host should hear about the sequence state: after a gap, a
+ * duplicate or a receive overflow, every CONFIG_PARSER_ACK_INTERVAL frames
+ * and once the received bytes are all parsed.  Same task as process.
+ */
+bool frame_parser_sequence_report(frame_parser_t * pParser, frame_seq_report_t * pReport);
+
+/*
+ * Running check over a frame: the byte sum, or the CRC register.
+ * frame_check_trailer() writes the trailer that brings the check over the
+ * whole frame to 0 and returns its size.
+ */
+uint32_t frame_check_start(FRAME_INTEGRITY_T integrity);
+uint32_t frame_check_update(FRAME_INTEGRITY_T integrity, uint32_t check,
+                            uint8_t const * pBuf, uint32_t length);
+uint32_t frame_check_trailer(FRAME_INTEGRITY_T integrity, uint32_t check, uint8_t * pTrailer);
 
 #endif /* USB_DEVICE_FRAMEPARSER_FRAMEPARSER_H_ */
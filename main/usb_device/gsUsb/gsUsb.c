@@ -0,0 +1,393 @@
+/*!
+ * \file gsUsb.c
+ *
+ * Glue between the gs_usb wire format (gsUsbCodec) and the CAN driver.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "tusb.h"
+#include "gsUsb.h"
+#include "gsUsbCodec.h"
+#include "bsp/board_api.h"
+#include "bsp/can.h"
+#include "stats/latency.h"
+
+#define GS_USB_CHANNEL_COUNT            (1)
+
+/*
+ * Frames to the host are sent one per bulk transfer.  None of the gs_usb
+ * frame sizes is a multiple of the endpoint size, so every transfer ends
+ * with a short packet and no ZLP is needed.
+ */
+typedef struct {
+    uint8_t size;
+    uint8_t data[GS_USB_FRAME_MAX_SZ];
+} to_host_element_t;
+
+#define GS_USB_TO_HOST_QUEUE_LENGTH     (8)
+#define GS_USB_TO_HOST_ELEMENT_SZ       sizeof(to_host_element_t)
+static StaticQueue_t toHostStaticQueue;
+uint8_t toHostQueueStorageArea[GS_USB_TO_HOST_QUEUE_LENGTH * GS_USB_TO_HOST_ELEMENT_SZ];
+static QueueHandle_t toHostQHandle;
+
+static bool bInit = false;
+static bool bStarted = false;
+static bool bOverflow = false;
+/*
+ * Host frames taken into the CAN TX path whose echo is not queued yet.
+ * Each one keeps a to-host slot free: the host driver only reuses a TX
+ * context once its echo_id comes back, so echoes are never dropped.
+ */
+static uint32_t echoesOutstanding = 0;
+static uint32_t modeFlags = 0;
+/* 1Mbps nominal and data until the host sets the bit timing */
+static can_timing_t nominalTiming = {1, 12, 71, 12};
+static can_timing_t dataTiming = {3, 4, 23, 4};
+
+/* EP0 data stage buffer, must outlive the control transfer */
+static uint8_t ctrlBuffer[GS_USB_BT_CONST_EXT_SZ];
+
+/* Host to device stream, reassembled into fixed size gs_host_frames */
+static uint8_t hostFrame[GS_USB_FRAME_MAX_SZ];
+static uint32_t hostFrameLength = 0;
+static bool bHostFramePending = false;
+static can_frame_t pendingFrame;
+static uint32_t pendingEchoId = 0;
+
+/* Serializes the USB class, CAN and EP0 contexts */
+static SemaphoreHandle_t xGsMutex = NULL;
+static StaticSemaphore_t xGsMutexBuffer;
+
+static void canRxHandler(can_frame_t const * pFrame, bool more);
+static void canTxHandler(tx_queue_element_t const * pElem);
+
+
+void gs_usb_init(void)
+{
+    if(!bInit) {
+        toHostQHandle = xQueueCreateStatic(
+                            GS_USB_TO_HOST_QUEUE_LENGTH,
+                            GS_USB_TO_HOST_ELEMENT_SZ,
+                            toHostQueueStorageArea,
+                            &toHostStaticQueue
+                            );
+        xGsMutex = xSemaphoreCreateRecursiveMutexStatic( &xGsMutexBuffer );
+        configASSERT(xGsMutex);
+
+        CAN_set_rx_handler(canRxHandler);
+        CAN_set_tx_handler(canTxHandler);
+
+        bInit = true;
+    }
+}
+
+
+/*
+ * Starts the next device to host transfer once the previous one is done
+ */
+static void to_host_pump(void)
+{
+    to_host_element_t element;
+
+    xSemaphoreTakeRecursive(xGsMutex, portMAX_DELAY);
+    if(tud_vendor_mounted() &&
+       (tud_vendor_write_available() == CFG_TUD_VENDOR_TX_BUFSIZE) &&
+       (pdTRUE == xQueueReceive(toHostQHandle, &element, 0))) {
+        tud_vendor_write(element.data, element.size);
+        tud_vendor_write_flush();
+    }
+    xSemaphoreGiveRecursive(xGsMutex);
+}
+
+
+/*
+ * Echoes always find a slot, received frames only take slots not held for
+ * outstanding echoes and are otherwise dropped with GS_CAN_FLAG_OVERFLOW
+ * on the next frame that makes it.
+ */
+static void to_host_push(can_frame_t const * pFrame, uint32_t echoId)
+{
+    to_host_element_t element;
+    bool queued = false;
+
+    xSemaphoreTakeRecursive(xGsMutex, portMAX_DELAY);
+    element.size = (uint8_t)gs_usb_encode_frame(element.data, pFrame, echoId, 0, modeFlags);
+    if(bOverflow) {
+        element.data[10] |= GS_CAN_FLAG_OVERFLOW;
+    }
+    if(echoId != GS_USB_ECHO_ID_RX) {
+        configASSERT(echoesOutstanding > 0);
+        echoesOutstanding--;
+        queued = (pdTRUE == xQueueSend(toHostQHandle, &element, 0));
+        configASSERT(queued);
+    } else if(uxQueueSpacesAvailable(toHostQHandle) > echoesOutstanding) {
+        queued = (pdTRUE == xQueueSend(toHostQHandle, &element, 0));
+    }
+    bOverflow = !queued;
+
+    to_host_pump();
+    xSemaphoreGiveRecursive(xGsMutex);
+}
+
+
+/*
+ * A host frame is only taken when its echo has a slot to come back in,
+ * otherwise it stays pending until the to-host queue drains.
+ */
+static void host_frame_send(void)
+{
+    /* Cleared first, as CAN_send_frame may call back into canTxHandler */
+    bHostFramePending = false;
+    if(uxQueueSpacesAvailable(toHostQHandle) <= echoesOutstanding) {
+        bHostFramePending = true;
+        return;
+    }
+    echoesOutstanding++;
+    if(!CAN_send_frame(&pendingFrame, pendingEchoId)) {
+        echoesOutstanding--;
+        bHostFramePending = true;
+    }
+}
+
+
+void gs_usb_process(void)
+{
+    const uint32_t frameSize = gs_usb_frame_size(modeFlags, false);
+    uint8_t channel;
+
+    xSemaphoreTakeRecursive(xGsMutex, portMAX_DELAY);
+    /* Leave data in the endpoint FIFO while the CAN TX queue is full */
+    while(!bHostFramePending && tud_vendor_available()) {
+        hostFrameLength += tud_vendor_read(&hostFrame[hostFrameLength], frameSize - hostFrameLength);
+        LATENCY_PROBE_OUT_READ();
+        if(hostFrameLength < frameSize) {
+            continue;
+        }
+        hostFrameLength = 0;
+        if(bStarted &&
+           gs_usb_decode_frame(hostFrame, frameSize, modeFlags, &pendingFrame, &pendingEchoId, &channel) &&
+           (channel < GS_USB_CHANNEL_COUNT)) {
+            host_frame_send();
+        }
+    }
+    xSemaphoreGiveRecursive(xGsMutex);
+}
+
+
+void gs_usb_tx_complete(void)
+{
+    xSemaphoreTakeRecursive(xGsMutex, portMAX_DELAY);
+    to_host_pump();
+    /* A slot came free, a host frame held back for its echo may go now */
+    if(bHostFramePending) {
+        host_frame_send();
+        if(!bHostFramePending) {
+            gs_usb_process();
+        }
+    }
+    xSemaphoreGiveRecursive(xGsMutex);
+}
+
+
+static bool gs_usb_start(uint32_t flags)
+{
+    uint32_t canMode = CAN_MODE_NORMAL;
+    bool ret;
+
+    if((flags & GS_CAN_FEATURE_LISTEN_ONLY) != 0) {
+        canMode |= CAN_MODE_LISTEN_ONLY;
+    }
+    if((flags & GS_CAN_FEATURE_LOOP_BACK) != 0) {
+        canMode |= CAN_MODE_LOOPBACK;
+    }
+    if((flags & GS_CAN_FEATURE_ONE_SHOT) != 0) {
+        canMode |= CAN_MODE_ONE_SHOT;
+    }
+    if((flags & GS_CAN_FEATURE_FD) != 0) {
+        canMode |= CAN_MODE_FD;
+    }
+
+    if(bStarted) {
+        CAN_stop();
+    }
+    modeFlags = flags;
+    hostFrameLength = 0;
+    bHostFramePending = false;
+    bOverflow = false;
+    /* Frames left in the CAN TX ring are dropped without an echo */
+    echoesOutstanding = 0;
+    xQueueReset(toHostQHandle);
+
+    ret = CAN_configure_timing(&nominalTiming, &dataTiming, canMode) && CAN_start();
+    bStarted = ret;
+
+    return ret;
+}
+
+
+static bool control_out(tusb_control_request_t const * request)
+{
+    bool ret = false;
+    uint32_t mode;
+    uint32_t flags;
+
+    if((request->bRequest != GS_USB_BREQ_HOST_FORMAT) &&
+       (request->wValue >= GS_USB_CHANNEL_COUNT)) {
+        return false;
+    }
+
+    xSemaphoreTakeRecursive(xGsMutex, portMAX_DELAY);
+    switch(request->bRequest) {
+        case GS_USB_BREQ_HOST_FORMAT: {
+            ret = gs_usb_decode_host_config(ctrlBuffer, request->wLength);
+            break;
+        }
+        case GS_USB_BREQ_BITTIMING: {
+            ret = gs_usb_decode_bittiming(ctrlBuffer, request->wLength, false, &nominalTiming);
+            break;
+        }
+        case GS_USB_BREQ_DATA_BITTIMING: {
+            ret = gs_usb_decode_bittiming(ctrlBuffer, request->wLength, true, &dataTiming);
+            break;
+        }
+        case GS_USB_BREQ_MODE: {
+            if(gs_usb_decode_mode(ctrlBuffer, request->wLength, &mode, &flags)) {
+                if(mode == GS_CAN_MODE_START) {
+                    ret = gs_usb_start(flags);
+                } else {
+                    CAN_stop();
+                    bStarted = false;
+                    ret = true;
+                }
+            }
+            break;
+        }
+        default: {
+            break;
+        }
+    }
+    xSemaphoreGiveRecursive(xGsMutex);
+
+    return ret;
+}
+
+
+static uint32_t control_in(tusb_control_request_t const * request)
+{
+    can_status_t canStatus;
+    uint32_t state;
+
+    if((request->bRequest != GS_USB_BREQ_DEVICE_CONFIG) &&
+       (request->wValue >= GS_USB_CHANNEL_COUNT)) {
+        return 0;
+    }
+
+    switch(request->bRequest) {
+        case GS_USB_BREQ_DEVICE_CONFIG:
+            return gs_usb_encode_device_config(ctrlBuffer, GS_USB_CHANNEL_COUNT);
+
+        case GS_USB_BREQ_BT_CONST:
+            return gs_usb_encode_bt_const(ctrlBuffer, false);
+
+        case GS_USB_BREQ_BT_CONST_EXT:
+            return gs_usb_encode_bt_const(ctrlBuffer, true);
+
+        case GS_USB_BREQ_TIMESTAMP:
+            return gs_usb_encode_timestamp(ctrlBuffer, board_timestamp_us());
+
+        case GS_USB_BREQ_GET_STATE: {
+            CAN_get_status(&canStatus);
+            if(!bStarted) {
+                state = GS_CAN_STATE_STOPPED;
+            } else if(canStatus.busState == CAN_BUS_OFF) {
+                state = GS_CAN_STATE_BUS_OFF;
+            } else if(canStatus.busState == CAN_BUS_ERROR_PASSIVE) {
+                state = GS_CAN_STATE_ERROR_PASSIVE;
+            } else if(canStatus.busState == CAN_BUS_ERROR_WARNING) {
+                state = GS_CAN_STATE_ERROR_WARNING;
+            } else {
+                state = GS_CAN_STATE_ERROR_ACTIVE;
+            }
+            return gs_usb_encode_device_state(ctrlBuffer, state,
+                                              canStatus.rxErrorCount, canStatus.txErrorCount);
+        }
+
+        default:
+            return 0;
+    }
+}
+
+
+/*
+ * gs_usb requests are vendor type with interface recipient, wValue is
+ * the channel.  OUT requests are handled once the data stage completes.
+ */
+bool gs_usb_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const * request)
+{
+    uint32_t length;
+
+    if(request->bmRequestType_bit.type != TUSB_REQ_TYPE_VENDOR) {
+        return false;
+    }
+
+    if(request->bmRequestType_bit.direction == TUSB_DIR_OUT) {
+        if(stage == CONTROL_STAGE_SETUP) {
+            if(request->wLength > sizeof(ctrlBuffer)) {
+                return false;
+            }
+            return tud_control_xfer(rhport, request, ctrlBuffer, request->wLength);
+        } else if(stage == CONTROL_STAGE_DATA) {
+            return control_out(request);
+        }
+        return true;
+    }
+
+    if(stage != CONTROL_STAGE_SETUP) {
+        return true;
+    }
+    length = control_in(request);
+    if(length == 0) {
+        return false;
+    }
+    return tud_control_xfer(rhport, request, ctrlBuffer, TU_MIN(request->wLength, length));
+}
+
+
+static void canRxHandler(can_frame_t const * pFrame, bool more)
+{
+    (void)more;
+
+    if(bStarted) {
+        to_host_push(pFrame, GS_USB_ECHO_ID_RX);
+    }
+}
+
+
+/*
+ * The echo goes back to the host once the frame is handed to the FDCAN
+ * TX FIFO, which is also when a slot frees up in the CAN TX queue.
+ */
+static void canTxHandler(tx_queue_element_t const * pElem)
+{
+    can_frame_t frame;
+
+    frame.id = fdcan_elem_id(pElem->word0);
+    frame.timestamp = board_timestamp_us();
+    frame.len = fdcan_elem_len(pElem->word1);
+    frame.flags = fdcan_elem_flags(pElem->word0, pElem->word1);
+    memcpy(frame.data, pElem->data, frame.len);
+
+    xSemaphoreTakeRecursive(xGsMutex, portMAX_DELAY);
+    to_host_push(&frame, pElem->tag);
+    if(bHostFramePending) {
+        host_frame_send();
+        if(!bHostFramePending) {
+            gs_usb_process();
+        }
+    }
+    xSemaphoreGiveRecursive(xGsMutex);
+}
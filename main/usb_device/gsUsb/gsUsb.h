@@ -0,0 +1,20 @@
+/*!
+ * \file gsUsb.h
+ *
+ * gs_usb (candleLight) compatible vendor interface, see CONFIG_GS_USB
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef USB_DEVICE_GSUSB_GSUSB_H_
+#define USB_DEVICE_GSUSB_GSUSB_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "tusb.h"
+
+void gs_usb_init(void);
+bool gs_usb_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const * request);
+void gs_usb_process(void);
+void gs_usb_tx_complete(void);
+
+#endif /* USB_DEVICE_GSUSB_GSUSB_H_ */
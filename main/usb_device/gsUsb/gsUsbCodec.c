@@ -0,0 +1,288 @@
+/*!
+ * \file gsUsbCodec.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "gsUsbCodec.h"
+
+#define CLASSIC_DATA_LENGTH             (8)
+
+
+static void put_u32(uint8_t * pBuf, uint32_t value)
+{
+    pBuf[0] = (uint8_t)(value & 0xFF);
+    pBuf[1] = (uint8_t)((value >> 8) & 0xFF);
+    pBuf[2] = (uint8_t)((value >> 16) & 0xFF);
+    pBuf[3] = (uint8_t)((value >> 24) & 0xFF);
+}
+
+
+static uint32_t get_u32(uint8_t const * pBuf)
+{
+    return ((uint32_t)pBuf[0]) |
+           (((uint32_t)pBuf[1]) << 8) |
+           (((uint32_t)pBuf[2]) << 16) |
+           (((uint32_t)pBuf[3]) << 24);
+}
+
+
+uint32_t gs_usb_frame_size(uint32_t modeFlags, bool toHost)
+{
+    uint32_t size = GS_USB_FRAME_HEADER_SZ;
+
+    size += ((modeFlags & GS_CAN_FEATURE_FD) != 0) ? CAN_MAX_DATA_LENGTH : CLASSIC_DATA_LENGTH;
+    if(toHost && ((modeFlags & GS_CAN_FEATURE_HW_TIMESTAMP) != 0)) {
+        size += GS_USB_TIMESTAMP_SZ;
+    }
+
+    return size;
+}
+
+
+/*
+ * The payload is sized by the frame's own FD flag: classic frames are sent
+ * as classic_can(_ts) even in FD mode, which is where the Linux driver looks
+ * for the data and the timestamp of a frame without GS_CAN_FLAG_FD.
+ */
+uint32_t gs_usb_encode_frame(uint8_t * pBuf, can_frame_t const * pFrame,
+                             uint32_t echoId, uint8_t channel, uint32_t modeFlags)
+{
+    const bool isFd = ((pFrame->flags & CAN_FRAME_FLAG_FD) != 0) && ((modeFlags & GS_CAN_FEATURE_FD) != 0);
+    const uint32_t dataSize = isFd ? CAN_MAX_DATA_LENGTH : CLASSIC_DATA_LENGTH;
+    uint32_t size = GS_USB_FRAME_HEADER_SZ + dataSize;
+    uint32_t canId = pFrame->id;
+    uint8_t flags = 0;
+    uint8_t len = pFrame->len;
+    uint8_t dlc;
+
+    if((pFrame->flags & CAN_FRAME_FLAG_EXTENDED) != 0) {
+        canId = (canId & 0x1FFFFFFFUL) | GS_CAN_EFF_FLAG;
+    } else {
+        canId &= 0x7FFUL;
+    }
+
+    if(isFd) {
+        dlc = can_len_to_dlc(len);
+        len = can_dlc_to_len(dlc);
+        flags |= GS_CAN_FLAG_FD;
+        if((pFrame->flags & CAN_FRAME_FLAG_BRS) != 0) {
+            flags |= GS_CAN_FLAG_BRS;
+        }
+        if((pFrame->flags & CAN_FRAME_FLAG_ESI) != 0) {
+            flags |= GS_CAN_FLAG_ESI;
+        }
+    } else {
+        if(len > CLASSIC_DATA_LENGTH) {
+            len = CLASSIC_DATA_LENGTH;
+        }
+        dlc = len;
+        if((pFrame->flags & CAN_FRAME_FLAG_RTR) != 0) {
+            canId |= GS_CAN_RTR_FLAG;
+        }
+    }
+
+    put_u32(&pBuf[0], echoId);
+    put_u32(&pBuf[4], canId);
+    pBuf[8] = dlc;
+    pBuf[9] = channel;
+    pBuf[10] = flags;
+    pBuf[11] = 0;
+    memset(&pBuf[GS_USB_FRAME_HEADER_SZ], 0, dataSize);
+    if((canId & GS_CAN_RTR_FLAG) == 0) {
+        memcpy(&pBuf[GS_USB_FRAME_HEADER_SZ], pFrame->data, len);
+    }
+
+    if((modeFlags & GS_CAN_FEATURE_HW_TIMESTAMP) != 0) {
+        put_u32(&pBuf[size], pFrame->timestamp);
+        size += GS_USB_TIMESTAMP_SZ;
+    }
+
+    return size;
+}
+
+
+/*
+ * As on encode, the payload size follows the frame's FD flag.  The Linux
+ * driver pads every frame to the size of the mode, which is what
+ * gs_usb_process() reassembles, so length may be larger.
+ */
+bool gs_usb_decode_frame(uint8_t const * pBuf, uint32_t length, uint32_t modeFlags,
+                         can_frame_t * pFrame, uint32_t * pEchoId, uint8_t * pChannel)
+{
+    uint32_t canId;
+    uint8_t dlc;
+    uint8_t flags;
+
+    if(length < (GS_USB_FRAME_HEADER_SZ + CLASSIC_DATA_LENGTH)) {
+        return false;
+    }
+
+    *pEchoId = get_u32(&pBuf[0]);
+    canId = get_u32(&pBuf[4]);
+    dlc = pBuf[8];
+    *pChannel = pBuf[9];
+    flags = pBuf[10];
+
+    if((canId & GS_CAN_ERR_FLAG) != 0) {
+        return false;
+    }
+
+    pFrame->flags = 0;
+    pFrame->timestamp = 0;
+    if((canId & GS_CAN_EFF_FLAG) != 0) {
+        pFrame->flags |= CAN_FRAME_FLAG_EXTENDED;
+        pFrame->id = canId & 0x1FFFFFFFUL;
+    } else {
+        pFrame->id = canId & 0x7FFUL;
+    }
+
+    if((flags & GS_CAN_FLAG_FD) != 0) {
+        if(((modeFlags & GS_CAN_FEATURE_FD) == 0) ||
+           (length < (GS_USB_FRAME_HEADER_SZ + CAN_MAX_DATA_LENGTH))) {
+            return false;
+        }
+        pFrame->flags |= CAN_FRAME_FLAG_FD;
+        if((flags & GS_CAN_FLAG_BRS) != 0) {
+            pFrame->flags |= CAN_FRAME_FLAG_BRS;
+        }
+        if((flags & GS_CAN_FLAG_ESI) != 0) {
+            pFrame->flags |= CAN_FRAME_FLAG_ESI;
+        }
+        pFrame->len = can_dlc_to_len(dlc);
+    } else {
+        if((canId & GS_CAN_RTR_FLAG) != 0) {
+            pFrame->flags |= CAN_FRAME_FLAG_RTR;
+        }
+        pFrame->len = (dlc > CLASSIC_DATA_LENGTH) ? CLASSIC_DATA_LENGTH : dlc;
+    }
+    memcpy(pFrame->data, &pBuf[GS_USB_FRAME_HEADER_SZ], pFrame->len);
+
+    return true;
+}
+
+
+bool gs_usb_decode_host_config(uint8_t const * pBuf, uint32_t length)
+{
+    return (length >= GS_USB_HOST_CONFIG_SZ) && (get_u32(pBuf) == GS_USB_HOST_BYTE_ORDER);
+}
+
+
+bool gs_usb_decode_mode(uint8_t const * pBuf, uint32_t length, uint32_t * pMode, uint32_t * pFlags)
+{
+    if(length < GS_USB_DEVICE_MODE_SZ) {
+        return false;
+    }
+    *pMode = get_u32(&pBuf[0]);
+    *pFlags = get_u32(&pBuf[4]);
+
+    if((*pMode != GS_CAN_MODE_RESET) && (*pMode != GS_CAN_MODE_START)) {
+        return false;
+    }
+
+    return ((*pFlags & ~GS_USB_SUPPORTED_FEATURES) == 0);
+}
+
+
+/*
+ * gs_device_bittiming: prop_seg, phase_seg1, phase_seg2, sjw, brp.
+ * FDCAN has no separate propagation segment, it is folded into tseg1.
+ */
+bool gs_usb_decode_bittiming(uint8_t const * pBuf, uint32_t length, bool isData, can_timing_t * pTiming)
+{
+    uint32_t tseg1;
+    uint32_t tseg2;
+    uint32_t sjw;
+    uint32_t brp;
+
+    if(length < GS_USB_BITTIMING_SZ) {
+        return false;
+    }
+    tseg1 = get_u32(&pBuf[0]) + get_u32(&pBuf[4]);
+    tseg2 = get_u32(&pBuf[8]);
+    sjw = get_u32(&pBuf[12]);
+    brp = get_u32(&pBuf[16]);
+
+    if(isData) {
+        if((tseg1 < GS_USB_DTSEG1_MIN) || (tseg1 > GS_USB_DTSEG1_MAX) ||
+           (tseg2 < GS_USB_DTSEG2_MIN) || (tseg2 > GS_USB_DTSEG2_MAX) ||
+           (sjw < 1) || (sjw > GS_USB_DSJW_MAX) ||
+           (brp < GS_USB_DBRP_MIN) || (brp > GS_USB_DBRP_MAX)) {
+            return false;
+        }
+    } else {
+        if((tseg1 < GS_USB_TSEG1_MIN) || (tseg1 > GS_USB_TSEG1_MAX) ||
+           (tseg2 < GS_USB_TSEG2_MIN) || (tseg2 > GS_USB_TSEG2_MAX) ||
+           (sjw < 1) || (sjw > GS_USB_SJW_MAX) ||
+           (brp < GS_USB_BRP_MIN) || (brp > GS_USB_BRP_MAX)) {
+            return false;
+        }
+    }
+
+    pTiming->prescaler = brp;
+    pTiming->sjw = sjw;
+    pTiming->tseg1 = tseg1;
+    pTiming->tseg2 = tseg2;
+
+    return true;
+}
+
+
+uint32_t gs_usb_encode_device_config(uint8_t * pBuf, uint8_t channelCount)
+{
+    pBuf[0] = 0;
+    pBuf[1] = 0;
+    pBuf[2] = 0;
+    pBuf[3] = (uint8_t)(channelCount - 1);  // icount is zero based
+    put_u32(&pBuf[4], GS_USB_SW_VERSION);
+    put_u32(&pBuf[8], GS_USB_HW_VERSION);
+
+    return GS_USB_DEVICE_CONFIG_SZ;
+}
+
+
+uint32_t gs_usb_encode_bt_const(uint8_t * pBuf, bool extended)
+{
+    put_u32(&pBuf[0], GS_USB_SUPPORTED_FEATURES);
+    put_u32(&pBuf[4], GS_USB_FCLK_CAN);
+    put_u32(&pBuf[8], GS_USB_TSEG1_MIN);
+    put_u32(&pBuf[12], GS_USB_TSEG1_MAX);
+    put_u32(&pBuf[16], GS_USB_TSEG2_MIN);
+    put_u32(&pBuf[20], GS_USB_TSEG2_MAX);
+    put_u32(&pBuf[24], GS_USB_SJW_MAX);
+    put_u32(&pBuf[28], GS_USB_BRP_MIN);
+    put_u32(&pBuf[32], GS_USB_BRP_MAX);
+    put_u32(&pBuf[36], 1);                  // brp_inc
+    if(!extended) {
+        return GS_USB_BT_CONST_SZ;
+    }
+
+    put_u32(&pBuf[40], GS_USB_DTSEG1_MIN);
+    put_u32(&pBuf[44], GS_USB_DTSEG1_MAX);
+    put_u32(&pBuf[48], GS_USB_DTSEG2_MIN);
+    put_u32(&pBuf[52], GS_USB_DTSEG2_MAX);
+    put_u32(&pBuf[56], GS_USB_DSJW_MAX);
+    put_u32(&pBuf[60], GS_USB_DBRP_MIN);
+    put_u32(&pBuf[64], GS_USB_DBRP_MAX);
+    put_u32(&pBuf[68], 1);                  // dbrp_inc
+
+    return GS_USB_BT_CONST_EXT_SZ;
+}
+
+
+uint32_t gs_usb_encode_device_state(uint8_t * pBuf, uint32_t state, uint32_t rxErr, uint32_t txErr)
+{
+    put_u32(&pBuf[0], state);
+    put_u32(&pBuf[4], rxErr);
+    put_u32(&pBuf[8], txErr);
+
+    return GS_USB_DEVICE_STATE_SZ;
+}
+
+
+uint32_t gs_usb_encode_timestamp(uint8_t * pBuf, uint32_t timestamp)
+{
+    put_u32(pBuf, timestamp);
+
+    return GS_USB_TIMESTAMP_SZ;
+}
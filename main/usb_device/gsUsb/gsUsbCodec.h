@@ -0,0 +1,137 @@
+/*!
+ * \file gsUsbCodec.h
+ *
+ * Wire format of the gs_usb (candleLight) USB protocol as used by the Linux
+ * gs_usb driver.  All structures are little-endian and packed/unpacked
+ * byte by byte, so this module has no HAL/RTOS dependency.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef USB_DEVICE_GSUSB_GSUSBCODEC_H_
+#define USB_DEVICE_GSUSB_GSUSBCODEC_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "bsp/can_types.h"
+
+/* Control requests (bRequest), vendor type, interface recipient */
+#define GS_USB_BREQ_HOST_FORMAT         (0)
+#define GS_USB_BREQ_BITTIMING           (1)
+#define GS_USB_BREQ_MODE                (2)
+#define GS_USB_BREQ_BERR                (3)
+#define GS_USB_BREQ_BT_CONST            (4)
+#define GS_USB_BREQ_DEVICE_CONFIG       (5)
+#define GS_USB_BREQ_TIMESTAMP           (6)
+#define GS_USB_BREQ_IDENTIFY            (7)
+#define GS_USB_BREQ_GET_USER_ID         (8)
+#define GS_USB_BREQ_SET_USER_ID         (9)
+#define GS_USB_BREQ_DATA_BITTIMING      (10)
+#define GS_USB_BREQ_BT_CONST_EXT        (11)
+#define GS_USB_BREQ_SET_TERMINATION     (12)
+#define GS_USB_BREQ_GET_TERMINATION     (13)
+#define GS_USB_BREQ_GET_STATE           (14)
+
+/* gs_device_mode.mode */
+#define GS_CAN_MODE_RESET               (0)
+#define GS_CAN_MODE_START               (1)
+
+/* gs_device_bt_const.feature and gs_device_mode.flags share these bits */
+#define GS_CAN_FEATURE_LISTEN_ONLY      (1UL << 0)
+#define GS_CAN_FEATURE_LOOP_BACK        (1UL << 1)
+#define GS_CAN_FEATURE_TRIPLE_SAMPLE    (1UL << 2)
+#define GS_CAN_FEATURE_ONE_SHOT         (1UL << 3)
+#define GS_CAN_FEATURE_HW_TIMESTAMP     (1UL << 4)
+#define GS_CAN_FEATURE_IDENTIFY         (1UL << 5)
+#define GS_CAN_FEATURE_USER_ID          (1UL << 6)
+#define GS_CAN_FEATURE_PAD_PKTS         (1UL << 7)
+#define GS_CAN_FEATURE_FD               (1UL << 8)
+#define GS_CAN_FEATURE_BT_CONST_EXT     (1UL << 10)
+#define GS_CAN_FEATURE_TERMINATION      (1UL << 11)
+#define GS_CAN_FEATURE_BERR_REPORTING   (1UL << 12)
+#define GS_CAN_FEATURE_GET_STATE        (1UL << 13)
+
+#define GS_USB_SUPPORTED_FEATURES       (GS_CAN_FEATURE_LISTEN_ONLY | \
+                                         GS_CAN_FEATURE_LOOP_BACK | \
+                                         GS_CAN_FEATURE_ONE_SHOT | \
+                                         GS_CAN_FEATURE_HW_TIMESTAMP | \
+                                         GS_CAN_FEATURE_FD | \
+                                         GS_CAN_FEATURE_BT_CONST_EXT | \
+                                         GS_CAN_FEATURE_GET_STATE)
+
+/* gs_device_state.state */
+#define GS_CAN_STATE_ERROR_ACTIVE       (0)
+#define GS_CAN_STATE_ERROR_WARNING      (1)
+#define GS_CAN_STATE_ERROR_PASSIVE      (2)
+#define GS_CAN_STATE_BUS_OFF            (3)
+#define GS_CAN_STATE_STOPPED            (4)
+
+/* gs_host_frame.flags */
+#define GS_CAN_FLAG_OVERFLOW            (0x01)
+#define GS_CAN_FLAG_FD                  (0x02)
+#define GS_CAN_FLAG_BRS                 (0x04)
+#define GS_CAN_FLAG_ESI                 (0x08)
+
+/* gs_host_frame.can_id, SocketCAN layout */
+#define GS_CAN_EFF_FLAG                 (0x80000000UL)
+#define GS_CAN_RTR_FLAG                 (0x40000000UL)
+#define GS_CAN_ERR_FLAG                 (0x20000000UL)
+
+#define GS_USB_ECHO_ID_RX               (0xFFFFFFFFUL)  //!< echo_id of received frames
+#define GS_USB_HOST_BYTE_ORDER          (0x0000BEEFUL)
+
+/* Wire sizes */
+#define GS_USB_HOST_CONFIG_SZ           (4)
+#define GS_USB_DEVICE_CONFIG_SZ         (12)
+#define GS_USB_DEVICE_MODE_SZ           (8)
+#define GS_USB_DEVICE_STATE_SZ          (12)
+#define GS_USB_BITTIMING_SZ             (20)
+#define GS_USB_BT_CONST_SZ              (40)
+#define GS_USB_BT_CONST_EXT_SZ          (72)
+#define GS_USB_TIMESTAMP_SZ             (4)
+#define GS_USB_FRAME_HEADER_SZ          (12)
+#define GS_USB_FRAME_MAX_SZ             (GS_USB_FRAME_HEADER_SZ + CAN_MAX_DATA_LENGTH + GS_USB_TIMESTAMP_SZ)
+
+/* FDCAN kernel clock and bit timing limits reported to the host */
+#define GS_USB_FCLK_CAN                 (84000000UL)
+#define GS_USB_TSEG1_MIN                (2)
+#define GS_USB_TSEG1_MAX                (256)
+#define GS_USB_TSEG2_MIN                (2)
+#define GS_USB_TSEG2_MAX                (128)
+#define GS_USB_SJW_MAX                  (128)
+#define GS_USB_BRP_MIN                  (1)
+#define GS_USB_BRP_MAX                  (512)
+#define GS_USB_DTSEG1_MIN               (1)
+#define GS_USB_DTSEG1_MAX               (32)
+#define GS_USB_DTSEG2_MIN               (1)
+#define GS_USB_DTSEG2_MAX               (16)
+#define GS_USB_DSJW_MAX                 (16)
+#define GS_USB_DBRP_MIN                 (1)
+#define GS_USB_DBRP_MAX                 (32)
+
+#define GS_USB_SW_VERSION               (2)
+#define GS_USB_HW_VERSION               (1)
+
+
+/*
+ * Largest gs_host_frame for the given mode flags, what the host sends for
+ * every frame.  Frames from the host never carry a timestamp, frames to the
+ * host do when HW_TIMESTAMP is set.
+ */
+uint32_t gs_usb_frame_size(uint32_t modeFlags, bool toHost);
+
+/* Returns the number of bytes written, at most GS_USB_FRAME_MAX_SZ, classic frames are sent classic sized */
+uint32_t gs_usb_encode_frame(uint8_t * pBuf, can_frame_t const * pFrame,
+                             uint32_t echoId, uint8_t channel, uint32_t modeFlags);
+bool gs_usb_decode_frame(uint8_t const * pBuf, uint32_t length, uint32_t modeFlags,
+                         can_frame_t * pFrame, uint32_t * pEchoId, uint8_t * pChannel);
+
+bool gs_usb_decode_host_config(uint8_t const * pBuf, uint32_t length);
+bool gs_usb_decode_mode(uint8_t const * pBuf, uint32_t length, uint32_t * pMode, uint32_t * pFlags);
+bool gs_usb_decode_bittiming(uint8_t const * pBuf, uint32_t length, bool isData, can_timing_t * pTiming);
+
+uint32_t gs_usb_encode_device_config(uint8_t * pBuf, uint8_t channelCount);
+uint32_t gs_usb_encode_bt_const(uint8_t * pBuf, bool extended);
+uint32_t gs_usb_encode_device_state(uint8_t * pBuf, uint32_t state, uint32_t rxErr, uint32_t txErr);
+uint32_t gs_usb_encode_timestamp(uint8_t * pBuf, uint32_t timestamp);
+
+#endif /* USB_DEVICE_GSUSB_GSUSBCODEC_H_ */
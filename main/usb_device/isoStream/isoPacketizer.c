@@ -0,0 +1,73 @@
+/*!
+ * \file isoPacketizer.c
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "isoPacketizer.h"
+
+#define RING_MASK                       (ISO_PACKETIZER_RING_SIZE - 1)
+
+
+static void put_u16(uint8_t * pBuf, uint16_t value)
+{
+    pBuf[0] = (uint8_t)(value & 0xFF);
+    pBuf[1] = (uint8_t)((value >> 8) & 0xFF);
+}
+
+
+static void put_u32(uint8_t * pBuf, uint32_t value)
+{
+    put_u16(&pBuf[0], (uint16_t)(value & 0xFFFF));
+    put_u16(&pBuf[2], (uint16_t)((value >> 16) & 0xFFFF));
+}
+
+
+void iso_packetizer_reset(iso_packetizer_t * pCtx)
+{
+    memset(pCtx, 0, sizeof(iso_packetizer_t));
+}
+
+
+bool iso_packetizer_push(iso_packetizer_t * pCtx, can_frame_t const * pFrame)
+{
+    if((pCtx->head - pCtx->tail) >= ISO_PACKETIZER_RING_SIZE) {
+        pCtx->bOverrun = true;
+        return false;
+    }
+    pCtx->ring[pCtx->head & RING_MASK] = *pFrame;
+    pCtx->head++;
+
+    return true;
+}
+
+
+uint32_t iso_packetizer_fill(iso_packetizer_t * pCtx, uint8_t * pBuf, uint32_t budget)
+{
+    uint32_t length = ISO_PACKET_HEADER_SZ;
+    uint8_t count = 0;
+    can_frame_t const * pFrame;
+
+    put_u16(&pBuf[0], pCtx->packetSequence++);
+    put_u16(&pBuf[2], pCtx->frameSequence);
+    while(pCtx->tail != pCtx->head) {
+        pFrame = &(pCtx->ring[pCtx->tail & RING_MASK]);
+        if((length + ISO_RECORD_HEADER_SZ + pFrame->len) > budget) {
+            break;
+        }
+        put_u32(&pBuf[length], pFrame->timestamp);
+        put_u32(&pBuf[length + 4], pFrame->id);
+        pBuf[length + 8] = pFrame->flags;
+        pBuf[length + 9] = pFrame->len;
+        memcpy(&pBuf[length + ISO_RECORD_HEADER_SZ], pFrame->data, pFrame->len);
+        length += ISO_RECORD_HEADER_SZ + pFrame->len;
+        pCtx->tail++;
+        count++;
+    }
+    pCtx->frameSequence += count;
+    pBuf[4] = count;
+    pBuf[5] = pCtx->bOverrun ? ISO_PACKET_FLAG_OVERRUN : 0;
+    pCtx->bOverrun = false;
+
+    return length;
+}
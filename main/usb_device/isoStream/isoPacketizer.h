@@ -0,0 +1,54 @@
+/*!
+ * \file isoPacketizer.h
+ *
+ * Packs received CAN frames into one fixed budget packet per USB frame.
+ * No RTOS or USB dependency, so it can be driven by a simulated SOF clock.
+ *
+ * Packet layout (little endian):
+ *   [0..1] packet sequence, incremented for every packet including empty ones
+ *   [2..3] sequence of the first record, so records lost with a packet can
+ *          be counted
+ *   [4]    record count
+ *   [5]    ISO_PACKET_FLAG_*
+ *   records: timestamp(4) id(4) flags(1) len(1) data(len)
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef USB_DEVICE_ISOSTREAM_ISOPACKETIZER_H_
+#define USB_DEVICE_ISOSTREAM_ISOPACKETIZER_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "bsp/can_types.h"
+
+#define ISO_PACKET_HEADER_SZ            (6)
+#define ISO_RECORD_HEADER_SZ            (10)
+#define ISO_RECORD_MAX_SZ               (ISO_RECORD_HEADER_SZ + CAN_MAX_DATA_LENGTH)
+
+/* Frames were dropped on the device since the previous packet */
+#define ISO_PACKET_FLAG_OVERRUN         (0x01)
+
+/* Power of two */
+#define ISO_PACKETIZER_RING_SIZE        (16)
+
+typedef struct {
+    can_frame_t ring[ISO_PACKETIZER_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    uint16_t packetSequence;
+    uint16_t frameSequence;
+    bool bOverrun;
+} iso_packetizer_t;
+
+void iso_packetizer_reset(iso_packetizer_t * pCtx);
+
+/* Returns false, and flags an overrun, when the ring is full */
+bool iso_packetizer_push(iso_packetizer_t * pCtx, can_frame_t const * pFrame);
+
+/*
+ * Builds the packet for one USB frame.  Records that do not fit the budget
+ * stay queued for the next one.  Returns the packet length.
+ */
+uint32_t iso_packetizer_fill(iso_packetizer_t * pCtx, uint8_t * pBuf, uint32_t budget);
+
+#endif /* USB_DEVICE_ISOSTREAM_ISOPACKETIZER_H_ */
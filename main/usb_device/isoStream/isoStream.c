@@ -0,0 +1,195 @@
+/*!
+ * \file isoStream.c
+ *
+ * TinyUSB application class driver for the isochronous CAN stream.  Each
+ * completed IN transfer, once per USB frame, queues the next packet.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "webusb.h"
+#include "isoStream.h"
+#include "isoPacketizer.h"
+
+#if CONFIG_ISO_STREAM
+
+#define ISO_STREAM_ALT_IDLE             (0)
+#define ISO_STREAM_ALT_STREAMING        (1)
+
+TU_VERIFY_STATIC(CONFIG_ISO_STREAM_BUDGET >= (ISO_PACKET_HEADER_SZ + ISO_RECORD_MAX_SZ),
+                 "iso budget must hold the largest CAN FD record");
+
+static iso_packetizer_t packetizer;
+CFG_TUSB_MEM_SECTION CFG_TUSB_MEM_ALIGN static uint8_t isoPacket[CONFIG_ISO_STREAM_BUDGET];
+
+static tusb_desc_endpoint_t const * pIsoEpDesc = NULL;
+static uint8_t itfNum = 0;
+static uint8_t altSetting = ISO_STREAM_ALT_IDLE;
+static volatile bool bStreaming = false;
+
+/* Serializes the CAN and USB device contexts */
+static SemaphoreHandle_t xIsoMutex = NULL;
+static StaticSemaphore_t xIsoMutexBuffer;
+
+
+static void isoQueuePacket(uint8_t rhport)
+{
+    uint32_t length;
+
+    xSemaphoreTakeRecursive(xIsoMutex, portMAX_DELAY);
+    length = iso_packetizer_fill(&packetizer, isoPacket, CONFIG_ISO_STREAM_BUDGET);
+    xSemaphoreGiveRecursive(xIsoMutex);
+
+    usbd_edpt_xfer(rhport, pIsoEpDesc->bEndpointAddress, isoPacket, (uint16_t)length);
+}
+
+
+static void isoInit(void)
+{
+    if(xIsoMutex == NULL) {
+        xIsoMutex = xSemaphoreCreateRecursiveMutexStatic(&xIsoMutexBuffer);
+    }
+    iso_packetizer_reset(&packetizer);
+}
+
+
+static void isoReset(uint8_t rhport)
+{
+    (void)rhport;
+    bStreaming = false;
+    altSetting = ISO_STREAM_ALT_IDLE;
+    pIsoEpDesc = NULL;
+}
+
+
+static uint16_t isoOpen(uint8_t rhport, tusb_desc_interface_t const * desc_intf, uint16_t max_len)
+{
+    uint8_t const * p_desc = (uint8_t const *)desc_intf;
+    uint16_t drv_len = 0;
+
+    if((desc_intf->bInterfaceClass != TUSB_CLASS_VENDOR_SPECIFIC) ||
+       (desc_intf->bInterfaceSubClass != ISO_STREAM_SUBCLASS) ||
+       (desc_intf->bInterfaceProtocol != ISO_STREAM_PROTOCOL)) {
+        return 0;
+    }
+    itfNum = desc_intf->bInterfaceNumber;
+
+    /* Claim every alternate setting of the interface */
+    while(drv_len < max_len) {
+        if((tu_desc_type(p_desc) == TUSB_DESC_INTERFACE) &&
+           (((tusb_desc_interface_t const *)p_desc)->bInterfaceNumber != itfNum)) {
+            break;
+        }
+        if(tu_desc_type(p_desc) == TUSB_DESC_ENDPOINT) {
+            tusb_desc_endpoint_t const * desc_ep = (tusb_desc_endpoint_t const *)p_desc;
+            if(desc_ep->bmAttributes.xfer == TUSB_XFER_ISOCHRONOUS) {
+                pIsoEpDesc = desc_ep;
+                usbd_edpt_iso_alloc(rhport, desc_ep->bEndpointAddress, tu_edpt_packet_size(desc_ep));
+            }
+        }
+        drv_len += tu_desc_len(p_desc);
+        p_desc = tu_desc_next(p_desc);
+    }
+
+    return (pIsoEpDesc != NULL) ? drv_len : 0;
+}
+
+
+static bool isoControlXferCb(uint8_t rhport, uint8_t stage, tusb_control_request_t const * request)
+{
+    if((request->bmRequestType_bit.type != TUSB_REQ_TYPE_STANDARD) ||
+       (request->bmRequestType_bit.recipient != TUSB_REQ_RCPT_INTERFACE) ||
+       (TU_U16_LOW(request->wIndex) != itfNum)) {
+        return false;
+    }
+    if(stage != CONTROL_STAGE_SETUP) {
+        return true;
+    }
+
+    switch(request->bRequest) {
+        case TUSB_REQ_GET_INTERFACE:
+            return tud_control_xfer(rhport, request, &altSetting, 1);
+
+        case TUSB_REQ_SET_INTERFACE:
+            if(request->wValue == ISO_STREAM_ALT_STREAMING) {
+                if(!bStreaming) {
+                    xSemaphoreTakeRecursive(xIsoMutex, portMAX_DELAY);
+                    iso_packetizer_reset(&packetizer);
+                    xSemaphoreGiveRecursive(xIsoMutex);
+                    if(!usbd_edpt_iso_activate(rhport, pIsoEpDesc)) {
+                        return false;
+                    }
+                    bStreaming = true;
+                    isoQueuePacket(rhport);
+                }
+            } else if(request->wValue == ISO_STREAM_ALT_IDLE) {
+                if(bStreaming) {
+                    bStreaming = false;
+                    usbd_edpt_close(rhport, pIsoEpDesc->bEndpointAddress);
+                }
+            } else {
+                return false;
+            }
+            altSetting = (uint8_t)request->wValue;
+            return tud_control_status(rhport, request);
+
+        default:
+            return false;
+    }
+}
+
+
+static bool isoXferCb(uint8_t rhport, uint8_t ep_addr, xfer_result_t result, uint32_t xferred_bytes)
+{
+    (void)result;
+    (void)xferred_bytes;
+
+    if(bStreaming && (pIsoEpDesc != NULL) && (ep_addr == pIsoEpDesc->bEndpointAddress)) {
+        isoQueuePacket(rhport);
+    }
+
+    return true;
+}
+
+
+static usbd_class_driver_t const isoDriver = {
+#if CFG_TUSB_DEBUG >= 2
+    .name            = "ISO-CAN",
+#endif
+    .init            = isoInit,
+    .reset           = isoReset,
+    .open            = isoOpen,
+    .control_xfer_cb = isoControlXferCb,
+    .xfer_cb         = isoXferCb,
+    .sof             = NULL
+};
+
+
+usbd_class_driver_t const * iso_stream_driver(void)
+{
+    return &isoDriver;
+}
+
+
+bool iso_stream_active(void)
+{
+    return bStreaming;
+}
+
+
+bool iso_stream_push(can_frame_t const * pFrame)
+{
+    bool ret;
+
+    if(!bStreaming) {
+        return false;
+    }
+    xSemaphoreTakeRecursive(xIsoMutex, portMAX_DELAY);
+    ret = iso_packetizer_push(&packetizer, pFrame);
+    xSemaphoreGiveRecursive(xIsoMutex);
+
+    return ret;
+}
+
+#endif /* CONFIG_ISO_STREAM */
@@ -0,0 +1,27 @@
+/*!
+ * \file isoStream.h
+ *
+ * Isochronous IN stream of received CAN frames, see CONFIG_ISO_STREAM.
+ * Alternate setting 0 has no endpoint; selecting alternate setting 1 starts
+ * one packet per USB frame and moves the CAN stream off the bulk endpoint.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef USB_DEVICE_ISOSTREAM_ISOSTREAM_H_
+#define USB_DEVICE_ISOSTREAM_ISOSTREAM_H_
+
+#include "stdint.h"
+#include "stdbool.h"
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "bsp/can_types.h"
+
+/* Vendor specific interface subclass/protocol claimed by the iso driver */
+#define ISO_STREAM_SUBCLASS             (0x01)
+#define ISO_STREAM_PROTOCOL             (0x01)
+
+usbd_class_driver_t const * iso_stream_driver(void);
+bool iso_stream_active(void);
+bool iso_stream_push(can_frame_t const * pFrame);
+
+#endif /* USB_DEVICE_ISOSTREAM_ISOSTREAM_H_ */
@@ -26,6 +26,9 @@
 #include "bsp/board_api.h"
 #include "tusb.h"
 #include "usb_descriptors.h"
+#include "webusb.h"
+#include "isoStream/isoStream.h"
+#include "expressEp/expressEp.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save device driver after the first plug.
  * Same VID/PID with different interface e.g MSC (first), then CDC (later) will possibly cause system error on PC.
@@ -37,6 +40,15 @@
 #define USB_PID           (0x4000 | _PID_MAP(CDC, 0) | _PID_MAP(MSC, 1) | _PID_MAP(HID, 2) | \
                            _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) )
 
+#if CONFIG_GS_USB
+/* openmoko candleLight/gs_usb IDs, matched by the Linux gs_usb driver on interface 0 */
+#define USB_VID           0x1D50
+#undef  USB_PID
+#define USB_PID           0x606F
+#else
+#define USB_VID           0xCafe
+#endif
+
 //--------------------------------------------------------------------+
 // Device Descriptors
 //--------------------------------------------------------------------+
@@ -53,7 +65,7 @@ tusb_desc_device_t const desc_device =
     .bDeviceProtocol    = MISC_PROTOCOL_IAD,
     .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
 
-    .idVendor           = 0xCafe,
+    .idVendor           = USB_VID,
     .idProduct          = USB_PID,
     .bcdDevice          = 0x0100,
 
@@ -74,15 +86,59 @@ uint8_t const * tud_descriptor_device_cb(void)
 //--------------------------------------------------------------------+
 // Configuration Descriptor
 //--------------------------------------------------------------------+
+#if CONFIG_GS_USB
+enum
+{
+  ITF_NUM_VENDOR = 0,
+  ITF_NUM_CDC,
+  ITF_NUM_CDC_DATA,
+  ITF_NUM_TOTAL
+};
+#else
 enum
 {
   ITF_NUM_CDC = 0,
   ITF_NUM_CDC_DATA,
   ITF_NUM_VENDOR,
+  ITF_NUM_EXPRESS,
+#if CONFIG_ISO_STREAM
+  ITF_NUM_ISO,
+#endif
   ITF_NUM_TOTAL
 };
+#endif
+
+#if CONFIG_GS_USB
+#define VENDOR_ITF_DESC_LEN  TUD_VENDOR_DESC_LEN
+#else
+// Express interrupt IN endpoint in an interface of its own, claimed by the expressEp class driver
+#define TUD_EXPRESS_EP_DESC_LEN  (9 + 7)
 
-#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_VENDOR_DESC_LEN)
+#define TUD_EXPRESS_EP_DESCRIPTOR(_itfnum, _stridx, _epin, _epsize, _ep_interval) \
+  /* Interface */\
+  9, TUSB_DESC_INTERFACE, _itfnum, 0, 1, TUSB_CLASS_VENDOR_SPECIFIC, EXPRESS_EP_SUBCLASS, EXPRESS_EP_PROTOCOL, _stridx,\
+  /* Endpoint In */\
+  7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_INTERRUPT, U16_TO_U8S_LE(_epsize), _ep_interval
+
+#define VENDOR_ITF_DESC_LEN  (TUD_VENDOR_DESC_LEN + TUD_EXPRESS_EP_DESC_LEN)
+#endif
+
+#if CONFIG_ISO_STREAM
+// Alternate setting 0 without endpoint, alternate setting 1 with the iso IN endpoint
+#define TUD_ISO_STREAM_DESC_LEN  (9 + 9 + 7)
+
+#define TUD_ISO_STREAM_DESCRIPTOR(_itfnum, _stridx, _epin, _epsize) \
+  /* Interface, alternate 0 */\
+  9, TUSB_DESC_INTERFACE, _itfnum, 0, 0, TUSB_CLASS_VENDOR_SPECIFIC, ISO_STREAM_SUBCLASS, ISO_STREAM_PROTOCOL, _stridx,\
+  /* Interface, alternate 1 */\
+  9, TUSB_DESC_INTERFACE, _itfnum, 1, 1, TUSB_CLASS_VENDOR_SPECIFIC, ISO_STREAM_SUBCLASS, ISO_STREAM_PROTOCOL, _stridx,\
+  /* Endpoint In, asynchronous iso, every frame */\
+  7, TUSB_DESC_ENDPOINT, _epin, (TUSB_XFER_ISOCHRONOUS | TUSB_ISO_EP_ATT_ASYNCHRONOUS), U16_TO_U8S_LE(_epsize), 1
+
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + VENDOR_ITF_DESC_LEN + TUD_ISO_STREAM_DESC_LEN)
+#else
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + VENDOR_ITF_DESC_LEN)
+#endif
 
 #if CFG_TUSB_MCU == OPT_MCU_LPC175X_6X || CFG_TUSB_MCU == OPT_MCU_LPC177X_8X || CFG_TUSB_MCU == OPT_MCU_LPC40XX
   // LPC 17xx and 40xx endpoint type (bulk/interrupt/iso) are fixed by its number
@@ -105,6 +161,13 @@ enum
   #define EPNUM_CDC_OUT    3
   #define EPNUM_VENDOR_IN  4
   #define EPNUM_VENDOR_OUT 5
+#elif CONFIG_GS_USB
+  // gs_usb hosts expect bulk IN 0x81 and bulk OUT 0x02
+  #define EPNUM_CDC_NOTIF  3
+  #define EPNUM_CDC_IN     4
+  #define EPNUM_CDC_OUT    4
+  #define EPNUM_VENDOR_IN  1
+  #define EPNUM_VENDOR_OUT 2
 #else
   #define EPNUM_CDC_IN     2
   #define EPNUM_CDC_OUT    2
@@ -112,16 +175,40 @@ enum
   #define EPNUM_VENDOR_OUT 3
 #endif
 
+#ifndef EPNUM_CDC_NOTIF
+  #define EPNUM_CDC_NOTIF  1
+#endif
+
+#ifndef EPNUM_ISO_IN
+  #define EPNUM_ISO_IN     5
+#endif
+
 uint8_t const desc_configuration[] =
 {
   // Config number, interface count, string index, total length, attribute, power in mA
   TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
 
+#if CONFIG_GS_USB
+  // Interface number, string index, EP Out & IN address, EP size
+  TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, 5, EPNUM_VENDOR_OUT, 0x80 | EPNUM_VENDOR_IN, TUD_OPT_HIGH_SPEED ? 512 : 64),
+
   // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
-  TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, 0x81, 8, EPNUM_CDC_OUT, 0x80 | EPNUM_CDC_IN, TUD_OPT_HIGH_SPEED ? 512 : 64),
+  TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, 0x80 | EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, 0x80 | EPNUM_CDC_IN, TUD_OPT_HIGH_SPEED ? 512 : 64)
+#else
+  // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
+  TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, 0x80 | EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, 0x80 | EPNUM_CDC_IN, TUD_OPT_HIGH_SPEED ? 512 : 64),
 
   // Interface number, string index, EP Out & IN address, EP size
-  TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, 5, EPNUM_VENDOR_OUT, 0x80 | EPNUM_VENDOR_IN, TUD_OPT_HIGH_SPEED ? 512 : 64)
+  TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, 5, EPNUM_VENDOR_OUT, 0x80 | EPNUM_VENDOR_IN, TUD_OPT_HIGH_SPEED ? 512 : 64),
+
+  // Interface number, string index, EP IN address, EP size, interval
+  TUD_EXPRESS_EP_DESCRIPTOR(ITF_NUM_EXPRESS, 7, 0x80 | EPNUM_VENDOR_EXPRESS, CFG_TUD_VENDOR_EPSIZE, VENDOR_EXPRESS_INTERVAL),
+#endif
+
+#if CONFIG_ISO_STREAM
+  // Interface number, string index, EP IN address, EP size
+  TUD_ISO_STREAM_DESCRIPTOR(ITF_NUM_ISO, 6, 0x80 | EPNUM_ISO_IN, CONFIG_ISO_STREAM_BUDGET),
+#endif
 };
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
@@ -153,7 +240,14 @@ https://developers.google.com/web/fundamentals/native-hardware/build-for-webusb/
 
 #define BOS_TOTAL_LEN      (TUD_BOS_DESC_LEN + TUD_BOS_WEBUSB_DESC_LEN + TUD_BOS_MICROSOFT_OS_DESC_LEN)
 
-#define MS_OS_20_DESC_LEN  0xB2
+// One WinUSB function per vendor specific interface the host opens
+#if CONFIG_GS_USB
+#define MS_OS_20_FUNCTION_COUNT  1
+#else
+#define MS_OS_20_FUNCTION_COUNT  2
+#endif
+#define MS_OS_20_FUNCTION_LEN    0xA0
+#define MS_OS_20_DESC_LEN        (0x0A + 0x08 + (MS_OS_20_FUNCTION_COUNT * MS_OS_20_FUNCTION_LEN))
 
 // BOS Descriptor is required for webUSB
 uint8_t const desc_bos[] =
@@ -174,6 +268,25 @@ uint8_t const * tud_descriptor_bos_cb(void)
 }
 
 
+// Function subset binding WinUSB and the DeviceInterfaceGUIDs below to an interface
+#define MS_OS_20_FUNCTION(_itfnum) \
+  /* Function Subset header: length, type, first interface, reserved, subset length */\
+  U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_FUNCTION), _itfnum, 0, U16_TO_U8S_LE(MS_OS_20_FUNCTION_LEN),\
+  /* MS OS 2.0 Compatible ID descriptor: length, type, compatible ID, sub compatible ID */\
+  U16_TO_U8S_LE(0x0014), U16_TO_U8S_LE(MS_OS_20_FEATURE_COMPATBLE_ID), 'W', 'I', 'N', 'U', 'S', 'B', 0x00, 0x00,\
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* sub-compatible */\
+  /* MS OS 2.0 Registry property descriptor: length, type */\
+  U16_TO_U8S_LE(MS_OS_20_FUNCTION_LEN-0x08-0x14), U16_TO_U8S_LE(MS_OS_20_FEATURE_REG_PROPERTY),\
+  U16_TO_U8S_LE(0x0007), U16_TO_U8S_LE(0x002A), /* wPropertyDataType, wPropertyNameLength and PropertyName "DeviceInterfaceGUIDs\0" in UTF-16 */\
+  'D', 0x00, 'e', 0x00, 'v', 0x00, 'i', 0x00, 'c', 0x00, 'e', 0x00, 'I', 0x00, 'n', 0x00, 't', 0x00, 'e', 0x00,\
+  'r', 0x00, 'f', 0x00, 'a', 0x00, 'c', 0x00, 'e', 0x00, 'G', 0x00, 'U', 0x00, 'I', 0x00, 'D', 0x00, 's', 0x00, 0x00, 0x00,\
+  U16_TO_U8S_LE(0x0050), /* wPropertyDataLength */\
+  /* bPropertyData: “{975F44D9-0D08-43FD-8B3E-127CA8AFFF9D}”. */\
+  '{', 0x00, '9', 0x00, '7', 0x00, '5', 0x00, 'F', 0x00, '4', 0x00, '4', 0x00, 'D', 0x00, '9', 0x00, '-', 0x00,\
+  '0', 0x00, 'D', 0x00, '0', 0x00, '8', 0x00, '-', 0x00, '4', 0x00, '3', 0x00, 'F', 0x00, 'D', 0x00, '-', 0x00,\
+  '8', 0x00, 'B', 0x00, '3', 0x00, 'E', 0x00, '-', 0x00, '1', 0x00, '2', 0x00, '7', 0x00, 'C', 0x00, 'A', 0x00,\
+  '8', 0x00, 'A', 0x00, 'F', 0x00, 'F', 0x00, 'F', 0x00, '9', 0x00, 'D', 0x00, '}', 0x00, 0x00, 0x00, 0x00, 0x00
+
 uint8_t const desc_ms_os_20[] =
 {
   // Set header: length, type, windows version, total length
@@ -182,24 +295,10 @@ uint8_t const desc_ms_os_20[] =
   // Configuration subset header: length, type, configuration index, reserved, configuration total length
   U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_CONFIGURATION), 0, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN-0x0A),
 
-  // Function Subset header: length, type, first interface, reserved, subset length
-  U16_TO_U8S_LE(0x0008), U16_TO_U8S_LE(MS_OS_20_SUBSET_HEADER_FUNCTION), ITF_NUM_VENDOR, 0, U16_TO_U8S_LE(MS_OS_20_DESC_LEN-0x0A-0x08),
-
-  // MS OS 2.0 Compatible ID descriptor: length, type, compatible ID, sub compatible ID
-  U16_TO_U8S_LE(0x0014), U16_TO_U8S_LE(MS_OS_20_FEATURE_COMPATBLE_ID), 'W', 'I', 'N', 'U', 'S', 'B', 0x00, 0x00,
-  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // sub-compatible
-
-  // MS OS 2.0 Registry property descriptor: length, type
-  U16_TO_U8S_LE(MS_OS_20_DESC_LEN-0x0A-0x08-0x08-0x14), U16_TO_U8S_LE(MS_OS_20_FEATURE_REG_PROPERTY),
-  U16_TO_U8S_LE(0x0007), U16_TO_U8S_LE(0x002A), // wPropertyDataType, wPropertyNameLength and PropertyName "DeviceInterfaceGUIDs\0" in UTF-16
-  'D', 0x00, 'e', 0x00, 'v', 0x00, 'i', 0x00, 'c', 0x00, 'e', 0x00, 'I', 0x00, 'n', 0x00, 't', 0x00, 'e', 0x00,
-  'r', 0x00, 'f', 0x00, 'a', 0x00, 'c', 0x00, 'e', 0x00, 'G', 0x00, 'U', 0x00, 'I', 0x00, 'D', 0x00, 's', 0x00, 0x00, 0x00,
-  U16_TO_U8S_LE(0x0050), // wPropertyDataLength
-	//bPropertyData: “{975F44D9-0D08-43FD-8B3E-127CA8AFFF9D}”.
-  '{', 0x00, '9', 0x00, '7', 0x00, '5', 0x00, 'F', 0x00, '4', 0x00, '4', 0x00, 'D', 0x00, '9', 0x00, '-', 0x00,
-  '0', 0x00, 'D', 0x00, '0', 0x00, '8', 0x00, '-', 0x00, '4', 0x00, '3', 0x00, 'F', 0x00, 'D', 0x00, '-', 0x00,
-  '8', 0x00, 'B', 0x00, '3', 0x00, 'E', 0x00, '-', 0x00, '1', 0x00, '2', 0x00, '7', 0x00, 'C', 0x00, 'A', 0x00,
-  '8', 0x00, 'A', 0x00, 'F', 0x00, 'F', 0x00, 'F', 0x00, '9', 0x00, 'D', 0x00, '}', 0x00, 0x00, 0x00, 0x00, 0x00
+  MS_OS_20_FUNCTION(ITF_NUM_VENDOR),
+#if !CONFIG_GS_USB
+  MS_OS_20_FUNCTION(ITF_NUM_EXPRESS),
+#endif
 };
 
 TU_VERIFY_STATIC(sizeof(desc_ms_os_20) == MS_OS_20_DESC_LEN, "Incorrect size");
@@ -224,7 +323,9 @@ char const *string_desc_arr[] =
   "WebUSB CAN-FD",               // 2: Product
   NULL,                          // 3: Serials will use unique ID if possible
   "TinyUSB CDC",                 // 4: CDC Interface
-  "TinyUSB WebUSB"               // 5: Vendor Interface
+  "TinyUSB WebUSB",              // 5: Vendor Interface
+  "CAN Iso Stream",              // 6: Isochronous Interface
+  "CAN Express"                  // 7: Express Interface
 };
 
 static uint16_t _desc_str[32 + 1];
@@ -28,9 +28,22 @@
 enum
 {
   VENDOR_REQUEST_WEBUSB = 1,
-  VENDOR_REQUEST_MICROSOFT = 2
+  VENDOR_REQUEST_MICROSOFT = 2,
+  VENDOR_REQUEST_CONNECT = 3,       // OUT, wValue: connect (LSB, 1 connect, 0 disconnect) and CAN_COMPACT_OPT_* (MSB)
+  VENDOR_REQUEST_SET_BITRATE = 4,   // OUT, wValue: arbitration (LSB) and data (MSB) bitrate index
+  VENDOR_REQUEST_GET_STATUS = 5,    // IN, returns device_status_t
+  VENDOR_REQUEST_GET_STATS = 6,     // IN, returns stats_block_t
+  VENDOR_REQUEST_SET_BUFFERS = 7,   // OUT, buffer_split_t, or none and wValue: BUFFER_PROFILE_T
+  VENDOR_REQUEST_GET_BUFFERS = 8,   // IN, returns buffer_status_t
+  VENDOR_REQUEST_GET_PROFILE = 9,   // IN, returns task_profile_block_t
+  VENDOR_REQUEST_GET_LATENCY = 10,  // IN, returns latency_block_t, wValue: 1 clears it after the read
+  VENDOR_REQUEST_GET_BENCH = 11     // IN, returns bench_block_t
 };
 
+// Interrupt IN endpoint of the express interface, see webusb_sendExpress()
+#define EPNUM_VENDOR_EXPRESS      6
+#define VENDOR_EXPRESS_INTERVAL   1   // ms
+
 extern uint8_t const desc_ms_os_20[];
 
 #endif /* USB_DESCRIPTORS_H_ */
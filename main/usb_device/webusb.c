@@ -10,23 +10,37 @@
 #include "task.h"
 #include "timers.h"
 #include "tusb.h"
+#include "device/usbd_pvt.h"
 #include "webusb.h"
 #include "frameParser/frameParser.h"
+#include "commandParser/commandParser.h"
+#include "gsUsb/gsUsb.h"
+#include "cdcCan/cdcCan.h"
+#include "isoStream/isoStream.h"
+#include "expressEp/expressEp.h"
 #include "usb_descriptors.h"
 #include "bsp/board_api.h"
-
+#include "bsp/can.h"
+#include "stats/stats.h"
+#include "bufferArena/bufferArena.h"
+#include "stats/taskProfile.h"
+#include "stats/latency.h"
+#include "stats/bench.h"
+
+#if CONFIG_USB_CAN_REACTOR
+#define USB_REACTOR_STACK_SIZE          (512)
+#else
 #define USB_DEVICE_STACK_SIZE           (384)
 #define USB_CLASS_STACK_SIZE            (256)
+#endif
 #define URL  "sicrisembay.github.io/webusb_canfd/"
 
 #define EVENT_CDC_AVAILABLE_BIT         (0x00000001)
 #define EVENT_VENDOR_AVAILABLE_BIT      (0x00000002)
 
-#define WEBUSB_TX_QUEUE_LENGTH          (10)
-#define WEBUSB_TX_ELEMENT_SZ            CFG_TUD_VENDOR_TX_BUFSIZE
+/* Storage from the buffer arena, see webusb_set_tx_queue() */
 static StaticQueue_t webUsbTxStaticQueue;
-uint8_t webUsbTxQueueStorageArea[WEBUSB_TX_QUEUE_LENGTH * WEBUSB_TX_ELEMENT_SZ];
-static QueueHandle_t webUsbTxQHandle;
+static QueueHandle_t webUsbTxQHandle = NULL;
 
 /*
  * Blink pattern
@@ -46,6 +60,12 @@ enum  {
 static bool bInit = false;
 static bool webusb_connected = false;
 
+#if CONFIG_USB_CAN_REACTOR
+/* USB/CAN Reactor Task */
+static TaskHandle_t reactorTask = NULL;
+static StackType_t usb_reactor_stack[USB_REACTOR_STACK_SIZE];
+static StaticTask_t usb_reactor_taskdef;
+#else
 /* USB Device Task */
 static TaskHandle_t deviceTask = NULL;
 static StackType_t usb_device_stack[USB_DEVICE_STACK_SIZE];
@@ -54,10 +74,24 @@ static StaticTask_t usb_device_taskdef;
 static TaskHandle_t classTask = NULL;
 static StackType_t  usb_class_stack[USB_CLASS_STACK_SIZE];
 static StaticTask_t usb_class_taskdef;
+#endif
 
 static TimerHandle_t blinky_tm = NULL;
 static StaticTimer_t blinky_tmdef;
 
+/* EP0 data stage buffer, must outlive the control transfer */
+static device_status_t deviceStatus;
+static stats_block_t statsBlock;
+static buffer_split_t bufferSplit;
+static buffer_status_t bufferStatus;
+static task_profile_block_t taskProfile;
+#if CONFIG_LATENCY_PROBES
+static latency_block_t latencyBlock;
+#endif
+#if CONFIG_BENCH
+static bench_block_t benchBlock;
+#endif
+
 const tusb_desc_webusb_url_t desc_url = {
     .bLength         = 3 + sizeof(URL) - 1,
     .bDescriptorType = 3, // WEBUSB URL type
@@ -65,8 +99,13 @@ const tusb_desc_webusb_url_t desc_url = {
     .url             = URL
 };
 
+#if CONFIG_USB_CAN_REACTOR
+static void usb_reactor_task(void * pxParam);
+#else
 static void usb_device_task(void * pxParam);
 static void usb_class_task(void * pxParam);
+#endif
+static void usb_class_process(uint32_t event);
 static void led_blinky_cb(TimerHandle_t xTimer);
 
 void webusb_init(void)
@@ -80,6 +119,17 @@ void webusb_init(void)
                             led_blinky_cb,
                             &blinky_tmdef
                             );
+#if CONFIG_USB_CAN_REACTOR
+        reactorTask = xTaskCreateStatic(
+                            usb_reactor_task,
+                            "usb-can",
+                            USB_REACTOR_STACK_SIZE,
+                            NULL,
+                            configMAX_PRIORITIES - 1,
+                            usb_reactor_stack,
+                            &usb_reactor_taskdef
+                            );
+#else
         deviceTask = xTaskCreateStatic(
                             usb_device_task,
                             "usb-device",
@@ -98,12 +148,7 @@ void webusb_init(void)
                             usb_class_stack,
                             &usb_class_taskdef
                             );
-        webUsbTxQHandle = xQueueCreateStatic(
-                            WEBUSB_TX_QUEUE_LENGTH,
-                            WEBUSB_TX_ELEMENT_SZ,
-                            webUsbTxQueueStorageArea,
-                            &webUsbTxStaticQueue
-                            );
+#endif
         xTimerStart(blinky_tm, 0);
 
         bInit = true;
@@ -111,56 +156,150 @@ void webusb_init(void)
 }
 
 
-void webusb_set_connect_state(bool isConnected)
+void webusb_set_tx_queue(uint8_t * pStorage, uint32_t packets)
+{
+    if(webUsbTxQHandle != NULL) {
+        vQueueDelete(webUsbTxQHandle);
+    }
+    webUsbTxQHandle = xQueueCreateStatic(
+                        packets,
+                        WEBUSB_TX_ELEMENT_SZ,
+                        pStorage,
+                        &webUsbTxStaticQueue
+                        );
+    configASSERT(webUsbTxQHandle);
+    LATENCY_PROBE_IN_FLUSHED();
+}
+
+
+/*
+ * No IN packet waits in the queue, so re-carving its storage loses none.
+ * The packet in the vendor FIFO is TinyUSB's own memory, not the arena's.
+ */
+bool webusb_tx_idle(void)
+{
+    return (webUsbTxQHandle == NULL) || (uxQueueMessagesWaiting(webUsbTxQHandle) == 0);
+}
+
+
+/*
+ * NOTE: CDC now carries the CAN stream itself (see cdcCan), so connect
+ *       state is no longer logged to it.
+ */
+void webusb_set_connect_state(bool isConnected, bool primeVendor)
 {
     webusb_connected = isConnected;
-    const char * pConnectString = "WebUSB interface connected\r\n";
-    const char * pDisconnectString = "WebUSB interface disconnected\r\n";
 
     // Always lit LED if connected
     if ( webusb_connected ) {
-        xQueueReset(webUsbTxQHandle);
-        // HACK: prime WebUSB EPIN where first CAN packet is lost -->
-        uint8_t buf[64];
-        memset(buf, 0, sizeof(buf));
-        tud_vendor_write(buf, sizeof(buf));
-        // <-- End HACK
+        if (primeVendor) {
+            xQueueReset(webUsbTxQHandle);
+            express_ep_discard();
+            LATENCY_PROBE_IN_FLUSHED();
+            // HACK: prime WebUSB EPIN where first CAN packet is lost -->
+            uint8_t buf[CFG_TUD_VENDOR_EPSIZE];
+            memset(buf, 0, sizeof(buf));
+            tud_vendor_write(buf, sizeof(buf));
+            LATENCY_PROBE_IN_UNTRACKED();
+            // <-- End HACK
+        }
 
         board_led_write(true);
         xTimerChangePeriod(blinky_tm, pdMS_TO_TICKS(BLINK_ALWAYS_ON), 0);
-        if (tud_cdc_connected()) {
-            tud_cdc_write_str(pConnectString);
-            tud_cdc_write_flush();
-        }
     } else {
         xTimerChangePeriod(blinky_tm, pdMS_TO_TICKS(BLINK_MOUNTED), 0);
-        if (tud_cdc_connected()) {
-            tud_cdc_write_str(pDisconnectString);
-            tud_cdc_write_flush();
-        }
     }
 }
 
 bool webusb_sendEp(uint8_t * pBuffer)
 {
     bool ret = true;
-    bool available = (tud_vendor_write_available() >= CFG_TUD_VENDOR_TX_BUFSIZE);
+    bool available = (tud_vendor_write_available() >= CFG_TUD_VENDOR_EPSIZE);
     bool queueNotEmpty = (uxQueueMessagesWaiting(webUsbTxQHandle) > 0);
+    const uint8_t bytes = pBuffer[OFFSET_USB_BYTES_IN_PACKET];     // pBuffer may be swapped below
 
+    if(!available) {
+        STATS_INC(usbInBusy);
+    }
     if(queueNotEmpty || !available) {
         ret = ret && (pdTRUE == xQueueSend(webUsbTxQHandle, pBuffer, 0));
+        STATS_MAX(hwmUsbTxQueue, uxQueueMessagesWaiting(webUsbTxQHandle));
         if(available) {
             ret = ret && (pdTRUE == xQueueReceive(webUsbTxQHandle, pBuffer, 0));
         }
     }
 
     if(available) {
-        ret = ret && (CFG_TUD_VENDOR == tud_vendor_write(pBuffer, CFG_TUD_VENDOR_TX_BUFSIZE));
+        ret = ret && (CFG_TUD_VENDOR_EPSIZE == tud_vendor_write(pBuffer, CFG_TUD_VENDOR_EPSIZE));
+    }
+    LATENCY_PROBE_IN_SENT(ret, ret && available);
+    if(ret) {
+        STATS_INC(usbInPackets);
+        STATS_ADD(usbInBytes, bytes);
     }
 
     return (ret);
 }
 
+/*
+ * Urgent packets take the express interrupt endpoint, whose latency is
+ * bounded by its polling interval.  They fall back to bulk while that
+ * interface is not configured or its queue is full, so nothing is dropped
+ * that bulk could carry.
+ */
+bool webusb_sendExpress(uint8_t * pBuffer)
+{
+    if(!express_ep_send(pBuffer)) {
+        return webusb_sendEp(pBuffer);
+    }
+    STATS_INC(usbInPackets);
+    STATS_ADD(usbInBytes, pBuffer[OFFSET_USB_BYTES_IN_PACKET]);
+
+    return true;
+}
+
+#if CONFIG_USB_CAN_REACTOR
+void webusb_reactor_defer(void (*func)(void *), void * param, bool inIsr)
+{
+    usbd_defer_func(func, param, inIsr);
+}
+
+
+//--------------------------------------------------------------------+
+// USB/CAN Reactor Task
+//   * TinyUSB events, deferred CAN work (see can.c), vendor/CDC RX
+//     and endpoint flushes all run to completion on this one task
+//--------------------------------------------------------------------+
+static void usb_reactor_task(void * pxParam)
+{
+    (void)pxParam;
+    uint32_t event = 0;
+
+    tud_init(BOARD_TUD_RHPORT);
+
+    if (board_init_after_tusb) {
+        board_init_after_tusb();
+    }
+
+    while (1) {
+        // blocks until a USB event or deferred CAN work is queued
+        tud_task();
+        CAN_reactor_poll();
+
+        event = 0;
+        if (tud_vendor_available()) {
+            event |= EVENT_VENDOR_AVAILABLE_BIT;
+        }
+        if (tud_cdc_available()) {
+            event |= EVENT_CDC_AVAILABLE_BIT;
+        }
+        usb_class_process(event);
+
+        tud_vendor_write_flush();
+        tud_cdc_write_flush();
+    }
+}
+#else
 //--------------------------------------------------------------------+
 // USB Device Task
 //--------------------------------------------------------------------+
@@ -194,6 +333,26 @@ static void usb_device_task(void * pxParam)
         tud_cdc_write_flush();
     }
 }
+#endif
+
+
+#if !CONFIG_GS_USB
+// Invoked when the device stack initializes, adds the express endpoint and
+// iso stream class drivers.  They are tried before the vendor driver, which
+// would otherwise claim their vendor specific interfaces.
+usbd_class_driver_t const * usbd_app_driver_get_cb(uint8_t * driver_count)
+{
+    static usbd_class_driver_t appDrivers[1 + CONFIG_ISO_STREAM];
+    uint8_t count = 0;
+
+    appDrivers[count++] = *express_ep_driver();
+#if CONFIG_ISO_STREAM
+    appDrivers[count++] = *iso_stream_driver();
+#endif
+    *driver_count = count;
+    return appDrivers;
+}
+#endif /* !CONFIG_GS_USB */
 
 
 //--------------------------------------------------------------------+
@@ -243,12 +402,11 @@ void tud_cdc_line_state_cb(uint8_t itf, bool dtr, bool rts)
     (void) itf;
     (void) rts;
 
-    // TODO set some indicator
-    if ( dtr ) {
-        // Terminal connected
-    } else {
-        // Terminal disconnected
-    }
+#if !CONFIG_GS_USB
+    cdc_can_line_state(dtr);
+#else
+    (void) dtr;
+#endif
 }
 
 
@@ -267,6 +425,19 @@ void tud_cdc_rx_cb(uint8_t itf)
 // return false to stall control endpoint (e.g unsupported request)
 bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const * request)
 {
+#if CONFIG_GS_USB
+    if (request->bmRequestType_bit.recipient == TUSB_REQ_RCPT_INTERFACE) {
+        return gs_usb_control_xfer_cb(rhport, stage, request);
+    }
+#endif
+
+    if ((stage == CONTROL_STAGE_DATA) &&
+        (request->bmRequestType_bit.type == TUSB_REQ_TYPE_VENDOR) &&
+        (request->bRequest == VENDOR_REQUEST_SET_BUFFERS)) {
+        /* bufferSplit has arrived, stall if it does not fit */
+        return buffer_arena_select(&bufferSplit);
+    }
+
     // nothing to with DATA & ACK stage
     if (stage != CONTROL_STAGE_SETUP) return true;
 
@@ -288,6 +459,70 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
                         return false;
                     }
 
+                case VENDOR_REQUEST_CONNECT:
+                    if (request->bmRequestType_bit.direction != TUSB_DIR_OUT) return false;
+                    command_parser_connect(TU_U16_LOW(request->wValue) != 0, TU_U16_HIGH(request->wValue));
+                    return tud_control_status(rhport, request);
+
+                case VENDOR_REQUEST_SET_BITRATE:
+                    if (request->bmRequestType_bit.direction != TUSB_DIR_OUT) return false;
+                    if (!command_parser_set_bitrate(TU_U16_LOW(request->wValue), TU_U16_HIGH(request->wValue))) {
+                        return false;
+                    }
+                    return tud_control_status(rhport, request);
+
+                case VENDOR_REQUEST_GET_STATUS:
+                    if (request->bmRequestType_bit.direction != TUSB_DIR_IN) return false;
+                    command_parser_get_status(&deviceStatus);
+                    return tud_control_xfer(rhport, request, &deviceStatus,
+                                            TU_MIN(request->wLength, sizeof(deviceStatus)));
+
+                case VENDOR_REQUEST_GET_STATS:
+                    /* Read on the USB task, the bulk stream is not involved */
+                    if (request->bmRequestType_bit.direction != TUSB_DIR_IN) return false;
+                    stats_snapshot(&statsBlock);
+                    return tud_control_xfer(rhport, request, &statsBlock,
+                                            TU_MIN(request->wLength, sizeof(statsBlock)));
+
+                case VENDOR_REQUEST_SET_BUFFERS:
+                    if (request->bmRequestType_bit.direction != TUSB_DIR_OUT) return false;
+                    if (request->wLength == 0) {
+                        if (!buffer_arena_select_profile((BUFFER_PROFILE_T)request->wValue)) {
+                            return false;
+                        }
+                        return tud_control_status(rhport, request);
+                    }
+                    if (request->wLength != sizeof(bufferSplit)) return false;
+                    return tud_control_xfer(rhport, request, &bufferSplit, sizeof(bufferSplit));
+
+                case VENDOR_REQUEST_GET_BUFFERS:
+                    if (request->bmRequestType_bit.direction != TUSB_DIR_IN) return false;
+                    buffer_arena_get_status(&bufferStatus);
+                    return tud_control_xfer(rhport, request, &bufferStatus,
+                                            TU_MIN(request->wLength, sizeof(bufferStatus)));
+
+                case VENDOR_REQUEST_GET_PROFILE:
+                    /* Only the tasks that exist are sent */
+                    if (request->bmRequestType_bit.direction != TUSB_DIR_IN) return false;
+                    return tud_control_xfer(rhport, request, &taskProfile,
+                                            TU_MIN(request->wLength, task_profile_get(&taskProfile)));
+
+#if CONFIG_LATENCY_PROBES
+                case VENDOR_REQUEST_GET_LATENCY:
+                    if (request->bmRequestType_bit.direction != TUSB_DIR_IN) return false;
+                    latency_get(&latencyBlock, (request->wValue & 0x01) != 0);
+                    return tud_control_xfer(rhport, request, &latencyBlock,
+                                            TU_MIN(request->wLength, sizeof(latencyBlock)));
+#endif /* CONFIG_LATENCY_PROBES */
+
+#if CONFIG_BENCH
+                case VENDOR_REQUEST_GET_BENCH:
+                    if (request->bmRequestType_bit.direction != TUSB_DIR_IN) return false;
+                    bench_get(&benchBlock);
+                    return tud_control_xfer(rhport, request, &benchBlock,
+                                            TU_MIN(request->wLength, sizeof(benchBlock)));
+#endif /* CONFIG_BENCH */
+
                 default:
                     break;
             }
@@ -310,16 +545,31 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
 
 void tud_vendor_tx_cb(uint8_t itf, uint32_t sent_bytes)
 {
-    uint8_t sendEpPacket[CFG_TUD_VENDOR_TX_BUFSIZE];
+#if CONFIG_GS_USB
+    gs_usb_tx_complete();
+#else
+    uint8_t sendEpPacket[CFG_TUD_VENDOR_EPSIZE];
+
+    LATENCY_PROBE_IN_COMPLETED();
+    /* Refill the vendor FIFO from the queue */
+    while(tud_vendor_write_available() >= CFG_TUD_VENDOR_EPSIZE) {
+        if(pdTRUE != xQueueReceive(webUsbTxQHandle, &sendEpPacket, 0)) {
+            break;
+        }
+        tud_vendor_write(sendEpPacket, CFG_TUD_VENDOR_EPSIZE);
+        LATENCY_PROBE_IN_WRITTEN();
+    }
+#if CONFIG_STREAM_RESUME
+    command_parser_tx_ready();
+#endif
 
     if(tud_vendor_write_available() == CFG_TUD_VENDOR_TX_BUFSIZE) {
         /* Empty */
-        if(pdTRUE != xQueueReceive(webUsbTxQHandle, &sendEpPacket, 0)) {
-            /* empty */
-            memset(sendEpPacket, 0, CFG_TUD_VENDOR_TX_BUFSIZE);
-        }
-        tud_vendor_write(sendEpPacket, CFG_TUD_VENDOR_TX_BUFSIZE);
+        memset(sendEpPacket, 0, CFG_TUD_VENDOR_EPSIZE);
+        tud_vendor_write(sendEpPacket, CFG_TUD_VENDOR_EPSIZE);
+        LATENCY_PROBE_IN_UNTRACKED();
     }
+#endif
 }
 
 void tud_vendor_rx_cb(uint8_t itf)
@@ -332,32 +582,51 @@ void tud_vendor_rx_cb(uint8_t itf)
 //   * calls WebUSB class
 //   * calls CDC class
 //--------------------------------------------------------------------+
+static void usb_class_process(uint32_t event)
+{
+    uint8_t buf[CFG_TUD_VENDOR_EPSIZE];
+
+    if((event & EVENT_CDC_AVAILABLE_BIT) != 0) {
+        while (tud_cdc_available()) {
+            uint32_t count = tud_cdc_read(buf, sizeof(buf));
+            LATENCY_PROBE_OUT_READ();
+#if !CONFIG_GS_USB
+            cdc_can_receive(buf, count);
+#else
+            (void) count;
+#endif
+        }
+    }
+    if((event & EVENT_VENDOR_AVAILABLE_BIT) != 0) {
+#if CONFIG_GS_USB
+        gs_usb_process();
+#else
+        while (tud_vendor_available()) {
+            uint32_t count = tud_vendor_read(buf, sizeof(buf));
+            LATENCY_PROBE_OUT_READ();
+            if(count > 1) {
+                /* push the receive data to frame parser */
+                command_parser_receive(COMMAND_CHANNEL_VENDOR, &buf[1], buf[0]);
+            }
+        }
+#endif
+    }
+}
+
+
+#if !CONFIG_USB_CAN_REACTOR
 static void usb_class_task(void * pxParam)
 {
     (void)pxParam;
     uint32_t event = 0;
-    uint8_t buf[64];
 
     while(1) {
         if(pdTRUE == xTaskNotifyWait(0, 0xFFFFFFFF, &event, portMAX_DELAY)) {
-            if((event & EVENT_CDC_AVAILABLE_BIT) != 0) {
-                while (tud_cdc_available()) {
-                    // read and echo back
-                    uint32_t count = tud_cdc_read(buf, sizeof(buf));
-                    /// TODO: implement CLI
-                }
-            }
-            if((event & EVENT_VENDOR_AVAILABLE_BIT) != 0) {
-                uint32_t count = tud_vendor_read(buf, sizeof(buf));
-                if(count > 1) {
-                    /* push the receive data to frame parser */
-                    frame_parser_receive(&buf[1], buf[0]);
-                    frame_parser_process();
-                }
-            }
+            usb_class_process(event);
         }
     }
 }
+#endif
 
 
 static void led_blinky_cb(TimerHandle_t xTimer)
@@ -8,8 +8,94 @@
 #ifndef USB_DEVICE_WEBUSB_H_
 #define USB_DEVICE_WEBUSB_H_
 
+/*
+ * CONFIG_USB_CAN_REACTOR
+ *   0: usb-device, usb-class and can-task run as separate tasks
+ *   1: a single usb-can task services TinyUSB events, vendor/CDC RX and
+ *      CAN RX/TX run-to-completion; CAN ISRs defer work into tud_task()
+ */
+#ifndef CONFIG_USB_CAN_REACTOR
+#define CONFIG_USB_CAN_REACTOR          (0)
+#endif /* CONFIG_USB_CAN_REACTOR */
+
+/*
+ * CONFIG_GS_USB
+ *   0: WebUSB vendor interface with the frame/command protocol
+ *   1: gs_usb (candleLight) compatible vendor interface on interface 0,
+ *      driven natively by the Linux gs_usb SocketCAN driver
+ */
+#ifndef CONFIG_GS_USB
+#define CONFIG_GS_USB                   (0)
+#endif /* CONFIG_GS_USB */
+
+/*
+ * CONFIG_ISO_STREAM
+ *   0: received CAN frames go to the host over the bulk vendor endpoint
+ *   1: adds a vendor interface with an isochronous IN endpoint in alternate
+ *      setting 1; while selected, received CAN frames go out once per USB
+ *      frame in packets of CONFIG_ISO_STREAM_BUDGET bytes
+ */
+#ifndef CONFIG_ISO_STREAM
+#define CONFIG_ISO_STREAM               (0)
+#endif /* CONFIG_ISO_STREAM */
+
+#ifndef CONFIG_ISO_STREAM_BUDGET
+#define CONFIG_ISO_STREAM_BUDGET        (192)
+#endif /* CONFIG_ISO_STREAM_BUDGET */
+
+/*
+ * CONFIG_SOF_SYNC
+ *   0: no shared timebase with the host
+ *   1: the USB interrupt latches the CAN timestamp counter at every SOF and
+ *      the latest (frame number, device time) pair is reported every
+ *      CONFIG_SOF_SYNC_PERIOD_MS while the vendor interface is connected
+ */
+#ifndef CONFIG_SOF_SYNC
+#define CONFIG_SOF_SYNC                 (0)
+#endif /* CONFIG_SOF_SYNC */
+
+#ifndef CONFIG_SOF_SYNC_PERIOD_MS
+#define CONFIG_SOF_SYNC_PERIOD_MS       (250)
+#endif /* CONFIG_SOF_SYNC_PERIOD_MS */
+
+/*
+ * CONFIG_STREAM_RESUME
+ *   0: packets the host does not read are dropped with the TX queue
+ *   1: vendor bulk packets are kept in a ring of CONFIG_STREAM_RESUME_PACKETS
+ *      until the host acknowledges them; a host that comes back with
+ *      RESUME gets everything after its last acknowledged sequence
+ */
+#ifndef CONFIG_STREAM_RESUME
+#define CONFIG_STREAM_RESUME            (0)
+#endif /* CONFIG_STREAM_RESUME */
+
+#ifndef CONFIG_STREAM_RESUME_PACKETS
+#define CONFIG_STREAM_RESUME_PACKETS    (64)
+#endif /* CONFIG_STREAM_RESUME_PACKETS */
+
+#if CONFIG_STREAM_RESUME && CONFIG_GS_USB
+#error "CONFIG_STREAM_RESUME is not supported with CONFIG_GS_USB"
+#endif
+
+#if CONFIG_ISO_STREAM && CONFIG_GS_USB
+#error "CONFIG_ISO_STREAM is not supported with CONFIG_GS_USB"
+#endif
+
+/* Vendor IN packet, the element of the TX queue */
+#define WEBUSB_TX_ELEMENT_SZ            CFG_TUD_VENDOR_EPSIZE
+
 void webusb_init(void);
-void webusb_set_connect_state(bool isConnected);
+/*
+ * Replaces the vendor IN packet queue with packets elements of storage
+ * from the buffer arena, dropping anything queued.  Scheduler suspended.
+ */
+void webusb_set_tx_queue(uint8_t * pStorage, uint32_t packets);
+bool webusb_tx_idle(void);
+void webusb_set_connect_state(bool isConnected, bool primeVendor);
 bool webusb_sendEp(uint8_t * pBuffer);
+bool webusb_sendExpress(uint8_t * pBuffer);
+#if CONFIG_USB_CAN_REACTOR
+void webusb_reactor_defer(void (*func)(void *), void * param, bool inIsr);
+#endif /* CONFIG_USB_CAN_REACTOR */
 
 #endif /* USB_DEVICE_WEBUSB_H_ */
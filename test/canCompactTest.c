@@ -0,0 +1,388 @@
+/*!
+ * \file canCompactTest.c
+ *
+ * Compact record round trip.  Random frame sequences are encoded into
+ * packets and decoded back with can_compact_decode(), over ID tables that
+ * overflow the 16 slots, with and without repeat coding, across varint
+ * boundaries and timestamp wrap.
+ *
+ * Then reports the stream bytes per frame against the binary encoding, on
+ * a candump -L log given as the first argument, or on a synthetic trace of
+ * periodic classic frames.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "stdlib.h"
+#include "string.h"
+#include "testAssert.h"
+#include "canCodec/canCompact.h"
+#include "canCodec/canCodec.h"
+
+#define KEY_FLAGS           (CAN_FRAME_FLAG_EXTENDED | CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_BRS | \
+                             CAN_FRAME_FLAG_ESI | CAN_FRAME_FLAG_RTR)
+/* Vendor bulk packet less the USB byte count, as compactAppend() fills it */
+#define PACKET_SIZE         (64 - SZ_USB_BYTES_IN_PACKET)
+#define PACKET_OVERHEAD     (CAN_CODEC_BINARY_PAYLOAD_OFFSET + 1 + SZ_CHECKSUM)
+#define MAX_SEQUENCE        (400)
+#define ROUND_TRIP_PACKET   (256)
+
+static uint32_t rngState = 0x12345678UL;
+
+static uint32_t rng(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+static bool frame_equal(can_frame_t const * pA, can_frame_t const * pB)
+{
+    return (pA->id == pB->id) && (pA->flags == pB->flags) && (pA->timestamp == pB->timestamp) &&
+           (pA->len == pB->len) && (memcmp(pA->data, pB->data, pA->len) == 0);
+}
+
+
+/* Decodes a packet's records and checks them against the frames put in */
+static void decode_packet(can_compact_t * pDecoder, uint8_t const * pBuf, uint32_t length,
+                          can_frame_t const * pExpected, uint32_t count)
+{
+    can_frame_t frame;
+    uint32_t offset = 0;
+    uint32_t decoded = 0;
+
+    while(offset < length) {
+        const uint32_t used = can_compact_decode(pDecoder, &pBuf[offset], length - offset, &frame);
+        TEST_CHECK(used != 0);
+        if(used == 0) {
+            return;
+        }
+        TEST_CHECK(decoded < count);
+        if(decoded < count) {
+            TEST_CHECK(frame_equal(&frame, &pExpected[decoded]));
+        }
+        offset += used;
+        decoded++;
+    }
+    TEST_CHECK_EQ(decoded, count);
+}
+
+
+static uint32_t random_id(bool extended)
+{
+    static const uint32_t boundaries[] = {0, 127, 128, 16383, 16384, 0x7FF, 2097151, 2097152, 0x1FFFFFFF};
+    const uint32_t pick = rng() % 4;
+
+    if(pick == 0) {
+        const uint32_t id = boundaries[rng() % (sizeof(boundaries) / sizeof(boundaries[0]))];
+        return extended ? id : (id & 0x7FF);
+    }
+    return extended ? (rng() & 0x1FFFFFFF) : (rng() & 0x7FF);
+}
+
+
+static uint32_t random_delta(void)
+{
+    static const uint32_t boundaries[] = {0, 1, 127, 128, 16383, 16384, 2097151, 2097152, 0xFFFFFFFF};
+
+    if((rng() % 3) == 0) {
+        return boundaries[rng() % (sizeof(boundaries) / sizeof(boundaries[0]))];
+    }
+    return rng() % 2000;
+}
+
+
+/* One random sequence through an encoder and a decoder, packet by packet */
+static void round_trip_sequence(uint32_t poolSize, uint8_t options, uint32_t * pLiterals, uint32_t * pRepeats)
+{
+    static can_frame_t pool[40];
+    static can_frame_t packetFrames[MAX_SEQUENCE];
+    can_compact_t encoder;
+    can_compact_t decoder;
+    can_compact_t saved;
+    uint8_t packet[ROUND_TRIP_PACKET];
+    const uint32_t packetSize = CAN_COMPACT_RECORD_MAX_SZ + (rng() % (ROUND_TRIP_PACKET - CAN_COMPACT_RECORD_MAX_SZ + 1));
+    const uint32_t frames = 1 + (rng() % MAX_SEQUENCE);
+    uint32_t timestamp = ((rng() % 2) == 0) ? (0xFFFFFFFF - (rng() % 5000)) : rng();
+    uint32_t length = 0;
+    uint32_t count = 0;
+
+    can_compact_reset(&encoder, options);
+    can_compact_reset(&decoder, options);
+    for(uint32_t i = 0; i < poolSize; i++) {
+        memset(&pool[i], 0, sizeof(pool[i]));
+        pool[i].flags = (uint8_t)(rng() & KEY_FLAGS);
+        pool[i].id = random_id((pool[i].flags & CAN_FRAME_FLAG_EXTENDED) != 0);
+    }
+
+    for(uint32_t n = 0; n < frames; n++) {
+        can_frame_t * pFrame = &pool[rng() % poolSize];
+        uint32_t used;
+
+        /* Keep the last payload a third of the time, for the repeat flag */
+        if((rng() % 3) != 0) {
+            pFrame->len = (uint8_t)(rng() % (CAN_MAX_DATA_LENGTH + 1));
+            for(uint32_t i = 0; i < pFrame->len; i++) {
+                pFrame->data[i] = (uint8_t)rng();
+            }
+        }
+        timestamp += random_delta();
+        pFrame->timestamp = timestamp;
+
+        saved = encoder;
+        used = can_compact_encode(&encoder, &packet[length], packetSize - length, pFrame);
+        if(used == 0) {
+            /* A record that does not fit leaves the encoder untouched */
+            TEST_CHECK(memcmp(&saved, &encoder, sizeof(encoder)) == 0);
+            decode_packet(&decoder, packet, length, packetFrames, count);
+            length = 0;
+            count = 0;
+            used = can_compact_encode(&encoder, packet, packetSize, pFrame);
+            TEST_CHECK(used != 0);
+        }
+        TEST_CHECK(used <= CAN_COMPACT_RECORD_MAX_SZ);
+        if((packet[length] & CAN_COMPACT_HDR_LITERAL) != 0) {
+            (*pLiterals)++;
+        }
+        if((packet[length] & CAN_COMPACT_HDR_REPEAT) != 0) {
+            TEST_CHECK((options & CAN_COMPACT_OPT_REPEAT) != 0);
+            (*pRepeats)++;
+        }
+        packetFrames[count++] = *pFrame;
+        length += used;
+    }
+    decode_packet(&decoder, packet, length, packetFrames, count);
+}
+
+
+static void test_round_trip(void)
+{
+    uint32_t literals = 0;
+    uint32_t repeats = 0;
+    uint32_t evictingLiterals = 0;
+    uint32_t evictingRepeats = 0;
+
+    for(uint32_t i = 0; i < 500; i++) {
+        round_trip_sequence(1 + (rng() % CAN_COMPACT_TABLE_SIZE), CAN_COMPACT_OPT_ENABLE, &literals, &repeats);
+        round_trip_sequence(1 + (rng() % CAN_COMPACT_TABLE_SIZE), CAN_COMPACT_OPT_ENABLE | CAN_COMPACT_OPT_REPEAT,
+                            &literals, &repeats);
+        /* More IDs than slots, literals keep evicting live entries */
+        round_trip_sequence(CAN_COMPACT_TABLE_SIZE + 1 + (rng() % 23), CAN_COMPACT_OPT_ENABLE | CAN_COMPACT_OPT_REPEAT,
+                            &evictingLiterals, &evictingRepeats);
+    }
+    TEST_CHECK(repeats > 0);
+    TEST_CHECK(evictingLiterals > (500 * CAN_COMPACT_TABLE_SIZE));
+}
+
+
+static uint32_t encode_one(can_compact_t * pEncoder, uint32_t id, uint32_t timestamp, uint8_t len)
+{
+    uint8_t buf[CAN_COMPACT_RECORD_MAX_SZ];
+    can_frame_t frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.flags = CAN_FRAME_FLAG_EXTENDED;
+    frame.timestamp = timestamp;
+    frame.len = len;
+    return can_compact_encode(pEncoder, buf, sizeof(buf), &frame);
+}
+
+
+static void test_varint_boundaries(void)
+{
+    can_compact_t encoder;
+
+    /* header, ID, flags, timestamp, length */
+    can_compact_reset(&encoder, CAN_COMPACT_OPT_ENABLE);
+    TEST_CHECK_EQ(encode_one(&encoder, 127, 127, 0), 5);
+    TEST_CHECK_EQ(encode_one(&encoder, 128, 127 + 128, 0), 7);
+    TEST_CHECK_EQ(encode_one(&encoder, 16383, 255 + 16383, 0), 7);
+    TEST_CHECK_EQ(encode_one(&encoder, 16384, 16638 + 16384, 0), 9);
+    /* Known slot: header, timestamp, length */
+    TEST_CHECK_EQ(encode_one(&encoder, 16384, 33022 + 16384, 0), 5);
+    TEST_CHECK_EQ(encode_one(&encoder, 0x1FFFFFFF, 49406, 0), 9);
+
+    /* A delta across the 32-bit wrap stays small */
+    can_compact_reset(&encoder, CAN_COMPACT_OPT_ENABLE);
+    TEST_CHECK_EQ(encode_one(&encoder, 1, 0xFFFFFFF0UL, 0), 9);
+    TEST_CHECK_EQ(encode_one(&encoder, 1, 0x10, 0), 3);
+}
+
+
+static void test_malformed(void)
+{
+    static const uint8_t unknownSlot[] = {0x03, 0x00, 0x00};
+    static const uint8_t shortLiteral[] = {CAN_COMPACT_HDR_LITERAL, 0x80};
+    static const uint8_t longLength[] = {CAN_COMPACT_HDR_LITERAL, 0x01, 0x00, 0x00, CAN_MAX_DATA_LENGTH + 1};
+    static const uint8_t shortData[] = {CAN_COMPACT_HDR_LITERAL, 0x01, 0x00, 0x00, 0x04, 0xAA};
+    can_compact_t decoder;
+    can_frame_t frame;
+
+    can_compact_reset(&decoder, CAN_COMPACT_OPT_ENABLE);
+    TEST_CHECK_EQ(can_compact_decode(&decoder, unknownSlot, sizeof(unknownSlot), &frame), 0);
+    TEST_CHECK_EQ(can_compact_decode(&decoder, shortLiteral, sizeof(shortLiteral), &frame), 0);
+    TEST_CHECK_EQ(can_compact_decode(&decoder, longLength, sizeof(longLength), &frame), 0);
+    TEST_CHECK_EQ(can_compact_decode(&decoder, shortData, sizeof(shortData), &frame), 0);
+}
+
+
+/* candump -L: "(1436509052.249713) can0 123#DEADBEEF", FD "123##1DEADBEEF" */
+static bool parse_candump(char const * pLine, can_frame_t * pFrame)
+{
+    unsigned long sec;
+    unsigned long usec;
+    char text[200];
+    char * pHash;
+    char * pData;
+    uint32_t idLength;
+
+    if(sscanf(pLine, "(%lu.%lu) %*s %199s", &sec, &usec, text) != 3) {
+        return false;
+    }
+    pHash = strchr(text, '#');
+    if(pHash == NULL) {
+        return false;
+    }
+    memset(pFrame, 0, sizeof(*pFrame));
+    idLength = (uint32_t)(pHash - text);
+    *pHash = 0;
+    pFrame->id = (uint32_t)strtoul(text, NULL, 16);
+    pFrame->timestamp = (uint32_t)((sec * 1000000UL) + usec);
+    if(idLength > 3) {
+        pFrame->flags |= CAN_FRAME_FLAG_EXTENDED;
+    }
+    pData = pHash + 1;
+    if(*pData == '#') {
+        pFrame->flags |= CAN_FRAME_FLAG_FD;
+        if((strtoul((char[]){pData[1], 0}, NULL, 16) & 0x01) != 0) {
+            pFrame->flags |= CAN_FRAME_FLAG_BRS;
+        }
+        pData += 2;
+    } else if(*pData == 'R') {
+        pFrame->flags |= CAN_FRAME_FLAG_RTR;
+        return true;
+    }
+    while((pData[0] != 0) && (pData[1] != 0) && (pFrame->len < CAN_MAX_DATA_LENGTH)) {
+        pFrame->data[pFrame->len++] = (uint8_t)strtoul((char[]){pData[0], pData[1], 0}, NULL, 16);
+        pData += 2;
+    }
+    return true;
+}
+
+
+/* Periodic classic frames: counters, a few signals moving, some static */
+static bool synthetic_frame(uint32_t n, can_frame_t * pFrame)
+{
+    static const uint16_t ids[] = {0x0C4, 0x0D0, 0x120, 0x1A0, 0x1F5, 0x260, 0x2A8, 0x316,
+                                   0x329, 0x3D0, 0x43F, 0x545, 0x5F0, 0x6A1, 0x7DF, 0x7E8};
+    static const uint16_t periodsMs[] = {10, 10, 20, 20, 20, 50, 50, 100, 100, 100, 200, 500, 500, 1000, 1000, 1000};
+    static uint32_t due[16];
+    static uint32_t counter[16];
+    uint32_t best = 0;
+
+    if(n >= 20000) {
+        return false;
+    }
+    for(uint32_t i = 1; i < 16; i++) {
+        if(due[i] < due[best]) {
+            best = i;
+        }
+    }
+    memset(pFrame, 0, sizeof(*pFrame));
+    pFrame->id = ids[best];
+    pFrame->timestamp = (due[best] * 1000U) + (best * 230U) + (rng() % 50);
+    pFrame->len = 8;
+    if(best < 10) {
+        pFrame->data[0] = (uint8_t)counter[best];
+        pFrame->data[1] = (uint8_t)(0x40 + (rng() % 3));
+        pFrame->data[2] = (uint8_t)(counter[best] >> 4);
+        pFrame->data[7] = (uint8_t)(counter[best] & 0x0F);
+    } else if(best < 13) {
+        pFrame->data[0] = 0x11;
+        pFrame->data[3] = 0x22;
+    }
+    counter[best]++;
+    due[best] += periodsMs[best];
+    return true;
+}
+
+
+static void report_trace(FILE * pLog)
+{
+    can_compact_t encoder;
+    can_frame_t frame;
+    uint8_t buf[CAN_CODEC_BINARY_MAX_SZ];
+    char line[256];
+    uint32_t frames = 0;
+    uint32_t binaryBytes = 0;
+    uint32_t compactBytes = 0;
+    uint32_t packetLength = 0;
+
+    can_compact_reset(&encoder, CAN_COMPACT_OPT_ENABLE | CAN_COMPACT_OPT_REPEAT);
+    for(;;) {
+        if(pLog != NULL) {
+            if(fgets(line, sizeof(line), pLog) == NULL) {
+                break;
+            }
+            if(!parse_candump(line, &frame)) {
+                continue;
+            }
+        } else if(!synthetic_frame(frames, &frame)) {
+            break;
+        }
+        frames++;
+        binaryBytes += can_codec_encode_binary(buf, &frame, 0, CAN_CODEC_BINARY_MAX_SZ, FRAME_INTEGRITY_SUM8);
+
+        for(uint32_t attempt = 0; attempt < 2; attempt++) {
+            uint32_t used;
+
+            if(packetLength == 0) {
+                packetLength = PACKET_OVERHEAD;
+            }
+            used = can_compact_encode(&encoder, buf, PACKET_SIZE - packetLength, &frame);
+            if(used != 0) {
+                packetLength += used;
+                break;
+            }
+            if(packetLength > PACKET_OVERHEAD) {
+                compactBytes += packetLength;
+                packetLength = 0;
+            } else {
+                /* Record larger than a packet, goes out as a binary frame */
+                compactBytes += can_codec_encode_binary(buf, &frame, 0, CAN_CODEC_BINARY_MAX_SZ, FRAME_INTEGRITY_SUM8);
+                packetLength = 0;
+                break;
+            }
+        }
+    }
+    compactBytes += packetLength;
+
+    if(frames != 0) {
+        printf("%s: %u frames, binary %.2f bytes/frame, compact %.2f bytes/frame\n",
+               (pLog != NULL) ? "trace" : "synthetic trace", (unsigned)frames,
+               (double)binaryBytes / frames, (double)compactBytes / frames);
+    }
+}
+
+
+int main(int argc, char ** argv)
+{
+    FILE * pLog = NULL;
+
+    test_varint_boundaries();
+    test_malformed();
+    test_round_trip();
+
+    if(argc > 1) {
+        pLog = fopen(argv[1], "r");
+        TEST_CHECK(pLog != NULL);
+    }
+    report_trace(pLog);
+    if(pLog != NULL) {
+        fclose(pLog);
+    }
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,110 @@
+/*!
+ * \file clockSyncTest.cpp
+ *
+ * ClockSyncEstimator on synthetic SOF samples: a device clock at a known
+ * skew and offset from the host, latched with a few us of interrupt
+ * jitter, some samples latched much later, and the 32-bit device counter
+ * wrapping.  The fitted drift and the mapped timestamps must stay within
+ * bounds of the truth.
+ *
+ * \author Sicris Rey Embay
+ */
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include "clockSync/ClockSyncEstimator.hpp"
+
+extern "C" {
+#include "testAssert.h"
+}
+
+using namespace webusb_canfd;
+
+namespace {
+
+constexpr int64_t kSamplePeriodUs = 10000;
+constexpr double kJitterUs = 5.0;       // latch delay, uniform 0..kJitterUs
+/* 5 us of jitter over the 640 ms default window, about 1 ppm rms */
+constexpr double kDriftBoundPpm = 5.0;
+/* Half the jitter as latch bias, plus the whole us of toHostUs() */
+constexpr double kOffsetBoundUs = 6.0;
+
+/* Device time of host time hostUs, as the device counter reads it */
+double deviceAt(double hostUs, double skewPpm, double deviceOriginUs)
+{
+    return deviceOriginUs + (hostUs * (1.0 + (skewPpm * 1e-6)));
+}
+
+void runSkew(double skewPpm, uint32_t seed)
+{
+    std::mt19937 gen(seed);
+    std::uniform_real_distribution<double> jitter(0.0, kJitterUs);
+    std::uniform_int_distribution<int> lateRoll(0, 49);
+    std::uniform_real_distribution<double> lateUs(50.0, 300.0);
+    /* The device counter wraps a few seconds in */
+    const double deviceOriginUs = 4294967296.0 - 3.0e6;
+    const int64_t hostOriginUs = 1700000000000000LL;
+    ClockSyncEstimator est;
+    double worstDriftPpm = 0.0;
+    double worstOffsetUs = 0.0;
+    int rejected = 0;
+    int late = 0;
+
+    for(int i = 0; i < 2000; i++) {
+        const double hostUs = static_cast<double>(i * kSamplePeriodUs);
+        double deviceUs = deviceAt(hostUs, skewPpm, deviceOriginUs) + jitter(gen);
+        const bool isLate = (i > 16) && (lateRoll(gen) == 0);
+
+        if(isLate) {
+            deviceUs += lateUs(gen);
+            late++;
+        }
+        const uint32_t deviceRead = static_cast<uint32_t>(static_cast<uint64_t>(std::llround(deviceUs)));
+        if(!est.addSample(hostOriginUs + static_cast<int64_t>(hostUs), deviceRead)) {
+            rejected++;
+            TEST_CHECK(isLate);
+        }
+
+        /* Once the window is full, check drift and a timestamp halfway to the next sample */
+        if(i >= 64) {
+            const double probeHostUs = hostUs + (kSamplePeriodUs / 2);
+            const uint32_t probeDevice = static_cast<uint32_t>(
+                static_cast<uint64_t>(std::llround(deviceAt(probeHostUs, skewPpm, deviceOriginUs))));
+            const double offsetErr = static_cast<double>(est.toHostUs(probeDevice) - hostOriginUs) - probeHostUs;
+            const double driftErr = est.driftPpm() + (skewPpm / (1.0 + (skewPpm * 1e-6)));
+
+            worstDriftPpm = std::max(worstDriftPpm, std::fabs(driftErr));
+            worstOffsetUs = std::max(worstOffsetUs, std::fabs(offsetErr));
+        }
+    }
+
+    printf("skew %+7.1f ppm: worst drift error %.3f ppm, worst offset error %.2f us, %d/%d late samples rejected\n",
+           skewPpm, worstDriftPpm, worstOffsetUs, rejected, late);
+    TEST_CHECK(worstDriftPpm < kDriftBoundPpm);
+    TEST_CHECK(worstOffsetUs < kOffsetBoundUs);
+    TEST_CHECK(rejected > (late / 2));
+}
+
+void testFrameUnwrapper()
+{
+    FrameUnwrapper unwrapper;
+
+    TEST_CHECK_EQ(unwrapper.unwrap(2040), 2040);
+    TEST_CHECK_EQ(unwrapper.unwrap(2047), 2047);
+    TEST_CHECK_EQ(unwrapper.unwrap(3), 2051);
+    TEST_CHECK_EQ(unwrapper.unwrap(1000), 3048);
+    TEST_CHECK_EQ(unwrapper.unwrap(999), 5095);
+}
+
+} // namespace
+
+int main()
+{
+    testFrameUnwrapper();
+    runSkew(0.0, 1);
+    runSkew(50.0, 2);
+    runSkew(-150.0, 3);
+    runSkew(300.0, 4);
+
+    return TEST_RESULT();
+}
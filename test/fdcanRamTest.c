@@ -0,0 +1,347 @@
+/*!
+ * \file fdcanRamTest.c
+ *
+ * FDCAN message RAM driver against a fake register block and a RAM array.
+ * A model of the 3 element RX FIFO 0 and TX FIFO keeps the fill level and
+ * the get/put indices in RXF0S/TXFQS, and checks the RXF0A and TXBAR
+ * writes.  Covers every DLC, the header bits of each flag combination,
+ * index wrap, and the empty and full FIFO.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "testAssert.h"
+#include "fdcanRam.h"
+
+#define FIFO_ELEMENTS       (3)
+#define UNTOUCHED           (0xA5A5A5A5UL)
+#define ALL_FLAGS           (CAN_FRAME_FLAG_EXTENDED | CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_BRS | \
+                             CAN_FRAME_FLAG_ESI | CAN_FRAME_FLAG_RTR)
+
+static FDCAN_GlobalTypeDef regs;
+static uint32_t ram[FDCAN_RAM_SIZE_WORDS];
+static uint32_t rxGet = 0;
+static uint32_t rxFill = 0;
+static uint32_t txGet = 0;
+static uint32_t txFill = 0;
+static uint32_t rngState = 0x0BADCAFEUL;
+
+static uint32_t rng(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+static uint32_t * element(uint32_t fifoOffset, uint32_t index)
+{
+    return &ram[fifoOffset + (index * FDCAN_RAM_ELEMENT_WORDS)];
+}
+
+
+static void fifo_reset(void)
+{
+    for(uint32_t i = 0; i < FDCAN_RAM_SIZE_WORDS; i++) {
+        ram[i] = UNTOUCHED;
+    }
+    rxGet = 0;
+    rxFill = 0;
+    txGet = 0;
+    txFill = 0;
+    regs.RXF0S = 0;
+    regs.TXFQS = FIFO_ELEMENTS << FDCAN_TXFQS_TFFL_Pos;
+}
+
+
+static void rx_status(void)
+{
+    regs.RXF0S = (rxFill << FDCAN_RXF0S_F0FL_Pos) |
+                 (rxGet << FDCAN_RXF0S_F0GI_Pos) |
+                 (((rxGet + rxFill) % FIFO_ELEMENTS) << FDCAN_RXF0S_F0PI_Pos) |
+                 ((rxFill == FIFO_ELEMENTS) ? FDCAN_RXF0S_F0F : 0);
+}
+
+
+/* The controller stores a frame, data words past the DLC keep old contents */
+static void rx_push(uint32_t word0, uint32_t word1, uint8_t const * pData)
+{
+    const uint8_t len = fdcan_elem_len(word1);
+    uint32_t * pElem = element(FDCAN_RAM_RX_FIFO0_OFFSET, (rxGet + rxFill) % FIFO_ELEMENTS);
+
+    TEST_CHECK(rxFill < FIFO_ELEMENTS);
+    pElem[0] = word0;
+    pElem[1] = word1;
+    memcpy(&pElem[2], pData, len);
+    rxFill++;
+    rx_status();
+}
+
+
+/* Reads the oldest element and checks the acknowledge frees exactly it */
+static bool rx_pop(can_frame_t * pFrame)
+{
+    regs.RXF0A = UNTOUCHED;
+    if(!fdcan_ram_read_rx0(&regs, ram, pFrame)) {
+        TEST_CHECK_EQ(regs.RXF0A, UNTOUCHED);
+        return false;
+    }
+    TEST_CHECK(rxFill > 0);
+    TEST_CHECK_EQ(regs.RXF0A, rxGet);
+    rxGet = (rxGet + 1) % FIFO_ELEMENTS;
+    rxFill--;
+    rx_status();
+    return true;
+}
+
+
+static void tx_status(void)
+{
+    regs.TXFQS = ((FIFO_ELEMENTS - txFill) << FDCAN_TXFQS_TFFL_Pos) |
+                 (txGet << FDCAN_TXFQS_TFGI_Pos) |
+                 (((txGet + txFill) % FIFO_ELEMENTS) << FDCAN_TXFQS_TFQPI_Pos) |
+                 ((txFill == FIFO_ELEMENTS) ? FDCAN_TXFQS_TFQF : 0);
+}
+
+
+/* Writes an element and checks the request names the put index; NULL when full */
+static uint32_t * tx_put(uint32_t word0, uint32_t word1, uint8_t const * pData)
+{
+    const uint32_t put = (txGet + txFill) % FIFO_ELEMENTS;
+
+    regs.TXBAR = 0;
+    if(!fdcan_ram_write_tx(&regs, ram, word0, word1, pData)) {
+        TEST_CHECK_EQ(regs.TXBAR, 0);
+        return NULL;
+    }
+    TEST_CHECK(txFill < FIFO_ELEMENTS);
+    TEST_CHECK_EQ(regs.TXBAR, 1UL << put);
+    txFill++;
+    tx_status();
+    return element(FDCAN_RAM_TX_FIFO_OFFSET, put);
+}
+
+
+/* The controller sends the oldest element */
+static void tx_sent(void)
+{
+    TEST_CHECK(txFill > 0);
+    txGet = (txGet + 1) % FIFO_ELEMENTS;
+    txFill--;
+    tx_status();
+}
+
+
+/* What a frame's flags read back as, the bits that do not apply dropped */
+static uint8_t flags_seen(uint8_t flags)
+{
+    if((flags & CAN_FRAME_FLAG_FD) != 0) {
+        return flags & (CAN_FRAME_FLAG_EXTENDED | CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_BRS | CAN_FRAME_FLAG_ESI);
+    }
+    return flags & (CAN_FRAME_FLAG_EXTENDED | CAN_FRAME_FLAG_RTR);
+}
+
+
+static void test_header_bits(void)
+{
+    /* RM0440 element layout */
+    TEST_CHECK_EQ(fdcan_elem_word0(0x123, 0), 0x123UL << 18);
+    TEST_CHECK_EQ(fdcan_elem_word0(0x1ABCDEF0, CAN_FRAME_FLAG_EXTENDED), (1UL << 30) | 0x1ABCDEF0UL);
+    TEST_CHECK_EQ(fdcan_elem_word0(0x7FF, CAN_FRAME_FLAG_RTR), (1UL << 29) | (0x7FFUL << 18));
+    TEST_CHECK_EQ(fdcan_elem_word0(0, CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_ESI), 1UL << 31);
+    TEST_CHECK_EQ(fdcan_elem_word0(0, CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_RTR), 0);
+    TEST_CHECK_EQ(fdcan_elem_word1(64, CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_BRS), (1UL << 21) | (1UL << 20) | (15UL << 16));
+    TEST_CHECK_EQ(fdcan_elem_word1(8, CAN_FRAME_FLAG_BRS), 8UL << 16);
+    /* Out of range identifiers are cut to their field */
+    TEST_CHECK_EQ(fdcan_elem_id(fdcan_elem_word0(0xFFFFFFFF, 0)), 0x7FF);
+    TEST_CHECK_EQ(fdcan_elem_id(fdcan_elem_word0(0xFFFFFFFF, CAN_FRAME_FLAG_EXTENDED)), 0x1FFFFFFF);
+
+    /* Every flag combination with a random identifier, header only */
+    for(uint8_t flags = 0; flags <= ALL_FLAGS; flags++) {
+        const uint32_t id = rng() & (((flags & CAN_FRAME_FLAG_EXTENDED) != 0) ? 0x1FFFFFFFUL : 0x7FFUL);
+        const uint32_t word0 = fdcan_elem_word0(id, flags);
+        const uint32_t word1 = fdcan_elem_word1(8, flags);
+
+        TEST_CHECK_EQ(fdcan_elem_id(word0), id);
+        TEST_CHECK_EQ(fdcan_elem_flags(word0, word1), flags_seen(flags));
+    }
+}
+
+
+/* Every DLC through the RX FIFO, data past the length is not copied */
+static void test_rx_lengths(void)
+{
+    uint8_t data[CAN_MAX_DATA_LENGTH];
+    can_frame_t frame;
+
+    fifo_reset();
+    for(uint8_t dlc = 0; dlc < 16; dlc++) {
+        const uint8_t len = can_dlc_to_len(dlc);
+        const uint8_t flags = (dlc > 8) ? (CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_BRS) : 0;
+        const uint32_t word1 = fdcan_elem_word1(len, flags);
+
+        TEST_CHECK_EQ(can_len_to_dlc(len), dlc);
+        TEST_CHECK_EQ((word1 >> FDCAN_ELEM_DLC_SHIFT) & FDCAN_ELEM_DLC_MASK, dlc);
+        for(uint32_t i = 0; i < sizeof(data); i++) {
+            data[i] = (uint8_t)rng();
+        }
+        rx_push(fdcan_elem_word0(dlc, flags), word1, data);
+        memset(&frame, 0xEE, sizeof(frame));
+        TEST_CHECK(rx_pop(&frame));
+        TEST_CHECK_EQ(frame.id, dlc);
+        TEST_CHECK_EQ(frame.flags, flags);
+        TEST_CHECK_EQ(frame.len, len);
+        TEST_CHECK(memcmp(frame.data, data, len) == 0);
+        /* Whole words are read, nothing past the last one */
+        for(uint32_t i = (len + 3U) & ~3U; i < sizeof(frame.data); i++) {
+            TEST_CHECK_EQ(frame.data[i], 0xEE);
+        }
+    }
+}
+
+
+/* Every DLC through the TX FIFO, the last word zero padded, no word more */
+static void test_tx_lengths(void)
+{
+    uint8_t data[CAN_MAX_DATA_LENGTH];
+
+    for(uint8_t dlc = 0; dlc < 16; dlc++) {
+        const uint8_t len = can_dlc_to_len(dlc);
+        const uint8_t flags = (dlc > 8) ? CAN_FRAME_FLAG_FD : 0;
+        const uint32_t word0 = fdcan_elem_word0(0x100 + dlc, flags);
+        const uint32_t word1 = fdcan_elem_word1(len, flags);
+        const uint32_t words = (len + 3U) / 4U;
+        uint32_t * pElem;
+
+        fifo_reset();
+        for(uint32_t i = 0; i < sizeof(data); i++) {
+            data[i] = (uint8_t)rng();
+        }
+        pElem = tx_put(word0, word1, data);
+        TEST_CHECK(pElem != NULL);
+        if(pElem == NULL) {
+            continue;
+        }
+        TEST_CHECK_EQ(pElem[0], word0);
+        TEST_CHECK_EQ(pElem[1], word1);
+        TEST_CHECK(memcmp(&pElem[2], data, len) == 0);
+        if((len % 4) != 0) {
+            uint8_t padding[4] = { 0 };
+            TEST_CHECK(memcmp((uint8_t const *)&pElem[2] + len, padding, 4 - (len % 4)) == 0);
+        }
+        if(words < (FDCAN_RAM_ELEMENT_WORDS - 2)) {
+            TEST_CHECK_EQ(pElem[2 + words], UNTOUCHED);
+        }
+        /* The next element is not touched */
+        TEST_CHECK_EQ(pElem[FDCAN_RAM_ELEMENT_WORDS], UNTOUCHED);
+    }
+}
+
+
+/* Random frames through both FIFOs at varying fill, get and put wrap */
+static void test_wrap(void)
+{
+    uint8_t data[CAN_MAX_DATA_LENGTH];
+    uint8_t pending[FIFO_ELEMENTS][CAN_MAX_DATA_LENGTH];
+    uint32_t pendingId[FIFO_ELEMENTS];
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+    can_frame_t frame;
+
+    fifo_reset();
+    for(uint32_t n = 0; n < 200; n++) {
+        /* RX: push 0..3, pop 0..3, in order */
+        const uint32_t pushes = rng() % (FIFO_ELEMENTS + 1 - rxFill);
+        const uint32_t pops = rng() % (FIFO_ELEMENTS + 1);
+        for(uint32_t i = 0; i < pushes; i++) {
+            const uint32_t slot = pushed % FIFO_ELEMENTS;
+            for(uint32_t k = 0; k < sizeof(data); k++) {
+                pending[slot][k] = (uint8_t)rng();
+            }
+            pendingId[slot] = rng() & FDCAN_ELEM_EXT_ID_MASK;
+            rx_push(fdcan_elem_word0(pendingId[slot], CAN_FRAME_FLAG_EXTENDED | CAN_FRAME_FLAG_FD),
+                    fdcan_elem_word1(64, CAN_FRAME_FLAG_FD), pending[slot]);
+            pushed++;
+        }
+        for(uint32_t i = 0; i < pops; i++) {
+            const bool expected = (popped != pushed);
+            TEST_CHECK_EQ(rx_pop(&frame), expected);
+            if(expected) {
+                const uint32_t slot = popped % FIFO_ELEMENTS;
+                TEST_CHECK_EQ(frame.id, pendingId[slot]);
+                TEST_CHECK(memcmp(frame.data, pending[slot], 64) == 0);
+                popped++;
+            }
+        }
+
+        /* TX: put until full now and then, the controller sends some */
+        for(uint32_t i = rng() % (FIFO_ELEMENTS + 2); i > 0; i--) {
+            const bool room = (txFill < FIFO_ELEMENTS);
+            uint32_t * pElem;
+            data[0] = (uint8_t)n;
+            pElem = tx_put(fdcan_elem_word0(n & 0x7FF, 0), fdcan_elem_word1(1, 0), data);
+            TEST_CHECK_EQ(pElem != NULL, room);
+            if(pElem != NULL) {
+                TEST_CHECK_EQ(fdcan_elem_id(pElem[0]), n & 0x7FF);
+                TEST_CHECK_EQ(pElem[2] & 0xFF, (uint8_t)n);
+            }
+        }
+        for(uint32_t i = rng() % (txFill + 1); i > 0; i--) {
+            tx_sent();
+        }
+    }
+    TEST_CHECK(pushed > 100);
+}
+
+
+/* An empty RX FIFO and a full TX FIFO leave the frame, RAM and registers alone */
+static void test_empty_full(void)
+{
+    uint8_t data[CAN_MAX_DATA_LENGTH] = { 0 };
+    can_frame_t frame;
+    can_frame_t before;
+
+    fifo_reset();
+    memset(&frame, 0x5A, sizeof(frame));
+    before = frame;
+    TEST_CHECK(!rx_pop(&frame));
+    TEST_CHECK(memcmp(&frame, &before, sizeof(frame)) == 0);
+
+    for(uint32_t i = 0; i < FIFO_ELEMENTS; i++) {
+        TEST_CHECK(tx_put(fdcan_elem_word0(i, 0), fdcan_elem_word1(8, 0), data) != NULL);
+    }
+    TEST_CHECK(regs.TXFQS & FDCAN_TXFQS_TFQF);
+    {
+        uint32_t snapshot[FDCAN_RAM_SIZE_WORDS];
+        memcpy(snapshot, ram, sizeof(ram));
+        TEST_CHECK(tx_put(fdcan_elem_word0(0x555, 0), fdcan_elem_word1(8, 0), data) == NULL);
+        TEST_CHECK(memcmp(snapshot, ram, sizeof(ram)) == 0);
+    }
+    tx_sent();
+    TEST_CHECK(tx_put(fdcan_elem_word0(0x555, 0), fdcan_elem_word1(8, 0), data) != NULL);
+
+    /* A full RX FIFO still reads in order */
+    for(uint32_t i = 0; i < FIFO_ELEMENTS; i++) {
+        rx_push(fdcan_elem_word0(0x10 + i, 0), fdcan_elem_word1(0, 0), data);
+    }
+    TEST_CHECK(regs.RXF0S & FDCAN_RXF0S_F0F);
+    for(uint32_t i = 0; i < FIFO_ELEMENTS; i++) {
+        TEST_CHECK(rx_pop(&frame));
+        TEST_CHECK_EQ(frame.id, 0x10 + i);
+        TEST_CHECK_EQ(frame.len, 0);
+    }
+    TEST_CHECK(!rx_pop(&frame));
+}
+
+
+int main(void)
+{
+    test_header_bits();
+    test_rx_lengths();
+    test_tx_lengths();
+    test_wrap();
+    test_empty_full();
+
+    return TEST_RESULT();
+}
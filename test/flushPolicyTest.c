@@ -0,0 +1,270 @@
+/*!
+ * \file flushPolicyTest.c
+ *
+ * Flush policies against a virtual clock.  The harness mirrors the command
+ * parser: records go into a packet of fixed size, a full packet goes out
+ * before the next record, and a one-shot timer on tick boundaries rechecks
+ * the deadline as flushDeadline() does.  For each policy the test checks
+ * when batches go out and that none is held past its deadline, then prints
+ * record latency and frames per packet for a few traffic patterns.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "testAssert.h"
+#include "flushPolicy/flushPolicy.h"
+
+/* Compact batch of a full speed vendor packet, see compactAppend() */
+#define PACKET_RECORDS_SZ   (56)
+#define RECORD_SZ(len)      (3 + (len))
+#define BATCH_MAX           (PACKET_RECORDS_SZ / RECORD_SZ(0))
+#define ARRIVALS            (20000)
+#define FLAGGED_ID          (0x100)
+
+typedef enum {
+    TRAFFIC_SPARSE = 0,     // one frame every 2..5 ms
+    TRAFFIC_DENSE,          // one frame every 50..200 us
+    TRAFFIC_BURSTY,         // 1..10 frames back to back every 1..10 ms
+    N_TRAFFIC
+} TRAFFIC_T;
+
+typedef struct {
+    flush_policy_t policy;
+    uint32_t tickUs;
+    uint32_t length;
+    uint32_t count;
+    uint32_t arrivals[BATCH_MAX];
+    bool bFlagged[BATCH_MAX];
+    bool bTimerArmed;
+    uint32_t timerUs;
+    /* results */
+    uint32_t packets;
+    uint32_t frames;
+    uint64_t latencySumUs;
+    uint32_t latencyMaxUs;
+    uint32_t flaggedLatencyMaxUs;
+    uint32_t fullFlushes;
+} sim_t;
+
+static uint32_t rngState = 0x9E3779B9UL;
+
+static uint32_t rng(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+static bool has_deadline(FLUSH_MODE_T mode)
+{
+    return (mode == FLUSH_MODE_DEADLINE) || (mode == FLUSH_MODE_FLAGGED) || (mode == FLUSH_MODE_ADAPTIVE);
+}
+
+
+static void sim_flush(sim_t * pSim, uint32_t nowUs, bool full)
+{
+    if(pSim->count == 0) {
+        return;
+    }
+    /* Deadlines are rounded up to the timer tick, exact with a 1 us tick */
+    if(has_deadline(pSim->policy.mode)) {
+        TEST_CHECK((nowUs - pSim->arrivals[0]) <= (pSim->policy.deadlineUs + pSim->tickUs - 1));
+    }
+    if(pSim->policy.mode == FLUSH_MODE_FULL) {
+        TEST_CHECK(full);
+    }
+    for(uint32_t i = 0; i < pSim->count; i++) {
+        const uint32_t latency = nowUs - pSim->arrivals[i];
+        pSim->latencySumUs += latency;
+        if(latency > pSim->latencyMaxUs) {
+            pSim->latencyMaxUs = latency;
+        }
+        if(pSim->bFlagged[i] && (latency > pSim->flaggedLatencyMaxUs)) {
+            pSim->flaggedLatencyMaxUs = latency;
+        }
+    }
+    pSim->frames += pSim->count;
+    pSim->packets++;
+    if(full) {
+        pSim->fullFlushes++;
+    }
+    pSim->length = 0;
+    pSim->count = 0;
+    flush_policy_flushed(&pSim->policy);
+}
+
+
+/* flushTimerArm(): whole ticks, at least one, fires on a tick boundary */
+static void sim_arm(sim_t * pSim, uint32_t nowUs, uint32_t remainingUs)
+{
+    uint32_t ticks = (remainingUs + pSim->tickUs - 1) / pSim->tickUs;
+
+    if(ticks == 0) {
+        ticks = 1;
+    }
+    pSim->timerUs = ((nowUs / pSim->tickUs) + ticks) * pSim->tickUs;
+    pSim->bTimerArmed = true;
+}
+
+
+/* compactAppend() */
+static void sim_frame(sim_t * pSim, uint32_t nowUs, can_frame_t const * pFrame, bool more)
+{
+    uint32_t remainingUs;
+
+    if((pSim->length + RECORD_SZ(pFrame->len)) > PACKET_RECORDS_SZ) {
+        sim_flush(pSim, nowUs, true);
+    }
+    pSim->arrivals[pSim->count] = nowUs;
+    pSim->bFlagged[pSim->count] = (pFrame->id == FLAGGED_ID);
+    pSim->count++;
+    pSim->length += RECORD_SZ(pFrame->len);
+
+    if(flush_policy_on_frame(&pSim->policy, nowUs, pFrame, more)) {
+        sim_flush(pSim, nowUs, false);
+    } else if(!pSim->bTimerArmed && flush_policy_deadline(&pSim->policy, nowUs, &remainingUs)) {
+        sim_arm(pSim, nowUs, remainingUs);
+    }
+    if((pSim->policy.mode == FLUSH_MODE_IDLE) && !more) {
+        TEST_CHECK_EQ(pSim->count, 0);
+    }
+}
+
+
+/* flushDeadline() */
+static void sim_timer(sim_t * pSim, uint32_t nowUs)
+{
+    uint32_t remainingUs;
+
+    pSim->bTimerArmed = false;
+    if(flush_policy_deadline(&pSim->policy, nowUs, &remainingUs)) {
+        if(remainingUs == 0) {
+            sim_flush(pSim, nowUs, false);
+        } else {
+            sim_arm(pSim, nowUs, remainingUs);
+        }
+    }
+}
+
+
+static uint32_t next_gap(TRAFFIC_T traffic, uint32_t * pBurstLeft)
+{
+    switch(traffic) {
+        case TRAFFIC_SPARSE:
+            return 2000 + (rng() % 3001);
+        case TRAFFIC_DENSE:
+            return 50 + (rng() % 151);
+        case TRAFFIC_BURSTY:
+        default:
+            if(*pBurstLeft > 0) {
+                (*pBurstLeft)--;
+                return 0;
+            }
+            *pBurstLeft = rng() % 10;
+            return 1000 + (rng() % 9001);
+    }
+}
+
+
+static void run(sim_t * pSim, FLUSH_MODE_T mode, uint32_t deadlineUs, uint32_t tickUs, TRAFFIC_T traffic)
+{
+    static const uint32_t flagged[] = {FLAGGED_ID};
+    uint32_t burstLeft = 0;
+    uint32_t nowUs = 0;
+    uint32_t nextUs;
+    can_frame_t frame;
+
+    memset(pSim, 0, sizeof(*pSim));
+    pSim->tickUs = tickUs;
+    TEST_CHECK(flush_policy_configure(&pSim->policy, mode, deadlineUs, flagged, 1));
+    memset(&frame, 0, sizeof(frame));
+    /* Starts just short of the wrap, the policy runs on 32-bit time */
+    nowUs = 0xFFFFFFFFUL - 50000;
+    nowUs -= nowUs % tickUs;
+    nextUs = nowUs + next_gap(traffic, &burstLeft);
+
+    for(uint32_t n = 0; n < ARRIVALS; n++) {
+        const uint32_t arrivalUs = nextUs;
+        /* Timer events due before the arrival */
+        while(pSim->bTimerArmed && ((int32_t)(pSim->timerUs - arrivalUs) <= 0)) {
+            nowUs = pSim->timerUs;
+            sim_timer(pSim, nowUs);
+        }
+        nowUs = arrivalUs;
+        nextUs = arrivalUs + next_gap(traffic, &burstLeft);
+        frame.id = ((rng() % 50) == 0) ? FLAGGED_ID : (0x200 + (rng() % 8));
+        frame.len = (uint8_t)(rng() % 9);
+        /* Back to back arrivals are what the RX queue holds */
+        sim_frame(pSim, nowUs, &frame, (nextUs == arrivalUs) && (n < (ARRIVALS - 1)));
+    }
+    while(pSim->bTimerArmed) {
+        nowUs = pSim->timerUs;
+        sim_timer(pSim, nowUs);
+    }
+    if(mode != FLUSH_MODE_FULL) {
+        TEST_CHECK_EQ(pSim->count, 0);
+    }
+}
+
+
+static void test_policies(void)
+{
+    static const char * const modeNames[N_FLUSH_MODE] = {"idle", "full", "deadline", "flagged", "adaptive"};
+    static const char * const trafficNames[N_TRAFFIC] = {"sparse", "dense", "bursty"};
+    static const uint32_t ticks[] = {1, 1000};
+    static const uint32_t deadlines[] = {250, 2000};
+    sim_t sim;
+
+    printf("%-8s %-6s %8s %6s %10s %10s %12s\n", "mode", "traffic", "deadline", "tick", "avg us", "max us", "frames/pkt");
+    for(uint32_t mode = 0; mode < N_FLUSH_MODE; mode++) {
+        for(uint32_t traffic = 0; traffic < N_TRAFFIC; traffic++) {
+            for(uint32_t t = 0; t < (sizeof(ticks) / sizeof(ticks[0])); t++) {
+                for(uint32_t d = 0; d < (sizeof(deadlines) / sizeof(deadlines[0])); d++) {
+                    if(!has_deadline((FLUSH_MODE_T)mode) && (d > 0)) {
+                        continue;
+                    }
+                    run(&sim, (FLUSH_MODE_T)mode, deadlines[d], ticks[t], (TRAFFIC_T)traffic);
+                    if((mode == FLUSH_MODE_FLAGGED) || (mode == FLUSH_MODE_IDLE)) {
+                        TEST_CHECK_EQ(sim.flaggedLatencyMaxUs, 0);
+                    }
+                    if((mode == FLUSH_MODE_ADAPTIVE) && (traffic == TRAFFIC_SPARSE)) {
+                        /* Gaps above the deadline, every frame goes out at once */
+                        TEST_CHECK_EQ(sim.latencyMaxUs, 0);
+                    }
+                    if(sim.frames == 0) {
+                        continue;
+                    }
+                    printf("%-8s %-7s %8u %6u %10.1f %10u %12.2f\n", modeNames[mode], trafficNames[traffic],
+                           has_deadline((FLUSH_MODE_T)mode) ? (unsigned)deadlines[d] : 0U, (unsigned)ticks[t],
+                           (double)sim.latencySumUs / sim.frames, (unsigned)sim.latencyMaxUs,
+                           (double)sim.frames / sim.packets);
+                }
+            }
+        }
+    }
+}
+
+
+static void test_configure(void)
+{
+    flush_policy_t policy;
+    uint32_t ids[FLUSH_POLICY_MAX_FLAGGED_IDS + 1] = {0};
+
+    TEST_CHECK(!flush_policy_configure(&policy, FLUSH_MODE_DEADLINE, 0, NULL, 0));
+    TEST_CHECK(!flush_policy_configure(&policy, FLUSH_MODE_ADAPTIVE, 0, NULL, 0));
+    TEST_CHECK(!flush_policy_configure(&policy, N_FLUSH_MODE, 100, NULL, 0));
+    TEST_CHECK(!flush_policy_configure(&policy, FLUSH_MODE_FLAGGED, 100, ids, FLUSH_POLICY_MAX_FLAGGED_IDS + 1));
+    TEST_CHECK(flush_policy_configure(&policy, FLUSH_MODE_FULL, 0, NULL, 0));
+    TEST_CHECK(flush_policy_configure(&policy, FLUSH_MODE_IDLE, 0, NULL, 0));
+}
+
+
+int main(void)
+{
+    test_configure();
+    test_policies();
+
+    return TEST_RESULT();
+}
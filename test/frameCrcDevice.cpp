@@ -0,0 +1,10 @@
+/*!
+ * \file frameCrcDevice.cpp
+ *
+ * CRC_update16/32 of bsp/crc.h for the host builds of the frame parser and
+ * the codecs, from the host library.
+ *
+ * \author Sicris Rey Embay
+ */
+#define FRAME_CRC_DEVICE_API
+#include "frameCrc/FrameCrc.hpp"
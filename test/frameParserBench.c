@@ -0,0 +1,121 @@
+/*!
+ * \file frameParserBench.c
+ *
+ * Frame parser throughput on the host, in MB/s, for the streams of the
+ * on-target parse benchmarks (stats/bench.h): clean 20 byte payload frames
+ * with each trailer, random noise and the worst case resync input, a SOF
+ * announcing the longest frame over and over.  Fed 64 bytes at a time.
+ * Build with -DTEST_SANITIZE=OFF for meaningful figures.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "time.h"
+#include "canCodec/canCodec.h"
+#include "usb_device/frameParser/frameParser.h"
+
+#define STREAM_SIZE         (16UL << 20)
+#define CHUNK_SIZE          (64)
+#define PAYLOAD_SIZE        (20)
+#define RING_SIZE           (2048)
+/* Longest frame there is, it has a CRC-32 trailer */
+#define RESYNC_LENGTH       (FRAME_MAX_LENGTH | (FRAME_INTEGRITY_CRC32 << FRAME_LENGTH_INTEGRITY_SHIFT))
+
+static uint8_t ring[RING_SIZE];
+static uint8_t commandBuffer[CONFIG_CMD_FRAME_SIZE];
+static uint32_t frames = 0;
+static uint32_t rngState = 0x12345678UL;
+
+static uint32_t rng(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+static int32_t frameCb(uint8_t const * pPayload, uint32_t length)
+{
+    (void) pPayload;
+    (void) length;
+    frames++;
+    return 0;
+}
+
+
+static void run(const char * pName, uint8_t * pStream, uint32_t size)
+{
+    static frame_parser_t parser;
+    frame_valid_cb_t validCb = {
+        .callback = frameCb,
+        .pCommandBuffer = commandBuffer
+    };
+    struct timespec start;
+    struct timespec end;
+    double seconds;
+
+    memset(&parser, 0, sizeof(parser));
+    frame_parser_init(&parser, &validCb);
+    frame_parser_set_ring(&parser, ring, sizeof(ring));
+    frames = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(uint32_t offset = 0; offset < size; offset += CHUNK_SIZE) {
+        frame_parser_receive(&parser, &pStream[offset], CHUNK_SIZE);
+        frame_parser_process(&parser);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = (double)(end.tv_sec - start.tv_sec) + ((double)(end.tv_nsec - start.tv_nsec) * 1e-9);
+    printf("%-14s %8.1f MB/s, %u frames\n", pName, ((double)size / seconds) * 1e-6, frames);
+}
+
+
+int main(void)
+{
+    static const char * const names[N_FRAME_INTEGRITY] = { "clean-sum8", "clean-crc16", "clean-crc32" };
+    uint8_t * pStream = malloc(STREAM_SIZE);
+    uint8_t frame[CAN_CODEC_BINARY_PAYLOAD_OFFSET + PAYLOAD_SIZE + SZ_TRAILER_MAX];
+
+    if(pStream == NULL) {
+        return 1;
+    }
+
+    for(uint32_t integrity = 0; integrity < N_FRAME_INTEGRITY; integrity++) {
+        uint32_t length = 0;
+        uint16_t sequence = 0;
+        for(uint32_t i = 0; i < PAYLOAD_SIZE; i++) {
+            frame[CAN_CODEC_BINARY_PAYLOAD_OFFSET + i] = (uint8_t)rng();
+        }
+        for(;;) {
+            const uint32_t size = can_codec_seal_binary(frame, PAYLOAD_SIZE, sequence++,
+                                                        (FRAME_INTEGRITY_T)integrity);
+            if((length + size) > STREAM_SIZE) {
+                break;
+            }
+            memcpy(&pStream[length], frame, size);
+            length += size;
+        }
+        memset(&pStream[length], 0, STREAM_SIZE - length);
+        run(names[integrity], pStream, STREAM_SIZE);
+    }
+
+    for(uint32_t i = 0; i < STREAM_SIZE; i++) {
+        pStream[i] = (uint8_t)rng();
+    }
+    run("noise", pStream, STREAM_SIZE);
+
+    memset(pStream, 0, STREAM_SIZE);
+    for(uint32_t i = 0; (i + 3) <= STREAM_SIZE; i += 3) {
+        pStream[i] = TAG_SOF;
+        pStream[i + 1] = (uint8_t)(RESYNC_LENGTH & 0xFF);
+        pStream[i + 2] = (uint8_t)(RESYNC_LENGTH >> 8);
+    }
+    run("resync", pStream, STREAM_SIZE);
+
+    free(pStream);
+    return 0;
+}
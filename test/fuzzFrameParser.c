@@ -0,0 +1,233 @@
+/*!
+ * \file fuzzFrameParser.c
+ *
+ * Frame parser fuzzing.  Each input is fed one byte per receive/process
+ * call to a fresh parser, behind the trailer its first byte requires.
+ * Under ASAN and UBSAN any out of bounds ring or command buffer access
+ * aborts.  Every delivered payload must fit the command buffer.  A valid
+ * frame sent right after the input must be delivered, unless a frame
+ * accepted over it took its bytes, and once any frame the input started
+ * has run out a valid frame must always be delivered.
+ *
+ * Built with clang the file is a libFuzzer target (FUZZ_LIBFUZZER).  With
+ * any other compiler a standalone driver runs the files given as
+ * arguments, or a fixed number of random inputs mixing noise, start of
+ * frame tags and valid frames.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "stdlib.h"
+#include "string.h"
+#include "testAssert.h"
+#include "canCodec/canCodec.h"
+#include "usb_device/frameParser/frameParser.h"
+
+#define RING_SIZE           (2048)
+#define PROBE_PAYLOAD_SIZE  (21)
+/* Valid frames up to this much past the largest deliverable one */
+#define OVERSIZE            (8)
+#define FRAME_BUF_SIZE      (CAN_CODEC_BINARY_PAYLOAD_OFFSET + CONFIG_CMD_FRAME_SIZE + OVERSIZE + SZ_TRAILER_MAX)
+#define RANDOM_INPUTS       (20000)
+#define RANDOM_INPUT_MAX    (1500)
+
+static uint8_t ring[RING_SIZE];
+static uint8_t commandBuffer[CONFIG_CMD_FRAME_SIZE];
+static uint8_t probe[FRAME_BUF_SIZE];
+static uint32_t probeSize = 0;
+static uint32_t delivered = 0;
+static uint32_t frames = 0;
+static bool probeDelivered = false;
+
+
+static int32_t frameCb(uint8_t const * pPayload, uint32_t length)
+{
+    TEST_CHECK(length <= CONFIG_CMD_FRAME_SIZE);
+    frames++;
+    /* Touch every byte, ASAN checks the range */
+    for(uint32_t i = 0; i < length; i++) {
+        delivered += pPayload[i];
+    }
+    if((length == PROBE_PAYLOAD_SIZE) &&
+       (memcmp(pPayload, &probe[CAN_CODEC_BINARY_PAYLOAD_OFFSET], length) == 0)) {
+        probeDelivered = true;
+    }
+    return 0;
+}
+
+
+static void feed(frame_parser_t * pParser, uint8_t const * pBuf, uint32_t length)
+{
+    for(uint32_t i = 0; i < length; i++) {
+        uint8_t byte = pBuf[i];
+        TEST_CHECK(frame_parser_receive(pParser, &byte, 1));
+        frame_parser_process(pParser);
+    }
+}
+
+
+/* Any frame started before ends within this, none starts in it */
+static void pad(frame_parser_t * pParser)
+{
+    static const uint8_t zero = 0;
+
+    for(uint32_t i = 0; i < FRAME_MAX_LENGTH; i++) {
+        feed(pParser, &zero, 1);
+    }
+}
+
+
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    static frame_parser_t parser;
+    uint32_t framesBefore;
+    frame_valid_cb_t validCb = {
+        .callback = frameCb,
+        .pCommandBuffer = commandBuffer
+    };
+
+    if(probeSize == 0) {
+        for(uint32_t i = 0; i < PROBE_PAYLOAD_SIZE; i++) {
+            probe[CAN_CODEC_BINARY_PAYLOAD_OFFSET + i] = (uint8_t)(0xA5 ^ i);
+        }
+        probeSize = can_codec_seal_binary(probe, PROBE_PAYLOAD_SIZE, 0x1234, FRAME_INTEGRITY_CRC32);
+    }
+
+    memset(&parser, 0, sizeof(parser));
+    frame_parser_init(&parser, &validCb);
+    frame_parser_set_ring(&parser, ring, sizeof(ring));
+    if(size > 0) {
+        frame_parser_require(&parser, (FRAME_INTEGRITY_T)(data[0] % N_FRAME_INTEGRITY));
+    }
+    feed(&parser, data, (uint32_t)size);
+
+    /* A candidate the input started may run over the probe, but only an
+     * accepted one may keep it from being found once that one fails */
+    probeDelivered = false;
+    framesBefore = frames;
+    feed(&parser, probe, probeSize);
+    pad(&parser);
+    TEST_CHECK(probeDelivered || (frames != framesBefore));
+
+    probeDelivered = false;
+    feed(&parser, probe, probeSize);
+    TEST_CHECK(probeDelivered);
+    TEST_CHECK(frame_parser_idle(&parser));
+
+    if(testFailures != 0) {
+        fflush(stdout);
+        abort();
+    }
+    return 0;
+}
+
+
+#ifndef FUZZ_LIBFUZZER
+
+#include "stdio.h"
+
+static uint32_t rngState = 0x12345678UL;
+
+static uint32_t rng(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+/*
+ * Noise, start of frame tags with any length, and whole or cut valid
+ * frames, some too large to deliver
+ */
+static uint32_t randomInput(uint8_t * pBuf, uint32_t maxSize)
+{
+    uint8_t frame[FRAME_BUF_SIZE];
+    const uint32_t target = rng() % maxSize;
+    uint32_t length = 0;
+
+    while(length < target) {
+        switch(rng() % 4) {
+            case 0: {
+                pBuf[length++] = (uint8_t)rng();
+                break;
+            }
+            case 1: {
+                pBuf[length++] = TAG_SOF;
+                break;
+            }
+            case 2: {
+                /* Length near the limits, any trailer */
+                const uint16_t value = (uint16_t)(((rng() % 2) ? (FRAME_MAX_LENGTH - 2 + (rng() % 5)) : (rng() % 16)) |
+                                                  ((rng() % 4) << FRAME_LENGTH_INTEGRITY_SHIFT));
+                if((length + 3) <= maxSize) {
+                    pBuf[length++] = TAG_SOF;
+                    pBuf[length++] = (uint8_t)(value & 0xFF);
+                    pBuf[length++] = (uint8_t)(value >> 8);
+                } else {
+                    return length;
+                }
+                break;
+            }
+            default: {
+                const uint32_t payload = rng() % (CONFIG_CMD_FRAME_SIZE + OVERSIZE + 1);
+                uint32_t size;
+                for(uint32_t i = 0; i < payload; i++) {
+                    frame[CAN_CODEC_BINARY_PAYLOAD_OFFSET + i] = (uint8_t)rng();
+                }
+                size = can_codec_seal_binary(frame, payload, (uint16_t)rng(),
+                                             (FRAME_INTEGRITY_T)(rng() % N_FRAME_INTEGRITY));
+                /* Now and then cut short */
+                if((rng() % 8) == 0) {
+                    size = rng() % size;
+                }
+                if((length + size) > maxSize) {
+                    return length;
+                }
+                memcpy(&pBuf[length], frame, size);
+                length += size;
+                break;
+            }
+        }
+    }
+    return length;
+}
+
+
+static bool runFile(const char * pPath)
+{
+    static uint8_t data[1 << 20];
+    FILE * pFile = fopen(pPath, "rb");
+    size_t size;
+
+    if(pFile == NULL) {
+        printf("%s: can not open\n", pPath);
+        return false;
+    }
+    size = fread(data, 1, sizeof(data), pFile);
+    fclose(pFile);
+    LLVMFuzzerTestOneInput(data, size);
+    return true;
+}
+
+
+int main(int argc, char * argv[])
+{
+    static uint8_t data[RANDOM_INPUT_MAX];
+
+    if(argc > 1) {
+        for(int i = 1; i < argc; i++) {
+            TEST_CHECK(runFile(argv[i]));
+        }
+        return TEST_RESULT();
+    }
+
+    for(uint32_t n = 0; n < RANDOM_INPUTS; n++) {
+        const uint32_t size = randomInput(data, sizeof(data));
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("%d random inputs\n", RANDOM_INPUTS);
+    return TEST_RESULT();
+}
+
+#endif /* FUZZ_LIBFUZZER */
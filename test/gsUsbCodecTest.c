@@ -0,0 +1,221 @@
+/*!
+ * \file gsUsbCodecTest.c
+ *
+ * gs_usb wire format: host frames to and from the host in classic and FD
+ * mode, with and without hardware timestamps, and the bit timing mapping
+ * onto the FDCAN prescaler and segments.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "testAssert.h"
+#include "usb_device/gsUsb/gsUsbCodec.h"
+
+#define FD_TS_MODE          (GS_CAN_FEATURE_FD | GS_CAN_FEATURE_HW_TIMESTAMP)
+
+
+static uint32_t get_u32(uint8_t const * pBuf)
+{
+    return ((uint32_t)pBuf[0]) | (((uint32_t)pBuf[1]) << 8) |
+           (((uint32_t)pBuf[2]) << 16) | (((uint32_t)pBuf[3]) << 24);
+}
+
+
+static void put_u32(uint8_t * pBuf, uint32_t value)
+{
+    pBuf[0] = (uint8_t)value;
+    pBuf[1] = (uint8_t)(value >> 8);
+    pBuf[2] = (uint8_t)(value >> 16);
+    pBuf[3] = (uint8_t)(value >> 24);
+}
+
+
+static can_frame_t make_frame(uint32_t id, uint8_t flags, uint8_t len)
+{
+    can_frame_t frame;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.id = id;
+    frame.flags = flags;
+    frame.len = len;
+    frame.timestamp = 0xA1B2C3D4UL;
+    for(uint32_t i = 0; i < len; i++) {
+        frame.data[i] = (uint8_t)(0x40 + i);
+    }
+    return frame;
+}
+
+
+/* Encode, check the size and timestamp offset, decode back */
+static void round_trip(can_frame_t const * pFrame, uint32_t echoId, uint32_t modeFlags,
+                       uint32_t expectedSize, uint32_t timestampOffset)
+{
+    uint8_t buf[GS_USB_FRAME_MAX_SZ + 4];
+    can_frame_t decoded;
+    uint32_t decodedEchoId;
+    uint8_t channel;
+    uint32_t size;
+
+    memset(buf, 0xEE, sizeof(buf));
+    size = gs_usb_encode_frame(buf, pFrame, echoId, 0, modeFlags);
+    TEST_CHECK_EQ(size, expectedSize);
+    TEST_CHECK(size <= GS_USB_FRAME_MAX_SZ);
+    TEST_CHECK_EQ(buf[size], 0xEE);
+    TEST_CHECK_EQ(get_u32(&buf[0]), echoId);
+    if(timestampOffset != 0) {
+        TEST_CHECK_EQ(get_u32(&buf[timestampOffset]), pFrame->timestamp);
+    }
+
+    TEST_CHECK(gs_usb_decode_frame(buf, size, modeFlags, &decoded, &decodedEchoId, &channel));
+    TEST_CHECK_EQ(decodedEchoId, echoId);
+    TEST_CHECK_EQ(channel, 0);
+    TEST_CHECK_EQ(decoded.id, pFrame->id);
+    TEST_CHECK_EQ(decoded.flags, pFrame->flags);
+    TEST_CHECK_EQ(decoded.len, pFrame->len);
+    if((pFrame->flags & CAN_FRAME_FLAG_RTR) == 0) {
+        TEST_CHECK(memcmp(decoded.data, pFrame->data, pFrame->len) == 0);
+    }
+}
+
+
+static void test_classic_mode(void)
+{
+    can_frame_t frame = make_frame(0x123, 0, 8);
+
+    round_trip(&frame, GS_USB_ECHO_ID_RX, 0, 20, 0);
+    round_trip(&frame, GS_USB_ECHO_ID_RX, GS_CAN_FEATURE_HW_TIMESTAMP, 24, 20);
+    /* Echo of a host frame, extended identifier */
+    frame = make_frame(0x1ABCDEF0, CAN_FRAME_FLAG_EXTENDED, 3);
+    round_trip(&frame, 7, GS_CAN_FEATURE_HW_TIMESTAMP, 24, 20);
+    /* Remote frame carries no data */
+    frame = make_frame(0x7FF, CAN_FRAME_FLAG_RTR, 4);
+    round_trip(&frame, GS_USB_ECHO_ID_RX, 0, 20, 0);
+}
+
+
+static void test_fd_mode(void)
+{
+    can_frame_t frame = make_frame(0x321, 0, 8);
+
+    /* Classic frames stay classic sized in FD mode */
+    round_trip(&frame, GS_USB_ECHO_ID_RX, GS_CAN_FEATURE_FD, 20, 0);
+    round_trip(&frame, GS_USB_ECHO_ID_RX, FD_TS_MODE, 24, 20);
+    round_trip(&frame, 3, FD_TS_MODE, 24, 20);
+
+    frame = make_frame(0x321, CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_BRS, 64);
+    round_trip(&frame, GS_USB_ECHO_ID_RX, GS_CAN_FEATURE_FD, 76, 0);
+    round_trip(&frame, GS_USB_ECHO_ID_RX, FD_TS_MODE, 80, 76);
+    frame = make_frame(0x1234567, CAN_FRAME_FLAG_FD | CAN_FRAME_FLAG_EXTENDED | CAN_FRAME_FLAG_ESI, 12);
+    round_trip(&frame, 9, FD_TS_MODE, 80, 76);
+}
+
+
+static void test_fd_length_rounding(void)
+{
+    can_frame_t frame = make_frame(0x10, CAN_FRAME_FLAG_FD, 13);
+    uint8_t buf[GS_USB_FRAME_MAX_SZ];
+    can_frame_t decoded;
+    uint32_t echoId;
+    uint8_t channel;
+
+    /* 13 bytes go out as the next FD length, DLC 10 */
+    gs_usb_encode_frame(buf, &frame, GS_USB_ECHO_ID_RX, 0, GS_CAN_FEATURE_FD);
+    TEST_CHECK_EQ(buf[8], 10);
+    TEST_CHECK(gs_usb_decode_frame(buf, 76, GS_CAN_FEATURE_FD, &decoded, &echoId, &channel));
+    TEST_CHECK_EQ(decoded.len, 16);
+}
+
+
+static void test_decode_from_host(void)
+{
+    uint8_t buf[GS_USB_FRAME_MAX_SZ];
+    can_frame_t decoded;
+    uint32_t echoId;
+    uint8_t channel;
+
+    /* The host pads a classic frame to the FD size in FD mode */
+    memset(buf, 0, sizeof(buf));
+    put_u32(&buf[0], 5);
+    put_u32(&buf[4], 0x100);
+    buf[8] = 2;
+    buf[12] = 0xAA;
+    buf[13] = 0xBB;
+    TEST_CHECK(gs_usb_decode_frame(buf, 76, GS_CAN_FEATURE_FD, &decoded, &echoId, &channel));
+    TEST_CHECK_EQ(decoded.len, 2);
+    TEST_CHECK_EQ(decoded.data[1], 0xBB);
+    TEST_CHECK(gs_usb_decode_frame(buf, 20, GS_CAN_FEATURE_FD, &decoded, &echoId, &channel));
+    TEST_CHECK(!gs_usb_decode_frame(buf, 19, 0, &decoded, &echoId, &channel));
+
+    /* FD frames need the full payload and FD mode */
+    buf[10] = GS_CAN_FLAG_FD;
+    buf[8] = 15;
+    TEST_CHECK(gs_usb_decode_frame(buf, 76, GS_CAN_FEATURE_FD, &decoded, &echoId, &channel));
+    TEST_CHECK_EQ(decoded.len, 64);
+    TEST_CHECK(!gs_usb_decode_frame(buf, 20, GS_CAN_FEATURE_FD, &decoded, &echoId, &channel));
+    TEST_CHECK(!gs_usb_decode_frame(buf, 76, 0, &decoded, &echoId, &channel));
+
+    /* Error frames are not sent */
+    buf[10] = 0;
+    put_u32(&buf[4], GS_CAN_ERR_FLAG | 0x100);
+    TEST_CHECK(!gs_usb_decode_frame(buf, 20, 0, &decoded, &echoId, &channel));
+}
+
+
+static bool decode_timing(uint32_t prop, uint32_t phase1, uint32_t phase2, uint32_t sjw, uint32_t brp,
+                          bool isData, can_timing_t * pTiming)
+{
+    uint8_t buf[GS_USB_BITTIMING_SZ];
+
+    put_u32(&buf[0], prop);
+    put_u32(&buf[4], phase1);
+    put_u32(&buf[8], phase2);
+    put_u32(&buf[12], sjw);
+    put_u32(&buf[16], brp);
+    return gs_usb_decode_bittiming(buf, sizeof(buf), isData, pTiming);
+}
+
+
+static void test_bittiming(void)
+{
+    can_timing_t timing;
+
+    /* 500 kbit/s at 84 MHz, 83.3% sample point: prop_seg folds into tseg1 */
+    TEST_CHECK(decode_timing(34, 35, 14, 14, 2, false, &timing));
+    TEST_CHECK_EQ(timing.prescaler, 2);
+    TEST_CHECK_EQ(timing.tseg1, 69);
+    TEST_CHECK_EQ(timing.tseg2, 14);
+    TEST_CHECK_EQ(timing.sjw, 14);
+    TEST_CHECK_EQ(GS_USB_FCLK_CAN / (timing.prescaler * (1 + timing.tseg1 + timing.tseg2)), 500000);
+
+    /* 2 Mbit/s data phase */
+    TEST_CHECK(decode_timing(15, 16, 10, 10, 1, true, &timing));
+    TEST_CHECK_EQ(timing.prescaler, 1);
+    TEST_CHECK_EQ(timing.tseg1, 31);
+    TEST_CHECK_EQ(timing.tseg2, 10);
+    TEST_CHECK_EQ(GS_USB_FCLK_CAN / (timing.prescaler * (1 + timing.tseg1 + timing.tseg2)), 2000000);
+
+    /* Limits of the nominal and data registers */
+    TEST_CHECK(decode_timing(128, 128, 128, 128, 512, false, &timing));
+    TEST_CHECK(!decode_timing(128, 129, 128, 1, 1, false, &timing));
+    TEST_CHECK(!decode_timing(1, 1, 129, 1, 1, false, &timing));
+    TEST_CHECK(!decode_timing(1, 1, 2, 1, 513, false, &timing));
+    TEST_CHECK(!decode_timing(1, 1, 2, 0, 1, false, &timing));
+    TEST_CHECK(!decode_timing(16, 17, 8, 1, 1, true, &timing));
+    TEST_CHECK(!decode_timing(1, 1, 17, 1, 1, true, &timing));
+    TEST_CHECK(!decode_timing(1, 1, 1, 1, 33, true, &timing));
+    TEST_CHECK(!decode_timing(1, 1, 1, 17, 1, true, &timing));
+    /* Short control transfer */
+    TEST_CHECK(!gs_usb_decode_bittiming((uint8_t const *)"", 0, false, &timing));
+}
+
+
+int main(void)
+{
+    test_classic_mode();
+    test_fd_mode();
+    test_fd_length_rounding();
+    test_decode_from_host();
+    test_bittiming();
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,147 @@
+/*!
+ * \file isoPacketizerTest.c
+ *
+ * Drives the iso packetizer once per simulated SOF with random frame
+ * arrivals.  Every packet stays within the budget, holds whole records
+ * only, and the frames accepted come out once and in order.  Frames the
+ * full ring refused are flagged as an overrun on the next packet.
+ *
+ * \author Sicris Rey Embay
+ */
+#include "string.h"
+#include "testAssert.h"
+#include "usb_device/isoStream/isoPacketizer.h"
+
+#define SOF_FRAMES          (20000)
+#define SENT_MAX            (SOF_FRAMES * 8)
+
+static uint32_t rngState = 0x2545F491UL;
+static can_frame_t sent[SENT_MAX];
+
+static uint32_t rng(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+static uint32_t get_u16(uint8_t const * pBuf)
+{
+    return ((uint32_t)pBuf[0]) | (((uint32_t)pBuf[1]) << 8);
+}
+
+
+static uint32_t get_u32(uint8_t const * pBuf)
+{
+    return get_u16(&pBuf[0]) | (get_u16(&pBuf[2]) << 16);
+}
+
+
+static void random_frame(can_frame_t * pFrame, uint32_t n)
+{
+    static const uint8_t lengths[] = {0, 1, 8, 8, 8, 12, 24, 48, 64};
+
+    memset(pFrame, 0, sizeof(*pFrame));
+    pFrame->id = rng() & 0x1FFFFFFF;
+    pFrame->timestamp = n;
+    pFrame->len = lengths[rng() % sizeof(lengths)];
+    pFrame->flags = (pFrame->len > 8) ? CAN_FRAME_FLAG_FD : 0;
+    for(uint32_t i = 0; i < pFrame->len; i++) {
+        pFrame->data[i] = (uint8_t)rng();
+    }
+}
+
+
+/* Returns the number of packets flagged with an overrun */
+static uint32_t run(uint32_t budget, uint32_t maxArrivals)
+{
+    static iso_packetizer_t packetizer;
+    uint8_t packet[1024];
+    uint32_t sentCount = 0;
+    uint32_t received = 0;
+    uint32_t packets = 0;
+    uint32_t overruns = 0;
+    bool bDropped = false;
+
+    iso_packetizer_reset(&packetizer);
+    /* Arrivals stop after SOF_FRAMES, the rest drains the ring */
+    for(uint32_t sof = 0; (sof < SOF_FRAMES) || (received < sentCount); sof++) {
+        uint32_t length;
+        uint32_t offset = ISO_PACKET_HEADER_SZ;
+        uint32_t count;
+
+        TEST_CHECK(sof < (SOF_FRAMES + ISO_PACKETIZER_RING_SIZE));
+        if(sof >= (SOF_FRAMES + ISO_PACKETIZER_RING_SIZE)) {
+            return overruns;
+        }
+        if(sof < SOF_FRAMES) {
+            const uint32_t arrivals = rng() % (maxArrivals + 1);
+            for(uint32_t i = 0; i < arrivals; i++) {
+                random_frame(&sent[sentCount], sentCount);
+                if(iso_packetizer_push(&packetizer, &sent[sentCount])) {
+                    sentCount++;
+                } else {
+                    bDropped = true;
+                }
+            }
+        }
+
+        memset(packet, 0xEE, sizeof(packet));
+        length = iso_packetizer_fill(&packetizer, packet, budget);
+        TEST_CHECK(length <= budget);
+        TEST_CHECK(length >= ISO_PACKET_HEADER_SZ);
+        TEST_CHECK_EQ(packet[length], 0xEE);
+        TEST_CHECK_EQ(get_u16(&packet[0]), packets & 0xFFFF);
+        TEST_CHECK_EQ(get_u16(&packet[2]), received & 0xFFFF);
+        TEST_CHECK_EQ((packet[5] & ISO_PACKET_FLAG_OVERRUN) != 0, bDropped);
+        if(bDropped) {
+            overruns++;
+        }
+        bDropped = false;
+        packets++;
+
+        /* Whole records only, in order */
+        count = packet[4];
+        for(uint32_t i = 0; i < count; i++) {
+            can_frame_t const * pExpected = &sent[received];
+            TEST_CHECK((offset + ISO_RECORD_HEADER_SZ) <= length);
+            if((offset + ISO_RECORD_HEADER_SZ) > length) {
+                return overruns;
+            }
+            TEST_CHECK_EQ(get_u32(&packet[offset]), pExpected->timestamp);
+            TEST_CHECK_EQ(get_u32(&packet[offset + 4]), pExpected->id);
+            TEST_CHECK_EQ(packet[offset + 8], pExpected->flags);
+            TEST_CHECK_EQ(packet[offset + 9], pExpected->len);
+            TEST_CHECK((offset + ISO_RECORD_HEADER_SZ + pExpected->len) <= length);
+            TEST_CHECK(memcmp(&packet[offset + ISO_RECORD_HEADER_SZ], pExpected->data, pExpected->len) == 0);
+            offset += ISO_RECORD_HEADER_SZ + pExpected->len;
+            received++;
+        }
+        TEST_CHECK_EQ(offset, length);
+        /* A packet left short only when the next record would not fit */
+        if((received < sentCount) && (received < SENT_MAX)) {
+            TEST_CHECK((length + ISO_RECORD_HEADER_SZ + sent[received].len) > budget);
+        }
+    }
+    TEST_CHECK_EQ(received, sentCount);
+    printf("budget %u, up to %u frames/SOF: %u frames in %u packets, %u overrun packets\n",
+           (unsigned)budget, (unsigned)maxArrivals, (unsigned)received, (unsigned)packets, (unsigned)overruns);
+
+    return overruns;
+}
+
+
+int main(void)
+{
+    /* Smallest budget that holds a CAN FD record, the default, a full FS iso packet */
+    run(ISO_PACKET_HEADER_SZ + ISO_RECORD_MAX_SZ, 1);
+    run(192, 2);
+    run(192, 6);
+    run(1023, 8);
+    /* More than the budget drains, the ring fills up */
+    TEST_CHECK(run(ISO_PACKET_HEADER_SZ + ISO_RECORD_MAX_SZ, 4) > 0);
+
+    return TEST_RESULT();
+}
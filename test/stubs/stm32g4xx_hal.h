@@ -0,0 +1,42 @@
+/*!
+ * \file stm32g4xx_hal.h
+ *
+ * Host stand in for the HAL header, for the drivers that take their
+ * registers as parameters.  Only the FDCAN registers and bits used by
+ * main/bsp/fdcanRam.c, at their RM0440 positions.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef TEST_STUBS_STM32G4XX_HAL_H_
+#define TEST_STUBS_STM32G4XX_HAL_H_
+
+#include "stdint.h"
+
+#define __IO                            volatile
+
+typedef struct {
+    __IO uint32_t RXF0S;                // RX FIFO 0 status
+    __IO uint32_t RXF0A;                // RX FIFO 0 acknowledge
+    __IO uint32_t TXFQS;                // TX FIFO/queue status
+    __IO uint32_t TXBAR;                // TX buffer add request
+} FDCAN_GlobalTypeDef;
+
+#define FDCAN_RXF0S_F0FL_Pos            (0U)
+#define FDCAN_RXF0S_F0FL                (0xFUL << FDCAN_RXF0S_F0FL_Pos)
+#define FDCAN_RXF0S_F0GI_Pos            (8U)
+#define FDCAN_RXF0S_F0GI                (0x3UL << FDCAN_RXF0S_F0GI_Pos)
+#define FDCAN_RXF0S_F0PI_Pos            (16U)
+#define FDCAN_RXF0S_F0PI                (0x3UL << FDCAN_RXF0S_F0PI_Pos)
+#define FDCAN_RXF0S_F0F_Pos             (24U)
+#define FDCAN_RXF0S_F0F                 (0x1UL << FDCAN_RXF0S_F0F_Pos)
+
+#define FDCAN_TXFQS_TFFL_Pos            (0U)
+#define FDCAN_TXFQS_TFFL                (0x7UL << FDCAN_TXFQS_TFFL_Pos)
+#define FDCAN_TXFQS_TFGI_Pos            (8U)
+#define FDCAN_TXFQS_TFGI                (0x3UL << FDCAN_TXFQS_TFGI_Pos)
+#define FDCAN_TXFQS_TFQPI_Pos           (16U)
+#define FDCAN_TXFQS_TFQPI               (0x3UL << FDCAN_TXFQS_TFQPI_Pos)
+#define FDCAN_TXFQS_TFQF_Pos            (21U)
+#define FDCAN_TXFQS_TFQF                (0x1UL << FDCAN_TXFQS_TFQF_Pos)
+
+#endif /* TEST_STUBS_STM32G4XX_HAL_H_ */
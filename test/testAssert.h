@@ -0,0 +1,37 @@
+/*!
+ * \file testAssert.h
+ *
+ * Minimal checks for the host tests, a failed check prints its location
+ * and the test exits non-zero at the end.
+ *
+ * \author Sicris Rey Embay
+ */
+#ifndef TEST_TESTASSERT_H_
+#define TEST_TESTASSERT_H_
+
+#include "stdio.h"
+
+static int testFailures = 0;
+
+#define TEST_CHECK(cond)                                                    \
+    do {                                                                    \
+        if(!(cond)) {                                                       \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            testFailures++;                                                 \
+        }                                                                   \
+    } while(0)
+
+#define TEST_CHECK_EQ(actual, expected)                                     \
+    do {                                                                    \
+        const long long _a = (long long)(actual);                           \
+        const long long _e = (long long)(expected);                         \
+        if(_a != _e) {                                                      \
+            printf("%s:%d: %s is %lld, expected %lld\n",                    \
+                   __FILE__, __LINE__, #actual, _a, _e);                    \
+            testFailures++;                                                 \
+        }                                                                   \
+    } while(0)
+
+#define TEST_RESULT()       ((testFailures == 0) ? 0 : 1)
+
+#endif /* TEST_TESTASSERT_H_ */